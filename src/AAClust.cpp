@@ -28,13 +28,16 @@
 #include "Args.hpp"
 #include "Assert.hpp"
 #include "Delegates.hpp"
+#include "DistanceDistributionLibrary.hpp"
+#include "DnaDistance.hpp"
 #include "KmerDistanceCache.hpp"
 #include "FastaSequence.hpp"
 #include "HBRandom.hpp"
 #include "Kmer.hpp"
 #include "KmerCluster.hpp"
 #include "TestFramework.h"
-#include "OmpTimer.h"
+#include "Profiler.hpp"
+#include "MemoryAccount.hpp"
 #include "KmerClusterPrototype.hpp"
 #include "FileUtil.hpp"
 
@@ -54,8 +57,8 @@ public:
 	static int Run() {
 		bool ok = true;
 
-		OMP_TIMER_DECLARE(loadTime);
-		OMP_TIMER_DECLARE(clusterTime);
+		ProfileRegion loadTime( "loadTime" );
+		ProfileRegion clusterTime( "clusterTime" );
 
 		string protoIn;
 		string protoOut;
@@ -63,11 +66,15 @@ public:
 		int numThreads = 7;
 		int wordLength = 32;
 		int threshold;
+		string libraryFile;
+		double pValue = 0;
+		int fragmentLength = 0;
 		int  seed;
 		int idIndex;
 		string clusterOut;
 		int increment;
 		int clusterMode = 1;
+		uint charsPerWord = 2;
 
 		if (arguments->IsDefined("help")) {
 			vector<string> text{
@@ -78,7 +85,10 @@ public:
 				"--generateEdges	Optional boolean, default value false. If true, edges for a multiple alignment will be generated.",
 				"--clusterOut	Required. The name the output file produced by the program.",
 				"--increment	Required. The number of new clusters to add on each pass. Make this smaller to minimise the chance of a prototype belonging to a cluster whose centroid is outside its basin of attraction.",
-				"--threshold	Required. Threshold for assignment of points to clusters. Distance less than or equal to the threshold corresponds to cluster membership.",
+				"--threshold	Required unless --libraryFile and --pValue are given. Threshold for assignment of points to clusters. Distance less than or equal to the threshold corresponds to cluster membership.",
+				"--libraryFile	Optional. A distribution library produced by GetKmerTheoreticalDistanceDistributions --libraryFile, from which the threshold is selected to match --pValue. The entry used is the one for the similarity matrix, wordLength and fragmentLength whose symbol composition is nearest to that of the input sequences.",
+				"--pValue	Required with --libraryFile. The threshold is the largest distance at which the probability that the distance between random kmers (or the least distance from a kmer to a random fragment) is within threshold does not exceed this value.",
+				"--fragmentLength	Optional; default = wordLength. The fragment length of the library entry used with --pValue.",
 				"--numThreads	Optional; default value = 7. The number of OpenMP threads to use in parallel regions.",
 				"--wordLength	Optional; default value = 32. The word length used for kmer tiling.",
 				"--seed		Required. The random number seed.",
@@ -88,10 +98,17 @@ public:
 				"		overlapping: Merge new edge onto existing edge when both endpoints of the new edge are within the current extent of the corresponding intervals represented by the existing edge. Some kmers covered by an edge built this way may not be HSKPs.",
 				"--matrixId	Optional, default = 62, but you need either --matrixId or --matrixFile. BLOSUM Matrix ID, one of { 35, 40, 45, 50, 62, 80, 100 }. This is ignored if a custom similarity matrix file is specified.",
 				"--matrixFile	Optional, but you need either --matrixId or --matrixFile. File name for custom similarity matrix. Use this to specify some matrix other than BLOSUM, or if a custom alphabet is in use.",
+				"--reducedAlphabet	Optional. Collapse the similarity matrix onto a reduced alphabet: murphy10, seb14, or a comma-separated list of residue groups such as LVIM,C,A,G,ST,P,FYW,EDNQ,KR,H. Residues are replaced by the first member of their group, giving smaller distance tables and more exact kmer matches.",
 				"--isCaseSensitive	Optional, default = true. Should symbols be treated as case-sensitive.",
 				"--clusterMode	Optional [1, 2], default = 1. Experimental clustering mode.",
 				"		1: Use Insertion-sort inspired modification to reduce worst case complexity by average factor of at least 2.",
 				"		2: Use banded version of 1 to partition work to threads ahead of time (which in the end slows things down).",
+				"--charsPerWord	Optional [1, 2, 3], default = 2. The number of symbols packed into each word of the precomputed distance table. Larger values take fewer lookups per kmer but need a much larger table (3 needs about 190MB for BLOSUM alphabets). wordLength must be a multiple of this value.",
+				"--alphabet	Optional [AA, DNA], default = AA. With DNA, sequences are nucleotide (u is read as t), kmers of up to 32 bases are packed 2 bits per base, the distance is the number of mismatches over the better of the two strands, and prototypes are written in canonical (lesser of forward and reverse complement) form. The matrix arguments and charsPerWord are ignored, and threshold is a mismatch count.",
+				"--profile	Optional. A file to which a JSON profile of the run is written: the time, call count and duration percentiles of each timed region, nested as the regions are.",
+				"--memoryBudget	Optional. The most memory the run may use, e.g. 512M or 64G. The requirement is estimated before the data is loaded; if it does not fit, a smaller charsPerWord is used where that would fit, and otherwise the program stops with an error.",
+				"--memoryReport	Optional, default = false. If true, the bytes held by sequences, encodings, kmer index, codebook and distance tables are reported after loading and after clustering, together with the resident set size.",
+				"--perfCounters	Optional, default = false. If true (and --profile is given), each region of the profile also reports hardware event counts, in total and per thread: cycles, instructions, L1 data and last level cache misses, and branch misses. Needs Linux perf_event_open; where the counters are unavailable the profile has times only.",
 			};
 
 			for (auto s : text) {
@@ -121,7 +138,15 @@ public:
 			ok = false;
 		}
 
-		if (!arguments->Get("threshold", threshold)) {
+		if (arguments->IsDefined("libraryFile")) {
+			arguments->Get("libraryFile", libraryFile);
+
+			if (!arguments->Get("pValue", pValue) || pValue < 0 || pValue > 1) {
+				cerr << arguments->ProgName() << ": error - '--libraryFile' requires '--pValue' between 0 and 1.\n";
+				ok = false;
+			}
+		}
+		else if (!arguments->Get("threshold", threshold)) {
 			cerr << arguments->ProgName() << ": error - required argument '--threshold' not provided.\n";
 			ok = false;
 		}
@@ -178,18 +203,43 @@ public:
 			}
 		}
 
-		if (!ok) {
-			cerr << "Invalid command line arguments supplied. For help, run: AAClust --help\n";
-			return 1;
+		if (arguments->IsDefined("charsPerWord")) {
+			if (!arguments->Get("charsPerWord", charsPerWord) || charsPerWord < 1 || charsPerWord > 3) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--charsPerWord'.\n";
+				ok = false;
+			}
+			else if (wordLength % charsPerWord != 0) {
+				cerr << arguments->ProgName() << ": error - '--wordLength' must be a multiple of '--charsPerWord'.\n";
+				ok = false;
+			}
 		}
 
-		string matrixFile;
-		DistanceType * distanceType = DistanceType::BlosumDistance();
+		pAlphabet alphabet = Alphabet::AA();
 
-		if (arguments->IsDefined("matrixFile")) {
-			arguments->Get("matrixFile", matrixFile);
-			distanceType = DistanceType::Custom();
-			matrixId = -1;
+		if (arguments->IsDefined("alphabet")) {
+			if (!arguments->Get("alphabet", Alphabet::Values(), alphabet)) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--alphabet'.\n";
+				ok = false;
+			}
+			else if (alphabet == Alphabet::DNA() && (wordLength < 1 || wordLength > (int)DnaDistance::MaxKmerLength)) {
+				cerr << arguments->ProgName() << ": error - DNA '--wordLength' must be between 1 and " << DnaDistance::MaxKmerLength << ".\n";
+				ok = false;
+			}
+		}
+
+		if (arguments->IsDefined("fragmentLength") && (!arguments->Get("fragmentLength", fragmentLength) || fragmentLength < wordLength)) {
+			cerr << arguments->ProgName() << ": error - '--fragmentLength' must be at least '--wordLength'.\n";
+			ok = false;
+		}
+
+		if (libraryFile.length() > 0 && alphabet == Alphabet::DNA()) {
+			cerr << arguments->ProgName() << ": error - '--libraryFile' requires a similarity matrix, so cannot be used with DNA.\n";
+			ok = false;
+		}
+
+		if (!ok) {
+			cerr << "Invalid command line arguments supplied. For help, run: AAClust --help\n";
+			return 1;
 		}
 
 		bool isCaseSensitive = true;
@@ -197,149 +247,237 @@ public:
 		if (arguments->IsDefined("isCaseSensitive")) {
 			if (!arguments->Get("isCaseSensitive", isCaseSensitive)) {
 				cerr << arguments->ProgName() << ": error - Invalid data for argument 'isCaseSensitive'." << "\n";
-				ok = false;
+				return 1;
 			}
 		}
 
-		SimilarityMatrix * matrix = SimilarityMatrix::GetMatrix(distanceType, matrixId, matrixFile, isCaseSensitive);
+		const bool isDna = alphabet == Alphabet::DNA();
+		UniformRealRandom rand(seed);
+		SimilarityMatrix * matrix = 0;
 
-		if (!matrix) {
-			cerr << arguments->ProgName() << ": error - unable to construct similarity matrix.\n";
-			cerr << arguments->ProgName() << ": error - you need to supply either matrixId or matrixFile arguments.\n";
-			ok = false;
-		}
+		auto run = [&](auto & distanceFunction) {
+			using DistanceFunction = typename std::remove_reference<decltype(distanceFunction)>::type;
+			using Cluster = KmerCluster<DistanceFunction, Kmer>;
 
-		if (ok == false || !matrix) {
-			cerr << arguments->ProgName() << ": error - unable to construct similarity matrix. For help, run: AAClust --help\n";
-			return 1;
-		}
+			const uint charsPerWord = distanceFunction.CharsPerWord();
+			vector<Cluster *> clusters;
 
-		Alphabet * alphabet = new Alphabet(matrix);
-		BlosumDifferenceFunction rawDistanceFunction(matrix);
-		KmerDistanceCache2 distanceFunction(alphabet, &rawDistanceFunction);
-		size_t charsPerWord = distanceFunction.CharsPerWord();
-		UniformRealRandom rand(seed);
+			omp_set_num_threads(numThreads);
 
-		using DistanceFunction = KmerDistanceCache2;
-		using Cluster = KmerCluster<DistanceFunction, Kmer>;
+			loadTime.Start();
+			PointerList<EncodedFastaSequence> protos;
 
-		vector<Cluster *> clusters;
+			if (protoIn.length() > 0) {
+				fstream protoStream(protoIn);
+				EncodedFastaSequence::ReadSequences(protos, protoStream, 0, -1, alphabet, wordLength, charsPerWord, 'x', KmerClusterPrototype::DefaultFactory);
 
-		omp_set_num_threads(numThreads);
+				if ( ! isCaseSensitive ) {
+					for ( auto p: protos ) {
+						String::ToLowerInPlace( p->Sequence() );
+					}
+				}
+			
+				Cluster::InitialiseClusters(protos, wordLength, distanceFunction, clusters);
+				(cerr << "AAClust: " << protos.Length() << " prototypes loaded.\n").flush();
+			}
 
-		OMP_TIMER_START(loadTime);
-		PointerList<EncodedFastaSequence> protos;
+			PointerList<EncodedFastaSequence> db;
 
-		if (protoIn.length() > 0) {
-			fstream protoStream(protoIn);
-			EncodedFastaSequence::ReadSequences(protos, protoStream, 0, -1, alphabet, wordLength, charsPerWord, 'x', KmerClusterPrototype::DefaultFactory);
+			{
+				fstream fasta(fastaFile);
+				EncodedFastaSequence::ReadSequences(db, fasta, idIndex, -1, alphabet, wordLength, charsPerWord, 'x', EncodedFastaSequence::DefaultFactory);
 
-			if ( ! isCaseSensitive ) {
-				for ( auto p: protos ) {
-					String::ToLowerInPlace( p->Sequence() );
+				if ( ! isCaseSensitive ) {
+					for ( auto p: db ) {
+						String::ToLowerInPlace( p->Sequence() );
+					}
 				}
 			}
-			
-			Cluster::InitialiseClusters(protos, wordLength, distanceFunction, clusters);
-			(cerr << "AAClust: " << protos.Length() << " prototypes loaded.\n").flush();
-		}
 
-		PointerList<EncodedFastaSequence> db;
+			cerr << "AAClust: " << db.Length() << " sequences loaded.\n";
+
+			if (MemoryAccount::IsActive()) {
+				EncodedFastaSequence::Account(db, MemoryAccount::Sequences, MemoryAccount::Encodings);
+				MemoryAccount::Set(MemoryAccount::DistanceTables, isDna ? 0 : KmerDistanceCache::EstimateTableBytes(alphabet->Size(), charsPerWord));
+			}
 
-		{
-			fstream fasta(fastaFile);
-			EncodedFastaSequence::ReadSequences(db, fasta, idIndex, -1, alphabet, wordLength, distanceFunction.CharsPerWord(), 'x', EncodedFastaSequence::DefaultFactory);
+			if (libraryFile.length() > 0) {
+				threshold = DistanceDistributionLibrary::SelectThreshold(libraryFile, *matrix, FastaSequence::GetSymbolHistogram(db.Items()),
+					wordLength, fragmentLength > 0 ? fragmentLength : wordLength, pValue);
 
-			if ( ! isCaseSensitive ) {
-				for ( auto p: db ) {
-					String::ToLowerInPlace( p->Sequence() );
+				if (threshold < 0) {
+					cerr << "AAClust: error - no distance threshold has p-value " << pValue << " or less.\n";
+					return 1;
 				}
+
+				cerr << "AAClust: threshold " << threshold << " selected for p-value " << pValue << ".\n";
 			}
-		}
 
-		cerr << "AAClust: " << db.Length() << " sequences loaded.\n";
+			KmerIndex kmerIndex(db.Items(), wordLength);
 
-		KmerIndex kmerIndex(db.Items(), wordLength);
+			if (MemoryAccount::IsActive()) {
+				MemoryAccount::Set(MemoryAccount::KmerIndex, kmerIndex.MemoryBytes());
+				MemoryAccount::Checkpoint("load");
+			}
 
-		OMP_TIMER_END(loadTime);
-		OMP_TIMER_START(clusterTime);
+			loadTime.Stop();
+			clusterTime.Start();
 
-		auto createPrototype = [=, &protos](Kmer *kmer) {
-			KmerClusterPrototype * protoSeq = new KmerClusterPrototype(kmer->Word(), alphabet, wordLength, charsPerWord);
-			protos.Add([protoSeq]() { return protoSeq; });
-			return protoSeq;
-		};
+			auto createPrototype = [=, &protos](Kmer *kmer) {
+				// Nucleotide prototypes are stored strand-independently.
+				string word = isDna ? DnaDistance::Canonical(kmer->Word()) : kmer->Word();
+				KmerClusterPrototype * protoSeq = new KmerClusterPrototype(word, alphabet, wordLength, charsPerWord);
+				protos.Add([protoSeq]() { return protoSeq; });
+				return protoSeq;
+			};
 
-		if (clusterMode == 2) {
-			// Banded version: doesn't work as fast as default.
-			Cluster::DoExhaustiveIncrementalClustering(
-				kmerIndex,
-				wordLength,
-				threshold,
-				alphabet->Size(),
-				distanceFunction,
-				rand,
-				increment,
-				createPrototype,
-				clusters,
-				numThreads
-			);
-		}
-		else {
-			// Default: uses the "first-fit" criterion to assign k-mers to 
-			// cluster, and remove from consideration.
-			Cluster::DoExhaustiveIncrementalClustering(
-				kmerIndex,
-				wordLength,
-				threshold,
-				alphabet->Size(),
-				distanceFunction,
-				rand,
-				increment,
-				createPrototype,
-				clusters
-			);
-		}
-#if REMOVE_TINY_CLUSTERS
-		int i;
+			if (clusterMode == 2) {
+				// Banded version: doesn't work as fast as default.
+				Cluster::DoExhaustiveIncrementalClustering(
+					kmerIndex,
+					wordLength,
+					threshold,
+					alphabet->Size(),
+					distanceFunction,
+					rand,
+					increment,
+					createPrototype,
+					clusters,
+					numThreads
+				);
+			}
+			else {
+				// Default: uses the "first-fit" criterion to assign k-mers to 
+				// cluster, and remove from consideration.
+				Cluster::DoExhaustiveIncrementalClustering(
+					kmerIndex,
+					wordLength,
+					threshold,
+					alphabet->Size(),
+					distanceFunction,
+					rand,
+					increment,
+					createPrototype,
+					clusters
+				);
+			}
+	#if REMOVE_TINY_CLUSTERS
+			int i;
 
-		for (i = clusters.size() - 1; i >= 0 && (clusters[i]->kmers.size() < 2; i--) {
-			delete clusters[i];
-				clusters[i] = 0;
-		}
+			for (i = clusters.size() - 1; i >= 0 && (clusters[i]->kmers.size() < 2; i--) {
+				delete clusters[i];
+					clusters[i] = 0;
+			}
 
-		clusters.resize(i + 1);
-#endif
-			OMP_TIMER_END(clusterTime);
+			clusters.resize(i + 1);
+	#endif
+				clusterTime.Stop();
 
-			// Update prototype sizes.
-		{
-			for (auto cluster : clusters) {
-				auto proto = (pKmerClusterPrototype)cluster->prototype.Sequence();
-				proto->Size(proto->Size() + cluster->InstanceCount());
+			if (MemoryAccount::IsActive()) {
+				MemoryAccount::Set(MemoryAccount::Codebook, Cluster::CodebookBytes(clusters, protos));
+				MemoryAccount::Checkpoint("clustering");
 			}
-		}
 
-		// Save the prototypes.
-		{
-			ofstream protoFile(protoOut);
+				// Update prototype sizes.
+			{
+				for (auto cluster : clusters) {
+					auto proto = (pKmerClusterPrototype)cluster->prototype.Sequence();
+					proto->Size(proto->Size() + cluster->InstanceCount());
+				}
+			}
 
-			for (auto proto_ : protos) {
-				auto proto = (pKmerClusterPrototype)proto_;
+			// Save the prototypes.
+			{
+				ofstream protoFile(protoOut);
 
-				if (proto->Size() > 0) {
-					protoFile << *proto;
+				for (auto proto_ : protos) {
+					auto proto = (pKmerClusterPrototype)proto_;
+
+					if (proto->Size() > 0) {
+						protoFile << *proto;
+					}
 				}
 			}
+
+			ofstream cOut( clusterOut );
+			for ( auto c: clusters) cOut << (*c);
+
+			cerr << "Elapsed time loading: " << loadTime.Elapsed() << "\n";
+			cerr << "Elapsed time clustering: " << clusterTime.Elapsed() << "\n";
+
+			return 0;
+		};
+
+		// With --memoryBudget, estimates the footprint of the run before 
+		// anything is loaded, and falls back to shorter words if they fit 
+		// where the requested ones do not.
+		auto fitBudget = [&](size_t alphabetSize) {
+			if (MemoryAccount::Budget() == 0) return;
+
+			FastaFileStats data = FastaFileStats::Scan(fastaFile);
+			FastaFileStats protoData = protoIn.length() > 0 ? FastaFileStats::Scan(protoIn) : FastaFileStats();
+
+			auto estimate = [&](uint charsPerWord) {
+				return EstimateCodebookLoadBytes(data, protoData, wordLength, charsPerWord)
+					+ (isDna ? 0 : KmerDistanceCache::EstimateTableBytes(alphabetSize, charsPerWord));
+			};
+
+			if (isDna) {
+				MemoryAccount::Require("Clustering " + fastaFile, estimate(Alphabet::PackedDnaCharsPerWord));
+				return;
+			}
+
+			uint fit = FitCharsPerWord(charsPerWord, wordLength, estimate);
+
+			if (fit == 0) {
+				MemoryAccount::Require("Clustering " + fastaFile, estimate(1));
+			}
+			else if (fit != charsPerWord) {
+				cerr << "AAClust: using charsPerWord " << fit << " rather than " << charsPerWord << " to fit the memory budget.\n";
+				charsPerWord = fit;
+			}
+		};
+
+		if (isDna) {
+			fitBudget(0);
+			DnaDistance distanceFunction;
+			return run(distanceFunction);
+		}
+
+		string matrixFile;
+		DistanceType * distanceType = DistanceType::BlosumDistance();
+
+		if (arguments->IsDefined("matrixFile")) {
+			arguments->Get("matrixFile", matrixFile);
+			distanceType = DistanceType::Custom();
+			matrixId = -1;
 		}
 
-		ofstream cOut( clusterOut );
-		for ( auto c: clusters) cOut << (*c);
+		matrix = SimilarityMatrix::GetMatrix(distanceType, matrixId, matrixFile, isCaseSensitive);
 
-		cerr << "Elapsed time loading: " << OMP_TIMER(loadTime) << "\n";
-		cerr << "Elapsed time clustering: " << OMP_TIMER(clusterTime) << "\n";
+		if (!matrix) {
+			cerr << arguments->ProgName() << ": error - unable to construct similarity matrix.\n";
+			cerr << arguments->ProgName() << ": error - you need to supply either matrixId or matrixFile arguments.\n";
+			ok = false;
+		}
+
+		string matrixError;
+
+		if (matrix && !arguments->GetReducedAlphabet(matrix, matrixError)) {
+			cerr << matrixError << "\n";
+			ok = false;
+		}
+
+		if (ok == false || !matrix) {
+			cerr << arguments->ProgName() << ": error - unable to construct similarity matrix. For help, run: AAClust --help\n";
+			return 1;
+		}
+
+		alphabet = new Alphabet(matrix);
+		BlosumDifferenceFunction rawDistanceFunction(matrix);
+		fitBudget(alphabet->Size());
 
-		return 0;
+		return WithKmerDistanceCache(charsPerWord, alphabet, &rawDistanceFunction, run);
 	}
 };
 
@@ -350,6 +488,8 @@ int main(int argc, char *argv[]) {
 		Args args(argc, argv);
 
 		arguments = &args;
+		ProfileSession profile( args );
+		MemorySession memory( args );
 
 		double start_time = omp_get_wtime();
 		int retCode = AAClust::Run();
@@ -35,10 +35,13 @@
 #include "Kmer.hpp"
 #include "KmerCluster.hpp"
 #include "TestFramework.h"
-#include "OmpTimer.h"
+#include "Profiler.hpp"
+#include "MappedFile.hpp"
+#include "MemoryAccount.hpp"
 #include "BitSet.hpp"
 #include "kNearestNeighbours.hpp"
 #include "Ranking.hpp"
+#include "SignatureRanking.hpp"
 #include <cstdio>
 #include <stdlib.h>
 #include <omp.h>
@@ -62,6 +65,8 @@ public:
 	using Cluster = KmerCluster<DistanceFunction, Kmer>;
 	using pCluster = Cluster * ;
 
+	struct Params;
+
 	struct Signature {
 		string id;
 		BitSet signature;
@@ -70,6 +75,43 @@ public:
 		Signature( const string &id, uint sigLength ) : id( id ), signature( sigLength ) {}
 
 		~Signature() {}
+
+		/// <summary>Gets the bytes held by the signature.</summary>
+		size_t MemoryBytes() const {
+			return sizeof( *this ) + MemoryAccount::BlockOverhead
+				+ MemoryAccount::HeapBytes( id )
+				+ ( signature.Capacity() > 0 ? ( signature.Capacity() + 63 ) / 64 * sizeof( uint64_t ) + MemoryAccount::BlockOverhead : 0 )
+				+ MemoryAccount::HeapBytes( indices );
+		}
+	};
+
+	/// <summary>The number of signatures and set bits in a signature file, counted without parsing it.</summary>
+	struct SignatureFileStats {
+		size_t signatures = 0;
+		size_t indices = 0;
+
+		// Each line is "id cardinality index ... index;", so the indices
+		// are the spaces less two per line.
+		static SignatureFileStats Scan( const string &fileName ) {
+			SignatureFileStats stats;
+			MappedFile file( fileName );
+			const char * data = file.Data();
+			size_t spaces = 0;
+
+			for ( size_t i = 0; i < file.Size(); i++ ) {
+				spaces += data[i] == ' ';
+				stats.signatures += data[i] == '\n';
+			}
+
+			stats.indices = spaces > stats.signatures ? spaces - stats.signatures : 0;
+			return stats;
+		}
+
+		/// <summary>Estimates the bytes needed to load the signatures, with or without their bit vectors.</summary>
+		size_t Estimate( uint sigLength, bool keepBits ) const {
+			return signatures * ( sizeof( Signature ) + 3 * MemoryAccount::BlockOverhead + ( keepBits ? ( sigLength + 63 ) / 64 * sizeof( uint64_t ) : 0 ) )
+				+ indices * sizeof( uint );
+		}
 	};
 
 	static int Run() {
@@ -83,26 +125,70 @@ public:
 			omp_set_num_threads( parms.numThreads );
 		}
 
+		FitBudget( parms );
+
+		// Only the bits mode needs the bit vectors once the indices have been
+		// extracted.
+		const bool keepBits = parms.mode == "bits";
 		vector<Signature *> querySigs, dbSigs;
 
-		ReadSignatures( parms.querySigs, querySigs, parms.sigLength );
-		ReadSignatures( parms.dbSigs, dbSigs, parms.sigLength );
+		ReadSignatures( parms.querySigs, querySigs, parms.sigLength, keepBits );
+		ReadSignatures( parms.dbSigs, dbSigs, parms.sigLength, keepBits );
 
 		vector<vector<uint>> dbIndex( parms.sigLength );
 		CreateIndex( dbSigs, dbIndex );
 
-		OMP_TIMER_DECLARE( rank );
-		OMP_TIMER_START( rank );
+		if ( MemoryAccount::IsActive() ) {
+			size_t signatureBytes = 0, postingBytes = MemoryAccount::HeapBytes( dbIndex );
+
+			for ( auto sig : querySigs ) signatureBytes += sig->MemoryBytes();
+			for ( auto sig : dbSigs ) signatureBytes += sig->MemoryBytes();
+			for ( auto & postings : dbIndex ) postingBytes += MemoryAccount::HeapBytes( postings );
+
+			MemoryAccount::Set( MemoryAccount::Signatures, signatureBytes );
+			MemoryAccount::Set( MemoryAccount::Postings, postingBytes );
+			MemoryAccount::Checkpoint( "load" );
+		}
+
+		ProfileRegion rank( "rank" );
+		rank.Start();
 		if ( parms.mode == "merge" ) {
 			RankMerge( querySigs, dbSigs, dbIndex, parms.maxResults, parms.outFile );
 		}
 		else {
 			RankBits( querySigs, dbSigs, dbIndex, parms.maxResults, parms.outFile );
 		}
-		OMP_TIMER_END( rank );
+		rank.Stop();
 		return 0;
 	}
 
+	/**
+	 *	<summary>
+	 *	With --memoryBudget, estimates the footprint of the signatures and the
+	 *	postings from the signature files before they are loaded. If the bits
+	 *	mode does not fit but the merge mode, which needs no bit vectors, 
+	 *	does, switches to merge (the rankings are the same); otherwise throws.
+	 *	</summary>
+	 */
+	static void FitBudget( Params &parms ) {
+		if ( MemoryAccount::Budget() == 0 ) return;
+
+		SignatureFileStats queries = SignatureFileStats::Scan( parms.querySigs );
+		SignatureFileStats db = SignatureFileStats::Scan( parms.dbSigs );
+		size_t postingBytes = parms.sigLength * ( sizeof( vector<uint> ) + MemoryAccount::BlockOverhead ) + db.indices * sizeof( uint );
+
+		auto estimate = [&]( bool keepBits ) {
+			return queries.Estimate( parms.sigLength, keepBits ) + db.Estimate( parms.sigLength, keepBits ) + postingBytes;
+		};
+
+		if ( parms.mode == "bits" && !MemoryAccount::Fits( estimate( true ) ) && MemoryAccount::Fits( estimate( false ) ) ) {
+			cerr << arguments->ProgName() << ": using mode merge rather than bits to fit the memory budget.\n";
+			parms.mode = "merge";
+		}
+
+		MemoryAccount::Require( "Ranking " + parms.querySigs + " against " + parms.dbSigs, estimate( parms.mode == "bits" ) );
+	}
+
 	static void CreateIndex(
 		const vector<Signature *> &dbSigs,
 		vector<vector<uint>> &index
@@ -110,6 +196,19 @@ public:
 	) {
 		const uint D = dbSigs.size();
 
+		// Size each postings list exactly, so none carries spare capacity.
+		vector<size_t> counts( index.size() );
+
+		for ( uint d = 0; d < D; d++ ) {
+			for ( auto i : dbSigs[d]->indices ) {
+				counts[i]++;
+			}
+		}
+
+		for ( size_t i = 0; i < index.size(); i++ ) {
+			index[i].reserve( counts[i] );
+		}
+
 		for ( uint d = 0; d < D; d++ ) {
 			for ( auto i : dbSigs[d]->indices ) {
 				index[i].push_back( d );
@@ -148,26 +247,29 @@ public:
 #if ! INTERLEAVE
 				auto & rankings = allRankings[q];
 #endif
-				const BitSet &querySignature = queries[q]->signature;
-
-				rankings.clear();
-				processed.Clear();
-
-				for ( uint c : queries[q]->indices ) {
-					for ( uint d : dbIndex[c] ) {
-						if ( !processed.Contains( d ) ) {
-							processed.Insert( d );
-							const BitSet &dbSignature = database[d]->signature;
-							double distance = 1.0 - querySignature.Similarity( dbSignature );
-
-							if ( rankings.canPush( distance ) ) {
-								rankings.push( d, distance );
+				{
+					PROFILE_SCOPE( "rankQuery" );
+					const BitSet &querySignature = queries[q]->signature;
+
+					rankings.clear();
+					processed.Clear();
+
+					for ( uint c : queries[q]->indices ) {
+						for ( uint d : dbIndex[c] ) {
+							if ( !processed.Contains( d ) ) {
+								processed.Insert( d );
+								const BitSet &dbSignature = database[d]->signature;
+								double distance = 1.0 - querySignature.Similarity( dbSignature );
+
+								if ( rankings.canPush( distance ) ) {
+									rankings.push( d, distance );
+								}
 							}
 						}
 					}
-				}
 
-				rankings.sort();
+					rankings.sort();
+				}
 
 #if INTERLEAVE
 #pragma omp critical
@@ -234,27 +336,13 @@ public:
 #if ! INTERLEAVE
 				auto & rankings = allRankings[q];
 #endif
-				auto &queryIndices = queries[q]->indices;
-
-				rankings.clear();
-				processed.Clear();
-
-				for ( uint c : queryIndices ) {
-					for ( uint d : dbIndex[c] ) {
-						if ( !processed.Contains( d ) ) {
-							processed.Insert( d );
-							auto &dbIndices = database[d]->indices;
-							double distance = 1.0 - Jaccard( queryIndices, dbIndices );
-
-							if ( rankings.canPush( distance ) ) {
-								rankings.push( d, distance );
-							}
-						}
-					}
+				{
+					PROFILE_SCOPE( "rankQuery" );
+					SignatureRanking::RankMerge( queries[q]->indices, dbIndex, [&]( uint d ) -> const vector<uint> & {
+						return database[d]->indices;
+					}, processed, rankings );
 				}
 
-				rankings.sort();
-
 #if INTERLEAVE
 #pragma omp critical
 				{
@@ -287,38 +375,11 @@ public:
 #endif
 	}
 
-	static double Jaccard( const vector<uint> & a, const vector<uint> & b ) {
-		uint m = a.size();
-		uint n = b.size();
-		uint i = 0, j = 0, intersect = 0, union_ = 0;
-
-		while ( i < m && j < n ) {
-			uint x = a[i], y = b[j];
-			
-			union_++;
-			
-			if ( x < y ) {
-				i++;
-			}
-			else if ( y < x ) {
-				j++;
-			}
-			else {
-				intersect ++;
-				i++;
-				j++;
-			}
-		}
-
-		union_ += m + n - i - j;
-
-		return (double) intersect / union_;
-	}
-
 	static void ReadSignatures(
 		string &sigFile,
 		vector<Signature *> &signatures,
-		uint sigLength //
+		uint sigLength,
+		bool keepBits //
 	) {
 		ifstream sigStream( sigFile );
 
@@ -327,6 +388,9 @@ public:
 			throw Exception( "Error reading file " + sigFile, FileAndLine );
 		}
 
+		// Receives each signature when the bit vectors are not kept.
+		BitSet scratch( sigLength );
+
 		while ( !sigStream.eof() ) {
 			string seqId;
 			sigStream >> seqId;
@@ -335,11 +399,14 @@ public:
 				break;
 			}
 
-			Signature * sig = new Signature( seqId, sigLength );
+			Signature * sig = new Signature( seqId, keepBits ? sigLength : 0 );
 			signatures.push_back( sig );
-			sigStream >> sig->signature;
 
-			sig->signature.Foreach( [&]( size_t index ) {
+			BitSet &bits = keepBits ? sig->signature : scratch;
+			sigStream >> bits;
+
+			sig->indices.reserve( bits.Cardinality() );
+			bits.Foreach( [&]( size_t index ) {
 				sig->indices.push_back( index );
 			} );
 		}
@@ -390,6 +457,24 @@ public:
 "             the bit indices (suitable for sparse signatures), while bits ",
 "             uses a packed array of boolean together with bitwise operators ",
 "             (suitable for dense signatures).",
+"",
+"--profile    Optional. A file to which a JSON profile of the run is written: ",
+"             the time, call count and duration percentiles of each timed ",
+"             region, nested as the regions are.",
+"",
+"--memoryBudget Optional. The most memory the run may use, e.g. 512M or 64G.",
+"             The requirement is estimated from the signature files before ",
+"             they are loaded; if mode bits does not fit but merge does, ",
+"             merge is used, and otherwise the program stops with an error.",
+"",
+"--memoryReport Optional, default = false. If true, the bytes held by the ",
+"             signatures and postings are reported once they are loaded.",
+"",
+"--perfCounters Optional, default = false. If true (and --profile is ",
+"             given), each region of the profile also reports hardware event ",
+"             counts, in total and per thread: cycles, instructions, L1 data ",
+"             and last level cache misses, and branch misses. Needs Linux ",
+"             perf_event_open; otherwise the profile has times only.",
 "",
 				};
 
@@ -454,6 +539,8 @@ int main( int argc, char *argv[] ) {
 		Args args( argc, argv );
 
 		arguments = &args;
+		ProfileSession profile( args );
+		MemorySession memory( args );
 
 		double start_time = omp_get_wtime();
 		int retCode = AAClustSig::Run();
@@ -28,14 +28,20 @@
 #include "Args.hpp"
 #include "Assert.hpp"
 #include "Delegates.hpp"
+#include "DistanceDistributionLibrary.hpp"
+#include "DnaDistance.hpp"
 #include "KmerCodebook.hpp"
 #include "KmerDistanceCache.hpp"
+#include "KmerEmbeddingFilter.hpp"
+#include "KmerNeighbourhood.hpp"
+#include "KmerShuffleDistance.hpp"
 #include "FastaSequence.hpp"
 #include "HBRandom.hpp"
 #include "Kmer.hpp"
 #include "KmerCluster.hpp"
 #include "TestFramework.h"
-#include "OmpTimer.h"
+#include "Profiler.hpp"
+#include "MemoryAccount.hpp"
 #include "BitSet.hpp"
 #include "kNearestNeighbours.hpp"
 #include "Ranking.hpp"
@@ -55,10 +61,6 @@ mutex QutBio::DistanceType::m;
 
 struct AAClustSig {
 public:
-	using DistanceFunction = KmerDistanceCache2;
-	using Cluster = KmerCluster<DistanceFunction, Kmer>;
-	using pCluster = Cluster * ;
-
 	struct Params {
 	public:
 		string seqFile;
@@ -72,7 +74,16 @@ public:
 		DistanceType *distanceType = DistanceType::BlosumDistance();
 		SimilarityMatrix *matrix;
 		Distance threshold;
+		string libraryFile;
+		double pValue = 0;
+		size_t fragmentLength = 0;
 		bool assignNearest = false;
+		bool useSimd = true;
+		uint charsPerWord = 2;
+		bool prefilter = false;
+		double prefilterScale = 1;
+		bool neighbourhood = true;
+		pAlphabet alphabet = Alphabet::AA();
 
 		Params() {
 
@@ -99,7 +110,15 @@ public:
 					"                         kmers to clusters. A kmer is considered to be a member of the cluster ",
 					"                         if the distance from kmer to cluster centroid is equal to or less than ",
 					"                         the threshold distance. The threshold should match that used when the ",
-					"                         codebook was constructed.",
+					"                         codebook was constructed. Not required if --libraryFile and --pValue",
+					"                         are given.",
+					"--libraryFile  Optional. A distribution library produced by GetKmerTheoreticalDistanceDistributions",
+					"                         --libraryFile, from which the threshold is selected to match --pValue,",
+					"                         using the entry for the matrix, wordLength and fragmentLength whose symbol",
+					"                         composition is nearest to that of the sequences.",
+					"--pValue       Required with --libraryFile. The largest acceptable probability that a random kmer",
+					"                         (or fragment) falls within threshold.",
+					"--fragmentLength Opt.    Default = wordLength. The fragment length of the library entry.",
 					"--numThreads   Optional; default value = 7. The number of OpenMP threads to use in parallel regions.",
 					"--matrixId     Optional, default = 62. BLOSUM Matrix ID, one of { 35, 40, 45, 50, 62, 80, 100 }.",
 					"                         This is ignored if a custom similarity matrix file is specified.",
@@ -108,8 +127,41 @@ public:
 					"                         a cluster. This may be cleaned up at some point in the future.}",
 					"--matrixFile   Optional. File name for custom similarity matrix. Use this to specify some matrix ",
 					"                         other than BLOSUM, or if a custom alphabet is in use.",
+					"--reducedAlphabet Opt.   Collapse the similarity matrix onto a reduced alphabet: murphy10, seb14, or a",
+					"                         comma-separated list of residue groups such as LVIM,C,A,G,ST,P,FYW,EDNQ,KR,H.",
+					"                         Must match the value used to create the prototypes.",
 					"--assignNearest Opt.     Boolean, default = false. Assign k-mers to only one cluster instead of all that fall ",
-					"                         within threshold."
+					"                         within threshold.",
+					"--useSimd      Optional; Boolean, default = true. Use the vector residue-lookup kernel when the processor",
+					"                         and alphabet support it; false forces the table lookup kernel.",
+					"--charsPerWord Optional; default = 2. The number of symbols packed into each word of the precomputed",
+					"                         distance table used by the table lookup kernel: 1, 2 or 3. Larger values",
+					"                         take fewer lookups per kmer but need a much larger table (3 needs about",
+					"                         190MB for BLOSUM alphabets). wordLength must be a multiple of this value.",
+					"--prefilter    Optional; Boolean, default = false. Skip exact distance evaluations that a lower bound",
+					"                         derived from the Hamming distance between CharMap embeddings shows cannot",
+					"                         affect the signature. This applies to the table lookup kernel, which is",
+					"                         used whenever the prefilter is enabled.",
+					"--prefilterScale Opt.    Default = 1. Multiplier applied to the prefilter bound. The default is lossless;",
+					"                         larger values skip more evaluations but may miss some kmers near the threshold.",
+					"--neighbourhood Opt.     Boolean, default = true. When the words within threshold of a typical kmer are",
+					"                         far fewer than the prototypes, enumerate them and look each one up in a hash table",
+					"                         of prototypes instead of scanning every prototype. The signatures are the same.",
+					"--alphabet     Optional; AA or DNA, default = AA. With DNA, kmers of up to 32 bases are packed",
+					"                         2 bits per base and compared by mismatch count over the better of the two",
+					"                         strands, using prototypes created by AAClust --alphabet DNA. The matrix,",
+					"                         charsPerWord, useSimd and prefilter arguments are ignored.",
+					"--profile      Optional. A file to which a JSON profile of the run is written: the time, call",
+					"                         count and duration percentiles of each timed region, nested as the regions are.",
+					"--perfCounters Optional; default = false. If true (and --profile is given), each region of the profile",
+					"                         also reports hardware event counts, in total and per thread: cycles, instructions,",
+					"                         L1 data and last level cache misses, and branch misses. Needs Linux perf_event_open;",
+					"                         where the counters are unavailable the profile has times only.",
+					"--memoryBudget Optional. The most memory the run may use, e.g. 512M or 64G. The requirement is",
+					"                         estimated before the data is loaded; if it does not fit, a smaller charsPerWord",
+					"                         is used where that would fit, and otherwise the program stops with an error.",
+					"--memoryReport Optional; default = false. If true, the bytes held by sequences, encodings,",
+					"                         prototypes and distance tables are reported after loading and after encoding."
 				};
 
 				for ( auto s : text ) {
@@ -156,22 +208,90 @@ public:
 				ok = false;
 			}
 
-			if ( !arguments->Get( "threshold", threshold ) ) {
+			if ( arguments->IsDefined( "libraryFile" ) ) {
+				arguments->Get( "libraryFile", libraryFile );
+
+				if ( !arguments->Get( "pValue", pValue ) || pValue < 0 || pValue > 1 ) {
+					cerr << arguments->ProgName() << ": Error - '--libraryFile' requires '--pValue' between 0 and 1.\n";
+					ok = false;
+				}
+			}
+			else if ( !arguments->Get( "threshold", threshold ) ) {
 				cerr << arguments->ProgName() << ": Error - required argument '--threshold' not provided.\n";
 				ok = false;
 			}
 
+			if ( arguments->IsDefined( "fragmentLength" ) && ( !arguments->Get( "fragmentLength", fragmentLength ) || fragmentLength < wordLength ) ) {
+				cerr << arguments->ProgName() << ": Error - '--fragmentLength' must be at least '--wordLength'.\n";
+				ok = false;
+			}
+
 			if ( arguments->IsDefined( "assignNearest" ) && !arguments->Get( "assignNearest", assignNearest ) ) {
 				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--assignNearest'.\n";
 				ok = false;
 			}
 
+			if ( arguments->IsDefined( "useSimd" ) && !arguments->Get( "useSimd", useSimd ) ) {
+				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--useSimd'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "charsPerWord" ) && !arguments->Get( "charsPerWord", charsPerWord ) ) {
+				cerr << arguments->ProgName() << ": Error - invalid data for argument '--charsPerWord'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "alphabet" ) && !arguments->Get( "alphabet", Alphabet::Values(), alphabet ) ) {
+				cerr << arguments->ProgName() << ": Error - invalid value for argument '--alphabet'.\n";
+				ok = false;
+			}
+
+			if ( alphabet == Alphabet::DNA() ) {
+				if ( wordLength < 1 || wordLength > DnaDistance::MaxKmerLength ) {
+					cerr << arguments->ProgName() << ": Error - DNA '--wordLength' must be between 1 and " << DnaDistance::MaxKmerLength << ".\n";
+					ok = false;
+				}
+			}
+			else if ( charsPerWord < 1 || charsPerWord > 3 ) {
+				cerr << arguments->ProgName() << ": Error - '--charsPerWord' must be 1, 2 or 3.\n";
+				ok = false;
+			}
+			else if ( wordLength % charsPerWord != 0 ) {
+				cerr << arguments->ProgName() << ": Error - '--wordLength' must be a multiple of '--charsPerWord'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "prefilter" ) && !arguments->Get( "prefilter", prefilter ) ) {
+				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--prefilter'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "prefilterScale" ) && !arguments->Get( "prefilterScale", prefilterScale ) ) {
+				cerr << arguments->ProgName() << ": Error - invalid data for argument '--prefilterScale'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "neighbourhood" ) && !arguments->Get( "neighbourhood", neighbourhood ) ) {
+				cerr << arguments->ProgName() << ": Error - invalid boolean data for argument '--neighbourhood'.\n";
+				ok = false;
+			}
+
+			if ( prefilterScale < 1 ) {
+				cerr << arguments->ProgName() << ": Error - '--prefilterScale' must be at least 1.\n";
+				ok = false;
+			}
+
 			string error;
-			if ( !arguments->Get( matrix, error ) ) {
+			if ( alphabet != Alphabet::DNA() && !arguments->Get( matrix, error ) ) {
 				cerr << error << '\n';
 				ok = false;
 			}
 
+			if ( alphabet == Alphabet::DNA() && libraryFile.length() > 0 ) {
+				cerr << arguments->ProgName() << ": Error - '--libraryFile' requires a similarity matrix, so cannot be used with DNA.\n";
+				ok = false;
+			}
+
 			if ( outFile == seqFile || outFile == protoFile ) {
 				cerr << arguments->ProgName() << ": Output file " << outFile << " will overwrite one of your input files.\n";
 				ok = false;
@@ -179,9 +299,6 @@ public:
 		}
 	};
 
-	using DF = KmerDistanceCache2;
-	using Codebook = KmerCodebook<DF, Kmer>;
-
 	static int Run() {
 		Params parms;
 
@@ -189,11 +306,139 @@ public:
 			return 1;
 		}
 
+		if ( parms.alphabet == Alphabet::DNA() ) {
+			return RunDna( parms );
+		}
+
 		Alphabet *alphabet = new Alphabet( parms.matrix );
 		BlosumDifferenceFunction rawDistanceFunction( parms.matrix );
-		DistanceFunction distanceFunction( alphabet, &rawDistanceFunction );
+		FitBudget( parms, alphabet->Size() );
+
+		return WithKmerDistanceCache( parms.charsPerWord, alphabet, &rawDistanceFunction, [&]( auto &distanceFunction ) {
+			omp_set_num_threads( parms.numThreads );
+
+			PointerList<EncodedFastaSequence> db;
+			EncodedFastaSequence::ReadSequences( db, parms.seqFile, parms.idIndex, parms.classIndex, alphabet, parms.wordLength, distanceFunction.CharsPerWord(), alphabet->DefaultSymbol(), EncodedFastaSequence::DefaultFactory );
+			cerr << arguments->ProgName() << ": " << db.Length() << " reference sequences loaded from " << parms.seqFile << ".\n";
+
+			if ( parms.libraryFile.length() > 0 && !SelectThreshold( parms, db ) ) {
+				return 1;
+			}
+
+			PointerList<KmerClusterPrototype> protos;
+			EncodedFastaSequence::ReadSequences<KmerClusterPrototype>( protos, parms.protoFile, 0, -1, alphabet, parms.wordLength, distanceFunction.CharsPerWord() );
+			cerr << arguments->ProgName() << ": " << protos.Length() << " prototypes loaded from " << parms.protoFile << ".\n";
+			AccountLoad( db, protos, distanceFunction.TableBytes() );
+
+			ProfileRegion encodeDb( "encodeDb" );
+			encodeDb.Start();
+			KmerShuffleDistance shuffleDistance( *alphabet, distanceFunction, parms.wordLength,
+				parms.useSimd ? KmerShuffleDistance::InstructionSet::Avx512Vbmi : KmerShuffleDistance::InstructionSet::None );
+			KmerNeighbourhood neighbourhood( *alphabet, distanceFunction, parms.wordLength );
+			bool useNeighbourhood = parms.neighbourhood && neighbourhood.IsAvailable();
+			double neighbourhoodSize = useNeighbourhood ? neighbourhood.ExpectedSize( parms.threshold ) : 0;
+
+			if ( parms.prefilter ) {
+				KmerEmbeddingFilter filter( *alphabet, distanceFunction, parms.wordLength, parms.prefilterScale );
+				Encode( db, protos, distanceFunction, parms.wordLength, parms.threshold, parms.assignNearest, parms.outFile, &filter );
+			}
+			else if ( useNeighbourhood && neighbourhoodSize < KmerNeighbourhood::Budget( protos.Length() ) ) {
+				cerr << arguments->ProgName() << ": using neighbourhood enumeration (about " << neighbourhoodSize << " words per kmer).\n";
+				Encode( db, protos, distanceFunction, parms.wordLength, parms.threshold, parms.assignNearest, parms.outFile, 0, &neighbourhood );
+			}
+			else if ( shuffleDistance.IsAvailable() ) {
+				cerr << arguments->ProgName() << ": using " << KmerShuffleDistance::Name( shuffleDistance.GetInstructionSet() ) << " residue lookup kernel.\n";
+				EncodeShuffle( db, protos, shuffleDistance, parms.wordLength, parms.threshold, parms.assignNearest, parms.outFile );
+			}
+			else {
+				Encode( db, protos, distanceFunction, parms.wordLength, parms.threshold, parms.assignNearest, parms.outFile );
+			}
+			encodeDb.Stop();
+
+			cerr << "Database encoded in " << encodeDb.Elapsed() << "s.\n";
+			if ( MemoryAccount::IsActive() ) MemoryAccount::Checkpoint( "encoding" );
+
+			// SaveSignatures(db, parms.outFile);
+			return 0;
+		} );
+	}
+
+	/**
+	 *	<summary>
+	 *	With --memoryBudget, estimates the footprint of the run before anything 
+	 *	is loaded: the sequences and prototypes with their encodings, and the 
+	 *	distance tables. If the requested charsPerWord does not fit but a 
+	 *	smaller one does, uses that instead; otherwise throws.
+	 *	</summary>
+	 */
+	static void FitBudget( Params &parms, size_t alphabetSize ) {
+		if ( MemoryAccount::Budget() == 0 ) return;
+
+		FastaFileStats data = FastaFileStats::Scan( parms.seqFile );
+		FastaFileStats protoData = FastaFileStats::Scan( parms.protoFile );
+		const bool isDna = parms.alphabet == Alphabet::DNA();
+
+		auto estimate = [&]( uint charsPerWord ) {
+			size_t sequenceBytes, encodingBytes, protoSequenceBytes, protoEncodingBytes;
+			EncodedFastaSequence::Estimate( data, parms.wordLength, charsPerWord, sequenceBytes, encodingBytes );
+			EncodedFastaSequence::Estimate( protoData, parms.wordLength, charsPerWord, protoSequenceBytes, protoEncodingBytes );
+
+			return sequenceBytes + encodingBytes + protoSequenceBytes + protoEncodingBytes
+				+ ( isDna ? 0 : KmerDistanceCache::EstimateTableBytes( alphabetSize, charsPerWord ) );
+		};
+
+		if ( isDna ) {
+			MemoryAccount::Require( "Encoding " + parms.seqFile, estimate( Alphabet::PackedDnaCharsPerWord ) );
+			return;
+		}
+
+		uint fit = FitCharsPerWord( parms.charsPerWord, parms.wordLength, estimate );
+
+		if ( fit == 0 ) {
+			MemoryAccount::Require( "Encoding " + parms.seqFile, estimate( 1 ) );
+		}
+		else if ( fit != parms.charsPerWord ) {
+			cerr << arguments->ProgName() << ": using charsPerWord " << fit << " rather than " << parms.charsPerWord << " to fit the memory budget.\n";
+			parms.charsPerWord = fit;
+		}
+	}
+
+	/// <summary>Records the footprint of the loaded data, if memory is being accounted.</summary>
+	template<typename ProtoList>
+	static void AccountLoad( PointerList<EncodedFastaSequence> &db, ProtoList &protos, size_t tableBytes ) {
+		if ( !MemoryAccount::IsActive() ) return;
+
+		EncodedFastaSequence::Account( db, MemoryAccount::Sequences, MemoryAccount::Encodings );
+
+		size_t codebookBytes = 0;
+
+		for ( auto proto : protos ) codebookBytes += proto->SequenceBytes() + proto->EncodingBytes();
 
+		MemoryAccount::Set( MemoryAccount::Codebook, codebookBytes );
+		MemoryAccount::Set( MemoryAccount::DistanceTables, tableBytes );
+		MemoryAccount::Checkpoint( "load" );
+	}
+
+	/// <summary>Sets the threshold from the distribution library to match the p-value.</summary>
+	static bool SelectThreshold( Params &parms, PointerList<EncodedFastaSequence> &db ) {
+		int threshold = DistanceDistributionLibrary::SelectThreshold( parms.libraryFile, *parms.matrix, FastaSequence::GetSymbolHistogram( db.Items() ),
+			(uint) parms.wordLength, (uint) ( parms.fragmentLength > 0 ? parms.fragmentLength : parms.wordLength ), parms.pValue );
+
+		if ( threshold < 0 || threshold > numeric_limits<Distance>::max() ) {
+			cerr << arguments->ProgName() << ": Error - no distance threshold has p-value " << parms.pValue << " or less.\n";
+			return false;
+		}
+
+		parms.threshold = (Distance) threshold;
+		cerr << arguments->ProgName() << ": threshold " << parms.threshold << " selected for p-value " << parms.pValue << ".\n";
+		return true;
+	}
+
+	static int RunDna( Params &parms ) {
+		Alphabet *alphabet = parms.alphabet;
+		DnaDistance distanceFunction;
 		omp_set_num_threads( parms.numThreads );
+		FitBudget( parms, 0 );
 
 		PointerList<EncodedFastaSequence> db;
 		EncodedFastaSequence::ReadSequences( db, parms.seqFile, parms.idIndex, parms.classIndex, alphabet, parms.wordLength, distanceFunction.CharsPerWord(), alphabet->DefaultSymbol(), EncodedFastaSequence::DefaultFactory );
@@ -202,18 +447,100 @@ public:
 		PointerList<KmerClusterPrototype> protos;
 		EncodedFastaSequence::ReadSequences<KmerClusterPrototype>( protos, parms.protoFile, 0, -1, alphabet, parms.wordLength, distanceFunction.CharsPerWord() );
 		cerr << arguments->ProgName() << ": " << protos.Length() << " prototypes loaded from " << parms.protoFile << ".\n";
+		AccountLoad( db, protos, 0 );
 
-		OMP_TIMER_DECLARE( encodeDb );
-		OMP_TIMER_START( encodeDb );
-		Encode( db, protos, distanceFunction, parms.wordLength, parms.threshold, parms.assignNearest, parms.outFile );
-		OMP_TIMER_END( encodeDb );
-
-		cerr << "Database encoded in " << OMP_TIMER( encodeDb ) << "s.\n";
+		ProfileRegion encodeDb( "encodeDb" );
+		encodeDb.Start();
+		EncodeDna( db, protos, parms.wordLength, parms.threshold, parms.assignNearest, parms.outFile );
+		encodeDb.Stop();
 
-		// SaveSignatures(db, parms.outFile);
+		cerr << "Database encoded in " << encodeDb.Elapsed() << "s.\n";
+		if ( MemoryAccount::IsActive() ) MemoryAccount::Checkpoint( "encoding" );
 		return 0;
 	}
 
+	/**
+	 *	<summary>
+	 *	Encodes nucleotide sequences against packed 2-bit prototypes. The prototypes
+	 *	are gathered into one contiguous array of 64 bit codes, and each sequence kmer
+	 *	is loaded and reverse complemented once, so the inner loop streams 8 bytes per
+	 *	prototype and costs two popcounts. Kmers are processed in sequence order, which
+	 *	gives the same signature as the prototype-major loop of EncodeAny.
+	 *	</summary>
+	 */
+	static void EncodeDna(
+		PointerList<EncodedFastaSequence> &sequences,
+		PointerList<KmerClusterPrototype> &protos,
+		uint K,
+		Distance threshold,
+		bool assignNearest,
+		string &outFile
+	) {
+		const uint Q = sequences.Length();
+		const uint C = protos.Length();
+		vector<uint64_t> protoCodes( C );
+
+		for ( uint c = 0; c < C; c++ ) {
+			protoCodes[c] = DnaDistance::Load( protos[c]->PackedEncoding() );
+		}
+
+		const uint64_t *p = protoCodes.data();
+		ofstream str( outFile );
+
+#pragma omp parallel
+		{
+			BitSet signature( C );
+
+#pragma omp for schedule(guided)
+			for ( uint q = 0; q < Q; q++ ) {
+				PROFILE_SCOPE( "encodeSequence" );
+				auto seq = sequences[q];
+				uint M = seq->KmerCount( K );
+				signature.Clear();
+
+				for ( uint m = 0; m < M; m++ ) {
+					if ( seq->IsUnknownKmer( m, K ) ) continue;
+
+					uint64_t fwd = DnaDistance::Load( seq->GetEncodedKmer( m ) );
+					uint64_t rev = DnaDistance::ReverseComplement( fwd, K );
+
+					if ( assignNearest ) {
+						Distance nearestDistance = numeric_limits<Distance>::max();
+						uint nearestIndex = 0;
+
+						for ( uint c = 0; c < C; c++ ) {
+							Distance dist = std::min( DnaDistance::Mismatches( fwd, p[c] ), DnaDistance::Mismatches( rev, p[c] ) );
+
+							if ( dist < nearestDistance ) {
+								nearestIndex = c;
+								nearestDistance = dist;
+							}
+						}
+
+						if ( nearestDistance <= threshold ) {
+							signature.Insert( nearestIndex );
+						}
+					}
+					else {
+						for ( uint c = 0; c < C; c++ ) {
+							Distance dist = std::min( DnaDistance::Mismatches( fwd, p[c] ), DnaDistance::Mismatches( rev, p[c] ) );
+
+							if ( dist <= threshold ) {
+								signature.Insert( c );
+							}
+						}
+					}
+				}
+
+#pragma omp critical
+				{
+					str << sequences[q]->Id() << " " << signature << "\n";
+				}
+			}
+		}
+	}
+
+	template<typename DistanceFunction>
 	static void Encode(
 		PointerList<EncodedFastaSequence> &sequences,
 		PointerList<KmerClusterPrototype> &protos,
@@ -221,26 +548,42 @@ public:
 		uint K,
 		Distance threshold,
 		bool assignNearest,
-		string &outFile //
+		string &outFile,
+		const KmerEmbeddingFilter *filter = 0,
+		const KmerNeighbourhood *neighbourhood = 0 //
 	) {
 		if ( assignNearest ) {
-			EncodeNearest( sequences, protos, distanceFunction, K, threshold, outFile );
+			EncodeNearest( sequences, protos, distanceFunction, K, threshold, outFile, filter, neighbourhood );
 		}
 		else {
-			EncodeAny( sequences, protos, distanceFunction, K, threshold, outFile );
+			EncodeAny( sequences, protos, distanceFunction, K, threshold, outFile, filter, neighbourhood );
 		}
 	}
 
+	template<typename DistanceFunction>
 	static void EncodeNearest(
 		PointerList<EncodedFastaSequence> &sequences,
 		PointerList<KmerClusterPrototype> &protos,
 		DistanceFunction &distanceFunction,
 		uint K,
 		Distance threshold,
-		string &outFile //
+		string &outFile,
+		const KmerEmbeddingFilter *filter,
+		const KmerNeighbourhood *neighbourhood //
 	) {
 		const uint Q = sequences.Length();
 		const uint C = protos.Length();
+		KmerEmbeddingBlocks protoEmbedding;
+		KmerWordTable protoTable;
+		size_t exactCount = 0, pairCount = 0;
+
+		if ( filter ) {
+			EmbedPrototypes( protos, *filter, K, protoEmbedding );
+		}
+
+		if ( neighbourhood ) {
+			IndexPrototypes( protos, *neighbourhood, protoTable );
+		}
 
 #define INTERLEAVE 1
 #if INTERLEAVE
@@ -256,48 +599,105 @@ public:
 		// With no schedule, encodes 500000 sequences against 10000 prototypes in 1751s
 		// With schedule(guided), takes 1509s
 		// With the output interleaved with calculation, takes:
+		distanceFunction.Dispatch( K, [&]( auto kernel ) {
 #pragma omp parallel
-		{
+			{
 #if INTERLEAVE
-			BitSet signature( C );
+				BitSet signature( C );
 #endif
+				vector<uint64_t> embedding;
+				vector<Distance> bounds( protoEmbedding.PaddedCount() );
+				vector<KmerWord> symbols;
+				size_t exact = 0, pairs = 0;
+
 #pragma omp for schedule(guided)
-			for ( uint q = 0; q < Q; q++ ) {
-				auto seq = sequences[q];
-				uint M = seq->KmerCount( K );
+				for ( uint q = 0; q < Q; q++ ) {
+					PROFILE_SCOPE( "encodeSequence" );
+					auto seq = sequences[q];
+					uint M = seq->KmerCount( K );
 #if INTERLEAVE
-				signature.Clear();
+					signature.Clear();
 #else
-				BitSet & signature = signatures[q];
+					BitSet & signature = signatures[q];
 #endif
 
-				for ( uint m = 0; m < M; m++ ) {
-					EncodedKmer kmerCode = seq->GetEncodedKmer( m );
-					Distance nearestDistance = numeric_limits<Distance>::max();
-					uint nearestIndex = 0;
+					if ( filter ) {
+						EmbedSequence( seq, *filter, embedding );
+					}
+
+					if ( neighbourhood ) {
+						GetSymbols( seq, *neighbourhood, symbols );
+					}
+
+					for ( uint m = 0; m < M; m++ ) {
+						EncodedKmer kmerCode = seq->GetEncodedKmer( m );
+						Distance nearestDistance = numeric_limits<Distance>::max();
+						uint nearestIndex = 0;
+
+						if ( neighbourhood ) {
+							pairs++;
+
+							// A neighbourhood too large to beat the scan falls back to it.
+							if ( neighbourhood->FindNearest( &symbols[m], threshold, protoTable, KmerNeighbourhood::Budget( C ), nearestIndex, nearestDistance ) ) {
+								if ( nearestIndex != KmerWordTable::None ) {
+									signature.Insert( nearestIndex );
+								}
+
+								continue;
+							}
+
+							exact++;
+							nearestDistance = numeric_limits<Distance>::max();
+							nearestIndex = 0;
+						}
+
+						if ( filter ) {
+							filter->GetLowerBounds( &embedding[m], protoEmbedding, bounds.data() );
+							pairs += C;
+						}
 
-					for ( uint c = 0; c < C; c++ ) {
-						EncodedKmer centroidCode = protos[c]->SingletonKmer().PackedEncoding();
-						auto dist = distanceFunction( centroidCode, kmerCode, K );
+						for ( uint c = 0; c < C; c++ ) {
+							// The bound never exceeds the distance (when the scale is 1), so 
+							// this prototype can be neither within threshold nor nearer.
+							if ( filter && ( bounds[c] > threshold || bounds[c] >= nearestDistance ) ) continue;
 
-						if ( dist <= threshold && dist < nearestDistance ) {
-							nearestIndex = c;
-							nearestDistance = dist;
+							exact += filter != 0;
+							EncodedKmer centroidCode = protos[c]->SingletonKmer().PackedEncoding();
+							auto dist = kernel( centroidCode, kmerCode );
+
+							if ( dist <= threshold && dist < nearestDistance ) {
+								nearestIndex = c;
+								nearestDistance = dist;
+							}
+						}
+
+						if ( nearestDistance < numeric_limits<Distance>::max() ) {
+							signature.Insert( nearestIndex );
 						}
 					}
 
-					if ( nearestDistance < numeric_limits<Distance>::max() ) {
-						signature.Insert( nearestIndex );
+#if INTERLEAVE
+#pragma omp critical
+					{
+						str << sequences[q]->Id() << " " << signature << "\n";
 					}
+#endif
 				}
 
-#if INTERLEAVE
 #pragma omp critical
 				{
-					str << sequences[q]->Id() << " " << signature << "\n";
+					exactCount += exact;
+					pairCount += pairs;
 				}
-#endif
 			}
+		} );
+
+		if ( filter ) {
+			ReportPrefilter( exactCount, pairCount );
+		}
+
+		if ( neighbourhood ) {
+			ReportNeighbourhood( exactCount, pairCount );
 		}
 
 #if !INTERLEAVE
@@ -310,16 +710,30 @@ public:
 	}
 
 
+	template<typename DistanceFunction>
 	static void EncodeAny(
 		PointerList<EncodedFastaSequence> &sequences,
 		PointerList<KmerClusterPrototype> &protos,
 		DistanceFunction &distanceFunction,
 		uint K,
 		Distance threshold,
-		string &outFile //
+		string &outFile,
+		const KmerEmbeddingFilter *filter,
+		const KmerNeighbourhood *neighbourhood //
 	) {
 		const uint Q = sequences.Length();
 		const uint C = protos.Length();
+		KmerEmbeddingBlocks protoEmbedding;
+		KmerWordTable protoTable;
+		size_t exactCount = 0, pairCount = 0;
+
+		if ( filter ) {
+			EmbedPrototypes( protos, *filter, K, protoEmbedding );
+		}
+
+		if ( neighbourhood ) {
+			IndexPrototypes( protos, *neighbourhood, protoTable );
+		}
 
 #define INTERLEAVE 1
 #if INTERLEAVE
@@ -332,42 +746,110 @@ public:
 		}
 #endif
 
+		distanceFunction.Dispatch( K, [&]( auto kernel ) {
 #pragma omp parallel
-		{
+			{
 #if INTERLEAVE
-			BitSet signature( C );
+				BitSet signature( C );
 #endif
+				vector<uint64_t> embedding;
+				vector<Distance> bounds( protoEmbedding.PaddedCount() );
+				vector<KmerWord> symbols;
+				size_t exact = 0, pairs = 0;
+
 #pragma omp for schedule(guided)
-			for ( uint q = 0; q < Q; q++ ) {
-				auto seq = sequences[q];
-				uint M = seq->KmerCount( K );
+				for ( uint q = 0; q < Q; q++ ) {
+					PROFILE_SCOPE( "encodeSequence" );
+					auto seq = sequences[q];
+					uint M = seq->KmerCount( K );
 #if INTERLEAVE
-				signature.Clear();
+					signature.Clear();
 #else
-				BitSet & signature = signatures[q];
+					BitSet & signature = signatures[q];
 #endif
 
-				for ( uint c = 0; c < C; c++ ) {
-					EncodedKmer centroidCode = protos[c]->PackedEncoding();
+					if ( filter ) {
+						// Kmer-major order, so that the bounds for one kmer are computed
+						// in a single pass over the prototypes. The signature is the same.
+						EmbedSequence( seq, *filter, embedding );
 
-					for ( uint m = 0; m < M; m++ ) {
-						EncodedKmer kmerCode = seq->GetEncodedKmer( m );
-						auto dist = distanceFunction( centroidCode, kmerCode, K );
+						for ( uint m = 0; m < M; m++ ) {
+							EncodedKmer kmerCode = seq->GetEncodedKmer( m );
+							filter->GetLowerBounds( &embedding[m], protoEmbedding, bounds.data() );
+							pairs += C;
+
+							for ( uint c = 0; c < C; c++ ) {
+								if ( bounds[c] > threshold || signature.Contains( c ) ) continue;
+
+								exact++;
 
-						if ( dist <= threshold ) {
-							signature.Insert( c );
-							break;
+								if ( kernel( protos[c]->PackedEncoding(), kmerCode ) <= threshold ) {
+									signature.Insert( c );
+								}
+							}
+						}
+					}
+					else if ( neighbourhood ) {
+						GetSymbols( seq, *neighbourhood, symbols );
+
+						for ( uint m = 0; m < M; m++ ) {
+							pairs++;
+
+							bool complete = neighbourhood->Enumerate( &symbols[m], threshold, KmerNeighbourhood::Budget( C ), [&]( uint64_t code, Distance ) {
+								for ( uint c = protoTable.Find( code ); c != KmerWordTable::None; c = protoTable.Next( c ) ) {
+									signature.Insert( c );
+								}
+							} );
+
+							if ( complete ) continue;
+
+							// A neighbourhood too large to beat the scan falls back to it.
+							exact++;
+							EncodedKmer kmerCode = seq->GetEncodedKmer( m );
+
+							for ( uint c = 0; c < C; c++ ) {
+								if ( !signature.Contains( c ) && kernel( protos[c]->PackedEncoding(), kmerCode ) <= threshold ) {
+									signature.Insert( c );
+								}
+							}
+						}
+					}
+					else for ( uint c = 0; c < C; c++ ) {
+						EncodedKmer centroidCode = protos[c]->PackedEncoding();
+
+						for ( uint m = 0; m < M; m++ ) {
+							EncodedKmer kmerCode = seq->GetEncodedKmer( m );
+							auto dist = kernel( centroidCode, kmerCode );
+
+							if ( dist <= threshold ) {
+								signature.Insert( c );
+								break;
+							}
 						}
 					}
-				}
 
 #if INTERLEAVE
+#pragma omp critical
+					{
+						str << sequences[q]->Id() << " " << signature << "\n";
+					}
+#endif
+				}
+
 #pragma omp critical
 				{
-					str << sequences[q]->Id() << " " << signature << "\n";
+					exactCount += exact;
+					pairCount += pairs;
 				}
-#endif
 			}
+		} );
+
+		if ( filter ) {
+			ReportPrefilter( exactCount, pairCount );
+		}
+
+		if ( neighbourhood ) {
+			ReportNeighbourhood( exactCount, pairCount );
 		}
 
 #if !INTERLEAVE
@@ -378,6 +860,127 @@ public:
 		}
 #endif
 	}
+
+	/// <summary>Collects the subject embedding of each prototype kmer.</summary>
+	static void EmbedPrototypes( PointerList<KmerClusterPrototype> &protos, const KmerEmbeddingFilter &filter, uint K, KmerEmbeddingBlocks &embeddings ) {
+		const uint C = protos.Length();
+		vector<uint64_t> embedding( K );
+		embeddings = KmerEmbeddingBlocks( K, C );
+
+		for ( uint c = 0; c < C; c++ ) {
+			filter.EmbedSubject( protos[c]->Sequence().c_str(), K, embedding.data() );
+			embeddings.Set( c, embedding.data() );
+		}
+	}
+
+	/// <summary>Writes the query embedding of each residue of a sequence to embedding.</summary>
+	static void EmbedSequence( EncodedFastaSequence *seq, const KmerEmbeddingFilter &filter, vector<uint64_t> &embedding ) {
+		const string &s = seq->Sequence();
+		embedding.resize( s.size() );
+		filter.EmbedQuery( s.c_str(), s.size(), embedding.data() );
+	}
+
+	/// <summary>Builds a table which maps the words of the prototypes to their indices.</summary>
+	static void IndexPrototypes( PointerList<KmerClusterPrototype> &protos, const KmerNeighbourhood &neighbourhood, KmerWordTable &table ) {
+		const uint C = protos.Length();
+		table.Clear();
+
+		for ( uint c = 0; c < C; c++ ) {
+			table.Add( neighbourhood.Code( protos[c]->Sequence().c_str() ), c );
+		}
+	}
+
+	/// <summary>Writes the residue code of each symbol of a sequence to symbols.</summary>
+	static void GetSymbols( EncodedFastaSequence *seq, const KmerNeighbourhood &neighbourhood, vector<KmerWord> &symbols ) {
+		const string &s = seq->Sequence();
+		symbols.resize( s.size() );
+		neighbourhood.Symbols( s.c_str(), s.size(), symbols.data() );
+	}
+
+	static void ReportNeighbourhood( size_t scanCount, size_t kmerCount ) {
+		cerr << arguments->ProgName() << ": neighbourhood enumeration resolved " << ( kmerCount - scanCount ) << " of " << kmerCount
+			<< " kmers; the rest were scanned.\n";
+	}
+
+	static void ReportPrefilter( size_t exactCount, size_t pairCount ) {
+		cerr << arguments->ProgName() << ": prefilter evaluated " << exactCount << " of " << pairCount
+			<< " kmer-prototype distances (" << ( pairCount ? 100.0 * ( pairCount - exactCount ) / pairCount : 0.0 )
+			<< "% skipped).\n";
+	}
+
+	/**
+	 *	<summary>
+	 *	Encodes the sequences by scanning prototypes with the vector residue lookup 
+	 *	kernel. Each kmer is compared with every prototype in one pass, so the 
+	 *	signatures are the same as those produced by the table path.
+	 *	</summary>
+	 */
+	static void EncodeShuffle(
+		PointerList<EncodedFastaSequence> &sequences,
+		PointerList<KmerClusterPrototype> &protos,
+		const KmerShuffleDistance &distanceFunction,
+		uint K,
+		Distance threshold,
+		bool assignNearest,
+		string &outFile //
+	) {
+		const uint Q = sequences.Length();
+		const uint C = protos.Length();
+
+		KmerResidueBlocks centroids( K, C );
+
+		for ( uint c = 0; c < C; c++ ) {
+			centroids.Set( c, protos[c]->GetEncodedKmer1( 0 ) );
+		}
+
+		ofstream str( outFile );
+
+#pragma omp parallel
+		{
+			BitSet signature( C );
+			vector<Distance> dist( centroids.PaddedCount() );
+
+#pragma omp for schedule(guided)
+			for ( uint q = 0; q < Q; q++ ) {
+				PROFILE_SCOPE( "encodeSequence" );
+				auto seq = sequences[q];
+				uint M = seq->KmerCount( K );
+				signature.Clear();
+
+				for ( uint m = 0; m < M; m++ ) {
+					distanceFunction.GetDistances( seq->GetEncodedKmer1( m ), centroids, dist.data() );
+
+					if ( assignNearest ) {
+						Distance nearestDistance = numeric_limits<Distance>::max();
+						uint nearestIndex = 0;
+
+						for ( uint c = 0; c < C; c++ ) {
+							if ( dist[c] <= threshold && dist[c] < nearestDistance ) {
+								nearestIndex = c;
+								nearestDistance = dist[c];
+							}
+						}
+
+						if ( nearestDistance < numeric_limits<Distance>::max() ) {
+							signature.Insert( nearestIndex );
+						}
+					}
+					else {
+						for ( uint c = 0; c < C; c++ ) {
+							if ( dist[c] <= threshold ) {
+								signature.Insert( c );
+							}
+						}
+					}
+				}
+
+#pragma omp critical
+				{
+					str << sequences[q]->Id() << " " << signature << "\n";
+				}
+			}
+		}
+	}
 };
 
 int main( int argc, char *argv[] ) {
@@ -385,6 +988,8 @@ int main( int argc, char *argv[] ) {
 		Args args( argc, argv );
 
 		arguments = &args;
+		ProfileSession profile( args );
+		MemorySession memory( args );
 
 		double start_time = omp_get_wtime();
 		int retCode = AAClustSig::Run();
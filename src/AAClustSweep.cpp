@@ -0,0 +1,615 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies 
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18), 
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published 
+// by the Free Software Foundation; either version 3, or (at your 
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#include "AlphabetHelper.hpp"
+#include "Args.hpp"
+#include "Assert.hpp"
+#include "Delegates.hpp"
+#include "KmerDistanceCache.hpp"
+#include "FastaSequence.hpp"
+#include "Kmer.hpp"
+#include "KmerCluster.hpp"
+#include "KmerCodebook.hpp"
+#include "Profiler.hpp"
+#include "MemoryAccount.hpp"
+#include "BitSet.hpp"
+#include "kNearestNeighbours.hpp"
+#include "SignatureRanking.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <omp.h>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace QutBio;
+using namespace std;
+
+// Singletons.
+Args *arguments;
+mutex QutBio::DistanceType::m;
+
+/**
+ *	<summary>
+ *	Evaluates a grid of (threshold, numClusters, maxResults) configurations of the
+ *	AAClusterFirst -> AAClustSigEncode -> AAClustSig -> trec_eval_tc_compact 
+ *	pipeline in a single process. The database, kmer index, codebook and distance 
+ *	table are loaded once, and the kmer-prototype distances are computed once:
+ *	<list>
+ *		<item>Prototypes are ordered by descending cluster size, so the codebook 
+ *			chosen by AAClusterFirst for any numClusters is a prefix of them.</item>
+ *		<item>For each sequence, the least distance from any of its kmers to each
+ *			prototype is kept when it is within the largest threshold. Bit c of 
+ *			the signature for threshold T and codebook size N is set iff prototype 
+ *			c &lt; N has least distance &lt;= T, which is what AAClustSigEncode 
+ *			computes with assignNearest false.</item>
+ *		<item>Each (threshold, numClusters) pair is ranked once to the largest
+ *			maxResults, and average precision is read off each shorter prefix.</item>
+ *	</list>
+ *	</summary>
+ */
+struct AAClustSweep {
+public:
+	struct Params {
+	public:
+		string fastaFile;
+		string clusterIn;
+		string protoIn;
+		string homologs;
+		string outFile;
+		size_t numThreads = 7;
+		size_t wordLength = 0;
+		int idIndex = 0;
+		int classIndex = -1;
+		uint charsPerWord = 2;
+		vector<Distance> thresholds;
+		vector<size_t> numClusters;
+		vector<uint> maxResults;
+		bool ok = true;
+		SimilarityMatrix *matrix = 0;
+
+		Params() {
+			if ( arguments->IsDefined( "help" ) ) {
+				vector<string> text{
+					"AAClustSweep: Evaluates mean average precision over a grid of threshold, codebook size and ",
+					"              result list length without leaving the process. The result for each grid ",
+					"              point equals that of AAClusterFirst, AAClustSigEncode (--assignNearest false), ",
+					"              AAClustSig (--mode merge) and trec_eval_tc_compact (ignoreMissing false) run ",
+					"              all-vs-all over the database, except that equally ranked documents may be ",
+					"              ordered differently.",
+					"",
+					"--help         Gets this text.",
+					"--fastaFile    Required. The FASTA file which contains the database; every sequence is also a query.",
+					"--clusterIn    Required. The name of a file that contains a list of k-mer clusters.",
+					"--protoIn      Required. The name of a file containing the prototypes.",
+					"--homologs     Required. The homologs file which defines relevance.",
+					"--outFile      Required. The name of a tab-separated file which will be overwritten with one ",
+					"                         row per configuration.",
+					"--idIndex      Required. The 0-origin position of the sequence ID field in the pipe-separated",
+					"                         definition line.",
+					"--wordLength   Required. The word length used for kmer tiling.",
+					"--thresholds   Required. One or more kmer-prototype distance thresholds.",
+					"--numClusters  Required. One or more codebook sizes. The largest clusters are used, as in ",
+					"                         AAClusterFirst.",
+					"--maxResults   Optional; default = 1000. One or more result list lengths.",
+					"--numThreads   Optional; default value = 7. The number of OpenMP threads to use in parallel regions.",
+					"--matrixId     Optional, default = 62. BLOSUM Matrix ID, one of { 35, 40, 45, 50, 62, 80, 100 }.",
+					"--matrixFile   Optional. File name for custom similarity matrix.",
+					"--reducedAlphabet Opt.   Collapse the similarity matrix onto a reduced alphabet. Must match the value ",
+					"                         used to create the clusters.",
+					"--charsPerWord Optional; default = 2. The number of symbols packed into each word of the precomputed",
+					"                         distance table: 1, 2 or 3. wordLength must be a multiple of this value.",
+					"--profile      Optional. A file to which a JSON profile of the run is written: the time, call",
+					"                         count and duration percentiles of each timed region, nested as the regions are.",
+					"--perfCounters Optional; default = false. If true (and --profile is given), each region of the profile",
+					"                         also reports hardware event counts, in total and per thread: cycles, instructions,",
+					"                         L1 data and last level cache misses, and branch misses. Needs Linux perf_event_open;",
+					"                         where the counters are unavailable the profile has times only.",
+					"--memoryReport Optional; default = false. If true, the bytes held by sequences, encodings, kmer index,",
+					"                         codebook, prototype hits and distance tables are reported after loading and",
+					"                         after the distances are computed.",
+					"--memoryBudget Optional. A size such as 512M or 64G. The memory needed to load the inputs is",
+					"                         estimated before anything is loaded; if it does not fit, a smaller charsPerWord",
+					"                         is tried, and failing that the program stops. If the resident memory grows past",
+					"                         the budget later, a warning is given at the next report point.",
+				};
+
+				for ( auto s : text ) {
+					cerr << s << "\n";
+				}
+			}
+
+			if ( !arguments->Get( "fastaFile", fastaFile ) ) {
+				cerr << arguments->ProgName() << ": error - required argument '--fastaFile' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "clusterIn", clusterIn ) ) {
+				cerr << arguments->ProgName() << ": error - required argument '--clusterIn' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "protoIn", protoIn ) ) {
+				cerr << arguments->ProgName() << ": error - required argument '--protoIn' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "homologs", homologs ) ) {
+				cerr << arguments->ProgName() << ": error - required argument '--homologs' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "outFile", outFile ) ) {
+				cerr << arguments->ProgName() << ": error - required argument '--outFile' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "idIndex", idIndex ) ) {
+				cerr << arguments->ProgName() << ": error - required argument '--idIndex' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "wordLength", wordLength ) ) {
+				cerr << arguments->ProgName() << ": error - required argument '--wordLength' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "thresholds", thresholds ) || thresholds.empty() ) {
+				cerr << arguments->ProgName() << ": error - required argument '--thresholds' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "numClusters", numClusters ) || numClusters.empty() ) {
+				cerr << arguments->ProgName() << ": error - required argument '--numClusters' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !arguments->Get( "maxResults", maxResults ) ) {
+				maxResults.push_back( 1000 );
+				cerr << arguments->ProgName() << ": note - optional argument '--maxResults' not set"
+					"; running with default value " << maxResults[0] << ".\n";
+			}
+
+			for ( auto m : maxResults ) {
+				if ( m == 0 ) {
+					cerr << arguments->ProgName() << ": error - '--maxResults' values must be positive.\n";
+					ok = false;
+				}
+			}
+
+			if ( !arguments->Get( "numThreads", numThreads ) ) {
+				cerr << arguments->ProgName() << ": note - optional argument '--numThreads' not set"
+					"; running with default value " << numThreads << ".\n";
+			}
+
+			if ( arguments->IsDefined( "charsPerWord" ) && !arguments->Get( "charsPerWord", charsPerWord ) ) {
+				cerr << arguments->ProgName() << ": error - invalid data for argument '--charsPerWord'.\n";
+				ok = false;
+			}
+
+			if ( charsPerWord < 1 || charsPerWord > 3 ) {
+				cerr << arguments->ProgName() << ": error - '--charsPerWord' must be 1, 2 or 3.\n";
+				ok = false;
+			}
+			else if ( wordLength % charsPerWord != 0 ) {
+				cerr << arguments->ProgName() << ": error - '--wordLength' must be a multiple of '--charsPerWord'.\n";
+				ok = false;
+			}
+
+			string error;
+
+			if ( !arguments->Get( matrix, error ) ) {
+				cerr << error << '\n';
+				ok = false;
+			}
+
+			if ( outFile == fastaFile || outFile == clusterIn || outFile == protoIn || outFile == homologs ) {
+				cerr << arguments->ProgName() << ": Output file " << outFile << " will overwrite one of your input files.\n";
+				ok = false;
+			}
+		}
+	};
+
+	/// <summary>The least distance from any kmer of a sequence to a prototype.</summary>
+	struct ProtoHit {
+		uint proto;
+		Distance distance;
+	};
+
+	/// <summary>The relevance judgements for one query.</summary>
+	struct Topic {
+		unordered_set<uint> relevant;
+		size_t relevantCount = 0;
+	};
+
+	static int Run() {
+		Params parms;
+
+		if ( !parms.ok ) {
+			cerr << "Invalid command line arguments supplied. For help, run: " << arguments->ProgName() << " --help\n";
+			return 1;
+		}
+
+		omp_set_num_threads( parms.numThreads );
+
+		std::sort( parms.thresholds.begin(), parms.thresholds.end() );
+		std::sort( parms.maxResults.begin(), parms.maxResults.end() );
+
+		Alphabet *alphabet = new Alphabet( parms.matrix );
+		BlosumDifferenceFunction rawDistanceFunction( parms.matrix );
+
+		// The prototype hits depend on the thresholds, so only the loaded 
+		// structures can be estimated before the run; the hits are checked 
+		// against the budget at the checkpoint after they are computed.
+		if ( MemoryAccount::Budget() > 0 ) {
+			FastaFileStats data = FastaFileStats::Scan( parms.fastaFile );
+			FastaFileStats protoData = FastaFileStats::Scan( parms.protoIn );
+
+			auto estimate = [&]( uint charsPerWord ) {
+				// One list of hits and one topic per sequence.
+				size_t perSequenceBytes = data.sequences * ( sizeof( vector<ProtoHit> ) + sizeof( Topic ) );
+
+				return EstimateCodebookLoadBytes( data, protoData, parms.wordLength, charsPerWord ) + perSequenceBytes
+					+ KmerDistanceCache::EstimateTableBytes( alphabet->Size(), charsPerWord );
+			};
+
+			uint fit = FitCharsPerWord( parms.charsPerWord, (uint) parms.wordLength, estimate );
+
+			if ( fit == 0 ) {
+				MemoryAccount::Require( "Sweeping " + parms.fastaFile, estimate( 1 ) );
+			}
+			else if ( fit != parms.charsPerWord ) {
+				cerr << arguments->ProgName() << ": using charsPerWord " << fit << " rather than " << parms.charsPerWord << " to fit the memory budget.\n";
+				parms.charsPerWord = fit;
+			}
+		}
+
+		return WithKmerDistanceCache( parms.charsPerWord, alphabet, &rawDistanceFunction, [&]( auto &distanceFunction ) {
+			using DistanceFunction = typename std::remove_reference<decltype( distanceFunction )>::type;
+			using Cluster = KmerCluster<DistanceFunction, Kmer>;
+			using Codebook = KmerCodebook<DistanceFunction, Kmer>;
+			using pCluster = Cluster *;
+
+			const uint K = parms.wordLength;
+
+			ProfileRegion load( "load" );
+			load.Start();
+
+			PointerList<EncodedFastaSequence> db;
+			EncodedFastaSequence::ReadSequences( db, parms.fastaFile, parms.idIndex, parms.classIndex, alphabet, K, distanceFunction.CharsPerWord(), alphabet->DefaultSymbol(), EncodedFastaSequence::DefaultFactory );
+			cerr << arguments->ProgName() << ": " << db.Length() << " sequences loaded from " << parms.fastaFile << ".\n";
+
+			EncodedFastaSequence::Index seqIndex( db.Items() );
+			KmerIndex kmerIndex( db.Items(), K );
+
+			PointerList<EncodedFastaSequence> protos;
+			{
+				ifstream protoStream( parms.protoIn );
+				EncodedFastaSequence::ReadSequences( protos, protoStream, 0, -1, alphabet, K, distanceFunction.CharsPerWord(), 'x', KmerClusterPrototype::DefaultFactory );
+			}
+			EncodedFastaSequence::Index protoIndex( protos.Items() );
+
+			FILE *f = fopen( parms.clusterIn.c_str(), "r" );
+
+			if ( !f ) {
+				cerr << "Cluster dataset " << parms.clusterIn << " cannot be opened for reading.\n";
+				return 1;
+			}
+
+			Codebook codebook( alphabet, distanceFunction, distanceFunction.CharsPerWord(), K, seqIndex, protoIndex, kmerIndex, f );
+			fclose( f );
+
+			vector<pCluster> &clusters{ codebook.Codebook() };
+
+			if ( clusters.size() == 0 ) {
+				cerr << "Cluster dataset contains no entries; run terminated.\n";
+				return 1;
+			}
+
+			std::sort( clusters.begin(), clusters.end(), []( const pCluster &lhs, const pCluster &rhs ) {
+				return lhs->InstanceCount() > rhs->InstanceCount();
+			} );
+
+			vector<KmerClusterPrototype *> prototypes;
+
+			for ( auto cluster : clusters ) {
+				prototypes.push_back( (KmerClusterPrototype *) cluster->prototype.Sequence() );
+			}
+
+			vector<Topic> topics;
+			size_t missingTopics = ReadHomologs( parms.homologs, db, topics );
+
+			load.Stop();
+			cerr << arguments->ProgName() << ": " << prototypes.size() << " prototypes and " << topics.size()
+				<< " topics loaded in " << load.Elapsed() << "s.\n";
+
+			if ( MemoryAccount::IsActive() ) {
+				EncodedFastaSequence::Account( db, MemoryAccount::Sequences, MemoryAccount::Encodings );
+				MemoryAccount::Set( MemoryAccount::KmerIndex, kmerIndex.MemoryBytes() );
+				MemoryAccount::Set( MemoryAccount::Codebook, Cluster::CodebookBytes( clusters, protos ) );
+				MemoryAccount::Set( MemoryAccount::DistanceTables, distanceFunction.TableBytes() );
+				MemoryAccount::Checkpoint( "load" );
+			}
+
+			ProfileRegion encode( "encode" );
+			encode.Start();
+			vector<vector<ProtoHit>> hits;
+			GetProtoHits( db, prototypes, distanceFunction, K, parms.thresholds.front(), parms.thresholds.back(), hits );
+			encode.Stop();
+			cerr << arguments->ProgName() << ": kmer-prototype distances computed in " << encode.Elapsed() << "s.\n";
+
+			if ( MemoryAccount::IsActive() ) {
+				size_t postingBytes = MemoryAccount::HeapBytes( hits );
+
+				for ( auto & list : hits ) postingBytes += MemoryAccount::HeapBytes( list );
+
+				MemoryAccount::Set( MemoryAccount::Postings, postingBytes );
+				MemoryAccount::Checkpoint( "encoding" );
+			}
+
+			ofstream out( parms.outFile );
+			out << "threshold\tnumClusters\tmaxResults\ttopics\tMAP\tseconds\n";
+
+			for ( auto threshold : parms.thresholds ) {
+				for ( auto numClusters : parms.numClusters ) {
+					uint N = (uint) std::min( numClusters, prototypes.size() );
+
+					double start = omp_get_wtime();
+					vector<double> map = Evaluate( hits, threshold, N, parms.maxResults, topics, missingTopics );
+					double elapsed = omp_get_wtime() - start;
+
+					for ( size_t i = 0; i < parms.maxResults.size(); i++ ) {
+						out << threshold << "\t" << N << "\t" << parms.maxResults[i] << "\t"
+							<< ( topics.size() + missingTopics ) << "\t" << map[i] << "\t" << elapsed << "\n";
+					}
+
+					out.flush();
+					cerr << arguments->ProgName() << ": threshold " << threshold << ", numClusters " << N
+						<< " evaluated in " << elapsed << "s.\n";
+				}
+			}
+
+			return 0;
+		} );
+	}
+
+	/**
+	 *	<summary>
+	 *	Computes, for each sequence, the least distance from any of its kmers to each
+	 *	prototype, keeping those within maxThreshold in ascending prototype order. 
+	 *	The scan over kmers stops as soon as the distance reaches minThreshold, since
+	 *	every configuration then sets the bit.
+	 *	</summary>
+	 */
+	template<typename DistanceFunction>
+	static void GetProtoHits(
+		PointerList<EncodedFastaSequence> &sequences,
+		vector<KmerClusterPrototype *> &protos,
+		DistanceFunction &distanceFunction,
+		uint K,
+		Distance minThreshold,
+		Distance maxThreshold,
+		vector<vector<ProtoHit>> &hits //
+	) {
+		const uint Q = sequences.Length();
+		const uint C = protos.size();
+		hits.assign( Q, vector<ProtoHit>() );
+
+		distanceFunction.Dispatch( K, [&]( auto kernel ) {
+#pragma omp parallel for schedule(guided)
+			for ( uint q = 0; q < Q; q++ ) {
+				auto seq = sequences[q];
+				uint M = seq->KmerCount( K );
+
+				for ( uint c = 0; c < C; c++ ) {
+					EncodedKmer centroidCode = protos[c]->PackedEncoding();
+					Distance least = numeric_limits<Distance>::max();
+
+					for ( uint m = 0; m < M; m++ ) {
+						Distance dist = kernel( centroidCode, seq->GetEncodedKmer( m ) );
+
+						if ( dist < least ) {
+							least = dist;
+							if ( least <= minThreshold ) break;
+						}
+					}
+
+					if ( least <= maxThreshold ) {
+						hits[q].push_back( ProtoHit{ c, least } );
+					}
+				}
+			}
+		} );
+	}
+
+	/**
+	 *	<summary>
+	 *	Ranks every sequence against the database by Jaccard similarity of signatures 
+	 *	under one (threshold, numClusters) configuration, and returns the mean average
+	 *	precision for each list length in maxResults (ascending). Topics listed in the 
+	 *	homologs file which are not database sequences count as zero.
+	 *	</summary>
+	 */
+	static vector<double> Evaluate(
+		const vector<vector<ProtoHit>> &hits,
+		Distance threshold,
+		uint numClusters,
+		const vector<uint> &maxResults,
+		const vector<Topic> &topics,
+		size_t missingTopics //
+	) {
+		const uint Q = hits.size();
+		const uint R = maxResults.size();
+		vector<vector<uint>> signatures( Q );
+		vector<vector<uint>> dbIndex( numClusters );
+
+		for ( uint q = 0; q < Q; q++ ) {
+			for ( auto &hit : hits[q] ) {
+				if ( hit.proto < numClusters && hit.distance <= threshold ) {
+					signatures[q].push_back( hit.proto );
+					dbIndex[hit.proto].push_back( q );
+				}
+			}
+		}
+
+		vector<double> sumAveragePrecision( R, 0.0 );
+
+#pragma omp parallel
+		{
+			KnnVector<size_t, double> rankings( maxResults.back() );
+			BitSet processed( Q );
+			vector<double> averagePrecision( R );
+
+#pragma omp for schedule(guided)
+			for ( uint q = 0; q < Q; q++ ) {
+				SignatureRanking::RankMerge( signatures[q], dbIndex, [&]( uint d ) -> const vector<uint> & {
+					return signatures[d];
+				}, processed, rankings );
+				GetAveragePrecision( rankings, topics[q], maxResults, averagePrecision );
+
+#pragma omp critical
+				{
+					for ( uint r = 0; r < R; r++ ) {
+						sumAveragePrecision[r] += averagePrecision[r];
+					}
+				}
+			}
+		}
+
+		for ( auto &x : sumAveragePrecision ) {
+			x /= Q + missingTopics;
+		}
+
+		return sumAveragePrecision;
+	}
+
+	/// <summary>Gets the average precision of each prefix of a sorted ranking.</summary>
+	static void GetAveragePrecision(
+		KnnVector<size_t, double> &rankings,
+		const Topic &topic,
+		const vector<uint> &maxResults,
+		vector<double> &averagePrecision //
+	) {
+		size_t found = 0, relevantFound = 0;
+		double precisionSum = 0;
+		uint r = 0;
+
+		for ( auto &ranking : rankings ) {
+			while ( r < maxResults.size() && found == maxResults[r] ) {
+				averagePrecision[r++] = topic.relevantCount ? precisionSum / topic.relevantCount : 0;
+			}
+
+			found++;
+
+			if ( topic.relevant.count( ranking.second ) ) {
+				relevantFound++;
+				precisionSum += (double) relevantFound / found;
+			}
+		}
+
+		while ( r < maxResults.size() ) {
+			averagePrecision[r++] = topic.relevantCount ? precisionSum / topic.relevantCount : 0;
+		}
+	}
+
+	/**
+	 *	<summary>
+	 *	Reads a homologs file, in which each line holds a topic id followed by the ids 
+	 *	of its relevant documents. Topics are indexed by database position. Returns 
+	 *	the number of topics that are not database sequences.
+	 *	</summary>
+	 */
+	static size_t ReadHomologs( const string &fileName, PointerList<EncodedFastaSequence> &db, vector<Topic> &topics ) {
+		ifstream str( fileName );
+
+		if ( str.fail() ) {
+			cerr << "File " << fileName << " did not open properly\n";
+			throw Exception( "Error reading file " + fileName, FileAndLine );
+		}
+
+		unordered_map<string, uint> position;
+
+		for ( uint i = 0; i < db.Length(); i++ ) {
+			position[db[i]->Id()] = i;
+		}
+
+		topics.assign( db.Length(), Topic() );
+		unordered_set<string> missing;
+		string line;
+
+		while ( getline( str, line ) ) {
+			istringstream words( line );
+			string topicId, docId;
+
+			if ( !( words >> topicId ) ) continue;
+
+			auto t = position.find( topicId );
+			Topic *topic = t == position.end() ? 0 : &topics[t->second];
+
+			if ( !topic ) {
+				missing.insert( topicId );
+				continue;
+			}
+
+			while ( words >> docId ) {
+				topic->relevantCount++;
+
+				auto d = position.find( docId );
+
+				if ( d != position.end() ) {
+					topic->relevant.insert( d->second );
+				}
+			}
+		}
+
+		return missing.size();
+	}
+};
+
+int main( int argc, char *argv[] ) {
+	try {
+		Args args( argc, argv );
+
+		arguments = &args;
+		ProfileSession profile( args );
+		MemorySession memory( args );
+
+		double start_time = omp_get_wtime();
+		int retCode = AAClustSweep::Run();
+		double end_time = omp_get_wtime();
+
+		cout << "Elapsed time: " << ( end_time - start_time ) << "s" << endl;
+
+		return retCode;
+	}
+	catch ( Exception ex ) {
+		cerr << ex.File() << "(" << ex.Line() << "): " << ex.what() << "\n";
+		return 1;
+	}
+}
@@ -36,7 +36,8 @@
 #include "KmerCluster.hpp"
 #include "KmerCodebook.hpp"
 #include "TestFramework.h"
-#include "OmpTimer.h"
+#include "Profiler.hpp"
+#include "MemoryAccount.hpp"
 #include "FileUtil.hpp"
 
 #include <bitset>
@@ -51,11 +52,6 @@ using namespace std;
 Args *arguments;
 
 struct AAClusterFirst {
-
-	using DistanceFunction = KmerDistanceCache2;
-	using Cluster = KmerCluster<DistanceFunction, Kmer>;
-	using Codebook = KmerCodebook<DistanceFunction, Kmer>;
-
 public:
 	static int Run() {
 		bool ok = true;
@@ -69,6 +65,7 @@ public:
 		size_t wordLength = 32;
 		int idIndex = 0;
 		size_t numClusters = 0;
+		uint charsPerWord = 2;
 
 		if ( arguments->IsDefined( "help" ) ) {
 			vector<string> text{
@@ -85,6 +82,12 @@ public:
 				"--wordLength   Optional; default value = 32. The word length used for kmer tiling.",
 				"--matrixId     Optional, default = 62. BLOSUM Matrix ID, one of { 35, 40, 45, 50, 62, 80, 100 }. This is ignored if a custom similarity matrix file is specified.",
 				"--matrixFile   Optional. File name for custom similarity matrix. Use this to specify some matrix other than BLOSUM, or if a custom alphabet is in use.",
+				"--reducedAlphabet Optional. Collapse the similarity matrix onto a reduced alphabet: murphy10, seb14, or a comma-separated list of residue groups such as LVIM,C,A,G,ST,P,FYW,EDNQ,KR,H. Must match the value used to create the clusters.",
+				"--charsPerWord Optional [1, 2, 3], default = 2. The number of symbols packed into each word of the precomputed distance table. Larger values take fewer lookups per kmer but need a much larger table (3 needs about 190MB for BLOSUM alphabets). wordLength must be a multiple of this value.",
+				"--profile      Optional. A file to which a JSON profile of the run is written: the time, call count and duration percentiles of each timed region, nested as the regions are.",
+				"--perfCounters Optional, default = false. If true (and --profile is given), each region of the profile also reports hardware event counts, in total and per thread: cycles, instructions, L1 data and last level cache misses, and branch misses. Needs Linux perf_event_open; where the counters are unavailable the profile has times only.",
+				"--memoryReport Optional, default = false. If true, the bytes held by sequences, encodings, kmer index, codebook and distance tables are reported once they are loaded.",
+				"--memoryBudget Optional. A size such as 512M or 64G. The memory needed is estimated from the input files before anything is loaded; if it does not fit, a smaller charsPerWord is tried, and failing that the program stops. If the resident memory has grown past the budget once the data is loaded, a warning is given.",
 			};
 
 			for ( auto s : text ) {
@@ -159,6 +162,17 @@ public:
 			}
 		}
 
+		if ( arguments->IsDefined( "charsPerWord" ) ) {
+			if ( !arguments->Get( "charsPerWord", charsPerWord ) || charsPerWord < 1 || charsPerWord > 3 ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--charsPerWord'.\n";
+				ok = false;
+			}
+			else if ( wordLength % charsPerWord != 0 ) {
+				cerr << arguments->ProgName() << ": error - '--wordLength' must be a multiple of '--charsPerWord'.\n";
+				ok = false;
+			}
+		}
+
 		if ( !ok ) {
 			cerr << "Invalid command line arguments supplied. For help, run: " << arguments->ProgName() << " --help\n";
 			return 1;
@@ -184,6 +198,13 @@ public:
 
 		SimilarityMatrix * matrix = SimilarityMatrix::GetMatrix( distanceType, matrixId, matrixFile, isCaseSensitive );
 
+		string matrixError;
+
+		if ( matrix && !arguments->GetReducedAlphabet( matrix, matrixError ) ) {
+			cerr << matrixError << "\n";
+			ok = false;
+		}
+
 		if ( ok == false || !matrix ) {
 			cerr << "Unable to construct similarity matrix. For help, run: AAClusterFirst --help\n";
 			return 1;
@@ -201,98 +222,130 @@ public:
 
 		Alphabet * alphabet = new Alphabet( matrix );
 		BlosumDifferenceFunction rawDistanceFunction( matrix );
-		using DistanceFunction = KmerDistanceCache2;
-		DistanceFunction distanceFunction( alphabet, &rawDistanceFunction );
 
-		omp_set_num_threads( numThreads );
+		if ( MemoryAccount::Budget() > 0 ) {
+			FastaFileStats data = FastaFileStats::Scan( fastaFile );
+			FastaFileStats protoData = FastaFileStats::Scan( protoIn );
+
+			auto estimate = [&]( uint charsPerWord ) {
+				return EstimateCodebookLoadBytes( data, protoData, wordLength, charsPerWord )
+					+ KmerDistanceCache::EstimateTableBytes( alphabet->Size(), charsPerWord );
+			};
 
-		PointerList<EncodedFastaSequence> db;
+			uint fit = FitCharsPerWord( charsPerWord, (uint) wordLength, estimate );
+
+			if ( fit == 0 ) {
+				MemoryAccount::Require( "Loading the codebook of " + fastaFile, estimate( 1 ) );
+			}
+			else if ( fit != charsPerWord ) {
+				cerr << "AAClusterFirst: using charsPerWord " << fit << " rather than " << charsPerWord << " to fit the memory budget.\n";
+				charsPerWord = fit;
+			}
+		}
 
-		{
-			fstream fasta( fastaFile );
+		return WithKmerDistanceCache( charsPerWord, alphabet, &rawDistanceFunction, [&]( auto &distanceFunction ) {
+			using DistanceFunction = typename std::remove_reference<decltype( distanceFunction )>::type;
+			using Cluster = KmerCluster<DistanceFunction, Kmer>;
+			using Codebook = KmerCodebook<DistanceFunction, Kmer>;
+
+			omp_set_num_threads( numThreads );
+
+			PointerList<EncodedFastaSequence> db;
+
+			{
+				fstream fasta( fastaFile );
+				EncodedFastaSequence::ReadSequences(
+					db,
+					fasta,
+					idIndex,
+					-1,
+					alphabet,
+					wordLength,
+					distanceFunction.CharsPerWord(),
+					'x',
+					EncodedFastaSequence::DefaultFactory
+				);
+			}
+
+			cerr << "AAClusterFirst: " << db.Length() << " sequences loaded.\n";
+
+			EncodedFastaSequence::Index seqIndex( db.Items() );
+			KmerIndex kmerIndex( db.Items(), wordLength );
+
+			PointerList<EncodedFastaSequence> protos;
+			ifstream protoStream( protoIn );
 			EncodedFastaSequence::ReadSequences(
-				db,
-				fasta,
-				idIndex,
+				protos,
+				protoStream,
+				0,
 				-1,
 				alphabet,
 				wordLength,
 				distanceFunction.CharsPerWord(),
 				'x',
-				EncodedFastaSequence::DefaultFactory
+				KmerClusterPrototype::DefaultFactory
 			);
-		}
+			EncodedFastaSequence::Index protoIndex( protos.Items() );
 
-		cerr << "AAClusterFirst: " << db.Length() << " sequences loaded.\n";
-
-		EncodedFastaSequence::Index seqIndex( db.Items() );
-		KmerIndex kmerIndex( db.Items(), wordLength );
-
-		PointerList<EncodedFastaSequence> protos;
-		ifstream protoStream( protoIn );
-		EncodedFastaSequence::ReadSequences(
-			protos,
-			protoStream,
-			0,
-			-1,
-			alphabet,
-			wordLength,
-			distanceFunction.CharsPerWord(),
-			'x',
-			KmerClusterPrototype::DefaultFactory
-		);
-		EncodedFastaSequence::Index protoIndex( protos.Items() );
-
-		//for (auto & i : protoIndex) {
-		//	cerr << i.first << "\n";
-		//	cerr << (*i.second) << "\n";
-		//}
-
-		Codebook * codebook = 0;
-
-		FILE * f = fopen( clusterIn.c_str(), "r" );
-		if ( f ) {
-			codebook = new Codebook( alphabet, distanceFunction, distanceFunction.CharsPerWord(), wordLength, seqIndex, protoIndex, kmerIndex, f );
-			fclose( f );
-
-			if ( codebook->Size() == 0 ) {
-				cerr << "Cluster dataset contains no entries; run terminated.\n";
+			//for (auto & i : protoIndex) {
+			//	cerr << i.first << "\n";
+			//	cerr << (*i.second) << "\n";
+			//}
+
+			Codebook * codebook = 0;
+
+			FILE * f = fopen( clusterIn.c_str(), "r" );
+			if ( f ) {
+				codebook = new Codebook( alphabet, distanceFunction, distanceFunction.CharsPerWord(), wordLength, seqIndex, protoIndex, kmerIndex, f );
+				fclose( f );
+
+				if ( codebook->Size() == 0 ) {
+					cerr << "Cluster dataset contains no entries; run terminated.\n";
+					exit( 1 );
+				}
+			}
+			else {
+				( cerr << "Cluster dataset " << clusterIn << " cannot be opened for reading.\n" ).flush();
 				exit( 1 );
 			}
-		}
-		else {
-			( cerr << "Cluster dataset " << clusterIn << " cannot be opened for reading.\n" ).flush();
-			exit( 1 );
-		}
 
-		using pCluster = Cluster * ;
-		vector<pCluster> &clusters{ codebook->Codebook() };
+			using pCluster = Cluster * ;
+			vector<pCluster> &clusters{ codebook->Codebook() };
+
+			if ( MemoryAccount::IsActive() ) {
+				EncodedFastaSequence::Account( db, MemoryAccount::Sequences, MemoryAccount::Encodings );
+				MemoryAccount::Set( MemoryAccount::KmerIndex, kmerIndex.MemoryBytes() );
+				MemoryAccount::Set( MemoryAccount::Codebook, Cluster::CodebookBytes( clusters, protos ) );
+				MemoryAccount::Set( MemoryAccount::DistanceTables, distanceFunction.TableBytes() );
+				MemoryAccount::Checkpoint( "load" );
+			}
 
-		auto descendingClusterSize = []( const pCluster & lhs, const pCluster & rhs ) {
-			return lhs->InstanceCount() > rhs->InstanceCount();
-		};
+			auto descendingClusterSize = []( const pCluster & lhs, const pCluster & rhs ) {
+				return lhs->InstanceCount() > rhs->InstanceCount();
+			};
 
-		std::sort( clusters.begin(), clusters.end(), descendingClusterSize );
+			std::sort( clusters.begin(), clusters.end(), descendingClusterSize );
 
-		( cerr << "selecting largest " << numClusters << " clusters from " << clusters.size() << "\n" ).flush();
+			( cerr << "selecting largest " << numClusters << " clusters from " << clusters.size() << "\n" ).flush();
 
-		vector<pCluster> clusterSubset;
-		vector<KmerClusterPrototype *> protoSubset;
+			vector<pCluster> clusterSubset;
+			vector<KmerClusterPrototype *> protoSubset;
 
-		for ( auto cluster : clusters ) {
-			if ( clusterSubset.size() >= numClusters ) break;
+			for ( auto cluster : clusters ) {
+				if ( clusterSubset.size() >= numClusters ) break;
 
-			clusterSubset.push_back( cluster );
-			protoSubset.push_back( (KmerClusterPrototype *) cluster->prototype.Sequence() );
-		}
+				clusterSubset.push_back( cluster );
+				protoSubset.push_back( (KmerClusterPrototype *) cluster->prototype.Sequence() );
+			}
 
-		ofstream cOut( clusterOut );
-		for ( auto c: clusterSubset ) cOut << (*c);
+			ofstream cOut( clusterOut );
+			for ( auto c: clusterSubset ) cOut << (*c);
 
-		ofstream pOut( protoOut );
-		for ( auto p: protoSubset ) pOut << (*p);
+			ofstream pOut( protoOut );
+			for ( auto p: protoSubset ) pOut << (*p);
 
-		return 0;
+			return 0;
+		} );
 	}
 };
 
@@ -303,6 +356,8 @@ int main( int argc, char *argv[] ) {
 		Args args( argc, argv );
 
 		arguments = &args;
+		ProfileSession profile( args );
+		MemorySession memory( args );
 
 		double start_time = omp_get_wtime();
 		int retCode = AAClusterFirst::Run();
@@ -0,0 +1,1294 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies 
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18), 
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published 
+// by the Free Software Foundation; either version 3, or (at your 
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+
+#include "Alphabet.hpp"
+#include "Args.hpp"
+#include "BitSet.hpp"
+#include "Convolution.hpp"
+#include "Delegates.hpp"
+#include "DnaDistance.hpp"
+#include "EncodedKmer.hpp"
+#include "Exception.hpp"
+#include "FastaSequence.hpp"
+#include "HBRandom.hpp"
+#include "IntegerDistribution.hpp"
+#include "KmerCodebook.hpp"
+#include "KmerDistanceCache.hpp"
+#include "KmerEmbeddingFilter.hpp"
+#include "KmerShuffleDistance.hpp"
+#include "Profiler.hpp"
+#include "SequenceDistanceFunction.hpp"
+#include "SignatureRanking.hpp"
+#include "SimilarityMatrix.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <omp.h>
+#include <string>
+#include <vector>
+
+using namespace QutBio;
+using namespace std;
+
+// Address of singleton argument table.
+Args *arguments;
+
+/**
+**	<summary>
+**		Micro-benchmarks for the inner kernels of the clustering and encoding
+**		tools. Inputs are synthetic and generated from a fixed seed so that 
+**		timings are comparable between runs and between machines.
+**	</summary>
+*/
+struct Benchmark {
+	struct Params {
+		bool ok = true;
+		SimilarityMatrix *matrix = 0;
+		int seed = 1;
+		uint minK = 3;
+		uint maxK = 32;
+		uint numKmers = 4096;
+		uint numProtos = 1024;
+		uint reps = 5;
+		string seqFile;
+		uint filterK = 30;
+		Distance threshold = 305;
+		vector<string> sections{ "distance", "lookup", "footprint", "prefilter", "dna", "fragment", "convolution", "kernels" };
+
+		Params() {
+			if ( arguments->IsDefined( "help" ) ) {
+				vector<string> text{
+					"Benchmark: Times inner distance kernels on synthetic kmers.",
+					"--help        Gets this text.",
+					"--seed        Optional; default value = 1. The random number seed used to generate kmers.",
+					"--minK        Optional; default value = 3. The smallest kmer length to benchmark.",
+					"--maxK        Optional; default value = 32. The largest kmer length to benchmark.",
+					"--numKmers    Optional; default value = 4096. The number of query kmers.",
+					"--numProtos   Optional; default value = 1024. The number of prototype kmers scanned per query.",
+					"--reps        Optional; default value = 5. The number of timed repetitions; the fastest is reported.",
+					"--seqFile     Optional. A FASTA file (e.g. sp100000.faa). If supplied, the table footprint benchmark",
+					"              samples its kmers from these sequences rather than generating them at random.",
+					"--filterK     Optional; default value = 30. The kmer length used by the embedding prefilter benchmark.",
+					"--threshold   Optional; default value = 305. The cluster membership threshold used by the embedding",
+					"              prefilter benchmark.",
+					"--matrixId    Optional, default = 62. BLOSUM Matrix ID, one of { 35, 40, 45, 50, 62, 80, 100 }.",
+					"--matrixFile  Optional. File name for custom similarity matrix.",
+					"--reducedAlphabet Optional. Collapse the matrix onto a reduced alphabet: murphy10, seb14, or a",
+					"              comma-separated list of residue groups such as LVIM,C,A,G,ST,P,FYW,EDNQ,KR,H.",
+					"--sections    Optional; default value = all. The benchmarks to run, in order, as a space-separated",
+					"              list drawn from: distance lookup footprint prefilter dna fragment convolution kernels.",
+					"              Each writes a tab-separated table with a header row; tables are separated by a",
+					"              blank line.",
+					"--profile     Optional. A file to which a JSON profile of the run is written.",
+					"--perfCounters Optional; default = false. If true, the profile includes hardware event counts",
+					"              (cycles, instructions, cache and branch misses) for each region and thread.",
+					"",
+					"The kernels table has one row per (kernel, parameter, size), with columns:",
+					"  kernel      kmer_distance, find_nearest_cluster, bitset_similarity, integer_distribution_add,",
+					"              jaccard or rank_merge.",
+					"  param       The kmer length, bit count, distribution support or signature length.",
+					"  size        The number of prototypes, clusters, sets, signatures or database signatures.",
+					"  ops         The number of operations timed: distances, searches, similarities, additions,",
+					"              similarities or queries respectively.",
+					"  ns_per_op   Nanoseconds per operation, from the fastest of --reps repetitions.",
+					"  ops_per_s   Operations per second.",
+					"  work        A kernel-specific count of the work in one repetition: residues compared,",
+					"              prototypes scanned, words compared, output probabilities, entries merged or",
+					"              database signatures scored.",
+					"  checksum    A sum over the results, which should not change unless the results do.",
+				};
+
+				for ( auto s : text ) {
+					cerr << s << "\n";
+				}
+
+				ok = false;
+				return;
+			}
+
+			if ( arguments->IsDefined( "seed" ) && !arguments->Get( "seed", seed ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--seed'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "minK" ) && !arguments->Get( "minK", minK ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--minK'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "maxK" ) && !arguments->Get( "maxK", maxK ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--maxK'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "numKmers" ) && !arguments->Get( "numKmers", numKmers ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--numKmers'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "numProtos" ) && !arguments->Get( "numProtos", numProtos ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--numProtos'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "reps" ) && !arguments->Get( "reps", reps ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--reps'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "seqFile" ) && !arguments->Get( "seqFile", seqFile ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--seqFile'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "filterK" ) && !arguments->Get( "filterK", filterK ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--filterK'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "threshold" ) && !arguments->Get( "threshold", threshold ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--threshold'.\n";
+				ok = false;
+			}
+
+			if ( arguments->IsDefined( "sections" ) && !arguments->Get( "sections", sections ) ) {
+				cerr << arguments->ProgName() << ": error - invalid value for '--sections'.\n";
+				ok = false;
+			}
+
+			if ( minK < 1 || maxK < minK ) {
+				cerr << arguments->ProgName() << ": error - require 1 <= minK <= maxK.\n";
+				ok = false;
+			}
+
+			string error;
+
+			if ( !arguments->IsDefined( "matrixId" ) && !arguments->IsDefined( "matrixFile" ) ) {
+				matrix = SimilarityMatrix::Blosum62();
+
+				if ( !arguments->GetReducedAlphabet( matrix, error ) ) {
+					cerr << error << '\n';
+					ok = false;
+				}
+			}
+			else if ( !arguments->Get( matrix, error ) ) {
+				cerr << error << '\n';
+				ok = false;
+			}
+		}
+	};
+
+	static int Run() {
+		Params parms;
+
+		if ( !parms.ok ) {
+			return 1;
+		}
+
+		Alphabet alphabet( parms.matrix );
+		BlosumDifferenceFunction rawDistanceFunction( parms.matrix );
+		KmerDistanceCache2 distanceFunction( &alphabet, &rawDistanceFunction );
+
+		map<string, Action> benchmarks{
+			{ "distance", [&]() { KmerDistance( parms, alphabet, distanceFunction ); } },
+			{ "lookup", [&]() { ResidueLookup( parms, alphabet, distanceFunction ); } },
+			{ "footprint", [&]() { TableFootprint( parms, alphabet, rawDistanceFunction ); } },
+			{ "prefilter", [&]() { EmbeddingPrefilter( parms, alphabet, distanceFunction ); } },
+			{ "dna", [&]() { NucleotideDistance( parms ); } },
+			{ "fragment", [&]() { FragmentDistance( parms, alphabet ); } },
+			{ "convolution", [&]() { KmerDistanceConvolution( parms, alphabet ); } },
+			{ "kernels", [&]() { Kernels( parms, alphabet, distanceFunction ); } },
+		};
+
+		for ( auto & section : parms.sections ) {
+			if ( benchmarks.find( section ) == benchmarks.end() ) {
+				cerr << arguments->ProgName() << ": error - unknown section '" << section << "'.\n";
+				return 1;
+			}
+		}
+
+		for ( size_t i = 0; i < parms.sections.size(); i++ ) {
+			if ( i > 0 ) cout << "\n";
+			benchmarks[parms.sections[i]]();
+			cout.flush();
+		}
+
+		return 0;
+	}
+
+	/**
+	**	<summary>
+	**		Generates n random kmers of length K over the alphabet, packed 
+	**		charsPerWord symbols to the word, one kmer per row.
+	**	</summary>
+	*/
+	static void RandomKmers( Alphabet &alphabet, UniformIntRandom<int> &rand, uint n, uint K, uint charsPerWord, FlatMatrix<KmerWord> &kmers ) {
+		string symbols = alphabet.Symbols();
+		string kmer( K, ' ' );
+		kmers.resize( n, Alphabet::WordsPerKmer( K, charsPerWord ) );
+
+		for ( uint i = 0; i < n; i++ ) {
+			for ( uint j = 0; j < K; j++ ) {
+				kmer[j] = symbols[rand( 0, (int) symbols.size() - 1 )];
+			}
+
+			alphabet.Encode( kmer.c_str(), K, charsPerWord, kmers.row( i ) );
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Times a nearest-prototype scan using the run-time loop in 
+	**		KmerDistanceCache2::operator(), the length-specialised kernel 
+	**		returned by GetKernel, and a scan loop instantiated per kmer 
+	**		length via Dispatch, for each kmer length in range. Speedup is
+	**		that of the dispatched loop relative to the run-time loop.
+	**	</summary>
+	*/
+	static void KmerDistance( Params &parms, Alphabet &alphabet, KmerDistanceCache2 &distanceFunction ) {
+		UniformIntRandom<int> rand( parms.seed, 0, alphabet.Size() - 1 );
+		FlatMatrix<KmerWord> queries, protos;
+
+		cout << "K\tgeneric_ns\tpointer_ns\tdispatched_ns\tspeedup\n";
+
+		for ( uint K = parms.minK; K <= parms.maxK; K++ ) {
+			RandomKmers( alphabet, rand, parms.numKmers, K, distanceFunction.CharsPerWord(), queries );
+			RandomKmers( alphabet, rand, parms.numProtos, K, distanceFunction.CharsPerWord(), protos );
+
+			auto kernel = distanceFunction.GetKernel( K );
+			double ops = (double) parms.numKmers * parms.numProtos;
+			Distance checkGeneric = 0, checkKernel = 0, checkDispatched = 0;
+
+			double generic = Time( parms.reps, [&]() {
+				for ( uint q = 0; q < parms.numKmers; q++ ) {
+					Distance nearest = numeric_limits<Distance>::max();
+
+					for ( uint p = 0; p < parms.numProtos; p++ ) {
+						Distance d = distanceFunction( queries.row( q ), protos.row( p ), K );
+						if ( d < nearest ) nearest = d;
+					}
+
+					checkGeneric += nearest;
+				}
+			} );
+
+			double specialised = Time( parms.reps, [&]() {
+				for ( uint q = 0; q < parms.numKmers; q++ ) {
+					Distance nearest = numeric_limits<Distance>::max();
+
+					for ( uint p = 0; p < parms.numProtos; p++ ) {
+						Distance d = kernel( distanceFunction, queries.row( q ), protos.row( p ), K );
+						if ( d < nearest ) nearest = d;
+					}
+
+					checkKernel += nearest;
+				}
+			} );
+
+			double dispatched = Time( parms.reps, [&]() {
+				distanceFunction.Dispatch( K, [&]( auto kernel ) {
+					for ( uint q = 0; q < parms.numKmers; q++ ) {
+						Distance nearest = numeric_limits<Distance>::max();
+
+						for ( uint p = 0; p < parms.numProtos; p++ ) {
+							Distance d = kernel( queries.row( q ), protos.row( p ) );
+							if ( d < nearest ) nearest = d;
+						}
+
+						checkDispatched += nearest;
+					}
+				} );
+			} );
+
+			if ( checkGeneric != checkKernel || checkGeneric != checkDispatched ) {
+				throw Exception( "Specialised kernel disagrees with generic distance.", FileAndLine );
+			}
+
+			cout << K
+				<< "\t" << ( generic * 1e9 / ops )
+				<< "\t" << ( specialised * 1e9 / ops )
+				<< "\t" << ( dispatched * 1e9 / ops )
+				<< "\t" << ( generic / dispatched )
+				<< "\n";
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Times FragmentHausdorffDistanceFunction on pairs of random sequences,
+	**		using the direct kernel which recomputes each kmer distance, and the
+	**		diagonal update kernel restricted to each instruction set in turn. Times 
+	**		are per kmer pair, and are reported as 0 for instruction sets that this
+	**		processor does not support.
+	**	</summary>
+	*/
+	static void FragmentDistance( Params &parms, Alphabet &alphabet ) {
+		using Function = FragmentHausdorffDistanceFunction;
+		using Isa = Function::InstructionSet;
+
+		const uint length = 400;
+		const uint pairs = 16;
+		UniformIntRandom<int> rand( parms.seed, 0, alphabet.Size() - 1 );
+		string symbols = alphabet.Symbols();
+		vector<Isa> instructionSets{ Isa::None, Isa::Avx2, Isa::Avx512Bw };
+		vector<uint> fragmentLengths{ 1, 4 };
+
+		cout << "K\tfrag_length\tdirect_ns\tscalar_ns\tavx2_ns\tavx512bw_ns\n";
+
+		for ( uint fragmentLength : fragmentLengths ) {
+			uint K = parms.filterK;
+			PointerList<EncodedFastaSequence> seqs;
+
+			for ( uint i = 0; i < 2 * pairs; i++ ) {
+				string residues( length, ' ' );
+
+				for ( auto & ch : residues ) {
+					ch = symbols[rand( 0, (int) symbols.size() - 1 )];
+				}
+
+				auto seq = new EncodedFastaSequence( "", "", "", residues, &alphabet, K, 1, alphabet.DefaultSymbol() );
+				seqs.Add( [seq]() { return seq; } );
+			}
+
+			double ops = (double) pairs * ( length - K + 1 ) * ( length - K + 1 );
+			Function direct( parms.matrix, K, fragmentLength, Isa::None );
+			Distance checkDirect = 0;
+
+			double directTime = Time( parms.reps, [&]() {
+				checkDirect = 0;
+
+				for ( uint i = 0; i < pairs; i++ ) {
+					checkDirect += direct.ComputeDistanceDirect( seqs[2 * i], seqs[2 * i + 1] );
+				}
+			} );
+
+			cout << K << "\t" << fragmentLength << "\t" << ( directTime * 1e9 / ops );
+
+			for ( auto isa : instructionSets ) {
+				Function diagonal( parms.matrix, K, fragmentLength, isa );
+
+				if ( diagonal.GetInstructionSet() != isa ) {
+					cout << "\t" << 0;
+					continue;
+				}
+
+				Distance check = 0;
+
+				double elapsed = Time( parms.reps, [&]() {
+					check = 0;
+
+					for ( uint i = 0; i < pairs; i++ ) {
+						check += diagonal.ComputeDistance( seqs[2 * i], seqs[2 * i + 1] );
+					}
+				} );
+
+				if ( check != checkDirect ) {
+					throw Exception( "Diagonal fragment distance disagrees with direct calculation.", FileAndLine );
+				}
+
+				cout << "\t" << ( elapsed * 1e9 / ops );
+			}
+
+			cout << "\n";
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Times direct and FFT convolution of the distance distribution of 
+	**		filterK-mers under uniform residue frequencies with itself, doubling
+	**		the number of summands each step as GetKmerTheoreticalDistanceDistributions
+	**		does. Also reports the worst relative difference between the two over 
+	**		entries above 1e-300, which covers the far tails.
+	**	</summary>
+	*/
+	static void KmerDistanceConvolution( Params &parms, Alphabet &alphabet ) {
+		uint8_t table[128][128];
+		parms.matrix->PopulateDistanceTable( table );
+		string symbols = alphabet.Symbols();
+
+		vector<double> oneMer;
+
+		for ( char x : symbols ) {
+			for ( char y : symbols ) {
+				uint d = table[(uint8_t) x][(uint8_t) y];
+				if ( oneMer.size() <= d ) oneMer.resize( d + 1 );
+				oneMer[d] += 1.0 / ( symbols.size() * symbols.size() );
+			}
+		}
+
+		vector<double> kmer = oneMer;
+
+		for ( uint k = 1; k < parms.filterK; k++ ) {
+			kmer = Convolution::Convolve( kmer, oneMer );
+		}
+
+		cout << "summands\tsupport\tdirect_ms\tfft_ms\tmax_rel_error\n";
+
+		for ( uint m = 1; kmer.size() <= 16384; m *= 2 ) {
+			vector<double> direct( 2 * kmer.size() - 1 ), fft( 2 * kmer.size() - 1 );
+
+			double directTime = Time( 1, [&]() { Convolution::Direct( kmer, kmer, direct, 0, direct.size() ); } );
+			double fftTime = Time( 1, [&]() { Convolution::Fft( kmer, kmer, fft ); } );
+			double maxError = 0;
+
+			for ( size_t k = 0; k < direct.size(); k++ ) {
+				if ( direct[k] > 1e-300 ) {
+					maxError = std::max( maxError, fabs( fft[k] - direct[k] ) / direct[k] );
+				}
+			}
+
+			cout << ( 2 * m )
+				<< "\t" << direct.size()
+				<< "\t" << ( directTime * 1e3 )
+				<< "\t" << ( fftTime * 1e3 )
+				<< "\t" << maxError
+				<< "\n";
+
+			kmer = fft;
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Checks that packed nucleotide kmers which cover N or another ambiguity 
+	**		code are flagged unknown and left out of the kmer index, and that every
+	**		other kmer has the same code as it has in a sequence without ambiguity.
+	**	</summary>
+	*/
+	static void CheckUnknownNucleotides() {
+		const size_t K = 4, cpw = Alphabet::PackedDnaCharsPerWord;
+		const string sequence = "acgtNacgtacgRtacgtuu", clean = "acgtaacgtacgatacgtuu";
+		EncodedFastaSequence seq( "n", "", ">n", sequence, Alphabet::DNA(), K, cpw, Alphabet::DNA()->DefaultSymbol() );
+		EncodedFastaSequence ref( "c", "", ">c", clean, Alphabet::DNA(), K, cpw, Alphabet::DNA()->DefaultSymbol() );
+		EncodedFastaSequence *items[] = { &seq };
+		KmerIndex kmerIndex( items, 1, K );
+		size_t known = 0;
+
+		for ( size_t m = 0; m < seq.KmerCount( K ); m++ ) {
+			bool covers = sequence.find_first_of( "NR", m ) < m + K;
+
+			if ( seq.IsUnknownKmer( m, K ) != covers ) {
+				throw Exception( "Unknown nucleotide kmer flagged incorrectly.", FileAndLine );
+			}
+
+			if ( !covers ) {
+				known++;
+
+				if ( DnaDistance::Load( seq.GetEncodedKmer( m ) ) != DnaDistance::Load( ref.GetEncodedKmer( m ) ) ) {
+					throw Exception( "Known nucleotide kmer encoded incorrectly.", FileAndLine );
+				}
+			}
+		}
+
+		size_t indexed = 0;
+
+		for ( auto &p : kmerIndex ) {
+			indexed += p.second->Instances().size();
+		}
+
+		if ( indexed != known ) {
+			throw Exception( "Kmer index holds kmers which cover unknown nucleotides.", FileAndLine );
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Times a strand-independent nearest-prototype scan over packed 2-bit
+	**		nucleotide kmers, using the dispatched DnaDistance kernel on KmerWord
+	**		rows, and the loop of AAClustSigEncode::EncodeDna, which reverse 
+	**		complements each query once and streams a contiguous array of 64 
+	**		bit prototype codes.
+	**	</summary>
+	*/
+	static void NucleotideDistance( Params &parms ) {
+		Alphabet &alphabet = *Alphabet::DNA();
+		DnaDistance distanceFunction;
+		CheckUnknownNucleotides();
+		UniformIntRandom<int> rand( parms.seed, 0, alphabet.Size() - 1 );
+		FlatMatrix<KmerWord> queries, protos;
+		vector<uint> lengths{ 11, 16, 21, 32 };
+
+		cout << "K\tdna_dispatched_ns\tdna_packed_ns\tspeedup\n";
+
+		for ( uint K : lengths ) {
+			RandomKmers( alphabet, rand, parms.numKmers, K, distanceFunction.CharsPerWord(), queries );
+			RandomKmers( alphabet, rand, parms.numProtos, K, distanceFunction.CharsPerWord(), protos );
+
+			vector<uint64_t> protoCodes( parms.numProtos );
+
+			for ( uint p = 0; p < parms.numProtos; p++ ) {
+				protoCodes[p] = DnaDistance::Load( protos.row( p ) );
+			}
+
+			double ops = (double) parms.numKmers * parms.numProtos;
+			Distance checkDispatched = 0, checkPacked = 0;
+
+			double dispatched = Time( parms.reps, [&]() {
+				distanceFunction.Dispatch( K, [&]( auto kernel ) {
+					for ( uint q = 0; q < parms.numKmers; q++ ) {
+						Distance nearest = numeric_limits<Distance>::max();
+
+						for ( uint p = 0; p < parms.numProtos; p++ ) {
+							Distance d = kernel( queries.row( q ), protos.row( p ) );
+							if ( d < nearest ) nearest = d;
+						}
+
+						checkDispatched += nearest;
+					}
+				} );
+			} );
+
+			double packed = Time( parms.reps, [&]() {
+				const uint64_t *p = protoCodes.data();
+
+				for ( uint q = 0; q < parms.numKmers; q++ ) {
+					uint64_t fwd = DnaDistance::Load( queries.row( q ) );
+					uint64_t rev = DnaDistance::ReverseComplement( fwd, K );
+					Distance nearest = numeric_limits<Distance>::max();
+
+					for ( uint c = 0; c < parms.numProtos; c++ ) {
+						Distance d = std::min( DnaDistance::Mismatches( fwd, p[c] ), DnaDistance::Mismatches( rev, p[c] ) );
+						if ( d < nearest ) nearest = d;
+					}
+
+					checkPacked += nearest;
+				}
+			} );
+
+			if ( checkDispatched != checkPacked ) {
+				throw Exception( "Packed nucleotide scan disagrees with DnaDistance kernel.", FileAndLine );
+			}
+
+			cout << K
+				<< "\t" << ( dispatched * 1e9 / ops )
+				<< "\t" << ( packed * 1e9 / ops )
+				<< "\t" << ( dispatched / packed )
+				<< "\n";
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Times a nearest-prototype scan using the dispatched table kernel
+	**		and the residue lookup kernel of KmerShuffleDistance restricted 
+	**		to each instruction set in turn, for each kmer length in range.
+	**		Times are reported as 0 for instruction sets that this processor
+	**		does not support.
+	**	</summary>
+	*/
+	static void ResidueLookup( Params &parms, Alphabet &alphabet, KmerDistanceCache2 &distanceFunction ) {
+		using Isa = KmerShuffleDistance::InstructionSet;
+
+		UniformIntRandom<int> rand( parms.seed, 0, alphabet.Size() - 1 );
+		FlatMatrix<KmerWord> queries, protos, unpackedQueries, unpackedProtos;
+		vector<Isa> instructionSets{ Isa::None, Isa::Avx2, Isa::Avx512Vbmi };
+
+		cout << "K\ttable_ns\tscalar_ns\tavx2_ns\tavx512vbmi_ns\n";
+
+		for ( uint K = parms.minK; K <= parms.maxK; K++ ) {
+			RandomKmers( alphabet, rand, parms.numKmers, K, 1, unpackedQueries );
+			RandomKmers( alphabet, rand, parms.numProtos, K, 1, unpackedProtos );
+			Pack( alphabet, unpackedQueries, K, distanceFunction.CharsPerWord(), queries );
+			Pack( alphabet, unpackedProtos, K, distanceFunction.CharsPerWord(), protos );
+
+			KmerResidueBlocks blocks( K, parms.numProtos );
+
+			for ( uint p = 0; p < parms.numProtos; p++ ) {
+				blocks.Set( p, unpackedProtos.row( p ) );
+			}
+
+			vector<Distance> dist( blocks.PaddedCount() );
+			double ops = (double) parms.numKmers * parms.numProtos;
+			Distance checkTable = 0;
+
+			double table = Time( parms.reps, [&]() {
+				checkTable = 0;
+
+				distanceFunction.Dispatch( K, [&]( auto kernel ) {
+					for ( uint q = 0; q < parms.numKmers; q++ ) {
+						Distance nearest = numeric_limits<Distance>::max();
+
+						for ( uint p = 0; p < parms.numProtos; p++ ) {
+							Distance d = kernel( queries.row( q ), protos.row( p ) );
+							if ( d < nearest ) nearest = d;
+						}
+
+						checkTable += nearest;
+					}
+				} );
+			} );
+
+			cout << K << "\t" << ( table * 1e9 / ops );
+
+			for ( auto isa : instructionSets ) {
+				KmerShuffleDistance shuffleDistance( alphabet, distanceFunction, K, isa );
+
+				if ( shuffleDistance.GetInstructionSet() != isa ) {
+					cout << "\t" << 0;
+					continue;
+				}
+
+				Distance checkShuffle = 0;
+
+				double shuffle = Time( parms.reps, [&]() {
+					checkShuffle = 0;
+
+					for ( uint q = 0; q < parms.numKmers; q++ ) {
+						Distance nearest = numeric_limits<Distance>::max();
+						shuffleDistance.GetDistances( unpackedQueries.row( q ), blocks, dist.data() );
+
+						for ( uint p = 0; p < parms.numProtos; p++ ) {
+							if ( dist[p] < nearest ) nearest = dist[p];
+						}
+
+						checkShuffle += nearest;
+					}
+				} );
+
+				if ( checkTable != checkShuffle ) {
+					throw Exception( "Residue lookup kernel disagrees with table kernel.", FileAndLine );
+				}
+
+				cout << "\t" << ( shuffle * 1e9 / ops );
+			}
+
+			cout << "\n";
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Times a nearest-prototype scan with each of KmerDistanceCache1, 2
+	**		and 3, for each kmer length in range that is a multiple of the 
+	**		number of symbols per word, alongside the size of the tables and
+	**		the time taken to build them. Larger words mean fewer lookups per
+	**		kmer but a table which spills further out of cache.
+	**	</summary>
+	*/
+	static void TableFootprint( Params &parms, Alphabet &alphabet, RawKmerDistanceFunction &rawDistanceFunction ) {
+		vector<FastaSequence> seqs;
+
+		if ( parms.seqFile.size() > 0 ) {
+			FastaSequence::ReadSequences( parms.seqFile, 0, seqs );
+			cerr << arguments->ProgName() << ": " << seqs.size() << " sequences loaded from " << parms.seqFile << ".\n";
+		}
+
+		cout << "charsPerWord\ttable_bytes\tbuild_s\tK\tns\n";
+
+		for ( uint charsPerWord = 1; charsPerWord <= 3; charsPerWord++ ) {
+			double start = omp_get_wtime();
+
+			WithKmerDistanceCache( charsPerWord, &alphabet, &rawDistanceFunction, [&]( auto &distanceFunction ) {
+				double buildTime = omp_get_wtime() - start;
+				UniformIntRandom<int> rand( parms.seed, 0, alphabet.Size() - 1 );
+				FlatMatrix<KmerWord> queries, protos;
+
+				for ( uint K = parms.minK; K <= parms.maxK; K++ ) {
+					if ( K % charsPerWord != 0 ) continue;
+
+					SampleKmers( alphabet, seqs, rand, parms.numKmers, K, charsPerWord, queries );
+					SampleKmers( alphabet, seqs, rand, parms.numProtos, K, charsPerWord, protos );
+
+					double ops = (double) parms.numKmers * parms.numProtos;
+					Distance check = 0;
+
+					double elapsed = Time( parms.reps, [&]() {
+						distanceFunction.Dispatch( K, [&]( auto kernel ) {
+							for ( uint q = 0; q < parms.numKmers; q++ ) {
+								Distance nearest = numeric_limits<Distance>::max();
+
+								for ( uint p = 0; p < parms.numProtos; p++ ) {
+									Distance d = kernel( queries.row( q ), protos.row( p ) );
+									if ( d < nearest ) nearest = d;
+								}
+
+								check += nearest;
+							}
+						} );
+					} );
+
+					cout << charsPerWord
+						<< "\t" << distanceFunction.TableBytes()
+						<< "\t" << buildTime
+						<< "\t" << K
+						<< "\t" << ( elapsed * 1e9 / ops )
+						<< "\n";
+				}
+			} );
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Measures the recall and speed of the CharMap embedding prefilter 
+	**		in a nearest-prototype scan, at a range of bound scales. Recall
+	**		is reported two ways: the fraction of (kmer, prototype) pairs 
+	**		within threshold that survive the filter, and the fraction of
+	**		kmers whose nearest prototype within threshold is still found.
+	**		Scale 1 is lossless, so both recall figures should be 1.
+	**	</summary>
+	*/
+	static void EmbeddingPrefilter( Params &parms, Alphabet &alphabet, KmerDistanceCache2 &distanceFunction ) {
+		vector<FastaSequence> seqs;
+
+		if ( parms.seqFile.size() > 0 ) {
+			FastaSequence::ReadSequences( parms.seqFile, 0, seqs );
+		}
+
+		const uint K = parms.filterK;
+		const uint Q = parms.numKmers, P = parms.numProtos;
+		const uint charsPerWord = distanceFunction.CharsPerWord();
+
+		if ( K % charsPerWord != 0 ) return;
+
+		UniformIntRandom<int> rand( parms.seed, 0, alphabet.Size() - 1 );
+		FlatMatrix<KmerWord> unpackedQueries, unpackedProtos, queries, protos;
+		SampleKmers( alphabet, seqs, rand, Q, K, 1, unpackedQueries );
+		SampleKmers( alphabet, seqs, rand, P, K, 1, unpackedProtos );
+		Pack( alphabet, unpackedQueries, K, charsPerWord, queries );
+		Pack( alphabet, unpackedProtos, K, charsPerWord, protos );
+
+		// Exact distances and per-kmer nearest, for the recall calculation.
+		FlatMatrix<Distance> exact( Q, P );
+		vector<Distance> nearest( Q, numeric_limits<Distance>::max() );
+		size_t pairsWithin = 0;
+
+		distanceFunction.Dispatch( K, [&]( auto kernel ) {
+			for ( uint q = 0; q < Q; q++ ) {
+				for ( uint p = 0; p < P; p++ ) {
+					Distance d = kernel( queries.row( q ), protos.row( p ) );
+					exact( q, p ) = d;
+
+					if ( d <= parms.threshold ) {
+						pairsWithin++;
+						if ( d < nearest[q] ) nearest[q] = d;
+					}
+				}
+			}
+		} );
+
+		Distance check = 0;
+
+		double exactTime = Time( parms.reps, [&]() {
+			distanceFunction.Dispatch( K, [&]( auto kernel ) {
+				for ( uint q = 0; q < Q; q++ ) {
+					Distance best = numeric_limits<Distance>::max();
+
+					for ( uint p = 0; p < P; p++ ) {
+						Distance d = kernel( queries.row( q ), protos.row( p ) );
+						if ( d <= parms.threshold && d < best ) best = d;
+					}
+
+					check += best;
+				}
+			} );
+		} );
+
+		cout << "K\tthreshold\tscale\tpairs_within\tpruned_frac\tpair_recall\tnearest_recall\texact_ns\tfiltered_ns\n";
+
+		for ( double scale : { 1.0, 1.1, 1.2, 1.3, 1.5, 2.0 } ) {
+			KmerEmbeddingFilter filter( alphabet, distanceFunction, K, scale );
+			FlatMatrix<uint64_t> queryEmbedding( Q, K );
+			KmerEmbeddingBlocks protoEmbedding( K, P );
+			vector<uint64_t> embedding( K );
+			string symbols = alphabet.Symbols();
+			string kmer( K, ' ' );
+
+			for ( uint q = 0; q < Q; q++ ) {
+				for ( uint j = 0; j < K; j++ ) kmer[j] = symbols[unpackedQueries.row( q )[j]];
+				filter.EmbedQuery( kmer.c_str(), K, queryEmbedding.row( q ) );
+			}
+
+			for ( uint p = 0; p < P; p++ ) {
+				for ( uint j = 0; j < K; j++ ) kmer[j] = symbols[unpackedProtos.row( p )[j]];
+				filter.EmbedSubject( kmer.c_str(), K, embedding.data() );
+				protoEmbedding.Set( p, embedding.data() );
+			}
+
+			size_t pruned = 0, pairsKept = 0, nearestFound = 0, nearestWithin = 0;
+			vector<Distance> bounds( protoEmbedding.PaddedCount() );
+
+			double filteredTime = Time( parms.reps, [&]() {
+				pruned = pairsKept = nearestFound = nearestWithin = 0;
+
+				distanceFunction.Dispatch( K, [&]( auto kernel ) {
+					for ( uint q = 0; q < Q; q++ ) {
+						Distance best = numeric_limits<Distance>::max();
+
+						filter.GetLowerBounds( queryEmbedding.row( q ), protoEmbedding, bounds.data() );
+
+						for ( uint p = 0; p < P; p++ ) {
+							if ( bounds[p] > parms.threshold ) {
+								pruned++;
+								continue;
+							}
+
+							pairsKept += exact( q, p ) <= parms.threshold;
+
+							if ( bounds[p] >= best ) continue;
+
+							Distance d = kernel( queries.row( q ), protos.row( p ) );
+							if ( d <= parms.threshold && d < best ) best = d;
+						}
+
+						if ( nearest[q] <= parms.threshold ) {
+							nearestWithin++;
+							nearestFound += best == nearest[q];
+						}
+					}
+				} );
+			} );
+
+			double ops = (double) Q * P;
+
+			cout << K
+				<< "\t" << parms.threshold
+				<< "\t" << scale
+				<< "\t" << pairsWithin
+				<< "\t" << ( pruned / ops )
+				<< "\t" << ( pairsWithin ? (double) pairsKept / pairsWithin : 1.0 )
+				<< "\t" << ( nearestWithin ? (double) nearestFound / nearestWithin : 1.0 )
+				<< "\t" << ( exactTime * 1e9 / ops )
+				<< "\t" << ( filteredTime * 1e9 / ops )
+				<< "\n";
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Times the hot kernels of the clustering, encoding and ranking tools
+	**		over a sweep of sizes, writing one row per case in a fixed format
+	**		(see --help) so that results can be compared between builds. All
+	**		inputs are generated from the seed.
+	**	</summary>
+	*/
+	static void Kernels( Params &parms, Alphabet &alphabet, KmerDistanceCache2 &distanceFunction ) {
+		cout << "kernel\tparam\tsize\tops\tns_per_op\tops_per_s\twork\tchecksum\n";
+
+		KernelKmerDistance( parms, alphabet, distanceFunction );
+		KernelFindNearestCluster( parms, alphabet, distanceFunction );
+		KernelBitSetSimilarity( parms );
+		KernelIntegerDistributionAdd( parms );
+		KernelJaccard( parms );
+		KernelRankMerge( parms );
+	}
+
+	/**
+	**	<summary>
+	**		Writes a row of the kernels table.
+	**	</summary>
+	*/
+	static void Report( const char *kernel, size_t param, size_t size, size_t ops, double seconds, size_t work, double checksum ) {
+		auto precision = cout.precision();
+
+		cout << kernel
+			<< "\t" << param
+			<< "\t" << size
+			<< "\t" << ops
+			<< "\t" << ( seconds * 1e9 / ops )
+			<< "\t" << ( ops / seconds )
+			<< "\t" << work
+			<< "\t" << setprecision( 12 ) << checksum << setprecision( precision )
+			<< "\n";
+	}
+
+	/**
+	**	<summary>
+	**		KmerDistanceCache2::operator() in a nearest-prototype scan.
+	**	</summary>
+	*/
+	static void KernelKmerDistance( Params &parms, Alphabet &alphabet, KmerDistanceCache2 &distanceFunction ) {
+		const uint Q = 256;
+		UniformIntRandom<int> rand( parms.seed, 0, alphabet.Size() - 1 );
+		FlatMatrix<KmerWord> queries, protos;
+
+		for ( uint K : { 10, 20, 30 } ) {
+			for ( uint P : { 256, 1024, 4096 } ) {
+				RandomKmers( alphabet, rand, Q, K, distanceFunction.CharsPerWord(), queries );
+				RandomKmers( alphabet, rand, P, K, distanceFunction.CharsPerWord(), protos );
+
+				size_t ops = (size_t) Q * P;
+				Distance check = 0;
+
+				double elapsed = Time( parms.reps, [&]() {
+					check = 0;
+
+					for ( uint q = 0; q < Q; q++ ) {
+						Distance nearest = numeric_limits<Distance>::max();
+
+						for ( uint p = 0; p < P; p++ ) {
+							Distance d = distanceFunction( queries.row( q ), protos.row( p ), K );
+							if ( d < nearest ) nearest = d;
+						}
+
+						check += nearest;
+					}
+				} );
+
+				Report( "kmer_distance", K, P, ops, elapsed, ops * K, check );
+			}
+		}
+	}
+
+	/**
+	**	<summary>
+	**		KmerCodebook::FindNearestCluster with the plain scan, over a codebook
+	**		of random prototypes.
+	**	</summary>
+	*/
+	static void KernelFindNearestCluster( Params &parms, Alphabet &alphabet, KmerDistanceCache2 &distanceFunction ) {
+		using Codebook = KmerCodebook<KmerDistanceCache2, Kmer>;
+
+		const uint K = parms.filterK;
+		const uint Q = 256;
+		const uint charsPerWord = distanceFunction.CharsPerWord();
+		UniformIntRandom<int> rand( parms.seed, 0, alphabet.Size() - 1 );
+		string symbols = alphabet.Symbols();
+
+		auto randomSequence = [&]( uint length ) {
+			string residues( length, ' ' );
+
+			for ( auto &ch : residues ) {
+				ch = symbols[rand( 0, (int) symbols.size() - 1 )];
+			}
+
+			return residues;
+		};
+
+		PointerList<EncodedFastaSequence> querySeqs;
+		vector<Kmer *> queries;
+
+		for ( uint q = 0; q < Q; q++ ) {
+			auto seq = new EncodedFastaSequence( "", "", "", randomSequence( K ), &alphabet, K, charsPerWord, alphabet.DefaultSymbol() );
+			querySeqs.Add( [seq]() { return seq; } );
+			queries.push_back( new Kmer( seq, 0, K ) );
+		}
+
+		for ( uint P : { 256, 1024, 4096 } ) {
+			PointerList<EncodedFastaSequence> protos;
+			FILE *savedCodebook = tmpfile();
+
+			if ( !savedCodebook ) {
+				throw Exception( "Unable to create temporary codebook file.", FileAndLine );
+			}
+
+			fprintf( savedCodebook, "Clusters,%u\n", P );
+
+			for ( uint p = 0; p < P; p++ ) {
+				string id = "proto_" + std::to_string( p );
+				auto proto = new KmerClusterPrototype( id, "", "", randomSequence( K ), &alphabet, K, charsPerWord, alphabet.DefaultSymbol() );
+				protos.Add( [proto]() { return (EncodedFastaSequence *) proto; } );
+				fprintf( savedCodebook, "Cluster,0,%s:0\n", id.c_str() );
+			}
+
+			rewind( savedCodebook );
+
+			PointerList<EncodedFastaSequence> db;
+			EncodedFastaSequence::Index dbIndex( db.Items() );
+			EncodedFastaSequence::Index protoIndex( protos.Items() );
+			KmerIndex kmerIndex( db.Items(), K );
+			Codebook codebook( &alphabet, distanceFunction, charsPerWord, K, dbIndex, protoIndex, kmerIndex, savedCodebook );
+			fclose( savedCodebook );
+
+			Distance check = 0;
+
+			double elapsed = Time( parms.reps, [&]() {
+				check = 0;
+
+				for ( auto kmer : queries ) {
+					Distance dist;
+					codebook.FindNearestCluster( *kmer, dist );
+					check += dist;
+				}
+			} );
+
+			Report( "find_nearest_cluster", K, P, Q, elapsed, (size_t) Q * P, check );
+		}
+
+		for ( auto kmer : queries ) {
+			delete kmer;
+		}
+	}
+
+	/**
+	**	<summary>
+	**		BitSet::Similarity between all pairs of a set of random bit sets, each
+	**		with about 1/16 of its bits set.
+	**	</summary>
+	*/
+	static void KernelBitSetSimilarity( Params &parms ) {
+		const uint N = 64;
+
+		for ( uint bits : { 1024, 16384, 262144 } ) {
+			UniformIntRandom<int> rand( parms.seed, 0, bits - 1 );
+			vector<BitSet> sets( N, BitSet( bits ) );
+
+			for ( auto &set : sets ) {
+				for ( uint i = 0; i < bits / 16; i++ ) {
+					set.Insert( rand( 0, bits - 1 ) );
+				}
+			}
+
+			size_t ops = (size_t) N * N;
+			double check = 0;
+
+			double elapsed = Time( parms.reps, [&]() {
+				check = 0;
+
+				for ( auto &x : sets ) {
+					for ( auto &y : sets ) {
+						check += x.Similarity( y );
+					}
+				}
+			} );
+
+			Report( "bitset_similarity", bits, N, ops, elapsed, ops * ( ( bits + 63 ) / 64 ), check );
+		}
+	}
+
+	/**
+	**	<summary>
+	**		IntegerDistribution::Add of two random distributions with the same
+	**		support length, which spans the direct and FFT convolution paths. The
+	**		checksum is the sum of the means of the results.
+	**	</summary>
+	*/
+	static void KernelIntegerDistributionAdd( Params &parms ) {
+		UniformRealRandom rand( parms.seed );
+
+		for ( uint n : { 16, 64, 256, 1024, 4096, 16384 } ) {
+			vector<double> values( n );
+
+			for ( auto &v : values ) v = rand();
+
+			IntegerDistribution x( 0, n - 1, values );
+			uint calls = std::max<uint>( 1, ( 1u << 22 ) / ( n * n ) );
+			double check = 0;
+
+			double elapsed = Time( parms.reps, [&]() {
+				check = 0;
+
+				for ( uint i = 0; i < calls; i++ ) {
+					IntegerDistribution sum = x.Add( x );
+					double mean = 0;
+
+					for ( int t = sum.Min(); t <= sum.Max(); t++ ) {
+						mean += t * sum.P( t );
+					}
+
+					check += mean;
+				}
+			} );
+
+			Report( "integer_distribution_add", n, 1, calls, elapsed, (size_t) calls * ( 2 * n - 1 ), check );
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Generates n sparse signatures, each holding length distinct entries
+	**		drawn uniformly from the vocabulary, in ascending order.
+	**	</summary>
+	*/
+	static void RandomSignatures( UniformIntRandom<int> &rand, uint n, uint length, uint vocabulary, vector<vector<uint>> &signatures ) {
+		signatures.assign( n, vector<uint>() );
+
+		for ( auto &signature : signatures ) {
+			while ( signature.size() < length ) {
+				signature.push_back( rand( 0, vocabulary - 1 ) );
+				sort( signature.begin(), signature.end() );
+				signature.erase( unique( signature.begin(), signature.end() ), signature.end() );
+			}
+		}
+	}
+
+	/**
+	**	<summary>
+	**		SignatureRanking::Jaccard between all pairs of a set of random sparse
+	**		signatures drawn from a vocabulary of 16 times their length.
+	**	</summary>
+	*/
+	static void KernelJaccard( Params &parms ) {
+		const uint N = 256;
+		UniformIntRandom<int> rand( parms.seed, 0, 1 );
+		vector<vector<uint>> signatures;
+
+		for ( uint length : { 16, 64, 256, 1024 } ) {
+			RandomSignatures( rand, N, length, 16 * length, signatures );
+
+			size_t ops = (size_t) N * N;
+			double check = 0;
+
+			double elapsed = Time( parms.reps, [&]() {
+				check = 0;
+
+				for ( auto &x : signatures ) {
+					for ( auto &y : signatures ) {
+						check += SignatureRanking::Jaccard( x, y );
+					}
+				}
+			} );
+
+			Report( "jaccard", length, N, ops, elapsed, ops * 2 * length, check );
+		}
+	}
+
+	/**
+	**	<summary>
+	**		SignatureRanking::RankMerge, the inner loop of AAClustSig in merge
+	**		mode, for a set of queries against databases of increasing size.
+	**		Signatures hold 64 entries from a vocabulary of 4096, and the 100
+	**		nearest are kept. The checksum is the sum of the retained distances.
+	**	</summary>
+	*/
+	static void KernelRankMerge( Params &parms ) {
+		const uint Q = 64, length = 64, vocabulary = 4096, maxResults = 100;
+		UniformIntRandom<int> rand( parms.seed, 0, 1 );
+		vector<vector<uint>> queries, database;
+		RandomSignatures( rand, Q, length, vocabulary, queries );
+
+		for ( uint D : { 1024, 8192, 65536 } ) {
+			RandomSignatures( rand, D, length, vocabulary, database );
+
+			vector<vector<uint>> dbIndex( vocabulary );
+
+			for ( uint d = 0; d < D; d++ ) {
+				for ( uint c : database[d] ) {
+					dbIndex[c].push_back( d );
+				}
+			}
+
+			BitSet processed( D );
+			KnnVector<size_t, double> rankings( maxResults );
+			size_t scored = 0;
+			double check = 0;
+
+			double elapsed = Time( parms.reps, [&]() {
+				scored = 0;
+				check = 0;
+
+				for ( auto &query : queries ) {
+					scored += SignatureRanking::RankMerge( query, dbIndex, [&]( uint d ) -> const vector<uint> & {
+						return database[d];
+					}, processed, rankings );
+
+					for ( auto &ranking : rankings ) {
+						check += ranking.first;
+					}
+				}
+			} );
+
+			Report( "rank_merge", length, D, Q, elapsed, scored, check );
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Draws n kmers of length K uniformly from the sequences, or generates 
+	**		them at random if there are no sequences, packed charsPerWord symbols
+	**		to the word, one kmer per row.
+	**	</summary>
+	*/
+	static void SampleKmers( Alphabet &alphabet, vector<FastaSequence> &seqs, UniformIntRandom<int> &rand, uint n, uint K, uint charsPerWord, FlatMatrix<KmerWord> &kmers ) {
+		vector<const FastaSequence *> eligible;
+
+		for ( auto &seq : seqs ) {
+			if ( seq.Sequence().size() >= K ) eligible.push_back( &seq );
+		}
+
+		if ( eligible.size() == 0 ) {
+			RandomKmers( alphabet, rand, n, K, charsPerWord, kmers );
+			return;
+		}
+
+		kmers.resize( n, Alphabet::WordsPerKmer( K, charsPerWord ) );
+
+		for ( uint i = 0; i < n; i++ ) {
+			const string &s = eligible[rand( 0, (int) eligible.size() - 1 )]->Sequence();
+			uint pos = rand( 0, (int) ( s.size() - K ) );
+			alphabet.Encode( s.c_str() + pos, K, charsPerWord, kmers.row( i ) );
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Re-encodes kmers held one symbol per word, packing charsPerWord 
+	**		symbols to the word.
+	**	</summary>
+	*/
+	static void Pack( Alphabet &alphabet, FlatMatrix<KmerWord> &unpacked, uint K, uint charsPerWord, FlatMatrix<KmerWord> &packed ) {
+		string symbols = alphabet.Symbols();
+		string kmer( K, ' ' );
+		packed.resize( unpacked.rows(), Alphabet::WordsPerKmer( K, charsPerWord ) );
+
+		for ( size_t i = 0; i < unpacked.rows(); i++ ) {
+			for ( uint j = 0; j < K; j++ ) {
+				kmer[j] = symbols[unpacked.row( i )[j]];
+			}
+
+			alphabet.Encode( kmer.c_str(), K, charsPerWord, packed.row( i ) );
+		}
+	}
+
+	/**
+	**	<summary>
+	**		Runs the action the designated number of times and returns the 
+	**		shortest elapsed time, in seconds.
+	**	</summary>
+	*/
+	static double Time( uint reps, Action action ) {
+		double best = numeric_limits<double>::max();
+
+		for ( uint i = 0; i < reps; i++ ) {
+			double start = omp_get_wtime();
+			action();
+			double elapsed = omp_get_wtime() - start;
+			if ( elapsed < best ) best = elapsed;
+		}
+
+		return best;
+	}
+};
+
+mutex QutBio::DistanceType::m;
+
+int main( int argc, char *argv[] ) {
+	try {
+		Args args( argc, argv );
+
+		arguments = &args;
+		ProfileSession profile( args );
+
+		return Benchmark::Run();
+	}
+	catch ( Exception ex ) {
+		cerr << ex.File() << "(" << ex.Line() << "): " << ex.what() << "\n";
+		return 1;
+	}
+}
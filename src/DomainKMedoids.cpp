@@ -34,7 +34,9 @@
 #include <Domain.hpp>
 #include <FastaSequence.hpp>
 #include <KmerCodebook.hpp>
-#include <OmpTimer.h>
+#include <Profiler.hpp>
+#include <MemoryAccount.hpp>
+#include <MappedFile.hpp>
 #include <Exception.hpp>
 #include <FileUtil.hpp>
 #include <KMedoids.hpp>
@@ -44,94 +46,122 @@ using namespace std;
 
 namespace AdHoc {
 	struct DomainKMedoids {
-		using DistanceFunction = KmerDistanceCache2;
-		using KM = KMedoids<DistanceFunction, Kmer>;
-		using Cluster = KM::Cluster;
-		using SortMode = KM::SortMode;
-		using SelectMode = KM::SelectMode;
-		using MedoidMode = KM::MedoidMode;
-
 		static void Run( int argc, char** argv ) {
 			Args args( argc, argv );
+			ProfileSession profile( args );
+			MemorySession memory( args );
 			Params parms( args );
 			Alphabet alphabet( parms.matrix );
 			BlosumDifferenceFunction rawDist( parms.matrix );
-			DistanceFunction distance( &alphabet, &rawDist );
 
-			omp_set_num_threads( parms.numThreads );
+			if ( MemoryAccount::Budget() > 0 ) {
+				FastaFileStats data = FastaFileStats::Scan( parms.db );
+				size_t domainBytes = MappedFile( parms.domains ).Size();
+
+				auto estimate = [&]( uint charsPerWord ) {
+					size_t sequenceBytes, encodingBytes;
+					EncodedFastaSequence::Estimate( data, parms.kmerLength, charsPerWord, sequenceBytes, encodingBytes );
 
-			map<string, Domain> domains;
-			LoadDomains( parms.domains, domains );
+					// The domains partitioned at any one time index at most 
+					// every kmer of the database.
+					size_t partitionBytes = KmerIndex::Estimate( data.residues )
+						+ data.residues * ( sizeof( EncodedKmer ) + sizeof( unsigned long ) + sizeof( uint ) );
 
-			PointerList<EncodedFastaSequence> db;
-			LoadSequences( parms.db, parms.idIndex, parms.classIndex, db, parms.isCaseSensitive );
-			EncodedFastaSequence::Index dbIdx( db.Items() );
+					return sequenceBytes + encodingBytes + partitionBytes + domainBytes
+						+ KmerDistanceCache::EstimateTableBytes( alphabet.Size(), charsPerWord );
+				};
 
-			vector<const Domain*> domainList;
-			for ( auto & p : domains ) {
-				if ( parms.wantedDomains.size() == 0 || parms.wantedDomains.find( p.second.pfamId ) != parms.wantedDomains.end() ) {
-					domainList.push_back( &( p.second ) );
+				uint fit = FitCharsPerWord( parms.charsPerWord, parms.kmerLength, estimate );
+
+				if ( fit == 0 ) {
+					MemoryAccount::Require( "Partitioning the domains of " + parms.db, estimate( 1 ) );
+				}
+				else if ( fit != parms.charsPerWord ) {
+					cerr << "DomainKMedoids: using charsPerWord " << fit << " rather than " << parms.charsPerWord << " to fit the memory budget.\n";
+					parms.charsPerWord = fit;
 				}
 			}
 
+			WithKmerDistanceCache( parms.charsPerWord, &alphabet, &rawDist, [&]( auto & distance ) {
+				using DistanceFunction = typename std::remove_reference<decltype( distance )>::type;
+				using KM = KMedoids<DistanceFunction, Kmer>;
+				using Cluster = typename KM::Cluster;
+
+				omp_set_num_threads( parms.numThreads );
+
+				map<string, Domain> domains;
+				LoadDomains( parms.domains, domains );
+
+				PointerList<EncodedFastaSequence> db;
+				LoadSequences( parms.db, parms.idIndex, parms.classIndex, db, parms.isCaseSensitive, distance.CharsPerWord() );
+				EncodedFastaSequence::Index dbIdx( db.Items() );
+
+				vector<const Domain*> domainList;
+				for ( auto & p : domains ) {
+					if ( parms.wantedDomains.size() == 0 || parms.wantedDomains.find( p.second.pfamId ) != parms.wantedDomains.end() ) {
+						domainList.push_back( &( p.second ) );
+					}
+				}
+
 //			cerr << "domainList.size() = " << domainList.size() << "\n";
 
-			ofstream protoFile( parms.protos );
-			ofstream clusterFile( parms.clusters );
-			uint clusterCount = 0;
+				ofstream protoFile( parms.protos );
+				ofstream clusterFile( parms.clusters );
+				uint clusterCount = 0;
 
 #pragma omp parallel for schedule(dynamic)
-			for ( uint i = 0; i < domainList.size(); i++ ) {
-				auto dom = domainList[i];
-				vector<Subsequence> domainInstances;
-				dom->GetInstances( domainInstances, dbIdx );
+				for ( uint i = 0; i < domainList.size(); i++ ) {
+					auto dom = domainList[i];
+					vector<Subsequence> domainInstances;
+					dom->GetInstances( domainInstances, dbIdx );
 
 //#pragma omp critical
 //				{
 //					cerr << dom->pfamId << ": domainInstances.size() = " << domainInstances.size() << "\n";
 //				}
 
-				if ( domainInstances.size() == 0 ) continue;
+					if ( domainInstances.size() == 0 ) continue;
 
-				vector<Kmer *> clusterProtos;
-				vector<Cluster *> clusters;
+					vector<Kmer *> clusterProtos;
+					vector<Cluster *> clusters;
 
-				KM::Partition( domainInstances, clusterProtos, clusters, parms.kmerLength, parms.threshold, parms.seed, alphabet, distance );
+					KM::Partition( domainInstances, clusterProtos, clusters, parms.kmerLength, parms.threshold, parms.seed, alphabet, distance );
 
 #pragma omp critical
-				{
-					// cerr << dom->pfamId << ": clusters.size() = " << clusters.size() << "\n";
-					for ( uint i = 0; i < clusters.size(); i++ ) {
-						Cluster *c = clusters[i];
-						Kmer * p = clusterProtos[i];
-
-						// Yuck. KmerClusterPrototype is not thread-safe!!!
-						string id = "proto_" + std::to_string( clusterCount++ );
-						string defline = id + "|" + dom->pfamId + "|size=" + std::to_string( c->Size() );
-						EncodedFastaSequence seq( id, "", defline, p->Word(), &alphabet, parms.kmerLength, distance.CharsPerWord(), alphabet.DefaultSymbol() );
-						Kmer newProto( &seq, 0, parms.kmerLength );
-						c->prototype = newProto;
-
-						( protoFile << seq ).flush();
-						( clusterFile << ( *c ) ).flush();
-
-						delete c;
-						delete p;
+					{
+						// cerr << dom->pfamId << ": clusters.size() = " << clusters.size() << "\n";
+						for ( uint i = 0; i < clusters.size(); i++ ) {
+							Cluster *c = clusters[i];
+							Kmer * p = clusterProtos[i];
+
+							// Yuck. KmerClusterPrototype is not thread-safe!!!
+							string id = "proto_" + std::to_string( clusterCount++ );
+							string defline = id + "|" + dom->pfamId + "|size=" + std::to_string( c->Size() );
+							EncodedFastaSequence seq( id, "", defline, p->Word(), &alphabet, parms.kmerLength, distance.CharsPerWord(), alphabet.DefaultSymbol() );
+							Kmer newProto( &seq, 0, parms.kmerLength );
+							c->prototype = newProto;
+
+							( protoFile << seq ).flush();
+							( clusterFile << ( *c ) ).flush();
+
+							delete c;
+							delete p;
+						}
 					}
 				}
-			}
+			} );
 		}
 
 		static void LoadDomains( const string & domFileName, map<string, Domain> & domains ) {
-			OMP_TIMER_DECLARE( domLoad );
-			OMP_TIMER_START( domLoad );
+			ProfileRegion domLoad( "domLoad" );
+			domLoad.Start();
 
 			ifstream domFile( domFileName );
 			Domain::Load( domFile, domains );
 			domFile.close();
 
-			OMP_TIMER_END( domLoad );
-			cerr << domains.size() << " domains loaded from " << domFileName << " in " << OMP_TIMER( domLoad ) << "s\n";
+			domLoad.Stop();
+			cerr << domains.size() << " domains loaded from " << domFileName << " in " << domLoad.Elapsed() << "s\n";
 		}
 
 		static void LoadSequences(
@@ -139,20 +169,21 @@ namespace AdHoc {
 			int idIndex,
 			int classIndex,
 			PointerList<EncodedFastaSequence> & seqs,
-			bool isCaseSensitive
+			bool isCaseSensitive,
+			uint charsPerWord
 			//
 		) {
-			OMP_TIMER_DECLARE( load );
-			OMP_TIMER_START( load );
-			EncodedFastaSequence::ReadSequences( seqs, fileName, idIndex, classIndex, Alphabet::AA(), 30 );
+			ProfileRegion load( "load" );
+			load.Start();
+			EncodedFastaSequence::ReadSequences( seqs, fileName, idIndex, classIndex, Alphabet::AA(), 30, charsPerWord );
 
 			if ( !isCaseSensitive ) {
 				for ( auto seq : seqs ) {
 					String::ToLowerInPlace( seq->Sequence() );
 				}
 			}
-			OMP_TIMER_END( load );
-			cerr << seqs.Length() << " sequences loaded from " << fileName << " in " << OMP_TIMER( load ) << "s\n";
+			load.Stop();
+			cerr << seqs.Length() << " sequences loaded from " << fileName << " in " << load.Elapsed() << "s\n";
 		}
 
 		struct Params {
@@ -163,6 +194,7 @@ namespace AdHoc {
 			bool isCaseSensitive;
 			Distance threshold;
 			int numThreads;
+			uint charsPerWord = 2;
 			unordered_set<string> wantedDomains;
 
 			Params( Args & args ) {
@@ -215,6 +247,11 @@ namespace AdHoc {
 
 				args.Get( "wantedDomains", wantedDomains );
 
+				if ( args.IsDefined( "charsPerWord" ) && ( !args.Get( "charsPerWord", charsPerWord ) || charsPerWord < 1 || charsPerWord > 3 ) ) {
+					cerr << "Argument 'charsPerWord' must be 1, 2 or 3.\n";
+					ok = false;
+				}
+
 				string matrixError;
 
 				if ( !args.Get( matrix, matrixError ) ) {
@@ -0,0 +1,721 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18),
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published
+// by the Free Software Foundation; either version 3, or (at your
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+
+/*
+ *	Generates a synthetic protein database with planted homolog families,
+ *	written as a FASTA file and a homologs (qrels) file in the format read by
+ *	AAClustSweep, SplitFastaHomologs and trec_eval_tc_compact.
+ *
+ *	A pool of ancestral domains is drawn from the background composition. Each
+ *	family has an architecture of one or more domains from the pool, separated
+ *	by random linkers, and an ancestor in which each domain copy has itself
+ *	diverged from the pool. Members of the family evolve independently from the
+ *	ancestor by substitution under a similarity matrix, by insertion and
+ *	deletion, and occasionally by permutation of the domain order. Because
+ *	families draw domains from a shared pool, domains recur in unrelated
+ *	architectures, as they do in real proteins.
+ *
+ *	Every family is generated from its own counter-based random stream, so the
+ *	output depends only on the seed and the dataset parameters, not on the
+ *	number of threads. Memory use is proportional to the number of families,
+ *	so the database can be much larger than physical memory.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+#include <Args.hpp>
+#include <Exception.hpp>
+#include <HBRandom.hpp>
+#include <MemoryAccount.hpp>
+#include <Profiler.hpp>
+#include <SimilarityMatrix.hpp>
+
+using namespace std;
+using namespace QutBio;
+
+mutex QutBio::DistanceType::m;
+
+struct GenerateSyntheticDataset {
+	struct Params;
+
+	/// <summary>Random variates drawn from a counter-based stream.</summary>
+	struct Random : CounterRandom {
+		Random( uint64_t seed, uint64_t stream ) : CounterRandom( seed, stream ) {}
+
+		/// <summary>Gets a uniform integer in [0, n).</summary>
+		size_t Below( size_t n ) {
+			return std::min( (size_t) ( ( *this )( ) * n ), n - 1 );
+		}
+
+		/// <summary>Gets a standard normal variate by the Box-Muller method.</summary>
+		double Normal() {
+			double u = 1 - ( *this )( );
+			double v = ( *this )( );
+			return sqrt( -2 * log( u ) ) * cos( 2 * M_PI * v );
+		}
+
+		/// <summary>Gets the number of failures before the first success, with the designated mean.</summary>
+		size_t Geometric( double mean ) {
+			if ( mean <= 0 ) return 0;
+			double u = 1 - ( *this )( );
+			return (size_t) floor( log( u ) / log( mean / ( 1 + mean ) ) );
+		}
+	};
+
+	/**
+	 *	<summary>
+	 *	The substitution model: background residue frequencies, and for each
+	 *	residue a, the distribution of replacements b != a, in which P(b|a) is
+	 *	proportional to p_b exp(lambda s(a,b)), lambda being the Karlin-Altschul
+	 *	scale of the similarity matrix under the background.
+	 *	</summary>
+	 */
+	struct Substitution {
+		string residues;
+		vector<double> background;
+		vector<vector<double>> replace;
+		double lambda = 0;
+
+		Substitution( const SimilarityMatrix & matrix ) {
+			// Robinson & Robinson (1991) amino acid frequencies, as used by BLAST.
+			const string aa = "ARNDCQEGHILKMFPSTWYV";
+			const double rr[] = {
+				78.05, 51.29, 44.87, 53.64, 19.25, 42.64, 62.95, 73.77, 21.99, 51.42,
+				90.19, 57.44, 22.43, 38.56, 52.03, 71.20, 58.41, 13.30, 32.16, 64.41
+			};
+
+			for ( char c : matrix.Symbols() ) {
+				char upper = (char) toupper( c );
+				size_t pos = aa.find( upper );
+
+				if ( pos != string::npos && residues.find( upper ) == string::npos ) {
+					residues += upper;
+					background.push_back( rr[pos] );
+				}
+			}
+
+			// Not a protein matrix: use every symbol apart from the stop, uniformly.
+			if ( residues.size() < 2 ) {
+				residues.clear();
+				background.clear();
+
+				for ( char c : matrix.Symbols() ) {
+					if ( c != '*' ) {
+						residues += c;
+						background.push_back( 1 );
+					}
+				}
+			}
+
+			if ( residues.size() < 2 ) {
+				throw Exception( "Similarity matrix must define at least two residues.", FileAndLine );
+			}
+
+			Normalise( background );
+
+			const size_t n = residues.size();
+			// The scores as published: Similarity replaces every 0 with the matrix minimum.
+			auto score = [&]( size_t i, size_t j ) { return (double) matrix.RawSimilarity( residues[i], residues[j] ); };
+			auto f = [&]( double lambda ) {
+				double sum = 0;
+
+				for ( size_t i = 0; i < n; i++ ) {
+					for ( size_t j = 0; j < n; j++ ) {
+						sum += background[i] * background[j] * exp( lambda * score( i, j ) );
+					}
+				}
+
+				return sum - 1;
+			};
+
+			double expected = 0;
+
+			for ( size_t i = 0; i < n; i++ ) {
+				for ( size_t j = 0; j < n; j++ ) {
+					expected += background[i] * background[j] * score( i, j );
+				}
+			}
+
+			if ( expected >= 0 ) {
+				throw Exception( "Expected similarity score must be negative to derive substitution probabilities.", FileAndLine );
+			}
+
+			// f is convex with f(0) = 0 and f'(0) < 0, so the positive root is bracketed once f(hi) > 0.
+			double lo = 0, hi = 0.125;
+
+			while ( f( hi ) <= 0 ) hi *= 2;
+
+			for ( int i = 0; i < 100; i++ ) {
+				double mid = ( lo + hi ) / 2;
+				( f( mid ) > 0 ? hi : lo ) = mid;
+			}
+
+			lambda = ( lo + hi ) / 2;
+			replace.resize( n );
+
+			for ( size_t i = 0; i < n; i++ ) {
+				for ( size_t j = 0; j < n; j++ ) {
+					replace[i].push_back( i == j ? 0 : background[j] * exp( lambda * score( i, j ) ) );
+				}
+
+				Normalise( replace[i] );
+			}
+		}
+
+		static void Normalise( vector<double> & p ) {
+			double sum = 0;
+
+			for ( auto x : p ) sum += x;
+
+			for ( auto & x : p ) x /= sum;
+		}
+
+		static size_t Sample( const vector<double> & p, double u ) {
+			size_t last = p.size() - 1;
+
+			for ( size_t i = 0; i < last; i++ ) {
+				if ( u < p[i] ) return i;
+				u -= p[i];
+			}
+
+			return last;
+		}
+
+		/// <summary>Gets the index of a residue drawn from the background.</summary>
+		size_t Background( Random & rand ) const {
+			return Sample( background, rand() );
+		}
+
+		/// <summary>Gets the index of a residue which replaces residue a.</summary>
+		size_t Replace( size_t a, Random & rand ) const {
+			return Sample( replace[a], rand() );
+		}
+
+		void AppendRandom( string & s, size_t length, Random & rand ) const {
+			for ( size_t i = 0; i < length; i++ ) {
+				s += residues[Background( rand )];
+			}
+		}
+
+		/**
+		 *	<summary>
+		 *	Appends a descendant of the designated ancestor: each residue is
+		 *	substituted with probability mutationRate; and an indel event
+		 *	occurs at each position with probability indelRate, equally likely
+		 *	to delete or insert a run of residues of geometric length.
+		 *	</summary>
+		 */
+		void AppendDescendant(
+			string & s,
+			const string & ancestor,
+			double mutationRate,
+			double indelRate,
+			Random & rand
+		) const {
+			for ( size_t i = 0; i < ancestor.size(); i++ ) {
+				if ( rand() < indelRate ) {
+					size_t length = 1 + rand.Geometric( MeanIndelLength - 1 );
+
+					if ( rand() < 0.5 ) {
+						i += length - 1;
+						continue;
+					}
+
+					AppendRandom( s, length, rand );
+				}
+
+				size_t a = residues.find( ancestor[i] );
+				s += rand() < mutationRate ? residues[Replace( a, rand )] : ancestor[i];
+			}
+		}
+	};
+
+	/// <summary>The mean length of an inserted or deleted run.</summary>
+	static constexpr double MeanIndelLength = 2;
+
+	/// <summary>The shortest domain generated.</summary>
+	static constexpr size_t MinDomainLength = 10;
+
+	/// <summary>The number of families generated by each parallel pass before they are written.</summary>
+	static constexpr size_t BatchSize = 1024;
+
+	/// <summary>Random stream used for the architecture, ancestor and members of family f.</summary>
+	static uint64_t FamilyStream( size_t f ) {
+		return 2 * (uint64_t) f;
+	}
+
+	/// <summary>Random stream used for the pool sequence of domain d.</summary>
+	static uint64_t DomainStream( size_t d ) {
+		return 2 * (uint64_t) d + 1;
+	}
+
+	static void Run( int argc, char** argv ) {
+		Args args( argc, argv );
+		ProfileSession profile( args );
+		MemorySession memory( args );
+		Params parms( args );
+		omp_set_num_threads( (int) parms.numThreads );
+
+		MemoryAccount::Require( "Generating " + to_string( parms.sequences ) + " sequences", EstimateBytes( parms ) );
+
+		Substitution model( *parms.matrix );
+		cerr << args.ProgName() << ": " << model.residues.size() << " residues, lambda = " << model.lambda << ".\n";
+
+		// Pass 1: the domain architecture of every family, and the families in which each domain occurs.
+		vector<size_t> archStart( parms.families + 1 );
+		vector<size_t> archDomains;
+		vector<size_t> domainStart( parms.domains + 1 );
+		vector<size_t> domainFamilies;
+
+		{
+			PROFILE_SCOPE( "architectures" );
+			vector<size_t> arch;
+
+			for ( size_t f = 0; f < parms.families; f++ ) {
+				Random rand( parms.seed, FamilyStream( f ) );
+				Architecture( parms, rand, arch );
+				archStart[f] = archDomains.size();
+				archDomains.insert( archDomains.end(), arch.begin(), arch.end() );
+
+				for ( auto d : arch ) domainStart[d + 1]++;
+			}
+
+			archStart[parms.families] = archDomains.size();
+
+			for ( size_t d = 0; d < parms.domains; d++ ) {
+				domainStart[d + 1] += domainStart[d];
+			}
+
+			domainFamilies.resize( archDomains.size() );
+			vector<size_t> next( domainStart.begin(), domainStart.end() - 1 );
+
+			for ( size_t f = 0; f < parms.families; f++ ) {
+				for ( size_t i = archStart[f]; i < archStart[f + 1]; i++ ) {
+					domainFamilies[next[archDomains[i]]++] = f;
+				}
+			}
+		}
+
+		FILE * fasta = fopen( parms.fastaFile.c_str(), "wb" );
+		FILE * homologs = fopen( parms.homologsFile.c_str(), "wb" );
+
+		if ( !fasta || !homologs ) {
+			cerr << args.ProgName() << ": unable to open '" << ( fasta ? parms.homologsFile : parms.fastaFile ) << "' for writing.\n";
+			throw Exception( "Unable to create output files.", FileAndLine );
+		}
+
+		// Pass 2: the sequences and homolog lists, a batch of families at a time.
+		vector<string> fastaText( BatchSize ), homologText( BatchSize );
+		size_t residues = 0;
+
+		for ( size_t batch = 0; batch < parms.families; batch += BatchSize ) {
+			size_t count = std::min( (size_t) BatchSize, parms.families - batch );
+
+			{
+				PROFILE_SCOPE( "generate" );
+#pragma omp parallel for schedule(dynamic) reduction(+:residues)
+				for ( size_t i = 0; i < count; i++ ) {
+					residues += Family( parms, model, batch + i, archStart, archDomains, domainStart, domainFamilies, fastaText[i], homologText[i] );
+				}
+			}
+
+			PROFILE_SCOPE( "write" );
+
+			for ( size_t i = 0; i < count; i++ ) {
+				fwrite( fastaText[i].data(), 1, fastaText[i].size(), fasta );
+				fwrite( homologText[i].data(), 1, homologText[i].size(), homologs );
+			}
+		}
+
+		bool ok = fclose( fasta ) == 0;
+		ok = fclose( homologs ) == 0 && ok;
+
+		if ( !ok ) {
+			throw Exception( "Error writing output files.", FileAndLine );
+		}
+
+		cerr << args.ProgName() << ": " << parms.sequences << " sequences (" << residues << " residues) in "
+			<< parms.families << " families written to " << parms.fastaFile << ".\n";
+	}
+
+	/**
+	 *	<summary>
+	 *	Estimates the bytes needed to generate the dataset: the architecture 
+	 *	tables, which hold at most maxDomains entries per family, and the text 
+	 *	of one batch of families, at the expected sequence length and number of
+	 *	homologs. Strings grow by doubling, so the text is counted twice.
+	 *	</summary>
+	 */
+	static size_t EstimateBytes( const Params & parms ) {
+		size_t tableBytes = ( parms.families + parms.domains + 2 + 2 * parms.families * parms.maxDomains ) * sizeof( size_t );
+
+		double meanDomains = ( 1 + std::min( parms.maxDomains, parms.domains ) ) / 2.0;
+		double meanLength = meanDomains * parms.domainLength + ( meanDomains + 1 ) * parms.linkerLength;
+		double relatedFamilies = parms.homologyByDomain
+			? std::min( (double) parms.families, 1 + meanDomains * meanDomains * parms.families / parms.domains )
+			: 1;
+
+		size_t members = parms.sequences / parms.families + 1;
+		size_t idBytes = to_string( parms.sequences ).size() + 2;
+		double fastaBytes = 64 + 6 * meanDomains + meanLength * 61 / 60;
+		double homologBytes = ( relatedFamilies * members + 1 ) * idBytes;
+		double batchBytes = 2 * (double) std::min( (size_t) BatchSize, parms.families ) * members * ( fastaBytes + homologBytes );
+
+		return tableBytes + (size_t) batchBytes;
+	}
+
+	/// <summary>Draws the domains of a family, without repeats, from the pool.</summary>
+	static void Architecture( const Params & parms, Random & rand, vector<size_t> & arch ) {
+		size_t k = 1 + rand.Below( std::min( parms.maxDomains, parms.domains ) );
+		arch.clear();
+
+		while ( arch.size() < k ) {
+			size_t d = rand.Below( parms.domains );
+
+			if ( find( arch.begin(), arch.end(), d ) == arch.end() ) {
+				arch.push_back( d );
+			}
+		}
+	}
+
+	/// <summary>Regenerates the pool sequence of domain d, with lognormal length.</summary>
+	static string PoolDomain( const Params & parms, const Substitution & model, size_t d ) {
+		Random rand( parms.seed, DomainStream( d ) );
+		double cv = parms.domainLengthSd / parms.domainLength;
+		double sigma = sqrt( log( 1 + cv * cv ) );
+		double mu = log( parms.domainLength ) - sigma * sigma / 2;
+		size_t length = std::max( (size_t) MinDomainLength, (size_t) round( exp( mu + sigma * rand.Normal() ) ) );
+		string s;
+		model.AppendRandom( s, length, rand );
+		return s;
+	}
+
+	/// <summary>Gets the id of the first member of family f; families take consecutive ids.</summary>
+	static size_t FirstMember( const Params & parms, size_t f ) {
+		size_t size = parms.sequences / parms.families, extra = parms.sequences % parms.families;
+		return f * size + std::min( f, extra );
+	}
+
+	/**
+	 *	<summary>
+	 *	Generates the FASTA records and homologs lines of the members of family f.
+	 *	</summary>
+	 *	<returns>The number of residues generated.</returns>
+	 */
+	static size_t Family(
+		const Params & parms,
+		const Substitution & model,
+		size_t f,
+		const vector<size_t> & archStart,
+		const vector<size_t> & archDomains,
+		const vector<size_t> & domainStart,
+		const vector<size_t> & domainFamilies,
+		string & fastaText,
+		string & homologText
+	) {
+		Random rand( parms.seed, FamilyStream( f ) );
+		vector<size_t> arch;
+		Architecture( parms, rand, arch );
+
+		// The ancestor: linker, domain, linker, ..., domain, linker.
+		vector<string> domains, linkers( arch.size() + 1 );
+
+		for ( auto d : arch ) {
+			string s;
+			model.AppendDescendant( s, PoolDomain( parms, model, d ), parms.mutationRate, parms.indelRate, rand );
+			domains.push_back( s );
+		}
+
+		for ( auto & linker : linkers ) {
+			model.AppendRandom( linker, rand.Geometric( parms.linkerLength ), rand );
+		}
+
+		// Homologs are the members of this family or, by domain, of every family which shares a domain with it.
+		vector<size_t> related{ f };
+
+		if ( parms.homologyByDomain ) {
+			for ( size_t i = archStart[f]; i < archStart[f + 1]; i++ ) {
+				size_t d = archDomains[i];
+				related.insert( related.end(), domainFamilies.begin() + domainStart[d], domainFamilies.begin() + domainStart[d + 1] );
+			}
+
+			sort( related.begin(), related.end() );
+			related.erase( unique( related.begin(), related.end() ), related.end() );
+		}
+
+		string relatedIds;
+
+		for ( auto g : related ) {
+			for ( size_t id = FirstMember( parms, g ); id < FirstMember( parms, g + 1 ); id++ ) {
+				relatedIds += " S" + to_string( id + 1 );
+			}
+		}
+
+		vector<size_t> sortedArch( arch );
+		sort( sortedArch.begin(), sortedArch.end() );
+		string labels;
+
+		for ( auto d : sortedArch ) {
+			labels += ( labels.empty() ? "D" : ";D" ) + to_string( d + 1 );
+		}
+
+		fastaText.clear();
+		homologText.clear();
+		size_t residues = 0;
+		vector<size_t> order( arch.size() );
+
+		for ( size_t id = FirstMember( parms, f ); id < FirstMember( parms, f + 1 ); id++ ) {
+			for ( size_t i = 0; i < order.size(); i++ ) order[i] = i;
+
+			if ( order.size() > 1 && rand() < parms.shuffleRate ) {
+				for ( size_t i = order.size() - 1; i > 0; i-- ) {
+					swap( order[i], order[rand.Below( i + 1 )] );
+				}
+			}
+
+			string seq;
+
+			for ( size_t i = 0; i < order.size(); i++ ) {
+				model.AppendDescendant( seq, linkers[i], parms.mutationRate, parms.indelRate, rand );
+				model.AppendDescendant( seq, domains[order[i]], parms.mutationRate, parms.indelRate, rand );
+			}
+
+			model.AppendDescendant( seq, linkers.back(), parms.mutationRate, parms.indelRate, rand );
+
+			if ( seq.empty() ) {
+				model.AppendRandom( seq, 1, rand );
+			}
+
+			string seqId = "S" + to_string( id + 1 );
+			fastaText += ">syn|" + seqId + "|F" + to_string( f + 1 ) + "|" + labels + "|synthetic family " + to_string( f + 1 ) + "\n";
+
+			for ( size_t i = 0; i < seq.size(); i += 60 ) {
+				fastaText.append( seq, i, 60 );
+				fastaText += '\n';
+			}
+
+			homologText += seqId + relatedIds + "\n";
+			residues += seq.size();
+		}
+
+		return residues;
+	}
+
+	struct Params {
+		bool ok = true;
+		string fastaFile, homologsFile;
+		size_t sequences = 10000;
+		size_t families = 0;
+		size_t domains = 0;
+		size_t maxDomains = 3;
+		double domainLength = 120;
+		double domainLengthSd = 60;
+		double linkerLength = 20;
+		double mutationRate = 0.25;
+		double indelRate = 0.02;
+		double shuffleRate = 0.1;
+		bool homologyByDomain = true;
+		size_t seed = 1;
+		size_t numThreads = 7;
+		SimilarityMatrix * matrix = 0;
+
+		Params( Args & args ) {
+			if ( args.IsDefined( "help" ) ) {
+				vector<string> text{
+					"GenerateSyntheticDataset: Writes a synthetic protein database with planted homolog families,",
+					"                  as a FASTA file and a homologs file. The output depends only on the seed",
+					"                  and the dataset parameters, not on the number of threads. Deflines have the",
+					"                  form >syn|S<id>|F<family>|D<domain>;D<domain>...|description, so other tools",
+					"                  read them with --idIndex 1 --classIndex 3.",
+					"",
+					"--help         Gets this text.",
+					"--fastaFile    Required. The name of the FASTA file which will be overwritten with sequences.",
+					"--homologsFile Required. The name of the file which will be overwritten with homologs: one line",
+					"                         per sequence, the sequence id followed by the ids of all its homologs,",
+					"                         itself included.",
+					"--sequences    Optional; default = 10000. The number of sequences to generate.",
+					"--families     Optional; default = sequences / 20. The number of families. Sequences are shared",
+					"                         as equally as possible between families.",
+					"--domains      Optional; default = families. The number of ancestral domains in the pool from",
+					"                         which family architectures are drawn. Fewer domains means more domains",
+					"                         are shared between unrelated families.",
+					"--maxDomains   Optional; default = 3. Each family has between 1 and maxDomains distinct domains.",
+					"--domainLength Optional; default = 120. The mean length of a pool domain. Lengths are lognormal.",
+					"--domainLengthSd Opt.    Default = 60. The standard deviation of pool domain length.",
+					"--linkerLength Optional; default = 20. The mean length of the random linkers before, between and",
+					"                         after domains. Lengths are geometric.",
+					"--mutationRate Optional; default = 0.25. The probability that a residue is substituted in each",
+					"                         generation: pool domain to family ancestor, and ancestor to member.",
+					"                         Replacements are drawn with probability proportional to",
+					"                         p_b exp(lambda s(a,b)), under the background composition.",
+					"--indelRate    Optional; default = 0.02. The probability, per residue and generation, of an",
+					"                         insertion or deletion. Indel lengths are geometric with mean 2.",
+					"--shuffleRate  Optional; default = 0.1. The probability that a member of a multi-domain family",
+					"                         has its domains in a random order.",
+					"--homologs     Optional; family or domain, default = domain. With family, the homologs of a",
+					"                         sequence are the members of its family; with domain, they are the",
+					"                         members of every family which shares a domain with it.",
+					"--matrixId     Optional, default = 62. BLOSUM Matrix ID, one of { 35, 40, 45, 50, 62, 80, 100 }.",
+					"--matrixFile   Optional. File name for custom similarity matrix. Residues other than the 20",
+					"                         amino acids are not generated; if the matrix has none of them, all",
+					"                         symbols apart from '*' are used, with equal frequency.",
+					"--seed         Optional; default = 1. The seed for the random number generator.",
+					"--numThreads   Optional; default value = 7. The number of OpenMP threads to use in parallel regions.",
+					"--profile      Optional. A file to which a JSON profile of the run is written: the time, call",
+					"                         count and duration percentiles of each timed region, nested as the regions are.",
+					"--perfCounters Optional; default = false. If true (and --profile is given), each region of the profile",
+					"                         also reports hardware event counts, in total and per thread: cycles, instructions,",
+					"                         L1 data and last level cache misses, and branch misses. Needs Linux perf_event_open;",
+					"                         where the counters are unavailable the profile has times only.",
+					"--memoryReport Optional; default = false. If true, the peak resident memory is reported at the end.",
+					"--memoryBudget Optional. A size such as 512M or 64G. The memory needed is estimated from the dataset",
+					"                         parameters before anything is generated, and if it does not fit the",
+					"                         program stops.",
+				};
+
+				for ( auto s : text ) {
+					cerr << s << "\n";
+				}
+			}
+
+			if ( !args.Get( "fastaFile", fastaFile ) ) {
+				cerr << args.ProgName() << ": error - required argument '--fastaFile' not supplied.\n";
+				ok = false;
+			}
+
+			if ( !args.Get( "homologsFile", homologsFile ) ) {
+				cerr << args.ProgName() << ": error - required argument '--homologsFile' not supplied.\n";
+				ok = false;
+			}
+
+			GetOptional( args, "sequences", sequences );
+			families = std::max( (size_t) 1, sequences / 20 );
+			GetOptional( args, "families", families );
+			domains = families;
+			GetOptional( args, "domains", domains );
+			GetOptional( args, "maxDomains", maxDomains );
+			GetOptional( args, "domainLength", domainLength );
+			GetOptional( args, "domainLengthSd", domainLengthSd );
+			GetOptional( args, "linkerLength", linkerLength );
+			GetOptional( args, "mutationRate", mutationRate );
+			GetOptional( args, "indelRate", indelRate );
+			GetOptional( args, "shuffleRate", shuffleRate );
+			GetOptional( args, "seed", seed );
+			GetOptional( args, "numThreads", numThreads );
+
+			if ( args.IsDefined( "homologs" ) ) {
+				string homologs;
+				args.Get( "homologs", homologs );
+
+				if ( homologs == "family" ) {
+					homologyByDomain = false;
+				}
+				else if ( homologs != "domain" ) {
+					cerr << args.ProgName() << ": Error - '--homologs' must be family or domain.\n";
+					ok = false;
+				}
+			}
+
+			if ( sequences < 1 || families < 1 || families > sequences ) {
+				cerr << args.ProgName() << ": Error - '--families' must be between 1 and '--sequences'.\n";
+				ok = false;
+			}
+
+			if ( domains < 1 || maxDomains < 1 ) {
+				cerr << args.ProgName() << ": Error - '--domains' and '--maxDomains' must be positive.\n";
+				ok = false;
+			}
+
+			if ( domainLength < MinDomainLength || domainLengthSd < 0 || linkerLength < 0 ) {
+				cerr << args.ProgName() << ": Error - '--domainLength' must be at least " << MinDomainLength
+					<< ", and '--domainLengthSd' and '--linkerLength' must not be negative.\n";
+				ok = false;
+			}
+
+			if ( !IsProbability( mutationRate ) || !IsProbability( indelRate ) || !IsProbability( shuffleRate ) ) {
+				cerr << args.ProgName() << ": Error - '--mutationRate', '--indelRate' and '--shuffleRate' must be between 0 and 1.\n";
+				ok = false;
+			}
+
+			if ( numThreads < 1 ) {
+				cerr << args.ProgName() << ": Error - '--numThreads' must be positive.\n";
+				ok = false;
+			}
+
+			string error;
+
+			if ( !args.IsDefined( "matrixId" ) && !args.IsDefined( "matrixFile" ) ) {
+				matrix = SimilarityMatrix::Blosum62();
+			}
+			else if ( !args.Get( matrix, error ) ) {
+				cerr << error << '\n';
+				ok = false;
+			}
+
+			if ( ok && fastaFile == homologsFile ) {
+				cerr << args.ProgName() << ": Error - '--fastaFile' and '--homologsFile' must be different.\n";
+				ok = false;
+			}
+
+			if ( !ok ) {
+				throw Exception( "Invalid arguments.", FileAndLine );
+			}
+		}
+
+		template<typename T>
+		void GetOptional( Args & args, const char * name, T & value ) {
+			if ( !args.GetOptionalArgument( name, value ) ) {
+				cerr << args.ProgName() << ": Error - invalid data for argument '--" << name << "'.\n";
+				ok = false;
+			}
+		}
+
+		static bool IsProbability( double x ) {
+			return x >= 0 && x <= 1;
+		}
+	};
+};
+
+int main( int argc, char** argv ) {
+	try {
+		GenerateSyntheticDataset::Run( argc, argv );
+	}
+	catch ( Exception ex ) {
+		cerr << "Unhandled exception : " << ex.what() << " - " << ex.File() << "(" << ex.Line() << ")" << endl;
+		return 1;
+	}
+	catch ( runtime_error & err ) {
+		cerr << "Unhandled exception:" << endl << err.what() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -50,14 +50,35 @@
 #include "Delegates.hpp"
 #include "Histogram.hpp"
 #include "DiscreteDistribution.hpp"
+#include "DistanceDistributionLibrary.hpp"
+#include "Profiler.hpp"
 
 using namespace QutBio;
 using namespace std;
 
 Args * args;
 
+void ListLibrary( const DistanceDistributionLibrary & library ) {
+	auto & entries = library.Entries();
+
+	cout << "entry\tmatrix\tkmerLength\tfragmentLength\tsymbols\n";
+
+	for ( size_t i = 0; i < entries.size(); i++ ) {
+		auto & key = entries[i].key;
+		cout << i << "\t" << key.matrixLabel << "\t" << key.kmerLength << "\t" << key.fragmentLength << "\t";
+
+		for ( auto & p : key.composition ) {
+			cout << p.first;
+		}
+
+		cout << "\n";
+	}
+}
+
 void Run(void) {
 	string inFile;
+	string libraryFile;
+	int entry = -1;
 	vector<double> pValues;
 	bool ok = true;
 
@@ -66,11 +87,19 @@ void Run(void) {
 			"GetCdfInverse: Reports (to standard output) a list of inverse CDF values from a histogram file.",
 			"Arguments:"
 			"--help      : Gets this text.",
-			"--inFile    : Required. The path to a file which contains a histogram such as that produced by\n"
-			"              GetKmerTheoreticalDistanceDistributions.",
+			"--inFile    : Required unless --libraryFile is given. The path to a file which contains a histogram\n"
+			"              such as that produced by GetKmerTheoreticalDistanceDistributions.",
+			"--libraryFile: Alternative to --inFile. The path to a distribution library produced by\n"
+			"              GetKmerTheoreticalDistanceDistributions --libraryFile.",
+			"--entry     : Optional; with --libraryFile, the 0-origin index of the distribution to use.\n"
+			"              If omitted, the entries of the library are listed.",
 			"--pValues   : Required. A list of (floating point) probability thresholds for which the inverse\n"
 			"              CDF is wanted.",
 			"--numThreads: Optional; default value = 7. The number of OpenMP threads to use in parallel regions.",
+			"--profile   : Optional. A file to which a JSON profile of the run is written: the time, call\n"
+			"              count and duration percentiles of each timed region, nested as the regions are.",
+			"--perfCounters: Optional; default = false. If true, the profile includes hardware event counts\n"
+			"              (cycles, instructions, cache and branch misses) for each region and thread.",
 		};
 
 		for (auto s : text) {
@@ -78,11 +107,24 @@ void Run(void) {
 		}
 	}
 
-	if (!args->Get("inFile", inFile)) {
-		cerr << "Command line argument '--inFile' is required." << endl;
+	if (args->IsDefined("libraryFile")) {
+		args->Get("libraryFile", libraryFile);
+
+		if (args->IsDefined("entry") && !args->Get("entry", entry)) {
+			cerr << "Command line argument '--entry' is not valid." << endl;
+			ok = false;
+		}
+	}
+	else if (!args->Get("inFile", inFile)) {
+		cerr << "Command line argument '--inFile' or '--libraryFile' is required." << endl;
 		ok = false;
 	}
 
+	if (ok && libraryFile.length() > 0 && entry < 0) {
+		ListLibrary(DistanceDistributionLibrary(libraryFile));
+		return;
+	}
+
 	if (!args->Get("pValues", pValues)) {
 		cerr << "Command line argument '--pValues' is required." << endl;
 		ok = false;
@@ -93,6 +135,25 @@ void Run(void) {
 		return;
 	}
 
+	if ( libraryFile.length() > 0 ) {
+		DistanceDistributionLibrary library( libraryFile );
+
+		if ( (size_t) entry >= library.Entries().size() ) {
+			cerr << "Library '" << libraryFile << "' has " << library.Entries().size() << " entries.\n";
+			return;
+		}
+
+		auto & cdf = library.Entries()[entry].cdf;
+
+		cout << "p\tx\n";
+
+		for ( double p : pValues ) {
+			cout << p << "\t" << cdf.InverseCdf( p ) << "\n";
+		}
+
+		return;
+	}
+
 	ifstream inStream( inFile );
 
 	if (inStream.fail()) {
@@ -119,6 +180,7 @@ void Run(void) {
 int main(int argc, char** argv) {
 	try {
 		args = new Args(argc, argv);
+		ProfileSession profile(*args);
 		Run();
 	}
 	catch (Exception ex) {
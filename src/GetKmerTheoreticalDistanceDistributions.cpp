@@ -31,12 +31,15 @@
 #include <random>
 
 #include "Args.hpp"
+#include "DistanceDistributionLibrary.hpp"
 #include "DistanceType.hpp"
 #include "GMM1D.hpp"
 #include "HBRandom.hpp"
 #include "FastaSequence.hpp"
 #include "WeibullDistribution.hpp"
 #include "NormalDistribution.hpp"
+#include "Profiler.hpp"
+#include "MemoryAccount.hpp"
 
 #undef TRON
 #include "db.hpp"
@@ -55,6 +58,7 @@ namespace AdHoc {
 			string aicFile;
 			string distributionFile;
 			string paramFile;
+			string libraryFile;
 
 			int idIndex = 0;
 			int kmerLength = 0;
@@ -76,6 +80,7 @@ namespace AdHoc {
 				out << "--matrixFile " << parms.matrixFile << endl;
 				out << "--aicFile " << parms.aicFile << endl;
 				out << "--distributionFile " << parms.distributionFile << endl;
+				out << "--libraryFile " << parms.libraryFile << endl;
 				out << "--idIndex " << parms.idIndex << endl;
 				out << "--kmerLength " << parms.kmerLength << endl;
 				out << "--dist " << parms.dist->Name() << endl;
@@ -113,6 +118,13 @@ namespace AdHoc {
 "	32768}. Values printed for each n are: mean, standard deviation of exact ",
 "	distribution, and scale and shape parameters of a Weibull approximation.",
 "",
+"--libraryFile: FileName.",
+"	Path to a binary distribution library (see DistanceDistributionLibrary) ",
+"	which will be created or updated with the exact CDF of the kmer distance ",
+"	and of the minimum distance over each sample size, keyed by matrix, symbol ",
+"	composition, kmer length and fragment length. AAClust and AAClustSigEncode ",
+"	read this to convert --pValue to a distance threshold.",
+"",
 "--idIndex: int.",
 "	Zero-origin index of pipe-separated field within definition line which ",
 "	contains the sequence id." ,
@@ -139,6 +151,7 @@ namespace AdHoc {
 "--seed: int.",
 "	Optional seed for random number generator. If not supplied, seed is read ",
 "	from the system clock, timing a resolution of 1 tick per second.",
+"	For a given seed the sample is the same for any number of threads.",
 "",
 "--sampleSize: int.",
 "	Optional number of points to sample for the empirical CDF (which is ",
@@ -147,6 +160,25 @@ namespace AdHoc {
 "",
 "--maxModelSize: int",
 "	Maximum number of kernels in the Gaussian mixture model." ,
+"",
+"--profile: string.",
+"	Optional. A file to which a JSON profile of the run is written: the time,",
+"	call count and duration percentiles of each timed region, nested as the",
+"	regions are.",
+"",
+"--perfCounters: bool.",
+"	Optional, default = false. If true, the profile includes hardware event",
+"	counts (cycles, instructions, cache and branch misses) for each region",
+"	and thread.",
+"",
+"--memoryReport: bool.",
+"	Optional, default = false. If true, the peak resident memory is reported",
+"	at the end.",
+"",
+"--memoryBudget: size.",
+"	Optional. A size such as 512M or 64G. The memory needed is estimated from",
+"	the database and the matrix before anything is loaded, and if it does not",
+"	fit the program stops.",
 				};
 				for ( auto & s : help ) {
 					cerr << s << "\n\n";
@@ -178,8 +210,13 @@ namespace AdHoc {
 					ok = false;
 				}
 
-				if ( paramFile.length() == 0 && aicFile.length() == 0 && distributionFile.length() == 0 ) {
-					cerr << "At least one of 'paramFile', 'aicFile', and 'distributionFile' must be defined." << endl;
+				if ( arguments.IsDefined( "libraryFile" ) && !arguments.Get( "libraryFile", this->libraryFile ) ) {
+					cerr << "Invalid value for argument 'libraryFile'." << endl;
+					ok = false;
+				}
+
+				if ( paramFile.length() == 0 && aicFile.length() == 0 && distributionFile.length() == 0 && libraryFile.length() == 0 ) {
+					cerr << "At least one of 'paramFile', 'aicFile', 'distributionFile' and 'libraryFile' must be defined." << endl;
 					ok = false;
 				}
 
@@ -316,13 +353,23 @@ namespace AdHoc {
 
 			srand( (uint) parms.seed );
 
+			SimilarityMatrix * matrix = SimilarityMatrix::GetMatrix( parms.dist, parms.matrixId, parms.matrixFile, parms.isCaseSensitive );
+
+			vector<uint> sampleSizes;
+
+			for ( uint n = 2; n <= 1 << 24; n *= 2 ) {
+				sampleSizes.push_back( n );
+			}
+
+			if ( MemoryAccount::Budget() > 0 ) {
+				MemoryAccount::Require( "Tabulating the distributions of " + parms.dbFile, EstimateBytes( parms, *matrix, sampleSizes.size() ) );
+			}
+
 			PointerList<EncodedFastaSequence> db;
 			EncodedFastaSequence::ReadSequences( db, parms.dbFile, parms.idIndex, -1, Alphabet::DNA(), parms.kmerLength, 1, 'a', EncodedFastaSequence::DefaultFactory );
 			cerr << db.Length() << " sequences loaded from '" << parms.dbFile << "'" << endl;
 
 			EncodedFastaSequence::Index idx( db.Items() );
-
-			SimilarityMatrix * matrix = SimilarityMatrix::GetMatrix( parms.dist, parms.matrixId, parms.matrixFile, parms.isCaseSensitive );
 			Histogram<char> symbolHistogram = FastaSequence::GetSymbolHistogram( db.Items() );
 			TRACE;
 			function<Distance( char, char )> symbolDistance = [matrix]( char x, char y ) { return matrix->Difference( x, y ); };
@@ -344,9 +391,17 @@ namespace AdHoc {
 			}
 			TRACE;
 
-			for ( uint n = 2; n <= 1 << 24; n *= 2 ) {
+			vector<IntegerDistribution> minDists = rawKmerDist.GetMinimum( sampleSizes );
+			TRACE;
+
+			if ( parms.libraryFile.length() > 0 ) {
+				SaveLibrary( parms, *matrix, symbolHistogram, rawKmerDist, sampleSizes, minDists );
+			}
+
+			for ( size_t sample = 0; sample < sampleSizes.size(); sample++ ) {
+				uint n = sampleSizes[sample];
 				TRACE;
-				auto minDist = rawKmerDist.GetMinimum( n );
+				auto & minDist = minDists[sample];
 				TRACE;
 				vector<double> x, F;
 				TRACE;
@@ -440,13 +495,26 @@ namespace AdHoc {
 				symbolHistogram.GetValues( values );
 				IntegerDistribution background( 0, (int) ( values.size() - 1 ), values );
 
-				UniformRealRandom random( (int32_t) parms.seed );
+				// Each sample draws from its own counter-based stream, so the sample 
+				//	does not depend on the number of threads.
+				distances.resize( parms.sampleSize );
 
 				Histogram<char> generatedChars;
 
-				for ( int i = 0; i < parms.sampleSize; i++ ) {
-					Distance d = GetRandomKmerDistance( keys, background, parms.kmerLength, matrix, random, generatedChars );
-					distances.push_back( d );
+#pragma omp parallel
+				{
+					Histogram<char> localChars;
+
+#pragma omp for schedule(static)
+					for ( int i = 0; i < parms.sampleSize; i++ ) {
+						CounterRandom random( parms.seed, i );
+						distances[i] = GetRandomKmerDistance( keys, background, parms.kmerLength, matrix, random, localChars );
+					}
+
+#pragma omp critical
+					for ( auto & p : localChars.data ) {
+						generatedChars.Add( p.first, p.second );
+					}
 				}
 
 				cerr << "~~~~~~~~~~~~~" << endl;
@@ -471,6 +539,69 @@ namespace AdHoc {
 			if ( paramFile ) delete paramFile;
 		}
 
+		/**
+		**	Estimates the bytes needed before the database is loaded: the 
+		**	sequences, the kmer distance distribution and the minimum distance 
+		**	distribution for each sample size, each of which holds a pdf and cdf
+		**	over the whole support. With a distribution file, the sums of up to 
+		**	1024 minima are tabulated too, and with an AIC file, the sample.
+		*/
+		static size_t EstimateBytes( const Parameters & parms, const SimilarityMatrix & matrix, size_t sampleSizeCount ) {
+			size_t sequenceBytes, encodingBytes;
+			EncodedFastaSequence::Estimate( FastaFileStats::Scan( parms.dbFile ), parms.kmerLength, 1, sequenceBytes, encodingBytes );
+
+			size_t support = (size_t) parms.kmerLength * ( matrix.MaxValue() - matrix.MinValue() ) + 1;
+			size_t distributionBytes = 2 * support * sizeof( double );
+			size_t bytes = sequenceBytes + encodingBytes + ( 1 + sampleSizeCount ) * distributionBytes;
+
+			if ( parms.distributionFile.length() > 0 ) {
+				// The last sum and its predecessor, with room for the FFT buffers.
+				bytes += 4 * 1024 * distributionBytes;
+
+				if ( parms.aicFile.length() > 0 ) {
+					bytes += 2 * (size_t) parms.sampleSize * sizeof( Distance );
+				}
+			}
+
+			return bytes;
+		}
+
+		/**
+		**	Adds the kmer distance distribution and the minimum distance distributions 
+		**	to the library file, creating it if need be. A sample of n kmers is a 
+		**	fragment of length n + kmerLength - 1.
+		*/
+		static void SaveLibrary(
+			Parameters & parms,
+			SimilarityMatrix & matrix,
+			Histogram<char> & symbolHistogram,
+			IntegerDistribution & rawKmerDist,
+			vector<uint> & sampleSizes,
+			vector<IntegerDistribution> & minDists
+		) {
+			DistanceDistributionLibrary library;
+
+			if ( ifstream( parms.libraryFile ).good() ) {
+				library.Load( parms.libraryFile );
+			}
+
+			DistanceDistributionKey key;
+			key.matrix = DistanceDistributionKey::MatrixFingerprint( matrix );
+			key.matrixLabel = parms.dist->Name() + ( parms.matrixFile.length() > 0 ? ":" + parms.matrixFile : ":" + std::to_string( parms.matrixId ) );
+			key.composition = DistanceDistributionKey::Composition( symbolHistogram );
+			key.kmerLength = parms.kmerLength;
+			key.fragmentLength = parms.kmerLength;
+			library.Add( key, TabulatedCdf::FromDistribution( rawKmerDist ) );
+
+			for ( size_t sample = 0; sample < sampleSizes.size(); sample++ ) {
+				key.fragmentLength = sampleSizes[sample] + parms.kmerLength - 1;
+				library.Add( key, TabulatedCdf::FromDistribution( minDists[sample] ) );
+			}
+
+			library.Save( parms.libraryFile );
+			cerr << library.Entries().size() << " distributions saved to '" << parms.libraryFile << "'" << endl;
+		}
+
 		static string HighPrecision( double x ) {
 			stringstream s;
 			s << setprecision( 17 ) << x;
@@ -565,13 +696,13 @@ namespace AdHoc {
 			out << "\n";
 		}
 
-		static FittedModel FitMixtureModel( size_t modelSize, const vector<Distance> & distances ) {
-			FittedModel m{ GMM1D( modelSize ), 0 };
-			m.model.Initialise( distances );
+		/// <summary>
+		///	Trains a mixture model which has been constructed and initialised, and
+		///	computes its AICc.
+		/// </summary>
+		static void FitMixtureModel( FittedModel & m, const vector<Distance> & distances ) {
 			m.model.Train( distances, 1000, 1e-10, false );
 			m.AICc = m.model.AICc( distances );
-			cerr << "Gaussian mixture model with " << modelSize << " components: AICc = " << m.AICc << endl;
-			return m;
 		}
 
 		static void EmitMixtureModel( ofstream & out, FittedModel & mixture ) {
@@ -589,8 +720,23 @@ namespace AdHoc {
 			sort( sortedDistances.begin(), sortedDistances.end() );
 			EmitEmpiricalDistribution( distributionFile, sortedDistances );
 
-			for ( int i = 1; i <= maxModelSize; i++ ) {
-				FittedModel mixture = FitMixtureModel( i, distances );
+			// GMM1D draws its initial centres from rand(), so the models are 
+			//	seeded serially in order of size, and then trained concurrently, 
+			//	largest first.
+			vector<FittedModel> mixtures;
+
+			for ( size_t i = 1; i <= maxModelSize; i++ ) {
+				mixtures.push_back( FittedModel{ GMM1D( i ), 0 } );
+				mixtures.back().model.Initialise( distances );
+			}
+
+#pragma omp parallel for schedule(dynamic)
+			for ( int i = (int) maxModelSize - 1; i >= 0; i-- ) {
+				FitMixtureModel( mixtures[i], distances );
+			}
+
+			for ( auto & mixture : mixtures ) {
+				cerr << "Gaussian mixture model with " << mixture.model.Size() << " components: AICc = " << mixture.AICc << endl;
 				EmitMixtureModel( aicFile, mixture );
 				EmitDistribution( distributionFile, sortedDistances, mixture );
 			}
@@ -601,7 +747,7 @@ namespace AdHoc {
 			IntegerDistribution & background,
 			int kmerLength,
 			SimilarityMatrix * matrix,
-			UniformRealRandom & random,
+			CounterRandom & random,
 			Histogram<char> & generatedChars
 		) {
 			Distance d = 0;
@@ -640,6 +786,8 @@ int main( int argc, char ** argv ) {
 	}
 
 	try {
+		ProfileSession profile( arguments );
+		MemorySession memory( arguments );
 		AdHoc::GetKmerTheoreticalDistanceDistributions::Run( arguments );
 	}
 	catch ( Exception ex ) {
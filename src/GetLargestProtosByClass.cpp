@@ -43,7 +43,8 @@
 #include <Domain.hpp>
 #include <FastaSequence.hpp>
 #include <KmerCodebook.hpp>
-#include <OmpTimer.h>
+#include <Profiler.hpp>
+#include <MemoryAccount.hpp>
 #include <Exception.hpp>
 #include <SimilarityMatrix.hpp>
 #include <FileUtil.hpp>
@@ -59,6 +60,8 @@ struct GetLargestProtosByClass {
 
 	static void Run( int argc, char** argv ) {
 		Args args( argc, argv );
+		ProfileSession profile( args );
+		MemorySession memory( args );
 		Params parms( args );
 
 		//	The alphabet and distance function are dummies required to satisfy
@@ -68,6 +71,12 @@ struct GetLargestProtosByClass {
 		BlosumDifferenceFunction dist( SimilarityMatrix::Blosum62() );
 		DistanceFunction distanceFunction( alphabet, &dist );
 
+		if ( MemoryAccount::Budget() > 0 ) {
+			size_t bytes = EstimateCodebookLoadBytes( FastaFileStats::Scan( parms.db ), FastaFileStats::Scan( parms.protosIn ), parms.kmerLength, distanceFunction.CharsPerWord() )
+				+ distanceFunction.TableBytes();
+			MemoryAccount::Require( "Loading the codebook of " + parms.db, bytes );
+		}
+
 		PointerList<EncodedFastaSequence> db;
 
 		try {
@@ -29,6 +29,7 @@
 #include <string>
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
 
 #include "EncodedKmer.hpp"
 #include "EnumBase.hpp"
@@ -45,28 +46,60 @@ namespace QutBio {
 	private:
 		string symbols;
 		unsigned char inverse[128];
+		bool known[128];
+		bool isReduced = false;
+		char representative[128];
 
 		Alphabet(string literal, int value)
 			: EnumBase(literal, value) {
 			symbols = value == 0 ? SimilarityMatrix::Blosum62()->Symbols() : string("acgt");
 
 			std::fill(inverse, inverse + sizeof(inverse), 0);
+			std::fill(known, known + sizeof(known), false);
 
 			for (size_t i = 0; i < symbols.size(); i++) {
 				inverse[tolower(symbols[i])] = (unsigned char)i;
 				inverse[toupper(symbols[i])] = (unsigned char)i;
+				known[tolower(symbols[i])] = known[toupper(symbols[i])] = true;
+			}
+
+			if (value == 1) {
+				// RNA: uracil takes the place of thymine.
+				inverse['u'] = inverse['U'] = inverse['t'];
+				known['u'] = known['U'] = true;
 			}
 		}
 
 	public:
+		/// <summary> The charsPerWord value which selects packed nucleotide encoding: each
+		///		kmer of up to 32 bases is packed 2 bits per base into one 64 bit code, stored 
+		///		as a pair of KmerWords. Valid only for four-symbol alphabets.
+		/// </summary>
+		static const size_t PackedDnaCharsPerWord = 32;
+
+
 		Alphabet(SimilarityMatrix * matrix) : EnumBase("Custom", 2) {
 			symbols = matrix->Symbols();
 
 			std::fill(inverse, inverse + sizeof(inverse), 0);
+			std::fill(known, known + sizeof(known), false);
 
 			for (size_t i = 0; i < symbols.size(); i++) {
 				inverse[tolower(symbols[i])] = (unsigned char)i;
 				inverse[toupper(symbols[i])] = (unsigned char)i;
+				known[tolower(symbols[i])] = known[toupper(symbols[i])] = true;
+			}
+
+			// In a reduced alphabet, every member of a group shares the code of its representative.
+			isReduced = matrix->IsReduced();
+
+			for (int c = 0; c < 128; c++) {
+				representative[c] = matrix->Representative(c);
+
+				if (isReduced && matrix->IsDefined(c)) {
+					inverse[c] = inverse[(uint8_t)representative[c]];
+					known[c] = true;
+				}
 			}
 		}
 
@@ -88,6 +121,10 @@ namespace QutBio {
 		}
 
 		static size_t WordsPerKmer(size_t kmerLength, size_t charsPerWord) {
+			if (charsPerWord == PackedDnaCharsPerWord) {
+				return sizeof(uint64_t) / sizeof(KmerWord);
+			}
+
 			return (kmerLength + charsPerWord - 1) / charsPerWord;
 		}
 
@@ -115,6 +152,17 @@ namespace QutBio {
 		/// <returns></returns>
 
 		void Encode(const char * s, size_t kmerLength, size_t charsPerWord, EncodedKmer code) {
+			if (charsPerWord == PackedDnaCharsPerWord) {
+				uint64_t packed = 0;
+
+				for (size_t i = 0; i < kmerLength; i++) {
+					packed = (packed << 2) | (inverse[(uint8_t)s[i]] & 3);
+				}
+
+				memcpy(code, &packed, sizeof(packed));
+				return;
+			}
+
 			size_t words = WordsPerKmer(kmerLength, charsPerWord);
 			size_t size = symbols.size();
 			size_t wordIndex = 0;
@@ -124,7 +172,7 @@ namespace QutBio {
 				int j = inverse[(uint8_t)s[i]];
 				code[wordIndex] = code[wordIndex] * (int)size + j;
 
-				if (i > 0 && i % charsPerWord == (charsPerWord - 1)) {
+				if (i % charsPerWord == (charsPerWord - 1)) {
 					wordIndex++;
 
 					if (wordIndex < words) {
@@ -191,7 +239,10 @@ namespace QutBio {
 				throw Exception(str.str(), FileAndLine);
 			}
 
-			if (kmerLength > charsPerWord) {
+			if (charsPerWord == PackedDnaCharsPerWord) {
+				EncodePackedDna(s, len, kmerLength, code);
+			}
+			else if (kmerLength > charsPerWord) {
 				if (kmerLength % charsPerWord != 0) {
 					stringstream str;
 					str << "Alphabet::Encode: kmerLength must be divisible by charsPerWord: kmerLength = "
@@ -228,6 +279,41 @@ namespace QutBio {
 			}
 		}
 
+		/// <summary> Rolls a packed 2-bit code along the sequence, appending the 64 bit 
+		///		code of each kmer to code[0] as a pair of KmerWords, so that the kmer at
+		///		position i starts at code[0][2*i].
+		/// </summary>
+
+		void EncodePackedDna(const char * s, size_t len, size_t kmerLength, vector<vector<KmerWord>> & code) {
+			if (symbols.size() != 4 || kmerLength < 1 || kmerLength > 32) {
+				stringstream str;
+				str << "Alphabet::Encode: packed nucleotide encoding needs a four-symbol alphabet and 1 <= kmerLength <= 32: kmerLength = "
+					<< kmerLength
+					<< ", alphabet size = "
+					<< symbols.size()
+					<< "\n";
+				throw Exception(str.str(), FileAndLine);
+			}
+
+			const size_t wordsPerKmer = WordsPerKmer(kmerLength, PackedDnaCharsPerWord);
+			const uint64_t mask = kmerLength == 32 ? ~0ULL : (1ULL << (2 * kmerLength)) - 1;
+			const size_t kmerCount = len - kmerLength + 1;
+
+			code.resize(1);
+			code[0].resize(kmerCount * wordsPerKmer);
+
+			uint64_t packed = 0;
+
+			for (size_t i = 0; i < kmerLength - 1; i++) {
+				packed = (packed << 2) | (inverse[(uint8_t)s[i]] & 3);
+			}
+
+			for (size_t i = 0; i < kmerCount; i++) {
+				packed = ((packed << 2) | (inverse[(uint8_t)s[i + kmerLength - 1]] & 3)) & mask;
+				memcpy(&code[0][i * wordsPerKmer], &packed, sizeof(packed));
+			}
+		}
+
 		/// <summary> Decodes a sequence of zero-origin numeric values into a string.
 		/// </summary>
 		/// <param name="code">The sequence of numeric code values.</param>
@@ -238,6 +324,17 @@ namespace QutBio {
 		/// <returns></returns>
 
 		void Decode(const KmerWord * code, size_t k, size_t charsPerWord, char * charBuffer) const {
+			if (charsPerWord == PackedDnaCharsPerWord) {
+				uint64_t packed;
+				memcpy(&packed, code, sizeof(packed));
+
+				for (size_t i = 0; i < k; i++) {
+					charBuffer[i] = symbols[(packed >> (2 * (k - 1 - i))) & 3];
+				}
+
+				return;
+			}
+
 			size_t words = (k + charsPerWord - 1) / charsPerWord;
 			size_t size = symbols.size();
 			string * s = new string();
@@ -287,8 +384,10 @@ namespace QutBio {
 				}
 			}
 			else {
+				size_t stride = charsPerWord == PackedDnaCharsPerWord ? WordsPerKmer(kmerLength, charsPerWord) : 1;
+
 				for (size_t i = 0; i < len; i++) {
-					Decode(&code[0][i], kmerLength, charsPerWord, charBuffer + i);
+					Decode(&code[0][i * stride], kmerLength, charsPerWord, charBuffer + i);
 				}
 
 			}
@@ -317,9 +416,33 @@ namespace QutBio {
 			return idx = string::npos ? symbols.front() : symbols[idx];
 		}
 
+		/// <summary> Returns true if and only if c is a symbol of the alphabet (for DNA, 
+		///		one of acgtu in either case). Other symbols, such as N and the IUPAC ambiguity
+		///		codes, are encoded as symbol 0.
+		/// </summary>
+		bool Contains(char c) const {
+			return (uint8_t)c < 128 && known[(uint8_t)c];
+		}
+
 		const uint8_t * Inverse() const {
 			return inverse;
 		}
+
+		/// <summary>Returns true iff this alphabet was built from a reduced similarity matrix.</summary>
+		bool IsReduced() const {
+			return isReduced;
+		}
+
+		/// <summary>Replaces each residue of a reduced alphabet by the representative 
+		///		of its group, so that kmers which differ only within groups are equal
+		///		as strings. Does nothing if the alphabet is not reduced.</summary>
+		void Reduce(string & s) const {
+			if (!isReduced) return;
+
+			for (auto & c : s) {
+				c = representative[(uint8_t)c & 127];
+			}
+		}
 	};
 
 	typedef Alphabet * pAlphabet;
@@ -488,6 +488,35 @@ namespace QutBio {
 				return false;
 			}
 
+			return GetReducedAlphabet( matrix, error );
+		}
+
+		/**
+		 *	<summary>
+		 *	If the argument 'reducedAlphabet' is present, replaces the matrix by one over
+		 *	the designated reduced alphabet. The value is either the name of a standard 
+		 *	grouping (murphy10, seb14) or a comma-separated list of residue groups. 
+		 *	See SimilarityMatrix::Reduce.
+		 *	</summary>
+		 */
+		bool GetReducedAlphabet( SimilarityMatrix *&matrix, string & error ) {
+			if ( !IsDefined( "reducedAlphabet" ) ) return true;
+
+			string groups;
+
+			if ( !Get( "reducedAlphabet", groups ) || groups.size() == 0 ) {
+				error = ProgName() + ": error - argument 'reducedAlphabet' not valid.";
+				return false;
+			}
+
+			try {
+				matrix = SimilarityMatrix::Reduce( *matrix, SimilarityMatrix::ReducedAlphabetGroups( groups ) );
+			}
+			catch ( Exception & ex ) {
+				error = ProgName() + ": error - " + ex.what();
+				return false;
+			}
+
 			return true;
 		}
 
@@ -0,0 +1,349 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies 
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18), 
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published 
+// by the Free Software Foundation; either version 3, or (at your 
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <vector>
+
+namespace QutBio {
+	using std::complex;
+	using std::vector;
+
+	/**
+	 *	<summary>
+	 *	Convolution of non-negative sequences, such as probability mass functions.
+	 *	Short inputs use the direct O(n m) sum. Longer inputs use a real FFT: both 
+	 *	operands are packed into one complex transform, so the product costs a 
+	 *	forward and an inverse transform of length N >= n + m - 1.
+	 *	<para>
+	 *		The FFT has absolute error around DBL_EPSILON log2(N) relative to the 
+	 *		largest output, so on its own it loses every tail probability more than 
+	 *		about 14 orders of magnitude below the mode. Tails are recovered by 
+	 *		exponential tilting: the convolution of a[i] e^(theta i) and b[j] e^(theta j) 
+	 *		is c[k] e^(theta k), so each tilt moves the peak of the transformed 
+	 *		sequence, and with it the region of full relative precision, to a chosen 
+	 *		position. Starting from theta = 0, each side is walked outward by picking 
+	 *		theta to cancel the log slope of c at the edge of the region resolved so 
+	 *		far. For log-concave sequences (sums and order statistics of kmer 
+	 *		distances) a handful of tilts reaches underflow. Any entries still 
+	 *		unresolved when the walk stalls are computed directly.
+	 *	</para>
+	 *	</summary>
+	 */
+	class Convolution {
+	public:
+		/// <summary>The shorter operand length at and below which Convolve uses the direct sum.</summary>
+		static const size_t DirectLength = 1024;
+
+		/// <summary>Tilted outputs below this fraction of the tilted maximum are treated as FFT noise.</summary>
+		static constexpr double Tolerance = 1e-10;
+
+		/// <summary>The maximum number of tilts applied to each tail.</summary>
+		static const int MaxTilts = 64;
+
+		/**
+		 *	<summary>
+		 *	Gets the convolution of a and b, which must be non-empty and non-negative.
+		 *	</summary>
+		 *	<param name="parallel">If true, large transforms use OpenMP threads.</param>
+		 */
+		static vector<double> Convolve( const vector<double> & a, const vector<double> & b, bool parallel = false ) {
+			vector<double> c( a.size() + b.size() - 1 );
+
+			if ( std::min( a.size(), b.size() ) <= DirectLength ) {
+				Scatter( a, b, c );
+			}
+			else {
+				Fft( a, b, c, parallel );
+			}
+
+			return c;
+		}
+
+		/// <summary>Computes c[k] = sum_i a[i] b[k-i] directly, for k in [k0, k1).</summary>
+		static void Direct( const vector<double> & a, const vector<double> & b, vector<double> & c, size_t k0, size_t k1 ) {
+			const size_t n = a.size(), m = b.size();
+
+			for ( size_t k = k0; k < k1; k++ ) {
+				size_t iMin = k >= m ? k - m + 1 : 0;
+				size_t iMax = std::min( k, n - 1 );
+				double sum = 0;
+
+				for ( size_t i = iMin; i <= iMax; i++ ) {
+					sum += a[i] * b[k - i];
+				}
+
+				c[k] = sum;
+			}
+		}
+
+		/**
+		 *	<summary>
+		 *	Adds the convolution of a and b to c, which must have length n + m - 1, 
+		 *	one row a[i] b[.] at a time. The rows are contiguous, so the inner loop 
+		 *	vectorises, and each c[k] accumulates its terms in the same order as 
+		 *	Direct, so starting from zero the two agree exactly.
+		 *	</summary>
+		 */
+		static void Scatter( const vector<double> & a, const vector<double> & b, vector<double> & c ) {
+			const size_t n = a.size(), m = b.size();
+			const double * bp = b.data();
+
+			for ( size_t i = 0; i < n; i++ ) {
+				const double ai = a[i];
+				double * cp = c.data() + i;
+
+#pragma omp simd
+				for ( size_t j = 0; j < m; j++ ) {
+					cp[j] += ai * bp[j];
+				}
+			}
+		}
+
+		/// <summary>Computes the convolution of a and b by tilted FFTs, as described above.</summary>
+		static void Fft( const vector<double> & a, const vector<double> & b, vector<double> & c, bool parallel = false ) {
+			const size_t L = a.size() + b.size() - 1;
+			c.assign( L, 0 );
+
+			vector<double> logA( a.size() ), logB( b.size() ), logC( L, -INFINITY );
+			vector<char> state( L, Unresolved );
+
+			for ( size_t i = 0; i < a.size(); i++ ) logA[i] = a[i] > 0 ? log( a[i] ) : -INFINITY;
+			for ( size_t j = 0; j < b.size(); j++ ) logB[j] = b[j] > 0 ? log( b[j] ) : -INFINITY;
+
+			size_t first, last;
+
+			if ( !Tilt( logA, logB, 0, c, logC, state, first, last, parallel ) ) {
+				// Both operands are zero.
+				return;
+			}
+
+			size_t left = first, right = last;
+
+			for ( int t = 0; t < MaxTilts && left > 0; t++ ) {
+				if ( c[left] == 0 ) {
+					// Underflow: the rest of the tail is below DBL_MIN.
+					Settle( c, state, 0, left );
+					break;
+				}
+
+				size_t next = NextResolved( state, left, 1 );
+				double theta = next == left ? 0 : -( logC[next] - logC[left] ) / ( next - left );
+
+				if ( !Tilt( logA, logB, theta, c, logC, state, first, last, parallel ) || first >= left ) break;
+
+				left = first;
+			}
+
+			for ( int t = 0; t < MaxTilts && right < L - 1; t++ ) {
+				if ( c[right] == 0 ) {
+					Settle( c, state, right + 1, L );
+					break;
+				}
+
+				size_t prev = NextResolved( state, right, -1 );
+				double theta = prev == right ? 0 : -( logC[right] - logC[prev] ) / ( right - prev );
+
+				if ( !Tilt( logA, logB, theta, c, logC, state, first, last, parallel ) || last <= right ) break;
+
+				right = last;
+			}
+
+			// Whatever the walk did not reach, and, if they are few enough to cost no
+			// more than a few transforms, the interior dips which it only approximated.
+			size_t N = 1, logN = 0;
+			while ( N < L ) { N *= 2; logN++; }
+
+			size_t approximate = std::count( state.begin(), state.end(), Approximate );
+			bool refine = approximate * std::min( a.size(), b.size() ) <= 8 * N * logN;
+
+			for ( size_t k = 0; k < L; k++ ) {
+				if ( state[k] == Unresolved || ( refine && state[k] == Approximate && c[k] > 0 ) ) {
+					Direct( a, b, c, k, k + 1 );
+				}
+			}
+		}
+
+	private:
+		enum : char { Unresolved, Approximate, Resolved };
+
+		/**
+		 *	<summary>
+		 *	Convolves a[i] e^(theta i) with b[j] e^(theta j), each scaled so its largest 
+		 *	term is 1. Outputs within Tolerance of the largest become Resolved. Other
+		 *	unresolved outputs between the first and last resolved ones are interior 
+		 *	dips below the noise floor; they are set to the (non-negative) FFT value 
+		 *	and marked Approximate, so that a later tilt can refine them.
+		 *	Returns false if no output is resolved.
+		 *	</summary>
+		 */
+		static bool Tilt(
+			const vector<double> & logA,
+			const vector<double> & logB,
+			double theta,
+			vector<double> & c,
+			vector<double> & logC,
+			vector<char> & state,
+			size_t & first,
+			size_t & last,
+			bool parallel
+		) {
+			const size_t n = logA.size(), m = logB.size(), L = n + m - 1;
+			double shiftA = -INFINITY, shiftB = -INFINITY;
+
+			for ( size_t i = 0; i < n; i++ ) shiftA = std::max( shiftA, logA[i] + theta * i );
+			for ( size_t j = 0; j < m; j++ ) shiftB = std::max( shiftB, logB[j] + theta * j );
+
+			if ( shiftA == -INFINITY || shiftB == -INFINITY ) return false;
+
+			size_t N = 1;
+			while ( N < L ) N *= 2;
+
+			// Real FFT of both operands at once: z = a + i b.
+			vector<complex<double>> z( N );
+
+			for ( size_t i = 0; i < n; i++ ) z[i].real( exp( logA[i] + theta * i - shiftA ) );
+			for ( size_t j = 0; j < m; j++ ) z[j].imag( exp( logB[j] + theta * j - shiftB ) );
+
+			Transform( z, false, parallel );
+
+			// A[k] = (Z[k] + conj Z[-k]) / 2, B[k] = (Z[k] - conj Z[-k]) / 2i, so 
+			// A[k] B[k] = (Z[k]^2 - conj(Z[-k])^2) / 4i.
+			vector<complex<double>> product( N );
+
+			for ( size_t k = 0; k < N; k++ ) {
+				complex<double> x = z[k], y = conj( z[( N - k ) & ( N - 1 )] );
+				product[k] = ( x * x - y * y ) * complex<double>( 0, -0.25 );
+			}
+
+			Transform( product, true, parallel );
+
+			double largest = 0;
+
+			for ( size_t k = 0; k < L; k++ ) largest = std::max( largest, product[k].real() / N );
+
+			const double floor = largest * Tolerance;
+			first = L;
+			last = 0;
+
+			for ( size_t k = 0; k < L; k++ ) {
+				if ( product[k].real() / N >= floor ) {
+					first = std::min( first, k );
+					last = k;
+				}
+			}
+
+			if ( first > last ) return false;
+
+			for ( size_t k = first; k <= last; k++ ) {
+				double value = product[k].real() / N;
+
+				if ( value >= floor ) {
+					if ( state[k] != Resolved ) {
+						logC[k] = log( value ) - theta * k + shiftA + shiftB;
+						c[k] = exp( logC[k] );
+						state[k] = Resolved;
+					}
+				}
+				else if ( state[k] == Unresolved ) {
+					c[k] = value > 0 ? exp( log( value ) - theta * k + shiftA + shiftB ) : 0;
+					state[k] = Approximate;
+				}
+			}
+
+			return true;
+		}
+
+		/// <summary>Gets the nearest Resolved index after k in the given direction, or k if there is none.</summary>
+		static size_t NextResolved( const vector<char> & state, size_t k, int direction ) {
+			for ( size_t j = k + direction; j < state.size(); j += direction ) {
+				if ( state[j] == Resolved ) return j;
+			}
+
+			return k;
+		}
+
+		/// <summary>Marks entries in [k0, k1) which are still unresolved as zero.</summary>
+		static void Settle( vector<double> & c, vector<char> & state, size_t k0, size_t k1 ) {
+			for ( size_t k = k0; k < k1; k++ ) {
+				if ( state[k] == Unresolved ) {
+					c[k] = 0;
+					state[k] = Approximate;
+				}
+			}
+		}
+
+		/// <summary>In-place iterative radix-2 FFT. The inverse is unscaled.</summary>
+		static void Transform( vector<complex<double>> & z, bool inverse, bool parallel ) {
+			const size_t N = z.size();
+
+			for ( size_t i = 1, j = 0; i < N; i++ ) {
+				size_t bit = N >> 1;
+
+				for ( ; j & bit; bit >>= 1 ) j ^= bit;
+
+				j ^= bit;
+
+				if ( i < j ) std::swap( z[i], z[j] );
+			}
+
+			// Twiddles are evaluated directly rather than by recurrence, to keep 
+			// the error at O(DBL_EPSILON log N).
+			vector<complex<double>> w( N / 2 );
+			const double sign = inverse ? 1 : -1;
+
+			for ( size_t k = 0; k < N / 2; k++ ) {
+				double angle = sign * 2 * M_PI * k / N;
+				w[k] = complex<double>( cos( angle ), sin( angle ) );
+			}
+
+			for ( size_t len = 2; len <= N; len *= 2 ) {
+				const size_t half = len / 2, stride = N / len;
+				const long butterflies = (long) ( N / 2 );
+
+#pragma omp parallel for if ( parallel && N >= ( 1 << 16 ) )
+				for ( long t = 0; t < butterflies; t++ ) {
+					size_t i = ( t / half ) * len, j = t % half;
+					complex<double> u = z[i + j], v = z[i + j + half] * w[j * stride];
+					z[i + j] = u + v;
+					z[i + j + half] = u - v;
+				}
+			}
+		}
+	};
+}
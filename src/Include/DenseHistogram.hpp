@@ -0,0 +1,233 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18),
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published
+// by the Free Software Foundation; either version 3, or (at your
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <utility>
+#include <vector>
+
+#include "Convolution.hpp"
+
+namespace QutBio {
+	using std::pair;
+	using std::vector;
+
+	template < typename T > class Histogram;
+
+	/**
+	*	<summary>
+	*		A histogram whose keys lie on a fixed-step grid, origin + i * step,
+	*		stored as a contiguous array of values indexed by i. Integer keys, such
+	*		as kmer distances, are the usual case.
+	*	<para>
+	*		Grid points which are not keys of the histogram are flagged absent, so a
+	*		round trip through Histogram&lt;T&gt; preserves the key set exactly,
+	*		including keys with zero mass. The absence flags are only stored when
+	*		the support has holes.
+	*	</para>
+	*	<para>
+	*		Iteration visits the present entries in ascending key order as
+	*		(key, value) pairs, the same view as iterating Histogram&lt;T&gt;::data.
+	*	</para>
+	*	</summary>
+	*/
+	template < typename T >
+	class DenseHistogram {
+	public:
+		/// <summary>The key of values[0].</summary>
+		T origin = T();
+
+		/// <summary>The difference between consecutive grid keys.</summary>
+		T step = T( 1 );
+
+		/// <summary>The value at each grid point.</summary>
+		vector<double> values;
+
+		/// <summary>Nonzero at each grid point which is a key; empty if every grid point is a key.</summary>
+		vector<char> present;
+
+		/// <summary>A sparse histogram is left in the map when its grid would exceed this many points per key.</summary>
+		static const size_t MaxSparsity = 4;
+
+		class const_iterator {
+			const DenseHistogram * owner;
+			size_t i;
+
+			void Skip() {
+				while ( i < owner->values.size() && !owner->Contains( i ) ) i++;
+			}
+
+		public:
+			const_iterator( const DenseHistogram * owner, size_t i ) : owner( owner ), i( i ) { Skip(); }
+
+			pair<T, double> operator*() const { return pair<T, double>( owner->Key( i ), owner->values[i] ); }
+
+			const_iterator & operator++() { i++; Skip(); return *this; }
+
+			bool operator!=( const const_iterator & other ) const { return i != other.i; }
+
+			bool operator==( const const_iterator & other ) const { return i == other.i; }
+		};
+
+		const_iterator begin() const { return const_iterator( this, 0 ); }
+
+		const_iterator end() const { return const_iterator( this, values.size() ); }
+
+		/// <summary>The number of grid points.</summary>
+		size_t Size() const { return values.size(); }
+
+		/// <summary>Gets the key at grid point i.</summary>
+		T Key( size_t i ) const { return (T) ( origin + (T) i * step ); }
+
+		/// <summary>Returns true if and only if grid point i is a key.</summary>
+		bool Contains( size_t i ) const { return present.size() == 0 || present[i]; }
+
+		void Clear() {
+			origin = T();
+			step = T( 1 );
+			values.clear();
+			present.clear();
+		}
+
+		/**
+		*	<summary>
+		*		Copies a histogram into this dense representation, provided that its
+		*		keys lie exactly on a grid whose step is the least gap between
+		*		consecutive keys, and the grid is no more than MaxSparsity times as
+		*		long as the key set.
+		*	</summary>
+		*	<returns>True if the histogram was copied; false, leaving this empty, otherwise.</returns>
+		*/
+		bool Assign( const Histogram<T> & histogram ) {
+			Clear();
+
+			auto & data = histogram.data;
+
+			if ( data.size() == 0 ) return false;
+
+			T lo = data.begin()->first;
+			T hi = data.rbegin()->first;
+			T gap = T();
+
+			for ( auto p = data.begin(), q = std::next( p ); q != data.end(); p++, q++ ) {
+				T d = q->first - p->first;
+				if ( gap == T() || d < gap ) gap = d;
+			}
+
+			if ( gap == T() ) gap = T( 1 );
+
+			double span = ( (double) hi - (double) lo ) / (double) gap;
+
+			if ( !( span + 1 <= (double) MaxSparsity * data.size() ) ) return false;
+
+			size_t length = (size_t) ( span + 0.5 ) + 1;
+
+			origin = lo;
+			step = gap;
+			values.assign( length, 0.0 );
+
+			if ( length > data.size() ) present.assign( length, 0 );
+
+			for ( auto & p : data ) {
+				size_t i = (size_t) ( ( (double) p.first - (double) lo ) / (double) gap + 0.5 );
+
+				if ( i >= length || Key( i ) != p.first ) {
+					Clear();
+					return false;
+				}
+
+				values[i] = p.second;
+				if ( present.size() > 0 ) present[i] = 1;
+			}
+
+			return true;
+		}
+
+		/**
+		*	<summary>
+		*		Adds each present entry to a histogram. Entries are appended in key
+		*		order, so filling an empty histogram takes linear time.
+		*	</summary>
+		*/
+		void AddTo( Histogram<T> & histogram ) const {
+			auto & data = histogram.data;
+			bool append = data.size() == 0;
+
+			for ( size_t i = 0; i < values.size(); i++ ) {
+				if ( !Contains( i ) ) continue;
+
+				if ( append ) {
+					data.emplace_hint( data.end(), Key( i ), values[i] );
+				}
+				else {
+					histogram.Add( Key( i ), values[i] );
+				}
+			}
+		}
+
+		/**
+		*	<summary>
+		*		Populates result with the convolution of this histogram and another
+		*		on the same step, via Convolution::Convolve. The key set of the result
+		*		is the set of pairwise key sums, as for Histogram::DoConvolution.
+		*	</summary>
+		*/
+		void Convolve( const DenseHistogram & other, DenseHistogram & result ) const {
+			result.origin = (T) ( origin + other.origin );
+			result.step = step;
+			result.values = Convolution::Convolve( values, other.values );
+			result.present.clear();
+
+			if ( present.size() == 0 && other.present.size() == 0 ) return;
+
+			// A sum is a key iff some pair of keys adds to it: the convolution of the
+			// indicator arrays counts those pairs, so round it to decide presence.
+			vector<double> pairs = Convolution::Convolve( Indicator(), other.Indicator() );
+			result.present.resize( pairs.size() );
+
+			for ( size_t k = 0; k < pairs.size(); k++ ) {
+				result.present[k] = pairs[k] >= 0.5;
+			}
+		}
+
+		/// <summary>Gets an array which is 1 at each grid point which is a key, and 0 elsewhere.</summary>
+		vector<double> Indicator() const {
+			vector<double> indicator( values.size() );
+
+			for ( size_t i = 0; i < values.size(); i++ ) {
+				indicator[i] = Contains( i ) ? 1 : 0;
+			}
+
+			return indicator;
+		}
+	};
+}
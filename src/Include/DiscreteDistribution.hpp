@@ -48,6 +48,61 @@ namespace QutBio {
 		Histogram<double> cdf;
 		double mu;
 		double sigma;
+
+		/// <summary>
+		///	A contiguous copy of cdf, used by the order statistics when its keys lie 
+		///	on a fixed-step grid. Empty otherwise.
+		/// </summary>
+		DenseHistogram<double> denseCdf;
+
+		/// <summary>
+		///	Normalises pmf and cdf values accumulated on the grid of shape, computes the 
+		///	moments, and fills pmf, cdf and denseCdf in one ordered pass.
+		/// </summary>
+		void SetDense(
+			const DenseHistogram<double> & shape,
+			vector<double> & pmfValues,
+			vector<double> & cdfValues,
+			double maxCdf
+			) {
+			double sum_p_x = 0;
+			double sum_p_x_2 = 0;
+
+			for ( size_t i = 0; i < shape.Size(); i++ ) {
+				if ( !shape.Contains( i ) ) continue;
+
+				double key = shape.Key( i );
+				cdfValues[i] /= maxCdf;
+				pmfValues[i] /= maxCdf;
+				double p_x = key * pmfValues[i];
+				double p_x_2 = p_x * key;
+				sum_p_x += p_x;
+				sum_p_x_2 += p_x_2;
+
+				pmf.data.emplace_hint( pmf.data.end(), key, pmfValues[i] );
+				cdf.data.emplace_hint( cdf.data.end(), key, cdfValues[i] );
+			}
+
+			mu = sum_p_x;
+			sigma = sqrt(sum_p_x_2 - mu * mu);
+
+			denseCdf.origin = shape.origin;
+			denseCdf.step = shape.step;
+			denseCdf.values.swap( cdfValues );
+			denseCdf.present = shape.present;
+		}
+
+		/// <summary>
+		///	Drops the grid points of h from length onward.
+		/// </summary>
+		static void Truncate(DenseHistogram<double> & h, size_t length) {
+			h.values.resize(length);
+
+			if ( h.present.size() > 0 ) {
+				h.present.resize(length);
+			}
+		}
+
 	public:
 		Histogram<double> const & Pmf() { return pmf; }
 		Histogram<double> const & Cdf() { return cdf; }
@@ -73,8 +128,16 @@ namespace QutBio {
 		}
 
 		void SetCdf(Histogram<double> & cdf_) {
+			DenseHistogram<double> dense;
+
+			if ( dense.Assign(cdf_) ) {
+				SetCdf(dense);
+				return;
+			}
+
 			cdf.data.clear();
 			pmf.data.clear();
+			denseCdf.Clear();
 
 			double maxCdf = 0;
 			bool isFirst = true;
@@ -119,9 +182,44 @@ namespace QutBio {
 			sigma = sqrt(sum_p_x_2 - mu * mu);
 		}
 
+		/// <summary>
+		///	Sets the distribution from a cumulative distribution on a fixed-step grid.
+		/// </summary>
+		void SetCdf(const DenseHistogram<double> & cdf_) {
+			cdf.data.clear();
+			pmf.data.clear();
+
+			vector<double> pmfValues(cdf_.Size()), cdfValues(cdf_.Size());
+			double maxCdf = 0;
+			bool isFirst = true;
+
+			for ( size_t i = 0; i < cdf_.Size(); i++ ) {
+				if ( !cdf_.Contains(i) ) continue;
+
+				double value = cdf_.values[i];
+				cdfValues[i] = value;
+				pmfValues[i] = isFirst ? value : value - maxCdf;
+				isFirst = false;
+
+				if ( value > maxCdf ) {
+					maxCdf = value;
+				}
+			}
+
+			SetDense(cdf_, pmfValues, cdfValues, maxCdf);
+		}
+
 		void SetPmf(Histogram<double> cdf_) {
+			DenseHistogram<double> dense;
+
+			if ( dense.Assign(cdf_) ) {
+				SetPmf(dense);
+				return;
+			}
+
 			cdf.data.clear();
 			pmf.data.clear();
+			denseCdf.Clear();
 
 			double maxCdf = 0;
 			bool isFirst = true;
@@ -164,6 +262,27 @@ namespace QutBio {
 			sigma = sqrt(sum_p_x_2 - mu * mu);
 		}
 
+		/// <summary>
+		///	Sets the distribution from a probability mass function on a fixed-step grid.
+		/// </summary>
+		void SetPmf(const DenseHistogram<double> & pmf_) {
+			cdf.data.clear();
+			pmf.data.clear();
+
+			vector<double> pmfValues(pmf_.Size()), cdfValues(pmf_.Size());
+			double maxCdf = 0;
+
+			for ( size_t i = 0; i < pmf_.Size(); i++ ) {
+				if ( !pmf_.Contains(i) ) continue;
+
+				pmfValues[i] = pmf_.values[i];
+				maxCdf += pmf_.values[i];
+				cdfValues[i] = maxCdf;
+			}
+
+			SetDense(pmf_, pmfValues, cdfValues, maxCdf);
+		}
+
 		/// <summary>
 		///	Gets the distribution of the minimum of a subset containing 
 		///	subsetSize items from the underlying set.
@@ -173,6 +292,25 @@ namespace QutBio {
 			int subsetSize,
 			DiscreteDistribution & outDist
 			) {
+			if ( denseCdf.Size() > 0 ) {
+				DenseHistogram<double> min_cdf = denseCdf;
+
+				for ( size_t i = 0; i < min_cdf.Size(); i++ ) {
+					if ( !min_cdf.Contains(i) ) continue;
+
+					double Fm = 1 - pow(1 - min_cdf.values[i], subsetSize);
+					min_cdf.values[i] = Fm;
+
+					if ( Fm == 1 ) {
+						Truncate(min_cdf, i + 1);
+						break;
+					}
+				}
+
+				outDist.SetCdf(min_cdf);
+				return;
+			}
+
 			Histogram<double> max_cdf;
 
 			for ( auto k : cdf.data ) {
@@ -198,6 +336,25 @@ namespace QutBio {
 			int subsetSize,
 			DiscreteDistribution & outDist
 			) {
+			if ( denseCdf.Size() > 0 ) {
+				DenseHistogram<double> max_cdf = denseCdf;
+
+				for ( size_t i = 0; i < max_cdf.Size(); i++ ) {
+					if ( !max_cdf.Contains(i) ) continue;
+
+					double Fm = pow(max_cdf.values[i], subsetSize);
+					max_cdf.values[i] = Fm;
+
+					if ( Fm == 1 ) {
+						Truncate(max_cdf, i + 1);
+						break;
+					}
+				}
+
+				outDist.SetCdf(max_cdf);
+				return;
+			}
+
 			Histogram<double> max_cdf;
 
 			for ( auto k : cdf.data ) {
@@ -251,21 +408,14 @@ namespace QutBio {
 		}
 
 		double InverseCdf(double t) {
-			// TODO: consider a better solution based on directly traversing 
-			//  the tree, if that is possible. 
+			// Bisection on the interpolated CDF; each step is a single tree lookup.
 			if ( t < 0 || t > 1 ) {
 				return NAN;
 			}
 
-			vector<pair<double,double>> vec;
-			
-			for ( auto & rec : cdf.data ){
-				vec.push_back( rec );
-			}
-
 			const double epsilon = 1e-10;
-			double lo = vec.begin()->first;
-			double hi = vec.rbegin()->first;
+			double lo = cdf.data.begin()->first;
+			double hi = cdf.data.rbegin()->first;
 			double mid = (lo + hi) / 2;
 
 			while ( hi - lo >= epsilon ) {
@@ -310,6 +460,10 @@ namespace QutBio {
 				pmf.data.erase(key);
 				cdf.data.erase(key);
 			}
+
+			if ( toRemove.size() > 0 ) {
+				denseCdf.Assign(cdf);
+			}
 		}
 
 		/**
@@ -0,0 +1,488 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18),
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published
+// by the Free Software Foundation; either version 3, or (at your
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Exception.hpp"
+#include "HBRandom.hpp"
+#include "Histogram.hpp"
+#include "IntegerDistribution.hpp"
+#include "SimilarityMatrix.hpp"
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	A tabulated distance CDF <(x_i,F_i)|i=0..N>, with x_i strictly ascending,
+	 *	which answers inverse CDF queries by binary search.
+	 *	</summary>
+	 */
+	class TabulatedCdf {
+		std::vector<double> x;
+		std::vector<double> F;
+
+	public:
+		TabulatedCdf() {}
+
+		TabulatedCdf( const std::vector<double> & x, const std::vector<double> & F ) : x( x ), F( F ) {
+			if ( x.size() != F.size() || x.empty() ) {
+				throw Exception( "TabulatedCdf requires one or more (x,F) pairs.", FileAndLine );
+			}
+
+			for ( size_t i = 1; i < x.size(); i++ ) {
+				if ( !( x[i - 1] < x[i] ) || F[i - 1] > F[i] ) {
+					throw Exception( "TabulatedCdf requires ascending x and non-decreasing F.", FileAndLine );
+				}
+			}
+		}
+
+		/// <summary>Tabulates the CDF of an integer distribution over its support.</summary>
+		static TabulatedCdf FromDistribution( IntegerDistribution & dist ) {
+			std::vector<double> x, F;
+
+			for ( int i = dist.Min(); i <= dist.Max(); i++ ) {
+				x.push_back( i );
+				F.push_back( dist.Cdf( i ) );
+			}
+
+			return TabulatedCdf( x, F );
+		}
+
+		const std::vector<double> & X() const {
+			return x;
+		}
+
+		const std::vector<double> & Values() const {
+			return F;
+		}
+
+		size_t Size() const {
+			return x.size();
+		}
+
+		/// <summary>Gets the tabulated CDF at t, stepping between the tabulated points.</summary>
+		double Cdf( double t ) const {
+			auto pos = std::upper_bound( x.begin(), x.end(), t );
+			return pos == x.begin() ? 0 : F[pos - x.begin() - 1];
+		}
+
+		/**
+		 *	<summary>
+		 *	Gets the largest x_i such that F_i &lt;= p, the discrete inverse used by
+		 *	GetCdfInverse. If p &lt; F_0, returns x_0 - 1.
+		 *	</summary>
+		 */
+		double InverseCdf( double p ) const {
+			auto pos = std::upper_bound( F.begin(), F.end(), p );
+			return pos == F.begin() ? x[0] - 1 : x[pos - F.begin() - 1];
+		}
+
+		/**
+		 *	<summary>
+		 *	Gets the largest distance threshold t such that the probability of a
+		 *	distance less than or equal to t is at most pValue, or -1 if even a
+		 *	threshold of x_0 is too permissive.
+		 *	</summary>
+		 */
+		int Threshold( double pValue ) const {
+			return (int) std::floor( InverseCdf( pValue ) );
+		}
+	};
+
+	/**
+	 *	<summary>
+	 *	Identifies a distance distribution: the substitution matrix, the symbol
+	 *	composition from which both words are drawn, the kmer length, and the
+	 *	fragment length. The distribution is that of the least distance between
+	 *	a kmer and the fragmentLength - kmerLength + 1 kmers of a fragment, so
+	 *	fragmentLength == kmerLength gives the distance between two kmers.
+	 *	</summary>
+	 */
+	struct DistanceDistributionKey {
+		/// <summary>A hash of the one-symbol differences. See MatrixFingerprint.</summary>
+		uint64_t matrix = 0;
+
+		/// <summary>A readable name for the matrix, such as BLOSUM62.</summary>
+		std::string matrixLabel;
+
+		/// <summary>Normalised symbol frequencies, with case folded to lower.</summary>
+		std::map<char, double> composition;
+
+		uint kmerLength = 0;
+		uint fragmentLength = 0;
+
+		/// <summary>Gets a hash of the symbols and one-symbol differences of a matrix.</summary>
+		static uint64_t MatrixFingerprint( const SimilarityMatrix & matrix ) {
+			std::string symbols = matrix.Symbols();
+			uint64_t h = CounterRandom::Mix( symbols.size() );
+
+			for ( char a : symbols ) {
+				for ( char b : symbols ) {
+					uint64_t word = ( (uint64_t) (uint8_t) a << 24 ) | ( (uint64_t) (uint8_t) b << 16 ) | matrix.Difference( a, b );
+					h = CounterRandom::Mix( h ^ word );
+				}
+			}
+
+			return h;
+		}
+
+		/// <summary>Converts a symbol histogram to a normalised composition with case folded.</summary>
+		static std::map<char, double> Composition( const Histogram<char> & histogram ) {
+			std::map<char, double> composition;
+			double total = 0;
+
+			for ( auto & p : histogram.data ) {
+				composition[(char) std::tolower( (uint8_t) p.first )] += p.second;
+				total += p.second;
+			}
+
+			if ( total > 0 ) {
+				for ( auto & p : composition ) p.second /= total;
+			}
+
+			return composition;
+		}
+
+		/// <summary>Gets the total variation distance between two compositions.</summary>
+		static double CompositionDistance( const std::map<char, double> & a, const std::map<char, double> & b ) {
+			double sum = 0;
+			auto i = a.begin();
+			auto j = b.begin();
+
+			while ( i != a.end() || j != b.end() ) {
+				if ( j == b.end() || ( i != a.end() && i->first < j->first ) ) {
+					sum += i->second;
+					i++;
+				}
+				else if ( i == a.end() || j->first < i->first ) {
+					sum += j->second;
+					j++;
+				}
+				else {
+					sum += std::fabs( i->second - j->second );
+					i++;
+					j++;
+				}
+			}
+
+			return sum / 2;
+		}
+	};
+
+	/**
+	 *	<summary>
+	 *	A versioned binary file of precomputed kmer distance distributions, such as
+	 *	those produced by GetKmerTheoreticalDistanceDistributions --libraryFile.
+	 *	<para>
+	 *		Layout, in native byte order: the 8 byte Magic; uint32 Version; uint32
+	 *		entry count; then for each entry, uint64 matrix fingerprint, the matrix
+	 *		label, uint32 kmerLength, uint32 fragmentLength, uint32 symbol count
+	 *		followed by (char, double) pairs, uint32 N, and N x values followed by N
+	 *		CDF values. Strings are a uint32 length followed by the bytes.
+	 *	</para>
+	 *	</summary>
+	 */
+	class DistanceDistributionLibrary {
+	public:
+		struct Entry {
+			DistanceDistributionKey key;
+			TabulatedCdf cdf;
+		};
+
+		static const uint32_t Version = 1;
+
+		static const char * Magic() {
+			return "QUTDDLIB";
+		}
+
+	private:
+		std::vector<Entry> entries;
+
+	public:
+		DistanceDistributionLibrary() {}
+
+		explicit DistanceDistributionLibrary( const std::string & fileName ) {
+			Load( fileName );
+		}
+
+		const std::vector<Entry> & Entries() const {
+			return entries;
+		}
+
+		/// <summary>Adds an entry, replacing any with the same matrix, lengths and composition.</summary>
+		void Add( const DistanceDistributionKey & key, const TabulatedCdf & cdf ) {
+			for ( auto & entry : entries ) {
+				if ( entry.key.matrix == key.matrix
+					&& entry.key.kmerLength == key.kmerLength
+					&& entry.key.fragmentLength == key.fragmentLength
+					&& entry.key.composition == key.composition
+					) {
+					entry.cdf = cdf;
+					return;
+				}
+			}
+
+			entries.push_back( Entry{ key, cdf } );
+		}
+
+		/**
+		 *	<summary>
+		 *	Finds the entry for a matrix and kmer and fragment lengths whose
+		 *	composition is nearest to the designated composition, provided the
+		 *	total variation distance between them is at most tolerance.
+		 *	</summary>
+		 *	<returns>The entry, or null if there is none.</returns>
+		 */
+		const Entry * Find(
+			uint64_t matrix,
+			const std::map<char, double> & composition,
+			uint kmerLength,
+			uint fragmentLength,
+			double tolerance = 0.05
+		) const {
+			const Entry * best = 0;
+			double bestDistance = tolerance;
+
+			for ( auto & entry : entries ) {
+				if ( entry.key.matrix != matrix || entry.key.kmerLength != kmerLength || entry.key.fragmentLength != fragmentLength ) continue;
+
+				double d = DistanceDistributionKey::CompositionDistance( entry.key.composition, composition );
+
+				if ( d <= bestDistance ) {
+					best = &entry;
+					bestDistance = d;
+				}
+			}
+
+			return best;
+		}
+
+		/**
+		 *	<summary>
+		 *	Selects the distance threshold for a p-value from a library file: the
+		 *	largest threshold at which a kmer drawn from the composition falls
+		 *	within threshold of a random word (or fragment) with probability at most
+		 *	pValue.
+		 *	</summary>
+		 *	<exception cref="Exception">The file cannot be read, or holds no matching entry.</exception>
+		 */
+		static int SelectThreshold(
+			const std::string & fileName,
+			const SimilarityMatrix & matrix,
+			const Histogram<char> & symbols,
+			uint kmerLength,
+			uint fragmentLength,
+			double pValue
+		) {
+			DistanceDistributionLibrary library( fileName );
+			auto entry = library.Find( DistanceDistributionKey::MatrixFingerprint( matrix ), DistanceDistributionKey::Composition( symbols ), kmerLength, fragmentLength );
+
+			if ( !entry ) {
+				throw Exception( "Distribution library '" + fileName + "' has no entry for this matrix and composition with kmerLength "
+					+ std::to_string( kmerLength ) + " and fragmentLength " + std::to_string( fragmentLength ) + ".", FileAndLine );
+			}
+
+			return entry->cdf.Threshold( pValue );
+		}
+
+		void Load( const std::string & fileName ) {
+			std::ifstream in( fileName, std::ios::binary );
+
+			if ( !in ) {
+				throw Exception( "Unable to read distribution library '" + fileName + "'.", FileAndLine );
+			}
+
+			in.seekg( 0, std::ios::end );
+			const uint64_t size = (uint64_t) in.tellg();
+			in.seekg( 0, std::ios::beg );
+
+			// Rejects a count read from the file if that many items of the 
+			// designated size cannot fit in the rest of it.
+			auto checkCount = [&]( uint64_t count, uint64_t itemBytes, const char * what ) {
+				if ( !in ) {
+					throw Exception( "Distribution library '" + fileName + "' is truncated.", FileAndLine );
+				}
+
+				if ( count > Remaining( in, size ) / itemBytes ) {
+					throw Exception( "Distribution library '" + fileName + "' is corrupt: " + what + " " 
+						+ std::to_string( count ) + " does not fit in the file.", FileAndLine );
+				}
+			};
+
+			char magic[8];
+			in.read( magic, sizeof( magic ) );
+
+			if ( !in || memcmp( magic, Magic(), sizeof( magic ) ) != 0 ) {
+				throw Exception( "'" + fileName + "' is not a distribution library.", FileAndLine );
+			}
+
+			uint32_t version = Read<uint32_t>( in );
+
+			if ( version != Version ) {
+				throw Exception( "Distribution library '" + fileName + "' has version " + std::to_string( version )
+					+ "; expected " + std::to_string( Version ) + ".", FileAndLine );
+			}
+
+			uint32_t count = Read<uint32_t>( in );
+			checkCount( count, MinEntryBytes, "entry count" );
+			entries.clear();
+			entries.reserve( count );
+
+			for ( uint32_t i = 0; i < count; i++ ) {
+				DistanceDistributionKey key;
+				key.matrix = Read<uint64_t>( in );
+				key.matrixLabel = ReadString( in, size );
+				key.kmerLength = Read<uint32_t>( in );
+				key.fragmentLength = Read<uint32_t>( in );
+
+				uint32_t symbols = Read<uint32_t>( in );
+				checkCount( symbols, sizeof( char ) + sizeof( double ), "symbol count" );
+
+				for ( uint32_t j = 0; j < symbols; j++ ) {
+					char c = Read<char>( in );
+					key.composition[c] = Read<double>( in );
+				}
+
+				uint32_t n = Read<uint32_t>( in );
+
+				if ( !in ) {
+					throw Exception( "Distribution library '" + fileName + "' is truncated.", FileAndLine );
+				}
+
+				checkCount( n, 2 * sizeof( double ), "point count" );
+
+				std::vector<double> x( n ), F( n );
+				ReadArray( in, x );
+				ReadArray( in, F );
+
+				if ( !in ) {
+					throw Exception( "Distribution library '" + fileName + "' is truncated.", FileAndLine );
+				}
+
+				entries.push_back( Entry{ key, TabulatedCdf( x, F ) } );
+			}
+		}
+
+		void Save( const std::string & fileName ) const {
+			std::ofstream out( fileName, std::ios::binary );
+
+			if ( !out ) {
+				throw Exception( "Unable to create distribution library '" + fileName + "'.", FileAndLine );
+			}
+
+			out.write( Magic(), 8 );
+			Write<uint32_t>( out, Version );
+			Write<uint32_t>( out, (uint32_t) entries.size() );
+
+			for ( auto & entry : entries ) {
+				auto & key = entry.key;
+				Write<uint64_t>( out, key.matrix );
+				WriteString( out, key.matrixLabel );
+				Write<uint32_t>( out, key.kmerLength );
+				Write<uint32_t>( out, key.fragmentLength );
+				Write<uint32_t>( out, (uint32_t) key.composition.size() );
+
+				for ( auto & p : key.composition ) {
+					Write<char>( out, p.first );
+					Write<double>( out, p.second );
+				}
+
+				Write<uint32_t>( out, (uint32_t) entry.cdf.Size() );
+				WriteArray( out, entry.cdf.X() );
+				WriteArray( out, entry.cdf.Values() );
+			}
+
+			// Buffered data is only written, and any error reported, on close.
+			out.close();
+
+			if ( !out ) {
+				throw Exception( "Unable to write distribution library '" + fileName + "'.", FileAndLine );
+			}
+		}
+
+	private:
+		// The bytes of the smallest entry: matrix, label length, kmer length, 
+		// fragment length, symbol count and point count.
+		static const uint64_t MinEntryBytes = sizeof( uint64_t ) + 5 * sizeof( uint32_t );
+
+		static uint64_t Remaining( std::istream & in, uint64_t size ) {
+			std::streamoff pos = in.tellg();
+			return pos < 0 || (uint64_t) pos > size ? 0 : size - (uint64_t) pos;
+		}
+
+		template<typename T>
+		static T Read( std::istream & in ) {
+			T value = T();
+			in.read( (char *) &value, sizeof( T ) );
+			return value;
+		}
+
+		template<typename T>
+		static void Write( std::ostream & out, T value ) {
+			out.write( (const char *) &value, sizeof( T ) );
+		}
+
+		static void ReadArray( std::istream & in, std::vector<double> & values ) {
+			in.read( (char *) values.data(), values.size() * sizeof( double ) );
+		}
+
+		static void WriteArray( std::ostream & out, const std::vector<double> & values ) {
+			out.write( (const char *) values.data(), values.size() * sizeof( double ) );
+		}
+
+		/// <summary>Reads a string, setting the fail bit if its length does not fit in the rest of the file.</summary>
+		static std::string ReadString( std::istream & in, uint64_t size ) {
+			uint32_t length = Read<uint32_t>( in );
+
+			if ( in && length > Remaining( in, size ) ) in.setstate( std::ios::failbit );
+
+			std::string s( in ? length : 0, '\0' );
+			in.read( &s[0], s.size() );
+			return s;
+		}
+
+		static void WriteString( std::ostream & out, const std::string & s ) {
+			Write<uint32_t>( out, (uint32_t) s.size() );
+			out.write( s.data(), s.size() );
+		}
+	};
+}
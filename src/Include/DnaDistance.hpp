@@ -26,48 +26,133 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <string>
+
 #include "DistanceType.hpp"
+#include "Alphabet.hpp"
 
 namespace QutBio {
 
 	// Making this an object instead of a static function will let me
 	// use it in the KmerClusterAL template class.
+	//
+	// DNA kmers of up to MaxKmerLength bases are packed 2 bits per base into
+	// a single 64 bit code (see Alphabet::PackedDnaCharsPerWord), which is 
+	// stored as a pair of KmerWords. The distance between two kmers is the 
+	// number of mismatched bases, taken over the better of the two strands, 
+	// so a kmer and its reverse complement are at distance zero.
 	class DnaDistance {
 #if INSTRUMENT_DNA_DIST
-		size_t callCounter = 0;
+		mutable size_t callCounter = 0;
 #endif
 	public:
 
 #define MASK1 (0x5555555555555555ULL)
 #define MASK2 (MASK1<<1)
 
+		/// <summary>The longest kmer which fits in a packed 64 bit code.</summary>
+		static const uint MaxKmerLength = 32;
+
+		/// <summary>The charsPerWord value which selects the packed 2-bit encoding.</summary>
+		uint CharsPerWord() const {
+			return Alphabet::PackedDnaCharsPerWord;
+		}
+
+		/// <summary>Gets the packed 64 bit code of a kmer from its KmerWord image.</summary>
+		static uint64_t Load(const KmerWord * x) {
+			uint64_t code;
+			memcpy(&code, x, sizeof(code));
+			return code;
+		}
+
+		/// <summary>Counts the mismatched bases in two packed codes.</summary>
+		static Distance Mismatches(uint64_t x, uint64_t y) {
+			uint64_t a = x ^ y;
+			return (Distance)POPCOUNT((a | (a >> 1)) & MASK1);
+		}
+
+		/// <summary>Gets the packed code of the reverse complement of a kmer.
+		///		With a=0, c=1, g=2, t=3 the complement of each base is its bitwise
+		///		negation; the 2-bit groups are then reversed in place and the result
+		///		shifted down so that it occupies the low 2*kmerLength bits.
+		/// </summary>
+		static uint64_t ReverseComplement(uint64_t code, uint kmerLength) {
+			uint64_t x = ~code;
+			x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+			x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+			x = __builtin_bswap64(x);
+			return x >> (64 - 2 * kmerLength);
+		}
+
+		/// <summary>Gets the strand-independent representative of a packed kmer.</summary>
+		static uint64_t Canonical(uint64_t code, uint kmerLength) {
+			return std::min(code, ReverseComplement(code, kmerLength));
+		}
+
+		/// <summary>Gets the reverse complement of a DNA or RNA string. 
+		///		Symbols other than acgtu are left unchanged.
+		/// </summary>
+		static string ReverseComplement(const string & s) {
+			string result(s.rbegin(), s.rend());
+
+			for (auto & ch : result) {
+				switch (ch) {
+				case 'a': ch = 't'; break;
+				case 'c': ch = 'g'; break;
+				case 'g': ch = 'c'; break;
+				case 't': case 'u': ch = 'a'; break;
+				case 'A': ch = 'T'; break;
+				case 'C': ch = 'G'; break;
+				case 'G': ch = 'C'; break;
+				case 'T': case 'U': ch = 'A'; break;
+				}
+			}
+
+			return result;
+		}
+
+		/// <summary>Gets the lesser of a kmer string and its reverse complement.
+		///		This agrees with Canonical on packed codes because acgt sort in 
+		///		the same order as their 2-bit codes.
+		/// </summary>
+		static string Canonical(const string & s) {
+			string rc = ReverseComplement(s);
+			return rc < s ? rc : s;
+		}
+
 		// DNA kmers are always encoded in a single 64 bit word,
 		// so we can just calculate the Hamming distance by bit 
 		// operations.
 		Distance GetDistance1(KmerWord x, KmerWord y) const {
-			uint64_t a = x ^ y;
-			uint64_t b = a & MASK1;
-			uint64_t c = (a & MASK2) >> 1;
-			uint64_t d = b | c;
-			return POPCOUNT(d);
+			return Mismatches(x, y);
 		}
 
-		// Hot spot: lines 38, 39
-		Distance operator()(KmerWord *x, KmerWord *y, uint kmerLength) const {
+		Distance operator()(const KmerWord *x, const KmerWord *y, uint kmerLength) const {
 #if INSTRUMENT_DNA_DIST
 			callCounter++;
 #endif
-			Distance dist = 0;
-
-			for (size_t i = 0; i * (CHAR_BIT * sizeof(KmerWord) / 2) < kmerLength; i++) {
-				uint64_t a = x[i] ^ y[i];
-				uint64_t b = a & MASK1;
-				uint64_t c = (a & MASK2) >> 1;
-				uint64_t d = b | c;
-				dist += POPCOUNT(d);
+			uint64_t a = Load(x);
+			uint64_t b = Load(y);
+			return std::min(Mismatches(a, b), Mismatches(ReverseComplement(a, kmerLength), b));
+		}
+
+		/// <summary> Inline kernel passed by Dispatch. </summary>
+		struct Kernel {
+			uint kmerLength;
+
+			Distance operator()(const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint = 0) const {
+				uint64_t a = Load(sKmerCode);
+				uint64_t b = Load(tKmerCode);
+				return std::min(Mismatches(a, b), Mismatches(ReverseComplement(a, kmerLength), b));
 			}
+		};
 
-			return dist;
+		/// <summary> Invokes action(kernel), matching the interface of the kmer distance caches. </summary>
+		template<typename Action>
+		void Dispatch(uint kmerLength, Action && action) const {
+			action(Kernel{ kmerLength });
 		}
 
 #undef MASK1
@@ -32,6 +32,7 @@
 #define __cplusplus 201103L
 #endif
 
+#include <algorithm>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -46,6 +47,8 @@
 #include "TrecEvalRecord.hpp"
 #include "EncodedKmer.hpp"
 #include "Alphabet.hpp"
+#include "MappedFile.hpp"
+#include "MemoryAccount.hpp"
 
 namespace QutBio {
 	using EncodingMatrix = vector<vector<KmerWord>>;
@@ -371,6 +374,42 @@ namespace QutBio {
 		}
 	};
 
+	/**
+	 *	<summary>
+	 *	The counts of sequences and bytes in a FASTA file, gathered by a quick 
+	 *	scan of the mapped file without parsing, for memory estimates.
+	 *	</summary>
+	 */
+	struct FastaFileStats {
+		size_t sequences = 0;
+		size_t residues = 0;
+		size_t defLineBytes = 0;
+
+		static FastaFileStats Scan( const string & fileName ) {
+			FastaFileStats stats;
+			MappedFile file( fileName );
+			const char * p = file.Data();
+			const char * end = p + file.Size();
+
+			while ( p < end ) {
+				const char * eol = (const char *) memchr( p, '\n', end - p );
+				if ( !eol ) eol = end;
+
+				if ( *p == '>' ) {
+					stats.sequences++;
+					stats.defLineBytes += eol - p;
+				}
+				else {
+					stats.residues += eol - p;
+				}
+
+				p = eol + 1;
+			}
+
+			return stats;
+		}
+	};
+
 	class EncodedFastaSequence {
 	protected:
 		string id;
@@ -401,6 +440,10 @@ namespace QutBio {
 		// Update (hacky!) When switching to the centroid-based codebook, I need to access one-char and two-char encodings.
 		EncodingMatrix encoding1, encoding2;
 
+		// For packed nucleotide encodings, the ascending positions of symbols outside the alphabet
+		// (N and other ambiguity codes, or padding). Kmers which cover any of them are unknown.
+		vector<uint> unknownPositions;
+
 		const string &Id() const { return id; }
 		const string &ClassLabel() const { return classLabel; }
 		const vector<uint64_t> Embedding() { return embedding; }
@@ -507,6 +550,10 @@ namespace QutBio {
 		{
 			Sequence( sequence );
 
+			if ( alphabet ) {
+				alphabet->Reduce( this->sequence );
+			}
+
 			if ( classLabel.size() > 0 ) {
 				auto splitClassLabels = String::Split( classLabel, ';' );
 
@@ -747,6 +794,64 @@ namespace QutBio {
 			return false;
 		}
 
+		/// <summary>Gets the bytes held by this object and its strings and bookkeeping.</summary>
+		size_t SequenceBytes() const {
+			return sizeof( *this ) + MemoryAccount::BlockOverhead
+				+ MemoryAccount::HeapBytes( id )
+				+ MemoryAccount::HeapBytes( classLabel )
+				+ MemoryAccount::HeapBytes( defLine )
+				+ MemoryAccount::HeapBytes( sequence )
+				+ MemoryAccount::HeapBytes( rowMinima )
+				+ MemoryAccount::HeapBytes( colMinima )
+				+ MemoryAccount::HeapBytes( homologs )
+				+ MemoryAccount::HeapBytes( classNumbers );
+		}
+
+		/// <summary>Gets the bytes held by the numeric encodings and embedding of this sequence.</summary>
+		size_t EncodingBytes() const {
+			size_t bytes = MemoryAccount::HeapBytes( embedding )
+				+ MemoryAccount::HeapBytes( encoding1 )
+				+ MemoryAccount::HeapBytes( encoding2 )
+				+ MemoryAccount::HeapBytes( unknownPositions );
+
+			for ( auto & row : encoding1 ) bytes += MemoryAccount::HeapBytes( row );
+			for ( auto & row : encoding2 ) bytes += MemoryAccount::HeapBytes( row );
+
+			return bytes;
+		}
+
+		/// <summary>Records the footprint of a collection of sequences in the memory account.</summary>
+		template<typename Collection>
+		static void Account( Collection & sequences, MemoryAccount::Category sequenceCategory, MemoryAccount::Category encodingCategory ) {
+			size_t sequenceBytes = 0, encodingBytes = 0;
+
+			for ( auto seq : sequences ) {
+				sequenceBytes += seq->SequenceBytes();
+				encodingBytes += seq->EncodingBytes();
+			}
+
+			MemoryAccount::Set( sequenceCategory, sequenceBytes );
+			MemoryAccount::Set( encodingCategory, encodingBytes );
+		}
+
+		/**
+		 *	<summary>
+		 *	Estimates the bytes needed to load a FASTA file with the designated
+		 *	statistics. Encodings hold one word per position for charsPerWord = 1
+		 *	and two otherwise (the 1-symbol encoding is always kept as well).
+		 *	</summary>
+		 */
+		static void Estimate( const FastaFileStats & stats, size_t kmerLength, size_t charsPerWord, size_t & sequenceBytes, size_t & encodingBytes ) {
+			const size_t block = MemoryAccount::BlockOverhead;
+			const size_t positions = stats.residues + stats.sequences * kmerLength;
+			const size_t rows = charsPerWord > 1 ? 1 + charsPerWord : 1;
+
+			sequenceBytes = stats.sequences * ( sizeof( EncodedFastaSequence ) + sizeof( void * ) + 3 * block + 2 )
+				+ positions + stats.defLineBytes;
+			encodingBytes = positions * sizeof( KmerWord ) * ( charsPerWord > 1 ? 2 : 1 )
+				+ stats.sequences * ( 2 * sizeof( EncodingMatrix ) + rows * ( sizeof( vector<KmerWord> ) + block ) );
+		}
+
 		void SetEmbedding( const CharMap &charMap ) {
 			embedding.resize( sequence.size() );
 
@@ -865,7 +970,18 @@ namespace QutBio {
 		void Encode( Alphabet *alphabet, size_t kmerLength, size_t charsPerWord, char defaultSymbol = 'x' ) {
 			this->charsPerWord = charsPerWord;
 			this->kmerLength = kmerLength;
+			size_t unpaddedLength = length;
 			Pad( kmerLength, defaultSymbol );
+			unknownPositions.clear();
+
+			if ( charsPerWord == Alphabet::PackedDnaCharsPerWord ) {
+				for ( size_t i = 0; i < length; i++ ) {
+					if ( i >= unpaddedLength || !alphabet->Contains( sequence[i] ) ) {
+						unknownPositions.push_back( (uint) i );
+					}
+				}
+			}
+
 			alphabet->Encode( sequence.c_str(), length, kmerLength, 1, encoding1 );
 
 			if ( charsPerWord > 1 ) {
@@ -882,12 +998,28 @@ namespace QutBio {
 			return length >= K ? length + 1 - K : 0;
 		}
 
+		/**
+		*	<summary>
+		*	Returns true if and only if the kmer of length K at pos covers a symbol
+		*	outside the alphabet. Such kmers have no valid packed code, so they are 
+		*	left out of kmer indices and signatures.
+		*	</summary>
+		*/
+		bool IsUnknownKmer( size_t pos, size_t K ) const {
+			if ( unknownPositions.empty() ) return false;
+
+			auto p = std::lower_bound( unknownPositions.begin(), unknownPositions.end(), pos );
+			return p != unknownPositions.end() && *p < pos + K;
+		}
+
 		EncodedKmer GetEncodedKmer( size_t pos ) {
 			return charsPerWord == 0 ? GetEncodedKmerError( pos ) : charsPerWord == 1 ? GetEncodedKmer1( pos ) : charsPerWord == 2 ? GetEncodedKmer2( pos ) : charsPerWord == 3 ? GetEncodedKmer3( pos ) : GetEncodedKmerGeneral( pos );
 		}
 
 		EncodedKmer GetEncodedKmerGeneral( size_t pos ) {
-			return kmerLength <= charsPerWord
+			return charsPerWord == Alphabet::PackedDnaCharsPerWord
+				? &encoding2[0][pos * Alphabet::WordsPerKmer( kmerLength, charsPerWord )]
+				: kmerLength <= charsPerWord
 				? &encoding2[0][pos]
 				: &encoding2[pos % charsPerWord][pos / charsPerWord];
 		}
@@ -32,6 +32,9 @@
 #define __cplusplus 201103L
 #endif
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include "Array.hpp"
 #include "Assert.hpp"
@@ -57,7 +60,93 @@ namespace QutBio {
 		double aicc = 0;
 		double epsilon;
 
+		/// <summary>The number of observations whose densities are evaluated together, one kernel at a time.</summary>
+		static const size_t Block = 32;
+
+		/// <summary>
+		///	Log densities are raised to this value, which is below log(1e-10), so
+		///	that the floor applies without exp producing subnormals.
+		/// </summary>
+		static constexpr double MinLogDensity = -24;
+
+		/**
+		**	<summary>
+		**		Accumulates the E step for up to Block observations. The log density
+		**		of each kernel, log a_j - log sigma_j - log sqrt(2 pi) - z^2/2, is 
+		**		evaluated across the block in a loop free of branches, then 
+		**		exponentiated and floored at 1e-10, and the responsibilities are 
+		**		added to acc as described in Train.
+		**	</summary>
+		*/
+		template<typename T>
+		static void Accumulate(
+			const T * x,
+			size_t count,
+			size_t m,
+			const double * mu,
+			const double * invSigma,
+			const double * logNorm,
+			double * p,
+			double * acc
+			) {
+			double total_p[Block] = { 0 };
+			double xb[Block];
+
+			for ( size_t b = 0; b < count; b++ ) {
+				xb[b] = (double) x[b];
+			}
+
+			for ( size_t j = 0; j < m; j++ ) {
+				double * pj = p + j * Block;
+				const double mu_j = mu[j], invSigma_j = invSigma[j], logNorm_j = logNorm[j];
+
+#pragma omp simd
+				for ( size_t b = 0; b < count; b++ ) {
+					double z = (xb[b] - mu_j) * invSigma_j;
+					pj[b] = std::max(logNorm_j - 0.5 * z * z, (double) MinLogDensity);
+				}
+
+				for ( size_t b = 0; b < count; b++ ) {
+					double t = std::max(1e-10, exp(pj[b]));
+
+					// TODO - Do something more elegant to permit the probabilities to be evaluated
+					// TODO - Similar to what I did in LMVQ.
+					if ( !isfinite(t) ) t = 0;
+
+					pj[b] = t;
+					total_p[b] += t;
+				}
+			}
+
+			for ( size_t j = 0; j < m; j++ ) {
+				const double * pj = p + j * Block;
+				const double mu_j = mu[j];
+				double sum_p = 0, sum_p_d = 0, sum_p_d_squared = 0;
+
+#pragma omp simd reduction(+:sum_p,sum_p_d,sum_p_d_squared)
+				for ( size_t b = 0; b < count; b++ ) {
+					double w = pj[b] / total_p[b];
+					double d = xb[b] - mu_j;
+					sum_p += w;
+					sum_p_d += w * d;
+					sum_p_d_squared += w * d * d;
+				}
+
+				acc[j] += sum_p;
+				acc[m + j] += sum_p_d;
+				acc[2 * m + j] += sum_p_d_squared;
+			}
+		}
+
 	public:
+		/// <summary>Receives a contiguous chunk of observations.</summary>
+		template<typename T>
+		using Chunk = std::function<void(const T *, size_t)>;
+
+		/// <summary>Passes every observation of a data set to a Chunk, in one or more pieces.</summary>
+		template<typename T>
+		using Scan = std::function<void(const Chunk<T> &)>;
+
 		/**
 		**	<summary>
 		**		Initialises the mixture of Gaussians to hold the specified number of
@@ -179,182 +268,110 @@ namespace QutBio {
 
 		template<typename T>
 		void Train(const std::vector<T> & data, const uint epochs, const double epsilon, bool verbose = false) {
-			using std::vector;
-			size_t m = a.size();
-			size_t n = data.size();
-			const T *x = data.data();
-
-			vector<double> a2(a);
-			vector<double> mu2(mu);
-			vector<double> sigma2(sigma);
+			Train<T>(
+				[&data](const Chunk<T> & visit) { visit(data.data(), data.size()); },
+				epochs, epsilon, verbose
+				);
+		}
 
-			double * curr_a(a.data());
-			double * curr_mu(mu.data());
-			double * curr_sigma(sigma.data());
+		/***
+		 *	<summary>
+		 *		Apply the EM algorithm to a data set which is presented in chunks, so
+		 *		that it need not be resident in memory. Each epoch calls scan once;
+		 *		scan must pass every observation to its argument, in one or more
+		 *		contiguous chunks. The accumulators are additive over chunks, so
+		 *		this is full-batch EM, and a set passed as one chunk is trained
+		 *		exactly as by the vector overload.
+		 *	</summary>
+		 *	<param name="scan">
+		 *		Streams the data set through a Chunk callback, for example by reading
+		 *		a file block by block.
+		 *	</param>
+		 ***/
 
-			double * next_a(a2.data());
-			double * next_mu(mu2.data());
-			double * next_sigma(sigma2.data());
+		template<typename T>
+		void Train(const Scan<T> & scan, const uint epochs, const double epsilon, bool verbose = false) {
+			using std::vector;
+			const size_t m = a.size();
 
-			double ** p;
-			double ** sum_p;
-			double ** sum_p_x;
-			double ** sum_p_x_squared;
+			// Each thread owns 3m accumulators, laid out as sum_p[m], sum_p_d[m], 
+			// sum_p_d_squared[m], where d = x - mu[j] is measured from the current 
+			// centre. Blocks are padded by a full cache line so that no two threads
+			// write to the same line.
+			const size_t lineDoubles = 64 / sizeof(double);
+			const size_t stride = (3 * m + lineDoubles - 1) / lineDoubles * lineDoubles + lineDoubles;
+			const int numThreads = omp_get_max_threads();
 
-			RawMatrix<double> pijm(n, m);
-			vector<vector<double>> & pij( pijm.data );
+			vector<double> accumulators(numThreads * stride);
+			vector<double> logA(m), invSigma(m), logNorm(m);
+			vector<double> next_a(m), next_mu(m), next_sigma(m);
 
-			int numThreads = 0;
 			time_t start_time = time(0);
 
-#if USE_OMP
-#pragma omp parallel
-#endif
-			numThreads = omp_get_num_threads();
-
 			if ( verbose ) {
 				cerr << "Training Gaussian mixture model with " << numThreads << " threads." << endl;
 				cerr << "Start time: " << start_time << endl;
 			}
 
-			p = (double **) alloca(m*sizeof(double *));
-			sum_p = (double **) alloca(m*sizeof(double *));
-			sum_p_x = (double **) alloca(m*sizeof(double *));
-			sum_p_x_squared = (double **) alloca(m*sizeof(double *));
-
-			// Create accumulators for each thread.
-			for ( size_t j = 0; j < m; j++ ) {
-				p[j] = (double *) alloca(numThreads*sizeof(double));
-				sum_p[j] = (double *) alloca(numThreads*sizeof(double));
-				sum_p_x[j] = (double *) alloca(numThreads*sizeof(double));
-				sum_p_x_squared[j] = (double *) alloca(numThreads*sizeof(double));
-			}
-
-			auto swap_pointers = [&](void) {
-				double *t;
-				t = next_a; next_a = curr_a; curr_a = t;
-				t = next_mu; next_mu = curr_mu; curr_mu = t;
-				t = next_sigma; next_sigma = curr_sigma; curr_sigma = t;
-			};
-
 			for ( uint epoch = 0; epoch < epochs; epoch++ ) {
-				for ( uint j = 0; j < m; j++ ) {
-					for ( int thread = 0; thread < numThreads; thread++ ) {
-						// Clear the accumulators for each parameter.
-						p[j][thread] = 0;
-						sum_p[j][thread] = 0;
-						sum_p_x[j][thread] = 0;
-						sum_p_x_squared[j][thread] = 0;
-					}
+				for ( size_t j = 0; j < m; j++ ) {
+					invSigma[j] = 1 / sigma[j];
+					logNorm[j] = log(a[j]) - log(sigma[j]) - 0.5 * log(2 * M_PI);
 				}
 
-				// calculate sum of probabilities, a and mu for next step.
-#if USE_OMP
-#pragma omp parallel for
-#endif
-				for (size_t i = 0; i < n; i++ ) {
-					int thread = omp_get_thread_num();
-
-					// This is local to each training observation (indexed by distinct i values)
-					// so it is not subject to race conditions.
-					double total_p = 0;
-
-					for ( uint j = 0; j < m; j++ ) {
-						double t = max(1e-10, NormalDistribution::Pdf(x[i], curr_mu[j], curr_sigma[j]) * curr_a[j]);
-						pij[i][j] = t;
-
-						// TODO - Do something more elegant to permit the probabilities to be evaluated
-						// TODO - Similar to what I did in LMVQ.
-						if ( !isfinite(t) ) {
-							p[j][thread] = 0;
-							continue;
-						}
-
-						p[j][thread] = t;
-						total_p += t;
-					}
-
-					for ( uint j = 0; j < m; j++ ) {
-						double w = p[j][thread] / total_p;
-						sum_p[j][thread] += w;
-						sum_p_x[j][thread] += x[i] * w;
-					}
-				}
+				std::fill(accumulators.begin(), accumulators.end(), 0.0);
+				size_t n = 0;
 
-				for ( uint j = 0; j < m; j++ ) {
-					// Collect the partial sums computed by individual threads into sum.
-					double sum_p_j = 0, sum_p_x_j = 0;
+				scan([&](const T * x, size_t count) {
+					n += count;
 
-					for ( int thread = 0; thread < numThreads; thread++ ) {
-						sum_p_j += sum_p[j][thread];
-						sum_p_x_j += sum_p_x[j][thread];
-					}
-
-					next_a[j] = sum_p_j / n;
-					next_mu[j] = sum_p_x_j / sum_p_j;
-				}
-
-				// calculate variance.
-				// TODO - Optimise this if it needs optimising.
 #if USE_OMP
-#pragma omp parallel for
+#pragma omp parallel
 #endif
-				for (size_t i = 0; i < n; i++ ) {
-					int thread = omp_get_thread_num();
-
-					double total_p = 0;
-
-					for ( uint j = 0; j < m; j++ ) {
-						double t = pij[i][j];
-
-						// TODO - Do something more elegant to permit the probabilities to be evaluated
-						// TODO - Similar to what I did in LMVQ.
-						if ( !isfinite(t) ) continue;
-
-						p[j][thread] = t;
-						total_p += t;
-					}
+					{
+						double * acc = accumulators.data() + omp_get_thread_num() * stride;
+						vector<double> p(m * Block);
 
-					if ( total_p > 0 ) {
-
-						for ( uint j = 0; j < m; j++ ) {
-							double t = x[i] - next_mu[j];
-							sum_p_x_squared[j][thread] += t * t * p[j][thread] / total_p;
+#if USE_OMP
+#pragma omp for schedule(static)
+#endif
+						for ( int64_t i = 0; i < (int64_t) count; i += Block ) {
+							Accumulate(x + i, std::min((size_t) Block, count - i), m, mu.data(), invSigma.data(), logNorm.data(), p.data(), acc);
 						}
 					}
-				}
+				});
 
-				for ( uint j = 0; j < m; j++ ) {
-					double sum_p_j = 0;
-					double sum_p_x_squared_j = 0;
+				// Collect the partial sums computed by individual threads, then 
+				// take the M step in closed form. 
+				for ( size_t j = 0; j < m; j++ ) {
+					double sum_p = 0, sum_p_d = 0, sum_p_d_squared = 0;
 
 					for ( int thread = 0; thread < numThreads; thread++ ) {
-						sum_p_j += sum_p[j][thread];
-						sum_p_x_squared_j += sum_p_x_squared[j][thread];
+						const double * acc = accumulators.data() + thread * stride;
+						sum_p += acc[j];
+						sum_p_d += acc[m + j];
+						sum_p_d_squared += acc[2 * m + j];
 					}
 
-					next_sigma[j] = sqrt(sum_p_x_squared_j / sum_p_j);
-					//cerr << "j = " << j << ", a[j] = " << next_a[j] 
-					//	<< ", mu[j] = " << next_mu[j]
-					//	<< ", sigma[j] = " << next_sigma[j]
-					//	<< endl;
+					double shift = sum_p_d / sum_p;
+					next_a[j] = sum_p / n;
+					next_mu[j] = mu[j] + shift;
+					next_sigma[j] = sqrt(std::max(0.0, sum_p_d_squared / sum_p - shift * shift));
 				}
 
+				double change = Distance(next_a, next_mu, next_sigma);
+
+				a = next_a;
+				mu = next_mu;
+				sigma = next_sigma;
+
 				if ( verbose ) {
-					cerr << "Epoch " << epoch << ": LogLikelihood = " << LogLikelihood(data) << endl;
+					cerr << "Epoch " << epoch << ": LogLikelihood = " << LogLikelihood<T>(scan) << endl;
 				}
 
-				if ( Distance(a2, mu2, sigma2) < epsilon ) {
+				if ( change < epsilon ) {
 					break;
 				}
-
-				swap_pointers();
-			}
-
-			if ( curr_a == a.data() ) {
-				a = a2;
-				mu = mu2;
-				sigma = sigma2;
 			}
 
 			if ( verbose ) {
@@ -443,6 +460,29 @@ namespace QutBio {
 			return logLikelihood;
 		}
 
+		/***
+		*	<summary>
+		*		Gets the natural logarithm of the likelihood of a data set which is 
+		*		presented in chunks, as for the streaming overload of Train.
+		*	</summary>
+		***/
+
+		template<typename T>
+		double LogLikelihood(const Scan<T> & scan) {
+			double logLikelihood = 0;
+
+			scan([&](const T * x, size_t count) {
+#if USE_OMP
+#pragma omp parallel for reduction(+:logLikelihood)
+#endif
+				for ( int64_t i = 0; i < (int64_t) count; i++ ) {
+					logLikelihood += log(Pdf(x[i]));
+				}
+			});
+
+			return logLikelihood;
+		}
+
 		/***
 		*	<summary>
 		*		Gets the corrected Akaike Information Criterion of the model for a set of numeric
@@ -32,6 +32,7 @@
 #define __cplusplus 201103L
 #endif
 
+#include <cstdint>
 #include <random>
 
 namespace QutBio {
@@ -48,6 +49,36 @@ namespace QutBio {
 		}
 	};
 
+	/**
+	 *	<summary>
+	 *	A counter-based uniform generator on [0,1). The i-th draw of stream s under
+	 *	a given seed is a fixed hash of (seed, s, i), so a stream can be handed to 
+	 *	any thread, and a parallel loop which gives each work item its own stream
+	 *	produces the same values for every thread count and schedule.
+	 *	</summary>
+	 */
+	struct CounterRandom {
+		uint64_t key;
+		uint64_t counter = 0;
+
+		CounterRandom( uint64_t seed, uint64_t stream = 0 ) : key( Mix( Mix( seed ) ^ stream ) ) {}
+
+		/// <summary>The SplitMix64 finaliser, a bijection on 64 bit words.</summary>
+		static uint64_t Mix( uint64_t z ) {
+			z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+			z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+			return z ^ ( z >> 31 );
+		}
+
+		uint64_t Next() {
+			return Mix( key + ++counter * 0x9E3779B97F4A7C15ULL );
+		}
+
+		double operator()() {
+			return ( Next() >> 11 ) * ( 1.0 / 9007199254740992.0 );
+		}
+	};
+
 	template<typename T = int>
 	struct UniformIntRandom {
 		std::mt19937 rng;
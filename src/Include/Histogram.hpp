@@ -37,6 +37,7 @@
 #include <iostream>
 
 #include "CsvIO.hpp"
+#include "DenseHistogram.hpp"
 
 using std::map;
 
@@ -88,10 +89,27 @@ namespace QutBio {
 			}
 		}
 
+		/**
+		*	<summary>
+		*		Adds the convolution of this histogram and singleHistogram to
+		*		newHistogram. When both have keys on the same fixed-step grid the
+		*		product is formed on contiguous DenseHistogram arrays; otherwise
+		*		every pair of map entries is visited.
+		*	</summary>
+		*/
 		void DoConvolution(
 			const Histogram<T> & singleHistogram,
 			Histogram<T> & newHistogram
-			) {
+			) const {
+			DenseHistogram<T> x, y;
+
+			if ( x.Assign( *this ) && y.Assign( singleHistogram ) && x.step == y.step ) {
+				DenseHistogram<T> z;
+				x.Convolve( y, z );
+				z.AddTo( newHistogram );
+				return;
+			}
+
 			for ( auto i : data ) {
 				double currentKey = i.first;
 				double currentValue = i.second;
@@ -105,6 +123,43 @@ namespace QutBio {
 			}
 		}
 
+		/**
+		*	<summary>
+		*		Populates result with the n-fold self-convolution of this histogram
+		*		by repeated squaring, in O(log n) calls to DoConvolution. Power(0) is
+		*		the point mass at 0.
+		*	</summary>
+		*/
+		void Power(uint n, Histogram<T> & result) const {
+			if ( n == 0 ) {
+				result.data.clear();
+				result.data[T()] = 1;
+				return;
+			}
+
+			Histogram<T> square = *this;
+
+			for ( ; (n & 1) == 0; n >>= 1 ) {
+				Histogram<T> next;
+				square.DoConvolution(square, next);
+				square = next;
+			}
+
+			result = square;
+
+			while ( n >>= 1 ) {
+				Histogram<T> next;
+				square.DoConvolution(square, next);
+				square = next;
+
+				if ( n & 1 ) {
+					Histogram<T> sum;
+					result.DoConvolution(square, sum);
+					result = sum;
+				}
+			}
+		}
+
 		/**
 		*	<summary>
 		*		Populates this histogram with a normalised histogram (i.e. a probability mass function)
@@ -40,6 +40,7 @@
 
 
 #include "Assert.hpp"
+#include "Convolution.hpp"
 #include "CsvIO.hpp"
 #include "Distribution.hpp"
 #include "Exception.hpp"
@@ -142,13 +143,10 @@ namespace QutBio {
 			if ( t <= 0 ) return min;
 			if ( t >= 1 ) return max;
 
-			for ( uint i = 0; i < f.size(); i++ ) {
-				if ( f[i] >= t ) {
-					return i + min;
-				}
-			}
+			// f is non-decreasing, so the first f[i] >= t is found by bisection.
+			auto pos = std::lower_bound( f.begin(), f.end(), t );
 
-			return max;
+			return pos == f.end() ? max : (int) ( pos - f.begin() ) + min;
 		}
 
 		virtual double Mean( void ) {
@@ -191,27 +189,35 @@ namespace QutBio {
 
 		int Max() const { return max; }
 
+		/// <summary>
+		///	Gets the distribution of the sum of independent samples from this 
+		///	distribution and another. Long supports are convolved by FFT; see
+		///	Convolution.
+		/// </summary>
+
 		IntegerDistribution Add( const IntegerDistribution & other ) {
 			IntegerDistribution &my = *this;
 			int newMin = my.min + other.min;
 			int newMax = my.max + other.max;
 
-			vector<double> newP( 1 + newMax - newMin );
-
-			for ( int i = min; i <= max; i++ ) {
-				for ( int j = other.min; j <= other.max; j++ ) {
-					newP[i + j - newMin] += P( i ) * other.P( j );
-				}
-			}
-
-			return IntegerDistribution( newMin, newMax, newP );
+			return IntegerDistribution( newMin, newMax, Convolution::Convolve( p, other.p ) );
 		}
 
+		/// <summary>
+		///	As Add, using OpenMP threads.
+		/// </summary>
+
 		IntegerDistribution AddParallel( const IntegerDistribution & other ) {
 			IntegerDistribution &my = *this;
 			int newMin = my.min + other.min;
 			int newMax = my.max + other.max;
 
+			if ( std::min( p.size(), other.p.size() ) > Convolution::DirectLength ) {
+				vector<double> newP( 1 + newMax - newMin );
+				Convolution::Fft( p, other.p, newP, true );
+				return IntegerDistribution( newMin, newMax, newP );
+			}
+
 			vector<double> newP( 1 + newMax - newMin );
 
 #pragma omp parallel
@@ -236,6 +242,36 @@ namespace QutBio {
 			return IntegerDistribution( newMin, newMax, newP );
 		}
 
+		/// <summary>
+		///	Gets the distribution of the sum of n independent samples from this
+		///	distribution (the n-fold self-convolution) by repeated squaring, in
+		///	O(log n) calls to Add. Power(0) is the point mass at 0.
+		/// </summary>
+
+		IntegerDistribution Power( uint n ) {
+			if ( n == 0 ) {
+				return IntegerDistribution( 0, 0, vector<double>{ 1 } );
+			}
+
+			IntegerDistribution square( *this );
+
+			for ( ; ( n & 1 ) == 0; n >>= 1 ) {
+				square = square.Add( square );
+			}
+
+			IntegerDistribution result( square );
+
+			while ( n >>= 1 ) {
+				square = square.Add( square );
+
+				if ( n & 1 ) {
+					result = result.Add( square );
+				}
+			}
+
+			return result;
+		}
+
 		/// <summary>
 		/// Emits the distribution to standard output in a tabular form.
 		/// </summary>
@@ -412,92 +448,95 @@ namespace QutBio {
 		}
 
 	public:
+		/// <summary>
+		///	Gets the CDF of the maximum of n independent draws at a point where
+		///	the underlying CDF is F, that is F^n, evaluated as exp(n log F).
+		/// </summary>
+
+		static double MaximumCdf( double F, int n ) {
+			return exp( n * log( F ) );
+		}
+
+		/// <summary>
+		///	Gets the CDF of the minimum of n independent draws at a point where
+		///	the underlying CDF is F, that is 1 - (1 - F)^n, evaluated as
+		///	-expm1(n log1p(-F)). This keeps full relative precision when nF is
+		///	far below 1, where 1 - pow(1 - F, n) cancels to zero.
+		/// </summary>
+
+		static double MinimumCdf( double F, int n ) {
+			return -expm1( n * log1p( -std::min( F, 1.0 ) ) );
+		}
+
 		/// <summary>
 		///	Gets the distribution of the maximum of a subset containing 
 		///	subsetSize items from the underlying set.
 		/// </summary>
 
 		IntegerDistribution GetMaximum( int subsetSize ) {
-			double *f = this->f.data();
-
-			int newMin = max;
-			int newMax = min;
+			// http://stats.stackexchange.com/questions/220/how-is-the-minimum-of-a-set-of-random-variables-distributed
+			const double *f = this->f.data();
+			const int n = 1 + max - min;
 
-			vector<double> Fm( 1 + max - min );
+			vector<double> Fm( n );
+			double *fm = Fm.data();
 
-			for ( int i = min; i <= max; i++ ) {
-				// http://stats.stackexchange.com/questions/220/how-is-the-minimum-of-a-set-of-random-variables-distributed
-				double F = f[i - min];
-				Fm[i - min] = pow( F, subsetSize );
+#pragma omp simd
+			for ( int i = 0; i < n; i++ ) {
+				fm[i] = MaximumCdf( f[i], subsetSize );
 			}
 
-			for ( int i = min; i <= max; i++ ) {
-				if ( Fm[i - min] > 0 ) {
-					newMin = i;
-					break;
-				}
-			}
+			return FromOrderStatisticCdf( Fm );
+		}
 
-			for ( int i = max; i >= min; i-- ) {
-				if ( Fm[i - min] > 0 ) {
-					newMax = i;
-					break;
-				}
-			}
+		/// <summary>
+		///	Gets the distribution of the minimum of a subset containing 
+		///	subsetSize items from the underlying set.
+		/// </summary>
 
-			IntegerDistribution d( newMin, newMax );
-			double *fMax = d.f.data();
-			double *pMax = d.p.data();
+		IntegerDistribution GetMinimum( int subsetSize ) {
+			// http://stats.stackexchange.com/questions/220/how-is-the-minimum-of-a-set-of-random-variables-distributed
+			const double *f = this->f.data();
+			const int n = 1 + max - min;
 
-			double fPrev = 0;
+			vector<double> Fm( n );
+			double *fm = Fm.data();
 
-			for ( int i = newMin; i <= newMax; i++ ) {
-				fMax[i - newMin] = Fm[i - min];
-				pMax[i - newMin] = Fm[i - min] - fPrev;
-				fPrev = Fm[i - min];
+			fm[0] = 0;
+
+#pragma omp simd
+			for ( int i = 1; i < n; i++ ) {
+				fm[i] = MinimumCdf( f[i - 1], subsetSize );
 			}
 
-			return d;
+			return FromOrderStatisticCdf( Fm );
 		}
 
 		/// <summary>
-		///	Gets the distribution of the maximum of a subset containing 
-		///	subsetSize items from the underlying set.
+		///	Gets the distributions of the minimum of subsets of each of the 
+		///	designated sizes, computed concurrently.
 		/// </summary>
 
-		IntegerDistribution GetMinimum( int subsetSize ) {
-			double *f = this->f.data();
+		vector<IntegerDistribution> GetMinimum( const vector<uint> & subsetSizes ) {
+			vector<IntegerDistribution> result( subsetSizes.size(), IntegerDistribution( 0, 0 ) );
 
-			int newMin = max;
-			int newMax = min;
+#pragma omp parallel for schedule(dynamic)
+			for ( int i = 0; i < (int) subsetSizes.size(); i++ ) {
+				result[i] = GetMinimum( (int) subsetSizes[i] );
+			}
 
-			vector<double> Fm( 1 + max - min );
+			return result;
+		}
 
-			for ( int i = min; i <= max; i++ ) {
-				// http://stats.stackexchange.com/questions/220/how-is-the-minimum-of-a-set-of-random-variables-distributed
-				double F = i == min ? 0 : f[i - 1 - min];
-				double Fc = 1 - F;
-
-				if ( F < 1e-10 ) {
-					//	Once F is less than about 1e-17, we completely lose the
-					//	probability contribution for the left end. To be on the 
-					//	safe side I'll stretch the iterative procedure up to 
-					//	1e-10.
-					double currentTerm = 1;
-					int sign = -1;
-					Fm[i - min] = 0;
-
-					for ( int j = 1; j <= subsetSize; j++ ) {
-						sign = -sign;
-						currentTerm *= ( subsetSize - j + 1 ) * F / j;
-						Fm[i - min] += sign * currentTerm;
-						// cerr << "F = " << F << "\nn = " << subsetSize << "\nj = " << j << "\ncurrentTerm = " << currentTerm << "\nFm = " << Fm[i - min] << "\n";
-					}
-				}
-				else {
-					Fm[i - min] = 1 - pow( Fc, subsetSize );
-				}
-			}
+	private:
+		/// <summary>
+		///	Builds the distribution whose CDF is Fm, indexed from min, trimmed
+		///	to the points where Fm is positive.
+		/// </summary>
+
+		IntegerDistribution FromOrderStatisticCdf( const vector<double> & Fm ) {
+			int newMin = max;
+			int newMax = min;
 
 			for ( int i = min; i <= max; i++ ) {
 				if ( Fm[i - min] > 0 ) {
@@ -528,6 +567,7 @@ namespace QutBio {
 			return d;
 		}
 
+	public:
 		/// <summary>
 		///	Returns a distribution for a conditional event, as determined by the
 		///	predicate, which must return true to indicate that the designated value
@@ -593,14 +633,8 @@ namespace QutBio {
 			oneMers.GetOneMerHistogram( symbolHistogram, symbolDistance );
 
 			IntegerDistribution d1( oneMers );
-			IntegerDistribution current( d1 );
-
-			for ( int i = 2; i <= kmerLength; i++ ) {
-				IntegerDistribution d = current.Add( d1 );
-				current = d;
-			}
 
-			return current;
+			return d1.Power( kmerLength );
 		}
 
 	};
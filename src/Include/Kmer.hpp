@@ -193,6 +193,11 @@ namespace QutBio {
 			return instances;
 		}
 
+		/// <summary>Gets the heap bytes held by this kmer, excluding the object itself.</summary>
+		size_t HeapBytes() const {
+			return MemoryAccount::HeapBytes( instances );
+		}
+
 		// Gets the address of the first word in the packed numerically encoded kmer
 		// array.
 		//	*	This is currently a unit16_t array containing 1, 2, or 3 symbols
@@ -51,6 +51,7 @@
 #include "Selector.hpp"
 #include "SimilarityMatrix.hpp"
 #include "KmerIndex.hpp"
+#include "Profiler.hpp"
 
 #if defined(SHOW_PROGRESS)
 #define PROGRESS(x) x
@@ -63,6 +64,26 @@
 #endif
 
 namespace QutBio {
+	/**
+		**	<summary>
+		**		Estimates the bytes needed to load a database, its prototypes, a 
+		**		kmer index and a codebook, from the statistics of the FASTA files 
+		**		and before any of them is read. Clusters hold copies of their 
+		**		member kmers, so at worst the codebook holds every kmer again. 
+		**		The distance tables are not included.
+		**	</summary>
+		*/
+	inline size_t EstimateCodebookLoadBytes( const FastaFileStats & data, const FastaFileStats & protoData, size_t kmerLength, size_t charsPerWord ) {
+		size_t sequenceBytes, encodingBytes, protoSequenceBytes, protoEncodingBytes;
+		EncodedFastaSequence::Estimate( data, kmerLength, charsPerWord, sequenceBytes, encodingBytes );
+		EncodedFastaSequence::Estimate( protoData, kmerLength, charsPerWord, protoSequenceBytes, protoEncodingBytes );
+
+		size_t codebookBytes = data.residues * ( sizeof( Kmer ) + sizeof( Kmer::Instance ) + MemoryAccount::BlockOverhead );
+
+		return sequenceBytes + encodingBytes + protoSequenceBytes + protoEncodingBytes + codebookBytes
+			+ KmerIndex::Estimate( data.residues );
+	}
+
 	/**
 		**	<summary>
 		**		Template class representing cluster of Kmers with a "central" prototype.
@@ -70,7 +91,9 @@ namespace QutBio {
 		**	<typeparam name=DistanceFunction>
 		**		A class which provides a function
 		**			Distance GetDistance(EncodedKmer, EncodedKmer, size_t);
-		**		which returns the distance between two kmers.
+		**		which returns the distance between two kmers, and a function
+		**			void Dispatch(uint kmerLength, Action action);
+		**		which invokes action with a length-specialised distance kernel.
 		**	</typeparam>
 		*/
 	template <typename DistanceFunction, typename KmerType>
@@ -153,6 +176,37 @@ namespace QutBio {
 			return count;
 		}
 
+		/**
+		 *	Gets the bytes held by the cluster, including the copies of its
+		 *	member kmers and their instance lists.
+		 */
+
+		size_t MemoryBytes() const {
+			size_t bytes = sizeof( *this ) + MemoryAccount::BlockOverhead + prototype.HeapBytes()
+				+ MemoryAccount::HeapBytes( kmers )
+				+ MemoryAccount::HeapBytes( kmersPerThread );
+
+			for ( auto & kmer : kmers ) bytes += kmer.HeapBytes();
+			for ( auto & list : kmersPerThread ) bytes += MemoryAccount::HeapBytes( list );
+
+			return bytes;
+		}
+
+		/**
+		 *	Gets the bytes held by a codebook: the clusters and the sequences
+		 *	that hold their prototypes.
+		 */
+
+		template<typename ProtoList>
+		static size_t CodebookBytes( const vector<Cluster *> & clusters, ProtoList & protos ) {
+			size_t bytes = MemoryAccount::HeapBytes( clusters );
+
+			for ( auto cluster : clusters ) bytes += cluster->MemoryBytes();
+			for ( auto proto : protos ) bytes += proto->SequenceBytes() + proto->EncodingBytes();
+
+			return bytes;
+		}
+
 		/*
 		**	Appends a kmer to the list of kmers attached to this cluster.
 		**	Not OMP thread-safe.
@@ -291,42 +345,44 @@ namespace QutBio {
 				}
 			}
 
+			symbolCodeDist.Dispatch( K, [&]( auto kernel ) {
 #pragma omp parallel for
-			for ( size_t i = firstUnallocIndex; i < kmers.size(); i++ ) {
-				KmerType *kmer = kmers[i];
-				auto kmerEncoding = kmers[i]->PackedEncoding();
-				KmerCluster *attractor = 0;
-				auto attractorDistance = numeric_limits<Distance>::max();
-
-				for ( size_t j = firstClusterIndex; j < clusters.size(); j++ ) {
-					// Try to map kmer to a pre-existing cluster if possible, otherwise search the
-					// newly added clusters.
-					auto prototypeEncoding = clusters[j]->prototype.PackedEncoding();
-
-					// Always go with the first cluster that falls within the threshold.
-					// This way, any well-conserved kmers will be quickly mapped into clusters.
-					// Hopefully, these are in the majority.
-					auto dist = symbolCodeDist( kmerEncoding, prototypeEncoding, K );
-
-					if ( dist <= threshold ) {
-						attractor = clusters[j];
-						attractorDistance = dist;
-						break;
+				for ( size_t i = firstUnallocIndex; i < kmers.size(); i++ ) {
+					KmerType *kmer = kmers[i];
+					auto kmerEncoding = kmers[i]->PackedEncoding();
+					KmerCluster *attractor = 0;
+					auto attractorDistance = numeric_limits<Distance>::max();
+
+					for ( size_t j = firstClusterIndex; j < clusters.size(); j++ ) {
+						// Try to map kmer to a pre-existing cluster if possible, otherwise search the
+						// newly added clusters.
+						auto prototypeEncoding = clusters[j]->prototype.PackedEncoding();
+
+						// Always go with the first cluster that falls within the threshold.
+						// This way, any well-conserved kmers will be quickly mapped into clusters.
+						// Hopefully, these are in the majority.
+						auto dist = kernel( kmerEncoding, prototypeEncoding );
+
+						if ( dist <= threshold ) {
+							attractor = clusters[j];
+							attractorDistance = dist;
+							break;
+						}
 					}
-				}
 
-				if ( attractor ) {
-					kmer->DistanceFromPrototype( attractorDistance );
-					attractor->AddParallel( *kmer );
+					if ( attractor ) {
+						kmer->DistanceFromPrototype( attractorDistance );
+						attractor->AddParallel( *kmer );
 #pragma omp critical
-					{
-						if ( i > firstUnallocIndex ) {
-							std::swap( kmers[firstUnallocIndex], kmers[i] );
+						{
+							if ( i > firstUnallocIndex ) {
+								std::swap( kmers[firstUnallocIndex], kmers[i] );
+							}
+							firstUnallocIndex++;
 						}
-						firstUnallocIndex++;
 					}
 				}
-			}
+			} );
 		}
 
 		static void DoExhaustiveIncrementalClustering(
@@ -375,6 +431,7 @@ namespace QutBio {
 			size_t increment = clusters.size() > 0 ? 0 : clusterIncrement;
 
 			while ( firstUnallocIndex < N ) {
+				PROFILE_SCOPE( "clusteringPass" );
 				( cerr << "\r" << ( N - firstUnallocIndex ) << " unassigned kmers.                               " ).flush();
 				auto previous = firstUnallocIndex;
 
@@ -462,53 +519,55 @@ namespace QutBio {
 				}
 			}
 
+			symbolCodeDist.Dispatch( K, [&]( auto kernel ) {
 #if USE_OMP
 #pragma omp parallel
 #endif
-			{
+				{
 #if USE_OMP
-				size_t threadId = omp_get_thread_num();
+					size_t threadId = omp_get_thread_num();
 #else
-				size_t threadId = 0;
+					size_t threadId = 0;
 #endif
 
-				// Rely on firstUnallocIndex for the beginning of the unprocessed part of the range.
-				size_t endIdx = ( threadId + 1 ) * N / numThreads;
-
-				for ( size_t i = firstUnallocIndex[threadId]; i < endIdx; i++ ) {
-					KmerType *kmer = kmers[i];
-					KmerWord *kmerEncoding = kmers[i]->PackedEncoding();
-					KmerCluster *attractor = 0;
-					auto attractorDistance = numeric_limits<Distance>::max();
-
-					for ( size_t j = firstClusterIndex; j < clusters.size(); j++ ) {
-						// Try to map kmer to a pre-existing cluster if possible, otherwise search the
-						// newly added clusters.
-						auto prototypeEncoding = clusters[j]->prototype.PackedEncoding();
-
-						// Always go with the first cluster that falls within the threshold.
-						// This way, any well-conserved kmers will be quickly mapped into clusters.
-						// Hopefully, these are in the majority.
-						auto dist = symbolCodeDist( kmerEncoding, prototypeEncoding, K );
+					// Rely on firstUnallocIndex for the beginning of the unprocessed part of the range.
+					size_t endIdx = ( threadId + 1 ) * N / numThreads;
 
-						if ( dist <= threshold ) {
-							attractor = clusters[j];
-							attractorDistance = dist;
-							break;
+					for ( size_t i = firstUnallocIndex[threadId]; i < endIdx; i++ ) {
+						KmerType *kmer = kmers[i];
+						KmerWord *kmerEncoding = kmers[i]->PackedEncoding();
+						KmerCluster *attractor = 0;
+						auto attractorDistance = numeric_limits<Distance>::max();
+
+						for ( size_t j = firstClusterIndex; j < clusters.size(); j++ ) {
+							// Try to map kmer to a pre-existing cluster if possible, otherwise search the
+							// newly added clusters.
+							auto prototypeEncoding = clusters[j]->prototype.PackedEncoding();
+
+							// Always go with the first cluster that falls within the threshold.
+							// This way, any well-conserved kmers will be quickly mapped into clusters.
+							// Hopefully, these are in the majority.
+							auto dist = kernel( kmerEncoding, prototypeEncoding );
+
+							if ( dist <= threshold ) {
+								attractor = clusters[j];
+								attractorDistance = dist;
+								break;
+							}
 						}
-					}
 
-					if ( attractor ) {
-						kmer->DistanceFromPrototype( attractorDistance );
-						attractor->AddParallel( *kmer );
+						if ( attractor ) {
+							kmer->DistanceFromPrototype( attractorDistance );
+							attractor->AddParallel( *kmer );
 
-						if ( i > firstUnallocIndex[threadId] ) {
-							std::swap( kmers[firstUnallocIndex[threadId]], kmers[i] );
-							firstUnallocIndex[threadId]++;
+							if ( i > firstUnallocIndex[threadId] ) {
+								std::swap( kmers[firstUnallocIndex[threadId]], kmers[i] );
+								firstUnallocIndex[threadId]++;
+							}
 						}
 					}
 				}
-			}
+			} );
 		}
 
 		static size_t GetUnallocated( size_t numThreads, size_t N, vector<size_t> &firstUnallocIndex ) {
@@ -592,6 +651,7 @@ namespace QutBio {
 				.flush();
 
 			while ( numAllocated < N ) {
+				PROFILE_SCOPE( "clusteringPass" );
 				( cerr << "\r" << ( N - numAllocated ) << " unassigned kmers.                               " ).flush();
 				auto previous = numAllocated;
 
@@ -155,6 +155,7 @@ namespace QutBio {
 			Encode(alphabet, wordLength, charsPerWord, defaultSymbol);
 			UpdateDefLine();
 			largestSerialNumber(serialNumber);
+			thisKmer.Add( this, 0 );
 		}
 
 		KmerClusterPrototype(
@@ -172,6 +173,7 @@ namespace QutBio {
 		{
 			Encode(alphabet, wordLength, charsPerWord, defaultSymbol);
 			UpdateDefLine();
+			thisKmer.Add( this, 0 );
 		}
 
 		/// <summary>Get the (total) size of the cluster (s) represented by this prototype.</summary>
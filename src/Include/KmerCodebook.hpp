@@ -76,7 +76,9 @@ struct SequenceAssignment
 	**	<typeparam name=DistanceFunction>
 	**		A class which provides a function
 	**			Distance GetDistance(EncodedKmer, EncodedKmer, size_t);
-	**		which returns the distance between two kmers.
+	**		which returns the distance between two kmers, and a function
+	**			void Dispatch(uint kmerLength, Action action);
+	**		which invokes action with a length-specialised distance kernel.
 	**	</typeparam>
 	**	<typeparam name=KmerType>
 	**		A subclass of Kmer (or more likely, Kmer itself). This was introduced
@@ -275,6 +277,7 @@ class KmerCodebook
 		}
 
 		CopyKmerDataNonRecursive((int)Alphabet::WordsPerKmer(kmerLength, charsPerWord));
+		codebook_size = codebook.size();
 
 		(cerr << codebook.size() << " clusters parsed, indexing " << kmerCount << " kmers.\n").flush();
 	}
@@ -688,19 +691,21 @@ class KmerCodebook
 		size_t nearestIdx = 0;
 		KmerWord *seqStr = kmer.PackedEncoding();
 
-		dist = distanceFunction(seqStr, kmerData.row(0), kmerLength);
+		distanceFunction.Dispatch(kmerLength, [&](auto kernel) {
+			dist = kernel(seqStr, kmerData.row(0));
 
-		for (size_t i = 1; i < codebook_size; i++)
-		{
-			Distance d = distanceFunction(seqStr, kmerData.row(i), kmerLength);
-
-			if (d < dist)
+			for (size_t i = 1; i < codebook_size; i++)
 			{
-				dist = d;
-				nearestCluster = (pCluster)codebook[i];
-				nearestIdx = i;
+				Distance d = kernel(seqStr, kmerData.row(i));
+
+				if (d < dist)
+				{
+					dist = d;
+					nearestCluster = (pCluster)codebook[i];
+					nearestIdx = i;
+				}
 			}
-		}
+		});
 
 		if (nearestIdx == 0 && dist < 100)
 		{
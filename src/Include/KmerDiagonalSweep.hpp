@@ -0,0 +1,401 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies 
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18), 
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published 
+// by the Free Software Foundation; either version 3, or (at your 
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KMER_SWEEP_X86 1
+#else
+#define KMER_SWEEP_X86 0
+#endif
+
+#include "Exception.hpp"
+#include "SimilarityMatrix.hpp"
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	Sliding-window kmer distances between two sequences, computed incrementally.
+	 *	The distance between windows x[i..i+K) and y[j..j+K) is a sum of 1-mer 
+	 *	distances, so along a diagonal (j - i constant) consecutive windows differ 
+	 *	by one term leaving and one term entering:
+	 *		D[i+1][j+1] = D[i][j] - d(x[i], y[j]) + d(x[i+K], y[j+K]).
+	 *	<para>
+	 *		Diagonal walks a single diagonal in O(L). Rows advances every diagonal
+	 *		together, yielding the all-pairs distance matrix one row at a time. 
+	 *		Rows reads the 1-mer terms from a profile of y (one row of 8 bit distances 
+	 *		per distinct symbol of x), so each lane of the update is three contiguous 
+	 *		loads. It runs 32 lanes wide with AVX-512BW, 16 with AVX2, or scalar.
+	 *	</para>
+	 *	<para>
+	 *		The running sums are exact in 16 bit arithmetic while K times the largest
+	 *		1-mer distance fits in a Distance (IsExact). Otherwise every window is 
+	 *		summed from scratch with saturating adds.
+	 *	</para>
+	 *	</summary>
+	 */
+	class KmerDiagonalSweep {
+	public:
+		enum class InstructionSet { None, Avx2, Avx512Bw };
+
+	private:
+		uint kmerLength;
+		uint8_t oneMerDistance[128][128];
+		uint maxOneMerDistance = 0;
+		InstructionSet instructionSet = InstructionSet::None;
+
+	public:
+		/**
+		 *	<summary>
+		 *	Initialises the sweep.
+		 *	</summary>
+		 *	<param name="matrix">The similarity matrix which defines 1-mer distances.</param>
+		 *	<param name="kmerLength">The window length.</param>
+		 *	<param name="allowed">The widest instruction set to use. The kernel is 
+		 *	restricted further to what the processor supports.</param>
+		 */
+		KmerDiagonalSweep(
+			const SimilarityMatrix & matrix,
+			uint kmerLength,
+			InstructionSet allowed = InstructionSet::Avx512Bw
+		) : kmerLength(kmerLength) {
+			if ( kmerLength < 1 ) {
+				throw Exception("KmerDiagonalSweep: kmerLength must be at least 1.", FileAndLine);
+			}
+
+			matrix.PopulateDistanceTable(oneMerDistance);
+
+			for ( int x = 0; x < 128; x++ ) {
+				for ( int y = 0; y < 128; y++ ) {
+					maxOneMerDistance = std::max(maxOneMerDistance, (uint)oneMerDistance[x][y]);
+				}
+			}
+
+			InstructionSet supported = Detect();
+			instructionSet = allowed < supported ? allowed : supported;
+		}
+
+		static InstructionSet Detect() {
+#if KMER_SWEEP_X86
+			__builtin_cpu_init();
+
+			if ( __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl") ) {
+				return InstructionSet::Avx512Bw;
+			}
+
+			if ( __builtin_cpu_supports("avx2") ) {
+				return InstructionSet::Avx2;
+			}
+#endif
+			return InstructionSet::None;
+		}
+
+		static const char * Name(InstructionSet instructionSet) {
+			return instructionSet == InstructionSet::Avx512Bw ? "AVX-512BW"
+				: instructionSet == InstructionSet::Avx2 ? "AVX2"
+				: "scalar";
+		}
+
+		InstructionSet GetInstructionSet() const {
+			return instructionSet;
+		}
+
+		uint KmerLength() const {
+			return kmerLength;
+		}
+
+		/// <summary>Returns true iff the running sums cannot overflow a Distance.</summary>
+		bool IsExact() const {
+			return (uint64_t)kmerLength * maxOneMerDistance <= numeric_limits<Distance>::max();
+		}
+
+		/// <summary>Gets the row of 1-mer distances from symbol x to every symbol.</summary>
+		const uint8_t * OneMerDistances(char x) const {
+			return oneMerDistance[(uint8_t)x & 127];
+		}
+
+		/// <summary>Gets the distance between two windows, summed from scratch with saturating adds.</summary>
+		Distance WindowDistance(const char * x, const char * y) const {
+			Distance d = 0;
+
+			for ( uint t = 0; t < kmerLength; t++ ) {
+				d = SaturatingAdd(d, oneMerDistance[(uint8_t)x[t] & 127][(uint8_t)y[t] & 127]);
+			}
+
+			return d;
+		}
+
+		/**
+		 *	<summary>
+		 *	Invokes action(i, j, distance) for each window pair on the diagonal 
+		 *	j - i == offset, in order of increasing i.
+		 *	</summary>
+		 *	<param name="x">The first sequence.</param>
+		 *	<param name="xKmers">The number of windows in x.</param>
+		 *	<param name="y">The second sequence.</param>
+		 *	<param name="yKmers">The number of windows in y.</param>
+		 *	<param name="offset">The diagonal, j - i.</param>
+		 */
+		template<typename Action>
+		void Diagonal(const char * x, uint xKmers, const char * y, uint yKmers, int offset, Action && action) const {
+			uint i = offset < 0 ? (uint)-offset : 0;
+			uint j = offset < 0 ? 0 : (uint)offset;
+
+			if ( i >= xKmers || j >= yKmers ) return;
+
+			const uint n = std::min(xKmers - i, yKmers - j);
+			const uint K = kmerLength;
+
+			if ( !IsExact() ) {
+				for ( uint k = 0; k < n; k++ ) {
+					action(i + k, j + k, WindowDistance(x + i + k, y + j + k));
+				}
+
+				return;
+			}
+
+			Distance d = 0;
+
+			for ( uint t = 0; t < K; t++ ) {
+				d += OneMerDistances(x[i + t])[(uint8_t)y[j + t] & 127];
+			}
+
+			for ( uint k = 0; ; ) {
+				action(i + k, j + k, d);
+
+				if ( ++k == n ) break;
+
+				const uint a = i + k - 1, b = j + k - 1;
+				d = (Distance)(d - OneMerDistances(x[a])[(uint8_t)y[b] & 127] + OneMerDistances(x[a + K])[(uint8_t)y[b + K] & 127]);
+			}
+		}
+
+		/**
+		 *	<summary>
+		 *	Invokes action(i, row, rowLeast) for each window i of x in turn, where 
+		 *	row[j] is the distance from window i of x to window j of y and rowLeast 
+		 *	is the least of these. The row buffer is reused between calls.
+		 *	</summary>
+		 *	<param name="x">The first sequence.</param>
+		 *	<param name="xKmers">The number of windows in x.</param>
+		 *	<param name="y">The second sequence.</param>
+		 *	<param name="yKmers">The number of windows in y.</param>
+		 *	<param name="columnLeast">Null, or yKmers values which are lowered to each 
+		 *	row in the same pass that computes it.</param>
+		 */
+		template<typename Action>
+		void Rows(const char * x, uint xKmers, const char * y, uint yKmers, Distance * columnLeast, Action && action) const {
+			if ( xKmers == 0 || yKmers == 0 ) return;
+
+			if ( columnLeast ) {
+				RowsImpl<true>(x, xKmers, y, yKmers, columnLeast, action);
+			}
+			else {
+				RowsImpl<false>(x, xKmers, y, yKmers, columnLeast, action);
+			}
+		}
+
+	private:
+		template<bool foldColumns, typename Action>
+		void RowsImpl(const char * x, uint xKmers, const char * y, uint yKmers, Distance * columnLeast, Action & action) const {
+			const uint K = kmerLength;
+			const Distance maxDistance = numeric_limits<Distance>::max();
+			vector<Distance> prev(yKmers), cur(yKmers);
+
+			if ( !IsExact() ) {
+				for ( uint i = 0; i < xKmers; i++ ) {
+					Distance least = maxDistance;
+
+					for ( uint j = 0; j < yKmers; j++ ) {
+						cur[j] = WindowDistance(x + i, y + j);
+						least = std::min(least, cur[j]);
+						if ( foldColumns ) columnLeast[j] = std::min(columnLeast[j], cur[j]);
+					}
+
+					action(i, (const Distance *)cur.data(), least);
+				}
+
+				return;
+			}
+
+			const uint xLength = xKmers + K - 1;
+			const uint yLength = yKmers + K - 1;
+
+			// Profile of y: one row per distinct symbol of x.
+			int profileRow[128];
+			std::fill(profileRow, profileRow + 128, -1);
+			uint profileRows = 0;
+
+			for ( uint i = 0; i < xLength; i++ ) {
+				int & row = profileRow[(uint8_t)x[i] & 127];
+				if ( row < 0 ) row = profileRows++;
+			}
+
+			vector<uint8_t> profile((size_t)profileRows * yLength);
+
+			for ( int c = 0; c < 128; c++ ) {
+				if ( profileRow[c] < 0 ) continue;
+
+				uint8_t * row = &profile[(size_t)profileRow[c] * yLength];
+
+				for ( uint j = 0; j < yLength; j++ ) {
+					row[j] = oneMerDistance[c][(uint8_t)y[j] & 127];
+				}
+			}
+
+			auto P = [&](char c) { return &profile[(size_t)profileRow[(uint8_t)c & 127] * yLength]; };
+
+			for ( uint i = 0; i < xKmers; i++ ) {
+				Distance least = maxDistance;
+
+				if ( i == 0 ) {
+					std::fill(cur.begin(), cur.end(), 0);
+
+					for ( uint t = 0; t < K; t++ ) {
+						const uint8_t * p = P(x[t]) + t;
+
+						for ( uint j = 0; j < yKmers; j++ ) {
+							cur[j] += p[j];
+						}
+					}
+
+					for ( uint j = 0; j < yKmers; j++ ) {
+						least = std::min(least, cur[j]);
+						if ( foldColumns ) columnLeast[j] = std::min(columnLeast[j], cur[j]);
+					}
+				}
+				else {
+					std::swap(prev, cur);
+
+					Distance first = 0;
+
+					for ( uint t = 0; t < K; t++ ) {
+						first += P(x[i + t])[t];
+					}
+
+					cur[0] = first;
+					if ( foldColumns ) columnLeast[0] = std::min(columnLeast[0], first);
+					least = std::min(first, Step<foldColumns>(prev.data(), P(x[i - 1]), P(x[i + K - 1]) + K, cur.data() + 1, foldColumns ? columnLeast + 1 : 0, yKmers - 1));
+				}
+
+				action(i, (const Distance *)cur.data(), least);
+			}
+		}
+
+		/**
+		 *	<summary>
+		 *	Diagonal update of one row: out[j] = in[j] - leaving[j] + entering[j] for
+		 *	j in [0, n), lowering colMin[j] to out[j] when foldColumns is true. 
+		 *	Returns the least value written.
+		 *	</summary>
+		 */
+		template<bool foldColumns>
+		Distance Step(const Distance * in, const uint8_t * leaving, const uint8_t * entering, Distance * out, Distance * colMin, uint n) const {
+			switch ( instructionSet ) {
+#if KMER_SWEEP_X86
+			case InstructionSet::Avx512Bw:
+				return StepAvx512<foldColumns>(in, leaving, entering, out, colMin, n);
+			case InstructionSet::Avx2:
+				return StepAvx2<foldColumns>(in, leaving, entering, out, colMin, n);
+#endif
+			default:
+				return StepScalar<foldColumns>(in, leaving, entering, out, colMin, 0, n, numeric_limits<Distance>::max());
+			}
+		}
+
+		template<bool foldColumns>
+		static Distance StepScalar(const Distance * in, const uint8_t * leaving, const uint8_t * entering, Distance * out, Distance * colMin, uint j, uint n, Distance least) {
+			for ( ; j < n; j++ ) {
+				Distance d = (Distance)(in[j] - leaving[j] + entering[j]);
+				out[j] = d;
+				least = std::min(least, d);
+				if ( foldColumns ) colMin[j] = std::min(colMin[j], d);
+			}
+
+			return least;
+		}
+
+#if KMER_SWEEP_X86
+		template<bool foldColumns>
+		__attribute__((target("avx2")))
+		static Distance StepAvx2(const Distance * in, const uint8_t * leaving, const uint8_t * entering, Distance * out, Distance * colMin, uint n) {
+			__m256i least = _mm256_set1_epi16(-1);
+			uint j = 0;
+
+			for ( ; j + 16 <= n; j += 16 ) {
+				__m256i x = _mm256_loadu_si256((const __m256i *)(in + j));
+				__m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(leaving + j)));
+				__m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(entering + j)));
+				__m256i d = _mm256_add_epi16(_mm256_sub_epi16(x, a), b);
+				_mm256_storeu_si256((__m256i *)(out + j), d);
+				least = _mm256_min_epu16(least, d);
+
+				if ( foldColumns ) {
+					__m256i c = _mm256_loadu_si256((const __m256i *)(colMin + j));
+					_mm256_storeu_si256((__m256i *)(colMin + j), _mm256_min_epu16(c, d));
+				}
+			}
+
+			// Horizontal minimum: phminposuw finds the least of 8 unsigned words.
+			__m128i m = _mm_min_epu16(_mm256_castsi256_si128(least), _mm256_extracti128_si256(least, 1));
+			Distance result = (Distance)_mm_cvtsi128_si32(_mm_minpos_epu16(m));
+			return StepScalar<foldColumns>(in, leaving, entering, out, colMin, j, n, result);
+		}
+
+		template<bool foldColumns>
+		__attribute__((target("avx512f,avx512bw,avx512vl")))
+		static Distance StepAvx512(const Distance * in, const uint8_t * leaving, const uint8_t * entering, Distance * out, Distance * colMin, uint n) {
+			__m512i least = _mm512_set1_epi16(-1);
+
+			for ( uint j = 0; j < n; j += 32 ) {
+				__mmask32 mask = n - j >= 32 ? (__mmask32)~0u : (__mmask32)((1u << (n - j)) - 1);
+				__m512i x = _mm512_maskz_loadu_epi16(mask, in + j);
+				__m512i a = _mm512_cvtepu8_epi16(_mm256_maskz_loadu_epi8(mask, leaving + j));
+				__m512i b = _mm512_cvtepu8_epi16(_mm256_maskz_loadu_epi8(mask, entering + j));
+				__m512i d = _mm512_add_epi16(_mm512_sub_epi16(x, a), b);
+				_mm512_mask_storeu_epi16(out + j, mask, d);
+				least = _mm512_mask_min_epu16(least, mask, least, d);
+
+				if ( foldColumns ) {
+					__m512i c = _mm512_maskz_loadu_epi16(mask, colMin + j);
+					_mm512_mask_storeu_epi16(colMin + j, mask, _mm512_min_epu16(c, d));
+				}
+			}
+
+			__m256i m256 = _mm256_min_epu16(_mm512_castsi512_si256(least), _mm512_extracti64x4_epi64(least, 1));
+			__m128i m = _mm_min_epu16(_mm256_castsi256_si128(m256), _mm256_extracti128_si256(m256, 1));
+			return (Distance)_mm_cvtsi128_si32(_mm_minpos_epu16(m));
+		}
+#endif
+	};
+}
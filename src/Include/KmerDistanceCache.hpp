@@ -36,11 +36,16 @@
 #include <ctime>
 #include <cfloat>
 #include <functional>
+#include <utility>
+#include <array>
+#include <type_traits>
 
 #include "Alphabet.hpp"
 #include "Console.hpp"
 #include "Delegates.hpp"
 #include "EncodedKmer.hpp"
+#include "Exception.hpp"
+#include "MemoryAccount.hpp"
 #include "Util.hpp"
 #include "Array.hpp"
 
@@ -73,7 +78,7 @@ namespace QutBio {
 	 *		d(x,y) = b(x,x) + b(y,y) - 2 b(x,y).
 	 *	</summary>
 	 */
-	class HalperinBlosumDistanceFunction : public RawKmerDistanceFunction {
+	class HalperinBlosumDistanceFunction final : public RawKmerDistanceFunction {
 	private:
 		SimilarityMatrix * matrix;
 	public:
@@ -106,7 +111,7 @@ namespace QutBio {
 	 *	Implement the BLOSUM distance: d(x,y) = max { b(a,a) | a \in alphabet } - b(x,y).
 	 *	</summary>
 	 */
-	class BlosumDifferenceFunction : public RawKmerDistanceFunction {
+	class BlosumDifferenceFunction final : public RawKmerDistanceFunction {
 	private:
 		SimilarityMatrix * matrix;
 	public:
@@ -138,7 +143,7 @@ namespace QutBio {
 	 *	UngappedEditDistanceCalculator.
 	 *	</summary>
 	 */
-	class UngappedEditDistanceFunction : public RawKmerDistanceFunction {
+	class UngappedEditDistanceFunction final : public RawKmerDistanceFunction {
 	public:
 
 		/**
@@ -180,6 +185,7 @@ namespace QutBio {
 	protected:
 		Alphabet * alphabet;
 		RawKmerDistanceFunction & dist;
+		size_t tableBytes = 0;
 
 		typedef int8_t CacheType;
 		typedef CacheType * pCacheType;
@@ -192,6 +198,24 @@ namespace QutBio {
 
 		virtual ~KmerDistanceCache() {}
 
+		/// <summary>Gets the total size in bytes of the precomputed distance tables.</summary>
+
+		size_t TableBytes() const {
+			return tableBytes;
+		}
+
+		/// <summary>Gets the size in bytes of the tables that a cache with the designated word size will build.</summary>
+		static size_t EstimateTableBytes(size_t alphabetSize, uint charsPerWord) {
+			size_t bytes = 0, vocabSize = 1;
+
+			for ( uint i = 1; i <= charsPerWord; i++ ) {
+				vocabSize *= alphabetSize;
+				bytes += vocabSize * vocabSize * sizeof(CacheType);
+			}
+
+			return bytes;
+		}
+
 	protected:
 		void PrecomputeDistances(uint charsPerWord, pCacheType &kmerDistanceTable, uint & vocabSize_) {
 			int len = alphabet->Size();
@@ -217,6 +241,7 @@ namespace QutBio {
 			}
 
 			kmerDistanceTable = new CacheType[vocabSize*vocabSize];
+			tableBytes += (size_t) vocabSize * vocabSize * sizeof(CacheType);
 
 			for ( uint i = 0; i < vocabSize; i++ ) {
 				char * x = vocab[i];
@@ -238,6 +263,107 @@ namespace QutBio {
 
 	};
 
+	/**
+	*	<summary>
+	*		Compile-time unrolled sum of table lookups over the first 
+	*		wordCount packed words of two kmers. Used to build the fixed-length
+	*		kernels of the kmer distance caches.
+	*	</summary>
+	*/
+	template<uint wordCount>
+	struct KmerWordSum {
+		static inline Distance Sum(const int8_t * table, uint vocabSize, const KmerWord * s, const KmerWord * t) {
+			return KmerWordSum<wordCount - 1>::Sum(table, vocabSize, s, t) 
+				+ table[s[wordCount - 1] * vocabSize + t[wordCount - 1]];
+		}
+	};
+
+	template<>
+	struct KmerWordSum<0> {
+		static inline Distance Sum(const int8_t *, uint, const KmerWord *, const KmerWord *) {
+			return 0;
+		}
+	};
+
+	/**
+	*	<summary>
+	*		Mixin which supplies Dispatch, and the inline kernels it passes to its
+	*		action, to a kmer distance cache. Cache must provide a static member 
+	*		template GetKmerDistances_K&lt;kmerLength&gt;(instance, s, t, kmerLength)
+	*		which is exact for that length, and a run-time 
+	*		operator()(s, t, kmerLength) for longer kmers.
+	*	</summary>
+	*/
+	template<typename Cache>
+	class KmerKernelDispatch {
+	public:
+		/// <summary>The largest kmer length for which a fully unrolled kernel is instantiated.</summary>
+		static const uint MaxSpecialisedKmerLength = 32;
+
+		/// <summary> Inline kernel for kmers of length exactly kmerLength. 
+		///		Passed by Dispatch to loops which are instantiated once per 
+		///		kmer length, so that the unrolled sum is inlined into the loop body.
+		/// </summary>
+
+		template<uint kmerLength>
+		struct FixedLengthKernel {
+			const Cache & instance;
+
+			Distance operator()(const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint = kmerLength) const {
+				return Cache::template GetKmerDistances_K<kmerLength>(instance, sKmerCode, tKmerCode, kmerLength);
+			}
+		};
+
+		/// <summary> Inline kernel for kmers longer than MaxSpecialisedKmerLength.
+		/// </summary>
+
+		struct AnyLengthKernel {
+			const Cache & instance;
+			uint kmerLength;
+
+			Distance operator()(const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint = 0) const {
+				return instance(const_cast<KmerWord *>(sKmerCode), const_cast<KmerWord *>(tKmerCode), kmerLength);
+			}
+		};
+
+		/// <summary> Invokes action(kernel), where kernel is a function object 
+		///		computing distance between two kmers of the designated length.
+		///		Action is normally a generic lambda containing a distance loop; 
+		///		one copy of the loop is compiled per kmer length, and the 
+		///		selection is made via a table which is built once per Action type.
+		/// </summary>
+		/// <param name="kmerLength">The number of symbols in each kmer.</param>
+		/// <param name="action">A callable object which accepts a kernel.</param>
+
+		template<typename Action>
+		void Dispatch(uint kmerLength, Action && action) const {
+			using A = typename std::remove_reference<Action>::type;
+			static const auto table = DispatchTable<A>(std::make_integer_sequence<uint, MaxSpecialisedKmerLength + 1>());
+
+			if ( kmerLength <= MaxSpecialisedKmerLength ) {
+				table[kmerLength](Instance(), action);
+			}
+			else {
+				action(AnyLengthKernel{ Instance(), kmerLength });
+			}
+		}
+
+	private:
+		const Cache & Instance() const {
+			return static_cast<const Cache &>(*this);
+		}
+
+		template<typename Action, uint kmerLength>
+		static void InvokeFixedLength(const Cache & instance, Action & action) {
+			action(FixedLengthKernel<kmerLength>{ instance });
+		}
+
+		template<typename Action, uint ... kmerLengths>
+		static std::array<void(*)(const Cache &, Action &), sizeof...(kmerLengths)> DispatchTable(std::integer_sequence<uint, kmerLengths...>) {
+			return { { InvokeFixedLength<Action, kmerLengths>... } };
+		}
+	};
+
 	/**
 	*	<summary>
 	*		Pre-computed kmer distance tables for k == 1, 2, 3, and
@@ -245,7 +371,7 @@ namespace QutBio {
 	*		up the matrix to save a lookups and/or loops.
 	*	</summary>
 	*/
-	class KmerDistanceCache3 : public KmerDistanceCache {
+	class KmerDistanceCache3 : public KmerDistanceCache, public KmerKernelDispatch<KmerDistanceCache3> {
 	public:
 		typedef Distance(*KmerDistanceFunction)(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength);
 
@@ -300,10 +426,66 @@ namespace QutBio {
 			return kmerDistanceFunctions;
 		}
 
-		size_t CharsPerWord() {
+		size_t CharsPerWord() const {
 			return 3;
 		}
 
+		/// <summary> Computes distance between two kmers of arbitrary length with a 
+		///		run-time loop over the packed words.
+		/// </summary>
+		/// <param name="sKmerCode">The numeric code of kmer s.</param>
+		/// <param name="tKmerCode">The numeric code of kmer t.</param>
+		/// <param name="kmerLength">The number of symbols in each kmer.</param>
+		/// <returns></returns>
+
+		Distance operator()(const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint kmerLength) const {
+			uint numThrees = kmerLength / 3;
+			uint rem = kmerLength % 3;
+			Distance dist = 0;
+
+			uint i = 0;
+
+			for ( ; i < numThrees; i++ ) {
+				dist += kmerDistances3[sKmerCode[i] * vocabSize3 + tKmerCode[i]];
+			}
+
+			if ( rem > 0 ) {
+				dist += rem == 1
+					? kmerDistances1[sKmerCode[i] * vocabSize1 + tKmerCode[i]]
+					: kmerDistances2[sKmerCode[i] * vocabSize2 + tKmerCode[i]];
+			}
+
+			return dist;
+		}
+
+		/// <summary> Computes distance between two kmers of length exactly 
+		///		kmerLength. The word loop is unrolled at compile time and the 
+		///		trailing partial word (if any) is resolved without a branch.
+		/// </summary>
+		/// <param name="sKmerCode">The numeric code of kmer s.</param>
+		/// <param name="tKmerCode">The numeric code of kmer t.</param>
+		/// <returns></returns>
+
+		template<uint kmerLength>
+		static Distance GetKmerDistances_K(const KmerDistanceCache3 & instance, const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint) {
+			const uint numThrees = kmerLength / 3;
+
+			Distance dist = KmerWordSum<numThrees>::Sum(instance.kmerDistances3, instance.vocabSize3, sKmerCode, tKmerCode);
+
+			if ( kmerLength % 3 == 1 ) {
+				dist += instance.kmerDistances1[sKmerCode[numThrees] * instance.vocabSize1 + tKmerCode[numThrees]];
+			}
+			else if ( kmerLength % 3 == 2 ) {
+				dist += instance.kmerDistances2[sKmerCode[numThrees] * instance.vocabSize2 + tKmerCode[numThrees]];
+			}
+
+			return dist;
+		}
+
+		Distance GetDistance1(KmerWord x, KmerWord y) const {
+			return kmerDistances1[x * vocabSize1 + y];
+		}
+
 		/// <summary> Computes distance between two kmers, s and t, 
 		///		assuming that they are length 3 or less.
 		/// </summary>
@@ -337,7 +519,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_3(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_3(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			size_t s1 = sKmerCode[0];
 			size_t t1 = tKmerCode[0];
 
@@ -352,7 +534,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_1(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_1(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord t1 = tKmerCode[0];
 
@@ -367,7 +549,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_2(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_2(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord t1 = tKmerCode[0];
 
@@ -382,7 +564,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_4(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_4(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 
@@ -401,7 +583,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_5(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_5(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 
@@ -421,7 +603,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_6(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_6(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 
@@ -440,7 +622,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_7(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_7(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 			KmerWord s3 = sKmerCode[2];
@@ -462,7 +644,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_8(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_8(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 			KmerWord s3 = sKmerCode[2];
@@ -484,7 +666,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_9(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_9(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 			KmerWord s3 = sKmerCode[2];
@@ -506,7 +688,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_10(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_10(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 			KmerWord s3 = sKmerCode[2];
@@ -531,7 +713,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_11(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_11(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 			KmerWord s3 = sKmerCode[2];
@@ -556,7 +738,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_12(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_12(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 			KmerWord s3 = sKmerCode[2];
@@ -581,7 +763,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_13(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_13(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s1 = sKmerCode[0];
 			KmerWord s2 = sKmerCode[1];
 			KmerWord s3 = sKmerCode[2];
@@ -609,7 +791,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_14(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_14(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s0 = sKmerCode[0];
 			KmerWord s1 = sKmerCode[1];
 			KmerWord s2 = sKmerCode[2];
@@ -637,7 +819,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_15(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_15(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s0 = sKmerCode[0];
 			KmerWord s1 = sKmerCode[1];
 			KmerWord s2 = sKmerCode[2];
@@ -665,7 +847,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_16(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_16(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s0 = sKmerCode[0];
 			KmerWord s1 = sKmerCode[1];
 			KmerWord s2 = sKmerCode[2];
@@ -696,7 +878,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_17(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_17(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s0 = sKmerCode[0];
 			KmerWord s1 = sKmerCode[1];
 			KmerWord s2 = sKmerCode[2];
@@ -727,7 +909,7 @@ namespace QutBio {
 		/// <param name="tCode">The numeric code of kmer t.</param>
 		/// <returns></returns>
 
-		static Distance GetKmerDistances_18(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint kmerLength) {
+		static Distance GetKmerDistances_18(KmerDistanceCache3 & instance, KmerWord * sKmerCode, KmerWord * tKmerCode, uint) {
 			KmerWord s0 = sKmerCode[0];
 			KmerWord s1 = sKmerCode[1];
 			KmerWord s2 = sKmerCode[2];
@@ -825,8 +1007,13 @@ namespace QutBio {
 	*		up the matrix to save a lookups and/or loops.
 	*	</summary>
 	*/
-	class KmerDistanceCache2: KmerDistanceCache {
+	class KmerDistanceCache2: KmerDistanceCache, public KmerKernelDispatch<KmerDistanceCache2> {
 		// TODO: Define and implement IKmerWordDistance, offering the GetDistance function.
+	public:
+		typedef Distance(*KmerDistanceFunction)(const KmerDistanceCache2 & instance, const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint kmerLength);
+
+		using KmerDistanceCache::TableBytes;
+
 	protected:
 		CacheType * kmerDistances1;
 		uint vocabSize1;
@@ -834,9 +1021,14 @@ namespace QutBio {
 		CacheType * kmerDistances2;
 		uint vocabSize2;
 
+		// kmerDistanceFunctions[k] is the unrolled kernel for kmer length k. 
+		// Entry 0 holds the generic loop.
+		KmerDistanceFunction kmerDistanceFunctions[MaxSpecialisedKmerLength + 1];
+
 	public:
 		KmerDistanceCache2(Alphabet * alphabet, RawKmerDistanceFunction * dist) : KmerDistanceCache(alphabet, dist) {
 			PrecomputeDistances();
+			InitKmerDistanceFunctions(std::make_integer_sequence<uint, MaxSpecialisedKmerLength + 1>());
 		}
 
 		KmerDistanceCache2( const KmerDistanceCache2 & other ) = delete;
@@ -889,6 +1081,53 @@ namespace QutBio {
 			return dist;
 		}
 
+		/// <summary> Computes distance between two kmers of arbitrary length with a 
+		///		run-time loop over the packed words.
+		/// </summary>
+		/// <param name="sKmerCode">The numeric code of kmer s.</param>
+		/// <param name="tKmerCode">The numeric code of kmer t.</param>
+		/// <param name="kmerLength">The number of symbols in each kmer.</param>
+		/// <returns></returns>
+
+		static Distance GetKmerDistances_Any(const KmerDistanceCache2 & instance, const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint kmerLength) {
+			return instance(const_cast<KmerWord *>(sKmerCode), const_cast<KmerWord *>(tKmerCode), kmerLength);
+		}
+
+		/// <summary> Computes distance between two kmers of length exactly 
+		///		kmerLength. The word loop is unrolled at compile time and the 
+		///		trailing odd symbol (if any) is resolved without a branch.
+		/// </summary>
+		/// <param name="sKmerCode">The numeric code of kmer s.</param>
+		/// <param name="tKmerCode">The numeric code of kmer t.</param>
+		/// <returns></returns>
+
+		template<uint kmerLength>
+		static Distance GetKmerDistances_K(const KmerDistanceCache2 & instance, const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint) {
+			const uint numTwos = kmerLength / 2;
+
+			Distance dist = KmerWordSum<numTwos>::Sum(instance.kmerDistances2, instance.vocabSize2, sKmerCode, tKmerCode);
+
+			if ( kmerLength & 1 ) {
+				dist += instance.kmerDistances1[sKmerCode[numTwos] * instance.vocabSize1 + tKmerCode[numTwos]];
+			}
+
+			return dist;
+		}
+
+		/// <summary> Gets the kernel which computes distances between kmers of
+		///		the designated length. Callers which compute many distances 
+		///		with the same kmer length should fetch this once, outside the
+		///		inner loop, and then invoke it as kernel(cache, s, t, kmerLength).
+		/// </summary>
+		/// <param name="kmerLength">The number of symbols in each kmer.</param>
+		/// <returns></returns>
+
+		KmerDistanceFunction GetKernel(uint kmerLength) const {
+			return kmerLength <= MaxSpecialisedKmerLength 
+				? kmerDistanceFunctions[kmerLength] 
+				: GetKmerDistances_Any;
+		}
+
 		Distance GetDistance1(KmerWord x, KmerWord y) const {
 			return kmerDistances1[x * vocabSize1 + y];
 		}
@@ -939,6 +1178,17 @@ namespace QutBio {
 			KmerDistanceCache::PrecomputeDistances(1, kmerDistances1, vocabSize1);
 			KmerDistanceCache::PrecomputeDistances(2, kmerDistances2, vocabSize2);
 		}
+
+		template<uint ... kmerLengths>
+		void InitKmerDistanceFunctions(std::integer_sequence<uint, kmerLengths...>) {
+			KmerDistanceFunction f[] = { GetKmerDistances_K<kmerLengths>... };
+
+			for ( uint i = 0; i <= MaxSpecialisedKmerLength; i++ ) {
+				kmerDistanceFunctions[i] = f[i];
+			}
+
+			kmerDistanceFunctions[0] = GetKmerDistances_Any;
+		}
 	};
 
 	/**
@@ -948,7 +1198,7 @@ namespace QutBio {
 	*		up the matrix to save a lookups and/or loops.
 	*	</summary>
 	*/
-	class KmerDistanceCache1: public KmerDistanceCache {
+	class KmerDistanceCache1: public KmerDistanceCache, public KmerKernelDispatch<KmerDistanceCache1> {
 		// TODO: Define and implement IKmerWordDistance, offering the GetDistance function.
 	protected:
 		CacheType * kmerDistances1;
@@ -983,7 +1233,29 @@ namespace QutBio {
 			return dist;
 		}
 
-		Distance GetDistance1(KmerWord x, KmerWord y) {
+		Distance operator()(const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint kmerLength) const {
+			Distance dist = 0;
+
+			for ( uint i = 0; i < kmerLength; i++ ) {
+				dist += kmerDistances1[sKmerCode[i] * vocabSize1 + tKmerCode[i]];
+			}
+
+			return dist;
+		}
+
+		/// <summary> Computes distance between two kmers of length exactly 
+		///		kmerLength, with the loop unrolled at compile time.
+		/// </summary>
+		/// <param name="sKmerCode">The numeric code of kmer s.</param>
+		/// <param name="tKmerCode">The numeric code of kmer t.</param>
+		/// <returns></returns>
+
+		template<uint kmerLength>
+		static Distance GetKmerDistances_K(const KmerDistanceCache1 & instance, const KmerWord * sKmerCode, const KmerWord * tKmerCode, uint) {
+			return KmerWordSum<kmerLength>::Sum(instance.kmerDistances1, instance.vocabSize1, sKmerCode, tKmerCode);
+		}
+
+		Distance GetDistance1(KmerWord x, KmerWord y) const {
 			return kmerDistances1[x * vocabSize1 + y];
 		}
 
@@ -992,4 +1264,58 @@ namespace QutBio {
 			KmerDistanceCache::PrecomputeDistances(1, kmerDistances1, vocabSize1);
 		}
 	};
+
+	/**
+	*	<summary>
+	*		Constructs the kmer distance cache which packs charsPerWord symbols
+	*		into each word, and invokes action(cache). Tools use this to choose 
+	*		the table size at run time while their distance loops are compiled 
+	*		for the concrete cache type. Action is normally a generic lambda.
+	*	</summary>
+	*	<param name="charsPerWord">1, 2 or 3: selects KmerDistanceCache1, 2 or 3.</param>
+	*	<param name="alphabet">The alphabet.</param>
+	*	<param name="dist">The raw distance function used to populate the tables.</param>
+	*	<param name="action">A callable object which accepts a reference to a cache.</param>
+	*/
+	template<typename Action>
+	auto WithKmerDistanceCache(uint charsPerWord, Alphabet * alphabet, RawKmerDistanceFunction * dist, Action && action) 
+		-> decltype(action(std::declval<KmerDistanceCache2 &>())) {
+		switch ( charsPerWord ) {
+		case 1: {
+			KmerDistanceCache1 cache(alphabet, dist);
+			return action(cache);
+		}
+		case 2: {
+			KmerDistanceCache2 cache(alphabet, dist);
+			return action(cache);
+		}
+		case 3: {
+			KmerDistanceCache3 cache(alphabet, dist);
+			return action(cache);
+		}
+		default:
+			throw Exception("charsPerWord must be 1, 2 or 3.", FileAndLine);
+		}
+	}
+
+	/**
+	*	<summary>
+	*		Chooses the number of symbols per word under the memory budget. 
+	*		Smaller words give smaller distance tables and, at 1, omit the 
+	*		packed encodings of the sequences, at the cost of more lookups per
+	*		kmer. Returns the largest value no greater than requested which 
+	*		divides wordLength and for which estimate(charsPerWord) fits the 
+	*		budget, or 0 if there is none.
+	*	</summary>
+	*/
+	template<typename Estimate>
+	uint FitCharsPerWord(uint requested, uint wordLength, Estimate && estimate) {
+		for ( uint charsPerWord = requested; charsPerWord >= 1; charsPerWord-- ) {
+			if ( wordLength % charsPerWord == 0 && MemoryAccount::Fits(estimate(charsPerWord)) ) {
+				return charsPerWord;
+			}
+		}
+
+		return 0;
+	}
 }
@@ -95,14 +95,11 @@ namespace QutBio {
 				discrete.SetPmf(kmerDistances);
 				discrete.GetMinimumDistribution(fragLength, minDist);
 
-				Histogram<double> currentSum = minDist.Pmf();
-
-				for ( int f = 2; f <= fragLength; f++ ) {
-					Histogram<double> newSum;
-					currentSum.DoConvolution(minDist.Pmf(), newSum);
-					newSum.Cleanup([](double key, double value) { return value <= 0; });
-					currentSum = newSum;
-				}
+				// Each kmer length extends the previous one by a single narrow 1-mer
+				// convolution, but only the fragLength-fold sum of minima is needed.
+				Histogram<double> currentSum;
+				minDist.Pmf().Power(fragLength, currentSum);
+				currentSum.Cleanup([](double key, double value) { return value <= 0; });
 
 				Histogram<double> averagePmf;
 
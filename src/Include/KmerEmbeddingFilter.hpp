@@ -0,0 +1,363 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies 
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18), 
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published 
+// by the Free Software Foundation; either version 3, or (at your 
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KMER_EMBEDDING_X86 1
+#else
+#define KMER_EMBEDDING_X86 0
+#endif
+
+#include "Alphabet.hpp"
+#include "CharMap.hpp"
+#include "Exception.hpp"
+#include "KmerDistanceCache.hpp"
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	A fixed list of kmer embeddings, transposed into blocks of BlockSize kmers so 
+	 *	that word i of every kmer in a block occupies BlockSize consecutive words. This
+	 *	is the layout scanned by KmerEmbeddingFilter::GetLowerBounds. Unused slots in 
+	 *	the final block hold zero.
+	 *	</summary>
+	 */
+	class KmerEmbeddingBlocks {
+	public:
+		/// <summary>The number of kmers in each block: one AVX-512 register of 64-bit words.</summary>
+		static const uint BlockSize = 8;
+
+	private:
+		uint kmerLength;
+		size_t count;
+		vector<uint64_t> words;
+
+	public:
+		KmerEmbeddingBlocks( uint kmerLength = 0, size_t count = 0 ) :
+			kmerLength( kmerLength ),
+			count( count ),
+			words( ( count + BlockSize - 1 ) / BlockSize * BlockSize * kmerLength, 0 ) {}
+
+		/**
+		 *	<summary>
+		 *	Stores a kmer embedding in the designated slot.
+		 *	</summary>
+		 *	<param name="index">The slot, 0 &lt;= index &lt; Count().</param>
+		 *	<param name="embedding">The embedding, as produced by KmerEmbeddingFilter::EmbedSubject.</param>
+		 */
+		void Set( size_t index, const uint64_t * embedding ) {
+			uint64_t * slot = &words[index / BlockSize * BlockSize * kmerLength + index % BlockSize];
+
+			for ( uint i = 0; i < kmerLength; i++ ) {
+				slot[i * BlockSize] = embedding[i];
+			}
+		}
+
+		uint KmerLength() const {
+			return kmerLength;
+		}
+
+		size_t Count() const {
+			return count;
+		}
+
+		size_t BlockCount() const {
+			return ( count + BlockSize - 1 ) / BlockSize;
+		}
+
+		/// <summary>The length of the bound buffer required by KmerEmbeddingFilter::GetLowerBounds.</summary>
+		size_t PaddedCount() const {
+			return BlockCount() * BlockSize;
+		}
+
+		const uint64_t * Block( size_t b ) const {
+			return &words[b * BlockSize * kmerLength];
+		}
+	};
+
+	/**
+	 *	<summary>
+	 *	A cheap lower bound on kmer distance, used to skip exact distance evaluations 
+	 *	in nearest-prototype search. Each residue is mapped to a 64-bit embedding by a
+	 *	CharMap (query and subject kmers may use different maps), and the Hamming 
+	 *	distance between two kmers is the total popcount of the XOR of their embeddings.
+	 *
+	 *	The bound is calibrated against the one-symbol distance table: for every pair of
+	 *	symbols in the alphabet, the popcount h of the XOR of their embeddings is paired with their
+	 *	distance d, and g is the lower convex hull of the smallest d observed at each h.
+	 *	Since g is convex and lies below every (h, d) pair, a kmer of length K with total
+	 *	Hamming distance H has distance at least K * g(H / K). The bound is tabulated 
+	 *	for every H, so a lookup costs one array access after the popcounts.
+	 *
+	 *	With scale = 1 the bound never exceeds the true distance, so pruning on it is 
+	 *	lossless. Larger scale values prune more aggressively at some cost in recall.
+	 *	</summary>
+	 */
+	class KmerEmbeddingFilter {
+		uint kmerLength;
+		double scale;
+		bool useVectorPopcount;
+
+		// Embeddings indexed by character. Each character is first mapped to the 
+		// symbol which represents it in the alphabet, so the embedding, like the 
+		// distance, is a function of the residue code alone.
+		uint64_t queryEmbedding[128];
+		uint64_t subjectEmbedding[128];
+
+		// lowerBound[H] is the bound for total Hamming distance H, 0 <= H <= 64 * kmerLength.
+		vector<Distance> lowerBound;
+
+	public:
+		/**
+		 *	<summary>
+		 *	Calibrates a filter for kmers of the designated length.
+		 *	</summary>
+		 *	<param name="alphabet">The alphabet used to encode the kmers.</param>
+		 *	<param name="distance">Source of the one-symbol distance table: any of the
+		 *	kmer distance caches.</param>
+		 *	<param name="kmerLength">The kmer length.</param>
+		 *	<param name="scale">Multiplier applied to the bound; 1 gives a lossless filter.</param>
+		 *	<param name="queryMap">The embedding applied to query (database) kmers.</param>
+		 *	<param name="subjectMap">The embedding applied to subject (prototype) kmers.</param>
+		 */
+		template<typename DistanceFunction>
+		KmerEmbeddingFilter(
+			const Alphabet & alphabet,
+			const DistanceFunction & distance,
+			uint kmerLength,
+			double scale = 1.0,
+			const CharMap & queryMap = CharMap::Blosum62QueryEncoding(),
+			const CharMap & subjectMap = CharMap::Blosum62SubjectEncoding()
+		) :
+			kmerLength( kmerLength ),
+			scale( scale ),
+			useVectorPopcount( HasVectorPopcount() ),
+			lowerBound( 64 * kmerLength + 1, 0 ) //
+		{
+			if ( scale < 1 ) {
+				throw Exception( "Filter scale must be at least 1.", FileAndLine );
+			}
+
+			const uint Bits = 64;
+			const int None = numeric_limits<int>::max();
+			vector<int> minDistance( Bits + 1, None );
+			const uint8_t * inverse = alphabet.Inverse();
+			const string symbols = alphabet.Symbols();
+			const uint alphabetSize = alphabet.Size();
+
+			for ( uint c = 0; c < 128; c++ ) {
+				uint8_t symbol = tolower( symbols[inverse[c]] ) & 127;
+				queryEmbedding[c] = queryMap.bits[symbol].lo;
+				subjectEmbedding[c] = subjectMap.bits[symbol].lo;
+			}
+
+			for ( uint x = 0; x < alphabetSize; x++ ) {
+				for ( uint y = 0; y < alphabetSize; y++ ) {
+					uint h = POPCOUNT( queryEmbedding[(uint8_t) symbols[x]] ^ subjectEmbedding[(uint8_t) symbols[y]] );
+					int d = (int8_t) distance.GetDistance1( x, y );
+
+					if ( d < minDistance[h] ) {
+						minDistance[h] = d;
+					}
+				}
+			}
+
+			// Lower convex hull of (h, minDistance[h]), scanned left to right.
+			vector<uint> hull;
+
+			for ( uint h = 0; h <= Bits; h++ ) {
+				if ( minDistance[h] == None ) continue;
+
+				while ( hull.size() >= 2 ) {
+					uint a = hull[hull.size() - 2], b = hull.back();
+					int64_t cross = (int64_t) ( b - a ) * ( minDistance[h] - minDistance[a] )
+						- (int64_t) ( h - a ) * ( minDistance[b] - minDistance[a] );
+
+					if ( cross > 0 ) break;
+
+					hull.pop_back();
+				}
+
+				hull.push_back( h );
+			}
+
+			const double maxBound = numeric_limits<Distance>::max();
+
+			for ( uint H = 0; H < lowerBound.size(); H++ ) {
+				double mean = (double) H / kmerLength;
+
+				// Every per-residue Hamming distance lies within the hull, so their mean does too.
+				if ( mean < hull.front() || mean > hull.back() ) continue;
+
+				double g = minDistance[hull.front()];
+
+				if ( hull.size() > 1 ) {
+					uint i = 1;
+					while ( i < hull.size() - 1 && hull[i] < mean ) i++;
+
+					uint a = hull[i - 1], b = hull[i];
+					g = minDistance[a] + ( mean - a ) * ( minDistance[b] - minDistance[a] ) / ( b - a );
+				}
+
+				// Distances are integers, so the bound may be rounded up; the small 
+				// tolerance absorbs floating point error in the interpolation.
+				double bound = ceil( scale * kmerLength * g - 1e-6 );
+				lowerBound[H] = (Distance) std::max( 0.0, std::min( bound, maxBound ) );
+			}
+		}
+
+		uint KmerLength() const {
+			return kmerLength;
+		}
+
+		double Scale() const {
+			return scale;
+		}
+
+		/// <summary>Writes the query embedding of each of the first n characters of s to embedding.</summary>
+		void EmbedQuery( const char * s, size_t n, uint64_t * embedding ) const {
+			Embed( queryEmbedding, s, n, embedding );
+		}
+
+		/// <summary>Writes the subject embedding of each of the first n characters of s to embedding.</summary>
+		void EmbedSubject( const char * s, size_t n, uint64_t * embedding ) const {
+			Embed( subjectEmbedding, s, n, embedding );
+		}
+
+		/// <summary>Gets the Hamming distance between the embeddings of two kmers.</summary>
+		uint HammingDistance( const uint64_t * query, const uint64_t * subject ) const {
+			uint h = 0;
+
+			for ( uint i = 0; i < kmerLength; i++ ) {
+				h += POPCOUNT( query[i] ^ subject[i] );
+			}
+
+			return h;
+		}
+
+		/// <summary>Gets the lower bound on kmer distance for a given total Hamming distance.</summary>
+		Distance LowerBound( uint hammingDistance ) const {
+			return lowerBound[hammingDistance];
+		}
+
+		/// <summary>Gets the lower bound on the distance between two embedded kmers.</summary>
+		Distance LowerBound( const uint64_t * query, const uint64_t * subject ) const {
+			return lowerBound[HammingDistance( query, subject )];
+		}
+
+		/**
+		 *	<summary>
+		 *	Computes the lower bound on the distance from a query kmer to every kmer in
+		 *	a collection.
+		 *	</summary>
+		 *	<param name="query">The query embedding, as produced by EmbedQuery.</param>
+		 *	<param name="subjects">The collection; its kmer length must match that of this filter.</param>
+		 *	<param name="bounds">Receives bounds; must have room for subjects.PaddedCount() elements.
+		 *	Entries at and beyond subjects.Count() are unspecified.</param>
+		 */
+		void GetLowerBounds( const uint64_t * query, const KmerEmbeddingBlocks & subjects, Distance * bounds ) const {
+#if KMER_EMBEDDING_X86
+			if ( useVectorPopcount ) {
+				GetLowerBoundsAvx512( query, subjects, bounds );
+				return;
+			}
+#endif
+			const uint BlockSize = KmerEmbeddingBlocks::BlockSize;
+			uint h[BlockSize];
+
+			for ( size_t b = 0; b < subjects.BlockCount(); b++ ) {
+				const uint64_t * block = subjects.Block( b );
+
+				for ( uint j = 0; j < BlockSize; j++ ) h[j] = 0;
+
+				for ( uint i = 0; i < kmerLength; i++ ) {
+					for ( uint j = 0; j < BlockSize; j++ ) {
+						h[j] += POPCOUNT( query[i] ^ block[i * BlockSize + j] );
+					}
+				}
+
+				for ( uint j = 0; j < BlockSize; j++ ) {
+					bounds[b * BlockSize + j] = lowerBound[h[j]];
+				}
+			}
+		}
+
+		/// <summary>Returns true iff this processor has the AVX-512 vector popcount instructions.</summary>
+		static bool HasVectorPopcount() {
+#if KMER_EMBEDDING_X86
+			__builtin_cpu_init();
+			return __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512vpopcntdq" );
+#else
+			return false;
+#endif
+		}
+
+	private:
+#if KMER_EMBEDDING_X86
+		// One block of eight subjects per register; the query word is broadcast.
+		__attribute__( ( target( "avx512f,avx512vpopcntdq" ) ) )
+		void GetLowerBoundsAvx512( const uint64_t * query, const KmerEmbeddingBlocks & subjects, Distance * bounds ) const {
+			const uint BlockSize = KmerEmbeddingBlocks::BlockSize;
+			alignas( 64 ) uint64_t h[BlockSize];
+
+			for ( size_t b = 0; b < subjects.BlockCount(); b++ ) {
+				const uint64_t * block = subjects.Block( b );
+				__m512i sum = _mm512_setzero_si512();
+
+				for ( uint i = 0; i < kmerLength; i++ ) {
+					__m512i x = _mm512_xor_si512( _mm512_set1_epi64( (long long) query[i] ), _mm512_loadu_si512( block + i * BlockSize ) );
+					sum = _mm512_add_epi64( sum, _mm512_popcnt_epi64( x ) );
+				}
+
+				_mm512_store_si512( h, sum );
+
+				for ( uint j = 0; j < BlockSize; j++ ) {
+					bounds[b * BlockSize + j] = lowerBound[h[j]];
+				}
+			}
+		}
+#endif
+
+		static void Embed( const uint64_t * map, const char * s, size_t n, uint64_t * embedding ) {
+			for ( size_t i = 0; i < n; i++ ) {
+				embedding[i] = map[s[i] & 127];
+			}
+		}
+	};
+}
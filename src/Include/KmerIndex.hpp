@@ -75,6 +75,8 @@ class KmerIndex : public unordered_map<Substring, Kmer *, Substring::Hash>
 
 			for (size_t kmerPos = 0; kmerPos < kmerCount; kmerPos++)
 			{
+				if (seq->IsUnknownKmer(kmerPos, kmerLength)) continue;
+
 				Substring s(residues, kmerPos, kmerLength);
 				auto item = this->find(s);
 
@@ -116,6 +118,8 @@ class KmerIndex : public unordered_map<Substring, Kmer *, Substring::Hash>
 			uint kmerCount = seq->KmerCount( kmerLength );
 
 			for ( size_t kmerPos = substring.start; kmerPos < kmerCount && kmerPos + kmerLength <= substring.start + substring.length; kmerPos++ ){
+				if ( seq->IsUnknownKmer( kmerPos, kmerLength ) ) continue;
+
 				Substring s( residues, kmerPos, kmerLength );
 				auto item = this->find( s );
 
@@ -145,6 +149,8 @@ class KmerIndex : public unordered_map<Substring, Kmer *, Substring::Hash>
 			uint kmerCount = seq->KmerCount(kmerLength);
 
 			for ( size_t kmerPos = substring.start; kmerPos < kmerCount && kmerPos + kmerLength <= substring.start + substring.length; kmerPos++ ) {
+				if ( seq->IsUnknownKmer( kmerPos, kmerLength ) ) continue;
+
 				Substring s( residues, kmerPos, kmerLength );
 				auto item = this->find( s );
 
@@ -195,5 +201,35 @@ class KmerIndex : public unordered_map<Substring, Kmer *, Substring::Hash>
 	{
 		return BaseType::size();
 	}
+
+	/// <summary>Gets the bytes held by the index: hash table, kmers and their instance lists.</summary>
+	size_t MemoryBytes() const
+	{
+		size_t bytes = sizeof(*this) + this->bucket_count() * sizeof(void *) + MemoryAccount::HeapBytes(allKmers);
+
+		for (auto &pair : *this)
+		{
+			bytes += NodeBytes + sizeof(Kmer) + MemoryAccount::BlockOverhead + pair.second->HeapBytes();
+		}
+
+		return bytes;
+	}
+
+	/**
+		**	Summary:
+		**		Estimates the bytes needed to index the designated number of kmer
+		**		positions, assuming the worst case that every kmer is distinct.
+		*/
+	static size_t Estimate(size_t positions)
+	{
+		const size_t perKmer = NodeBytes + sizeof(Kmer) + MemoryAccount::BlockOverhead
+			+ sizeof(Kmer::Instance) + MemoryAccount::BlockOverhead
+			+ 2 * sizeof(void *);
+		return positions * perKmer;
+	}
+
+  private:
+	// A hash table node: value, next pointer, cached hash, heap block.
+	static const size_t NodeBytes = sizeof(BaseType::value_type) + 2 * sizeof(void *) + MemoryAccount::BlockOverhead;
 };
 } // namespace QutBio
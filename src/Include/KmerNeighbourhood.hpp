@@ -0,0 +1,348 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18),
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published
+// by the Free Software Foundation; either version 3, or (at your
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "Alphabet.hpp"
+#include "KmerDistanceCache.hpp"
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	A set of words (such as prototype kmers), each identified by a zero-origin
+	 *	index, keyed by the mixed-radix code of the word, which is assigned by
+	 *	KmerNeighbourhood::Code. Indices which share a word are chained in
+	 *	ascending order.
+	 *	</summary>
+	 */
+	class KmerWordTable {
+		std::unordered_map<uint64_t, uint> first;
+		std::vector<uint> next;
+
+	public:
+		static const uint None = std::numeric_limits<uint>::max();
+
+		void Clear() {
+			first.clear();
+			next.clear();
+		}
+
+		/// <summary>Adds a word. Indices must be added in ascending order.</summary>
+		void Add( uint64_t code, uint index ) {
+			if ( next.size() <= index ) next.resize( index + 1, (uint) None );
+
+			auto p = first.find( code );
+
+			if ( p == first.end() ) {
+				first[code] = index;
+			}
+			else {
+				// Walk to the end of the chain; duplicates are rare.
+				uint i = p->second;
+				while ( next[i] != None ) i = next[i];
+				next[i] = index;
+			}
+		}
+
+		/// <summary>Gets the least index of a word with the given code, or None.</summary>
+		uint Find( uint64_t code ) const {
+			auto p = first.find( code );
+			return p == first.end() ? None : p->second;
+		}
+
+		/// <summary>Gets the next index of a word with the same code as index, or None.</summary>
+		uint Next( uint index ) const {
+			return next[index];
+		}
+
+		size_t Size() const {
+			return next.size();
+		}
+	};
+
+	/**
+	 *	<summary>
+	 *	Enumerates the neighbourhood of a short kmer: every word over the alphabet
+	 *	whose distance from the kmer is at most a threshold, where the distance is
+	 *	the sum of the one-symbol distances of the kmer distance function.
+	 *	<para>
+	 *		The walk fixes one position at a time. Substitutes at each position are
+	 *		tried in ascending order of one-symbol distance, and a branch is cut as
+	 *		soon as its partial distance plus the least possible distance over the
+	 *		remaining positions exceeds the threshold. That bound is attained, so
+	 *		every branch entered emits at least one word, and the work is at most
+	 *		kmerLength steps per emitted word.
+	 *	</para>
+	 *	<para>
+	 *		For short kmers and small thresholds the neighbourhood is far smaller
+	 *		than a typical prototype set, and looking each emitted word up in a
+	 *		KmerWordTable replaces a linear scan. The walk takes a limit on the
+	 *		number of words, so callers can fall back to the scan when the
+	 *		neighbourhood turns out to be too large to beat the scan.
+	 *	</para>
+	 *	</summary>
+	 */
+	class KmerNeighbourhood {
+		Alphabet * alphabet;
+		uint kmerLength;
+		uint alphabetSize;
+
+		/// <summary>One-symbol distances, row major.</summary>
+		std::vector<Distance> distance1;
+
+		/// <summary>Row x lists the symbols in ascending order of distance from x.</summary>
+		std::vector<uint8_t> substitutes;
+
+		/// <summary>The least distance from each symbol to any symbol.</summary>
+		std::vector<Distance> leastDistance;
+
+	public:
+		/// <summary>
+		/// The measured cost of emitting one word and looking it up in a table, in
+		/// units of one kmer distance evaluation by the vector kernels. A scan of n
+		/// words is worth replacing by a walk of fewer than n / LookupCost words.
+		/// </summary>
+		static const uint LookupCost = 8;
+
+		/// <summary>Gets the number of words a walk may emit in place of a scan of n words.</summary>
+		static size_t Budget( size_t n ) {
+			return n / LookupCost;
+		}
+
+		/**
+		 *	<summary>
+		 *	Initialise a generator for kmers of the designated length.
+		 *	</summary>
+		 *	<param name="alphabet">The alphabet used to encode the kmers.</param>
+		 *	<param name="distance">Source of the one-symbol distance table: any of the
+		 *	kmer distance caches.</param>
+		 *	<param name="kmerLength">The kmer length.</param>
+		 */
+		template<typename DistanceFunction>
+		KmerNeighbourhood( Alphabet & alphabet, const DistanceFunction & distance, uint kmerLength ) :
+			alphabet( &alphabet ),
+			kmerLength( kmerLength ),
+			alphabetSize( alphabet.Size() ),
+			distance1( (size_t) alphabetSize * alphabetSize ),
+			substitutes( (size_t) alphabetSize * alphabetSize ),
+			leastDistance( alphabetSize ) //
+		{
+			for ( uint x = 0; x < alphabetSize; x++ ) {
+				Distance * row = &distance1[x * alphabetSize];
+				uint8_t * order = &substitutes[x * alphabetSize];
+
+				for ( uint y = 0; y < alphabetSize; y++ ) {
+					row[y] = distance.GetDistance1( x, y );
+					order[y] = (uint8_t) y;
+				}
+
+				std::stable_sort( order, order + alphabetSize, [row]( uint8_t a, uint8_t b ) { return row[a] < row[b]; } );
+				leastDistance[x] = row[order[0]];
+			}
+		}
+
+		/**
+		 *	<summary>
+		 *	Returns true if and only if every word of length kmerLength has a
+		 *	distinct 64 bit code, and the alphabet fits the byte-wide substitute
+		 *	lists.
+		 *	</summary>
+		 */
+		bool IsAvailable() const {
+			if ( alphabetSize < 2 || alphabetSize > 256 ) return false;
+
+			double bits = kmerLength * log2( (double) alphabetSize );
+			return bits < 64;
+		}
+
+		uint KmerLength() const {
+			return kmerLength;
+		}
+
+		/// <summary>Gets the residue codes of the first length symbols of s.</summary>
+		void Symbols( const char * s, size_t length, KmerWord * symbols ) const {
+			alphabet->Encode( s, length, 1, symbols );
+		}
+
+		/// <summary>Gets the mixed-radix code of a word from its residue codes.</summary>
+		uint64_t Code( const KmerWord * symbols ) const {
+			uint64_t code = 0;
+
+			for ( uint i = 0; i < kmerLength; i++ ) {
+				code = code * alphabetSize + symbols[i];
+			}
+
+			return code;
+		}
+
+		/// <summary>Gets the mixed-radix code of the first kmerLength symbols of s.</summary>
+		uint64_t Code( const char * s ) const {
+			std::vector<KmerWord> symbols( kmerLength );
+			Symbols( s, kmerLength, symbols.data() );
+			return Code( symbols.data() );
+		}
+
+		/**
+		 *	<summary>
+		 *	Gets the mean size of the neighbourhood of a kmer drawn uniformly from
+		 *	the alphabet. Callers compare this with the size of the word table to
+		 *	decide whether enumeration is likely to beat a linear scan.
+		 *	</summary>
+		 */
+		double ExpectedSize( Distance threshold ) const {
+			// ways[d] is the mean number of partial words at distance d.
+			std::vector<double> ways( threshold + 1 ), next( threshold + 1 );
+			ways[0] = 1;
+
+			for ( uint i = 0; i < kmerLength; i++ ) {
+				std::fill( next.begin(), next.end(), 0.0 );
+
+				for ( uint x = 0; x < alphabetSize; x++ ) {
+					const Distance * row = &distance1[x * alphabetSize];
+
+					for ( uint y = 0; y < alphabetSize; y++ ) {
+						for ( uint d = 0; d + row[y] <= threshold; d++ ) {
+							next[d + row[y]] += ways[d];
+						}
+					}
+				}
+
+				for ( uint d = 0; d <= threshold; d++ ) {
+					ways[d] = next[d] / alphabetSize;
+				}
+			}
+
+			double size = 0;
+
+			for ( auto w : ways ) size += w;
+
+			return size;
+		}
+
+		/**
+		 *	<summary>
+		 *	Calls visit(code, distance) for each word within threshold of the query,
+		 *	until maxWords words have been visited.
+		 *	</summary>
+		 *	<param name="query">The residue codes of the query kmer.</param>
+		 *	<returns>True if the whole neighbourhood was visited; false if the walk
+		 *	stopped at maxWords.</returns>
+		 */
+		template<typename Visit>
+		bool Enumerate( const KmerWord * query, Distance threshold, size_t maxWords, Visit visit ) const {
+			// remaining[i] is the least distance that positions i.. can add.
+			Distance * remaining = (Distance *) alloca( ( kmerLength + 1 ) * sizeof( Distance ) );
+			remaining[kmerLength] = 0;
+
+			for ( int i = (int) kmerLength - 1; i >= 0; i-- ) {
+				remaining[i] = remaining[i + 1] + leastDistance[query[i]];
+			}
+
+			if ( remaining[0] > threshold ) return true;
+
+			size_t words = 0;
+			return Walk( query, threshold, remaining, 0, 0, 0, maxWords, words, visit );
+		}
+
+		/**
+		 *	<summary>
+		 *	Finds the word of a table nearest to the query, provided it lies within
+		 *	threshold. Ties go to the least index, as in a linear scan that keeps
+		 *	the first strictly nearer word.
+		 *	</summary>
+		 *	<param name="index">Receives the index of the nearest word, or KmerWordTable::None.</param>
+		 *	<param name="dist">Receives its distance.</param>
+		 *	<returns>True if the search was exhaustive; false if the neighbourhood
+		 *	held more than maxWords words, in which case the outputs are undefined.</returns>
+		 */
+		bool FindNearest( const KmerWord * query, Distance threshold, const KmerWordTable & table, size_t maxWords, uint & index, Distance & dist ) const {
+			index = KmerWordTable::None;
+			dist = std::numeric_limits<Distance>::max();
+
+			return Enumerate( query, threshold, maxWords, [&]( uint64_t code, Distance d ) {
+				uint i = table.Find( code );
+
+				if ( i != KmerWordTable::None && ( d < dist || ( d == dist && i < index ) ) ) {
+					index = i;
+					dist = d;
+				}
+			} );
+		}
+
+	private:
+		template<typename Visit>
+		bool Walk(
+			const KmerWord * query,
+			Distance threshold,
+			const Distance * remaining,
+			uint position,
+			uint64_t code,
+			Distance partial,
+			size_t maxWords,
+			size_t & words,
+			Visit & visit
+		) const {
+			if ( position == kmerLength ) {
+				if ( words++ >= maxWords ) return false;
+
+				visit( code, partial );
+				return true;
+			}
+
+			const uint x = query[position];
+			const Distance * row = &distance1[x * alphabetSize];
+			const uint8_t * order = &substitutes[x * alphabetSize];
+			const Distance budget = threshold - remaining[position + 1];
+
+			for ( uint k = 0; k < alphabetSize; k++ ) {
+				uint y = order[k];
+				Distance d = partial + row[y];
+
+				if ( d > budget ) break;
+
+				if ( !Walk( query, threshold, remaining, position + 1, code * alphabetSize + y, d, maxWords, words, visit ) ) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+	};
+}
@@ -0,0 +1,340 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies 
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18), 
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published 
+// by the Free Software Foundation; either version 3, or (at your 
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KMER_SHUFFLE_X86 1
+#else
+#define KMER_SHUFFLE_X86 0
+#endif
+
+#include "Alphabet.hpp"
+#include "EncodedKmer.hpp"
+#include "KmerDistanceCache.hpp"
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	A fixed list of kmers held as residue-coded bytes, transposed into blocks of
+	 *	BlockSize kmers so that residue i of every kmer in a block occupies BlockSize
+	 *	consecutive bytes. This is the layout scanned by KmerShuffleDistance. Unused
+	 *	slots in the final block hold residue 0.
+	 *	</summary>
+	 */
+	class KmerResidueBlocks {
+	public:
+		/// <summary>The number of kmers in each block: one AVX-512 register of bytes.</summary>
+		static const uint BlockSize = 64;
+
+	private:
+		uint kmerLength;
+		size_t count;
+		vector<uint8_t> residues;
+
+	public:
+		KmerResidueBlocks( uint kmerLength, size_t count ) :
+			kmerLength( kmerLength ),
+			count( count ),
+			residues( ( count + BlockSize - 1 ) / BlockSize * BlockSize * kmerLength, 0 ) {}
+
+		/**
+		 *	<summary>
+		 *	Stores a kmer in the designated slot.
+		 *	</summary>
+		 *	<param name="index">The slot, 0 &lt;= index &lt; Count().</param>
+		 *	<param name="unpackedEncoding">
+		 *	The residue codes of the kmer, one symbol per word, as returned by
+		 *	EncodedFastaSequence::GetEncodedKmer1.
+		 *	</param>
+		 */
+		void Set( size_t index, const KmerWord * unpackedEncoding ) {
+			uint8_t * slot = &residues[index / BlockSize * BlockSize * kmerLength + index % BlockSize];
+
+			for ( uint i = 0; i < kmerLength; i++ ) {
+				slot[i * BlockSize] = (uint8_t) unpackedEncoding[i];
+			}
+		}
+
+		uint KmerLength() const {
+			return kmerLength;
+		}
+
+		size_t Count() const {
+			return count;
+		}
+
+		size_t BlockCount() const {
+			return ( count + BlockSize - 1 ) / BlockSize;
+		}
+
+		/// <summary>The length of the distance buffer required by KmerShuffleDistance::GetDistances.</summary>
+		size_t PaddedCount() const {
+			return BlockCount() * BlockSize;
+		}
+
+		const uint8_t * Block( size_t b ) const {
+			return &residues[b * BlockSize * kmerLength];
+		}
+	};
+
+	/**
+	 *	<summary>
+	 *	Computes the distances from one query kmer to every kmer in a KmerResidueBlocks
+	 *	collection. For each query residue, the corresponding row of the one-symbol
+	 *	distance table is held in registers and indexed by the residue codes of a whole
+	 *	block of kmers at once, using pshufb (AVX2, two 16-byte halves, alphabets of up to 
+	 *	32 symbols) or vpermb (AVX-512 VBMI, alphabets of up to 64 symbols). Per-residue 
+	 *	distances are accumulated in 16-bit lanes, so the results are identical to those
+	 *	of the table lookups in the kmer distance caches.
+	 *
+	 *	The instruction set is chosen at run time. When the processor, the alphabet or
+	 *	the distance table rules out both vector paths, IsAvailable() returns false and
+	 *	the caller should use the table path instead.
+	 *	</summary>
+	 */
+	class KmerShuffleDistance {
+	public:
+		enum class InstructionSet { None, Avx2, Avx512Vbmi };
+
+	private:
+		/// <summary>Bytes per table row; large enough for one vpermb table.</summary>
+		static const uint RowSize = 64;
+
+		uint kmerLength;
+		InstructionSet instructionSet;
+		vector<uint8_t> rows;
+
+	public:
+		/**
+		 *	<summary>
+		 *	Initialise a kernel for kmers of the designated length.
+		 *	</summary>
+		 *	<param name="alphabet">The alphabet used to encode the kmers.</param>
+		 *	<param name="distance">Source of the one-symbol distance table: any of the
+		 *	kmer distance caches.</param>
+		 *	<param name="kmerLength">The kmer length.</param>
+		 *	<param name="allowed">The most capable instruction set that may be used; pass
+		 *	InstructionSet::None to force the table path.</param>
+		 */
+		template<typename DistanceFunction>
+		KmerShuffleDistance(
+			const Alphabet & alphabet,
+			const DistanceFunction & distance,
+			uint kmerLength,
+			InstructionSet allowed = InstructionSet::Avx512Vbmi
+		) :
+			kmerLength( kmerLength ),
+			instructionSet( InstructionSet::None ),
+			rows( (size_t) alphabet.Size() * RowSize, 0 ) //
+		{
+			uint alphabetSize = alphabet.Size();
+			int maxDistance = 0;
+			bool fitsInBytes = true;
+
+			for ( uint x = 0; x < alphabetSize; x++ ) {
+				for ( uint y = 0; y < alphabetSize; y++ ) {
+					int d = (int8_t) distance.GetDistance1( x, y );
+
+					if ( d < 0 ) {
+						fitsInBytes = false;
+					}
+					else if ( d > maxDistance ) {
+						maxDistance = d;
+					}
+
+					if ( y < RowSize ) {
+						rows[x * RowSize + y] = (uint8_t) d;
+					}
+				}
+			}
+
+			// Sums must not wrap in the 16-bit accumulators.
+			if ( !fitsInBytes || (size_t) maxDistance * kmerLength > numeric_limits<int16_t>::max() ) {
+				return;
+			}
+
+			InstructionSet supported = Detect();
+
+			if ( allowed >= InstructionSet::Avx512Vbmi && supported >= InstructionSet::Avx512Vbmi && alphabetSize <= 64 ) {
+				instructionSet = InstructionSet::Avx512Vbmi;
+			}
+			else if ( allowed >= InstructionSet::Avx2 && supported >= InstructionSet::Avx2 && alphabetSize <= 32 ) {
+				instructionSet = InstructionSet::Avx2;
+			}
+		}
+
+		/// <summary>Gets the most capable instruction set supported by this processor.</summary>
+		static InstructionSet Detect() {
+#if KMER_SHUFFLE_X86
+			__builtin_cpu_init();
+
+			if ( __builtin_cpu_supports( "avx512bw" ) && __builtin_cpu_supports( "avx512vbmi" ) ) {
+				return InstructionSet::Avx512Vbmi;
+			}
+
+			if ( __builtin_cpu_supports( "avx2" ) ) {
+				return InstructionSet::Avx2;
+			}
+#endif
+			return InstructionSet::None;
+		}
+
+		static const char * Name( InstructionSet instructionSet ) {
+			return instructionSet == InstructionSet::Avx512Vbmi ? "AVX-512 VBMI"
+				: instructionSet == InstructionSet::Avx2 ? "AVX2"
+				: "none";
+		}
+
+		bool IsAvailable() const {
+			return instructionSet != InstructionSet::None;
+		}
+
+		InstructionSet GetInstructionSet() const {
+			return instructionSet;
+		}
+
+		/**
+		 *	<summary>
+		 *	Computes the distance from a query kmer to every kmer in a collection.
+		 *	</summary>
+		 *	<param name="query">The residue codes of the query kmer, one symbol per word.</param>
+		 *	<param name="kmers">The collection; its kmer length must match that of this kernel.</param>
+		 *	<param name="distances">Receives distances; must have room for kmers.PaddedCount() elements.
+		 *	Entries at and beyond kmers.Count() are unspecified.</param>
+		 */
+		void GetDistances( const KmerWord * query, const KmerResidueBlocks & kmers, Distance * distances ) const {
+			size_t blockCount = kmers.BlockCount();
+
+			switch ( instructionSet ) {
+#if KMER_SHUFFLE_X86
+			case InstructionSet::Avx512Vbmi:
+				for ( size_t b = 0; b < blockCount; b++ ) {
+					GetBlockDistancesAvx512( query, kmers.Block( b ), distances + b * KmerResidueBlocks::BlockSize );
+				}
+				break;
+
+			case InstructionSet::Avx2:
+				for ( size_t b = 0; b < blockCount; b++ ) {
+					GetBlockDistancesAvx2( query, kmers.Block( b ), distances + b * KmerResidueBlocks::BlockSize );
+				}
+				break;
+#endif
+			default:
+				for ( size_t b = 0; b < blockCount; b++ ) {
+					GetBlockDistances( query, kmers.Block( b ), distances + b * KmerResidueBlocks::BlockSize );
+				}
+				break;
+			}
+		}
+
+	private:
+		void GetBlockDistances( const KmerWord * query, const uint8_t * block, Distance * distances ) const {
+			const uint N = KmerResidueBlocks::BlockSize;
+
+			for ( uint j = 0; j < N; j++ ) {
+				distances[j] = 0;
+			}
+
+			for ( uint i = 0; i < kmerLength; i++ ) {
+				const uint8_t * row = &rows[query[i] * RowSize];
+				const uint8_t * residues = block + i * N;
+
+				for ( uint j = 0; j < N; j++ ) {
+					distances[j] += row[residues[j]];
+				}
+			}
+		}
+
+#if KMER_SHUFFLE_X86
+		static_assert( sizeof( Distance ) == 2, "The vector kernels store 16 bit lanes directly into the Distance array." );
+
+		__attribute__( ( target( "avx2" ) ) )
+		void GetBlockDistancesAvx2( const KmerWord * query, const uint8_t * block, Distance * distances ) const {
+			const uint N = KmerResidueBlocks::BlockSize;
+			const __m256i fifteen = _mm256_set1_epi8( 15 );
+			__m256i acc0 = _mm256_setzero_si256();
+			__m256i acc1 = _mm256_setzero_si256();
+			__m256i acc2 = _mm256_setzero_si256();
+			__m256i acc3 = _mm256_setzero_si256();
+
+			for ( uint i = 0; i < kmerLength; i++ ) {
+				const uint8_t * row = &rows[query[i] * RowSize];
+				const __m256i lo = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i *) row ) );
+				const __m256i hi = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i *) ( row + 16 ) ) );
+				const uint8_t * residues = block + i * N;
+
+				__m256i x0 = _mm256_loadu_si256( (const __m256i *) residues );
+				__m256i x1 = _mm256_loadu_si256( (const __m256i *) ( residues + 32 ) );
+
+				// pshufb uses the low four bits of each index; select the half by the fifth.
+				__m256i d0 = _mm256_blendv_epi8( _mm256_shuffle_epi8( lo, x0 ), _mm256_shuffle_epi8( hi, x0 ), _mm256_cmpgt_epi8( x0, fifteen ) );
+				__m256i d1 = _mm256_blendv_epi8( _mm256_shuffle_epi8( lo, x1 ), _mm256_shuffle_epi8( hi, x1 ), _mm256_cmpgt_epi8( x1, fifteen ) );
+
+				acc0 = _mm256_add_epi16( acc0, _mm256_cvtepu8_epi16( _mm256_castsi256_si128( d0 ) ) );
+				acc1 = _mm256_add_epi16( acc1, _mm256_cvtepu8_epi16( _mm256_extracti128_si256( d0, 1 ) ) );
+				acc2 = _mm256_add_epi16( acc2, _mm256_cvtepu8_epi16( _mm256_castsi256_si128( d1 ) ) );
+				acc3 = _mm256_add_epi16( acc3, _mm256_cvtepu8_epi16( _mm256_extracti128_si256( d1, 1 ) ) );
+			}
+
+			_mm256_storeu_si256( (__m256i *) ( distances + 0 ), acc0 );
+			_mm256_storeu_si256( (__m256i *) ( distances + 16 ), acc1 );
+			_mm256_storeu_si256( (__m256i *) ( distances + 32 ), acc2 );
+			_mm256_storeu_si256( (__m256i *) ( distances + 48 ), acc3 );
+		}
+
+		__attribute__( ( target( "avx512f,avx512bw,avx512vbmi" ) ) )
+		void GetBlockDistancesAvx512( const KmerWord * query, const uint8_t * block, Distance * distances ) const {
+			const uint N = KmerResidueBlocks::BlockSize;
+			__m512i acc0 = _mm512_setzero_si512();
+			__m512i acc1 = _mm512_setzero_si512();
+
+			for ( uint i = 0; i < kmerLength; i++ ) {
+				const __m512i row = _mm512_loadu_si512( &rows[query[i] * RowSize] );
+				const __m512i x = _mm512_loadu_si512( block + i * N );
+				const __m512i d = _mm512_permutexvar_epi8( x, row );
+
+				acc0 = _mm512_add_epi16( acc0, _mm512_cvtepu8_epi16( _mm512_castsi512_si256( d ) ) );
+				acc1 = _mm512_add_epi16( acc1, _mm512_cvtepu8_epi16( _mm512_extracti64x4_epi64( d, 1 ) ) );
+			}
+
+			_mm512_storeu_si512( distances + 0, acc0 );
+			_mm512_storeu_si512( distances + 32, acc1 );
+		}
+#endif
+	};
+}
@@ -0,0 +1,169 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18),
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published
+// by the Free Software Foundation; either version 3, or (at your
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#define MAPPED_FILE_READ 1
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Exception.hpp"
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	A read-only view of the whole content of a file. Where mmap is available
+	 *	the file is mapped, so parsers can tokenise it in place without copying;
+	 *	otherwise it is read into memory. The content is not null terminated.
+	 *	</summary>
+	 */
+	class MappedFile {
+		const char * data = 0;
+		size_t size = 0;
+
+#if MAPPED_FILE_READ
+		std::vector<char> buffer;
+#else
+		void * map = 0;
+#endif
+
+	public:
+		/// <summary>Maps the designated file.</summary>
+		/// <exception cref="Exception">The file cannot be opened or mapped.</exception>
+		MappedFile( const std::string & fileName ) {
+#if MAPPED_FILE_READ
+			std::ifstream in( fileName, std::ios::binary );
+
+			if ( !in ) {
+				throw Exception( "Unable to open '" + fileName + "'.", FileAndLine );
+			}
+
+			buffer.assign( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+			data = buffer.data();
+			size = buffer.size();
+#else
+			int fd = open( fileName.c_str(), O_RDONLY );
+
+			if ( fd < 0 ) {
+				throw Exception( "Unable to open '" + fileName + "'.", FileAndLine );
+			}
+
+			struct stat status;
+
+			if ( fstat( fd, &status ) != 0 ) {
+				close( fd );
+				throw Exception( "Unable to get the size of '" + fileName + "'.", FileAndLine );
+			}
+
+			size = (size_t) status.st_size;
+
+			// A zero-length mapping is an error, so an empty file is left unmapped.
+			if ( size > 0 ) {
+				map = mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+				if ( map == MAP_FAILED ) {
+					map = 0;
+					close( fd );
+					throw Exception( "Unable to map '" + fileName + "'.", FileAndLine );
+				}
+
+				madvise( map, size, MADV_SEQUENTIAL );
+				data = (const char *) map;
+			}
+
+			close( fd );
+#endif
+		}
+
+		MappedFile( const MappedFile & ) = delete;
+		MappedFile & operator=( const MappedFile & ) = delete;
+
+		~MappedFile() {
+#if !MAPPED_FILE_READ
+			if ( map ) munmap( map, size );
+#endif
+		}
+
+		const char * Data() const {
+			return data;
+		}
+
+		size_t Size() const {
+			return size;
+		}
+
+		/**
+		 *	<summary>
+		 *	Splits the content into at most parts contiguous pieces of roughly
+		 *	equal size, each of which ends just after a newline (or at the end of
+		 *	the file), so that the pieces can be parsed line by line independently.
+		 *	</summary>
+		 *	<returns>The ascending offsets of the boundaries, starting with 0 and
+		 *	ending with Size(). Piece i is [offsets[i], offsets[i+1]).</returns>
+		 */
+		std::vector<size_t> LineBoundaries( size_t parts ) const {
+			std::vector<size_t> offsets{ 0 };
+
+			if ( parts < 1 ) parts = 1;
+
+			for ( size_t i = 1; i < parts; i++ ) {
+				size_t target = std::max( offsets.back(), size / parts * i );
+
+				if ( target >= size ) break;
+
+				const char * newline = (const char *) memchr( data + target, '\n', size - target );
+
+				if ( !newline ) break;
+
+				size_t offset = newline - data + 1;
+
+				if ( offset > offsets.back() && offset < size ) offsets.push_back( offset );
+			}
+
+			offsets.push_back( size );
+			return offsets;
+		}
+	};
+}
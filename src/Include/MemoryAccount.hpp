@@ -0,0 +1,404 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18),
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published
+// by the Free Software Foundation; either version 3, or (at your
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "Exception.hpp"
+
+using namespace std;
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	Tallies the bytes held by the major data structures of a program, 
+	 *	alongside the resident set size of the process, and enforces an 
+	 *	optional memory budget.
+	 *
+	 *	Structures are accounted in bulk at phase boundaries, not per 
+	 *	allocation, so accounting costs nothing in inner loops. Each category
+	 *	keeps its current and peak size. Before a large allocation a program 
+	 *	can check an estimate of its size against the budget with Fits or 
+	 *	Require, and fall back to a lower-memory strategy or fail fast rather
+	 *	than be killed part way through a long run.
+	 *	</summary>
+	 */
+	class MemoryAccount {
+	public:
+		enum Category {
+			Sequences,
+			Encodings,
+			KmerIndex,
+			Codebook,
+			Postings,
+			Signatures,
+			DistanceTables,
+			Count
+		};
+
+		// Approximate bookkeeping overhead of each heap block, used in estimates
+		// and footprints.
+		static const size_t BlockOverhead = 16;
+
+		/// <summary>Gets the name used for a category in reports.</summary>
+		static const char * Name( int category ) {
+			static const char * names[Count] = {
+				"sequences", "encodings", "kmer index", "codebook", "postings", "signatures", "distance tables"
+			};
+			return names[category];
+		}
+
+		/// <summary>Records the current size of a category.</summary>
+		static void Set( Category category, size_t bytes ) {
+			Data<>::bytes[category] = bytes;
+			UpdatePeak( category, bytes );
+		}
+
+		/// <summary>Adds to (or, with a negative value, subtracts from) the current size of a category.</summary>
+		static void Add( Category category, int64_t bytes ) {
+			size_t current = Data<>::bytes[category] += (size_t) bytes;
+			UpdatePeak( category, current );
+		}
+
+		static size_t Bytes( Category category ) {
+			return Data<>::bytes[category];
+		}
+
+		static size_t Peak( Category category ) {
+			return Data<>::peak[category];
+		}
+
+		/// <summary>Gets the sum of the current sizes of all categories.</summary>
+		static size_t Total() {
+			size_t total = 0;
+
+			for ( int i = 0; i < Count; i++ ) {
+				total += Data<>::bytes[i];
+			}
+
+			return total;
+		}
+
+		/// <summary>Gets the resident set size of the process in bytes, or 0 if it is not available.</summary>
+		static size_t ResidentBytes() {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+			PROCESS_MEMORY_COUNTERS counters;
+			return GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) ? counters.WorkingSetSize : 0;
+#else
+			FILE * f = fopen( "/proc/self/statm", "r" );
+
+			if ( !f ) return 0;
+
+			unsigned long long pages = 0, resident = 0;
+			int fields = fscanf( f, "%llu %llu", &pages, &resident );
+			fclose( f );
+
+			return fields == 2 ? (size_t) resident * (size_t) sysconf( _SC_PAGESIZE ) : 0;
+#endif
+		}
+
+		/// <summary>Gets the peak resident set size of the process in bytes, or 0 if it is not available.</summary>
+		static size_t PeakResidentBytes() {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+			PROCESS_MEMORY_COUNTERS counters;
+			return GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) ? counters.PeakWorkingSetSize : 0;
+#else
+			struct rusage usage;
+
+			if ( getrusage( RUSAGE_SELF, &usage ) != 0 ) return 0;
+
+#if defined(__APPLE__)
+			return (size_t) usage.ru_maxrss;
+#else
+			return (size_t) usage.ru_maxrss * 1024;
+#endif
+#endif
+		}
+
+		/// <summary>Gets the memory budget in bytes; 0 means unlimited.</summary>
+		static size_t Budget() {
+			return Data<>::budget;
+		}
+
+		static void SetBudget( size_t bytes ) {
+			Data<>::budget = bytes;
+		}
+
+		/// <summary>Returns true iff there is no budget, or the designated number of bytes is within it.</summary>
+		static bool Fits( size_t bytes ) {
+			return Data<>::budget == 0 || bytes <= Data<>::budget;
+		}
+
+		/**
+		 *	<summary>
+		 *	Throws an Exception if the estimated requirement, in bytes, of the 
+		 *	designated task exceeds the budget.
+		 *	</summary>
+		 */
+		static void Require( const string & what, size_t bytes ) {
+			if ( Fits( bytes ) ) return;
+
+			throw Exception( what + " needs an estimated " + Format( bytes ) + ", which exceeds --memoryBudget " + Format( Data<>::budget ) + ".", FileAndLine );
+		}
+
+		/// <summary>Returns true iff there is a budget or reporting is on, so structures should be accounted.</summary>
+		static bool IsActive() {
+			return Data<>::budget > 0 || Data<>::reporting;
+		}
+
+		static bool IsReporting() {
+			return Data<>::reporting;
+		}
+
+		static void SetReporting( bool reporting ) {
+			Data<>::reporting = reporting;
+		}
+
+		/// <summary>Sets the name of the program, used as the prefix of messages.</summary>
+		static void SetProgram( const string & program ) {
+			Data<>::program = program;
+		}
+
+		/**
+		 *	<summary>
+		 *	Marks the end of a phase. If reporting, writes the size of each 
+		 *	non-empty category and the resident set size to standard error. If 
+		 *	there is a budget and the process has outgrown it, says so, since 
+		 *	that is the last warning before the system runs out of memory.
+		 *	</summary>
+		 */
+		static void Checkpoint( const string & phase ) {
+			size_t resident = ResidentBytes();
+
+			if ( Data<>::reporting ) {
+				// statm and getrusage are sampled separately, so the recorded 
+				// peak can lag the current resident size.
+				size_t peak = std::max( resident, PeakResidentBytes() );
+
+				ostringstream str;
+				str << Data<>::program << ": memory after " << phase << ":";
+
+				for ( int i = 0; i < Count; i++ ) {
+					if ( Data<>::bytes[i] > 0 ) str << " " << Name( i ) << " " << Format( Data<>::bytes[i] ) << ",";
+				}
+
+				str << " accounted " << Format( Total() )
+					<< ", resident " << Format( resident )
+					<< " (peak " << Format( peak ) << ").\n";
+				cerr << str.str();
+			}
+
+			if ( Data<>::budget > 0 && resident > Data<>::budget ) {
+				cerr << Data<>::program << ": warning - resident memory " << Format( resident )
+					<< " after " << phase << " exceeds --memoryBudget " << Format( Data<>::budget ) << ".\n";
+			}
+		}
+
+		/// <summary>Writes the peak size of each category and of the process to standard error.</summary>
+		static void ReportPeaks() {
+			ostringstream str;
+			str << Data<>::program << ": peak memory:";
+
+			for ( int i = 0; i < Count; i++ ) {
+				if ( Data<>::peak[i] > 0 ) str << " " << Name( i ) << " " << Format( Data<>::peak[i] ) << ",";
+			}
+
+			str << " resident " << Format( std::max( ResidentBytes(), PeakResidentBytes() ) ) << ".\n";
+			cerr << str.str();
+		}
+
+		/// <summary>Formats a number of bytes with a binary unit, e.g. 1.5 GiB.</summary>
+		static string Format( size_t bytes ) {
+			static const char * units[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB" };
+			double value = (double) bytes;
+			int unit = 0;
+
+			while ( value >= 1024 && unit < 5 ) {
+				value /= 1024;
+				unit++;
+			}
+
+			char buffer[32];
+			snprintf( buffer, sizeof( buffer ), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit] );
+			return buffer;
+		}
+
+		/**
+		 *	<summary>
+		 *	Parses a size such as 500000000, 512M, 64G or 1.5T. Suffixes K, M, G
+		 *	and T are binary multiples, and may be followed by B or iB.
+		 *	</summary>
+		 */
+		static bool Parse( const string & text, size_t & bytes ) {
+			const char * s = text.c_str();
+			char * end = 0;
+			double value = strtod( s, &end );
+
+			if ( end == s || value < 0 ) return false;
+
+			string suffix;
+
+			for ( ; *end; end++ ) {
+				if ( !isspace( (unsigned char) *end ) ) suffix += (char) toupper( (unsigned char) *end );
+			}
+
+			if ( suffix.size() > 1 && ( suffix.substr( 1 ) == "B" || suffix.substr( 1 ) == "IB" ) ) {
+				suffix = suffix.substr( 0, 1 );
+			}
+
+			double multiplier = suffix == "" || suffix == "B" ? 1
+				: suffix == "K" ? 1024.0
+				: suffix == "M" ? 1024.0 * 1024
+				: suffix == "G" ? 1024.0 * 1024 * 1024
+				: suffix == "T" ? 1024.0 * 1024 * 1024 * 1024
+				: 0;
+
+			if ( multiplier == 0 ) return false;
+
+			bytes = (size_t) ( value * multiplier );
+			return true;
+		}
+
+		/// <summary>Gets the heap bytes held by a vector, excluding any held by its elements.</summary>
+		template<typename T>
+		static size_t HeapBytes( const vector<T> & v ) {
+			return v.capacity() > 0 ? v.capacity() * sizeof( T ) + BlockOverhead : 0;
+		}
+
+		/**
+		 *	<summary>
+		 *	Gets the heap bytes held by a string, which are none if it fits in the 
+		 *	inline buffer. The capacity of an empty string is that of the buffer 
+		 *	(15 bytes under libstdc++, although the object takes 32).
+		 *	</summary>
+		 */
+		static size_t HeapBytes( const string & s ) {
+			static const size_t inlineCapacity = string().capacity();
+			return s.capacity() > inlineCapacity ? s.capacity() + 1 + BlockOverhead : 0;
+		}
+
+	private:
+		// Static data of a header-only class.
+		template<typename T = void>
+		struct Data {
+			static std::atomic<size_t> bytes[Count];
+			static std::atomic<size_t> peak[Count];
+			static size_t budget;
+			static bool reporting;
+			static string program;
+		};
+
+		static void UpdatePeak( Category category, size_t bytes ) {
+			size_t peak = Data<>::peak[category];
+
+			while ( bytes > peak && !Data<>::peak[category].compare_exchange_weak( peak, bytes ) ) {}
+		}
+	};
+
+	template<typename T> std::atomic<size_t> MemoryAccount::Data<T>::bytes[MemoryAccount::Count];
+	template<typename T> std::atomic<size_t> MemoryAccount::Data<T>::peak[MemoryAccount::Count];
+	template<typename T> size_t MemoryAccount::Data<T>::budget = 0;
+	template<typename T> bool MemoryAccount::Data<T>::reporting = false;
+	template<typename T> string MemoryAccount::Data<T>::program;
+
+	/**
+	 *	<summary>
+	 *	Sets up memory accounting from the command line: --memoryBudget size 
+	 *	sets the budget, and --memoryReport true reports the accounts at each
+	 *	checkpoint. When the session ends, the peaks are reported if either 
+	 *	option was given.
+	 *	</summary>
+	 *	<typeparam name="ArgList">Args, or a class with the same Get, IsDefined and ProgName methods.</typeparam>
+	 */
+	class MemorySession {
+		bool active = false;
+
+	public:
+		template<typename ArgList>
+		explicit MemorySession( ArgList & args ) {
+			MemoryAccount::SetProgram( args.ProgName() );
+
+			if ( args.IsDefined( "memoryBudget" ) ) {
+				string text;
+				size_t budget = 0;
+
+				if ( !args.Get( "memoryBudget", text ) || !MemoryAccount::Parse( text, budget ) ) {
+					throw Exception( "Invalid value for --memoryBudget: '" + text + "'. Expected a size such as 512M or 64G.", FileAndLine );
+				}
+
+				MemoryAccount::SetBudget( budget );
+				active = true;
+			}
+
+			if ( args.IsDefined( "memoryReport" ) ) {
+				bool reporting = false;
+
+				if ( !args.Get( "memoryReport", reporting ) ) {
+					throw Exception( "Invalid value for --memoryReport. Expected true or false.", FileAndLine );
+				}
+
+				MemoryAccount::SetReporting( reporting );
+				active = active || reporting;
+			}
+		}
+
+		~MemorySession() {
+			if ( active ) MemoryAccount::ReportPeaks();
+		}
+
+		MemorySession( const MemorySession & ) = delete;
+		MemorySession & operator=( const MemorySession & ) = delete;
+	};
+}
@@ -0,0 +1,303 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18),
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published
+// by the Free Software Foundation; either version 3, or (at your
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define PERF_COUNTERS_AVAILABLE 1
+#endif
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	A group of hardware performance counters which count events in the 
+	 *	calling thread, using the Linux perf_event_open system call. The group
+	 *	is scheduled on the PMU as a unit, so the counts in a sample are 
+	 *	mutually consistent; if the kernel has to multiplex the counters, the
+	 *	counts are scaled up by the fraction of time they were running.
+	 *
+	 *	Counters are often unavailable: in virtual machines without a virtual
+	 *	PMU, when /proc/sys/kernel/perf_event_paranoid is above 2, or on other
+	 *	platforms. Open reports why, and counters which cannot be opened on 
+	 *	their own are simply left out of the group.
+	 *
+	 *	Each Read is one system call, costing on the order of a microsecond, so 
+	 *	read the counters around phases and coarse loop bodies, not kernels.
+	 *	</summary>
+	 */
+	class PerfCounters {
+	public:
+		enum Counter {
+			Cycles,
+			Instructions,
+			L1dReadMisses,
+			LlcMisses,
+			BranchMisses,
+			Count
+		};
+
+		/// <summary>Gets the name used for a counter in reports.</summary>
+		static const char * Name( int counter ) {
+			static const char * names[Count] = {
+				"cycles", "instructions", "l1d_read_misses", "llc_misses", "branch_misses"
+			};
+			return names[counter];
+		}
+
+		/**
+		 *	<summary>
+		 *	A snapshot of the raw counters. Bit i of mask is set if values[i] is 
+		 *	valid. enabled and running are the times for which the group has been
+		 *	enabled and actually counting, which differ when the kernel 
+		 *	multiplexes the counters.
+		 *	</summary>
+		 */
+		struct Sample {
+			uint64_t values[Count] = {};
+			uint64_t enabled = 0;
+			uint64_t running = 0;
+			unsigned mask = 0;
+		};
+
+		PerfCounters() {
+			for ( int i = 0; i < Count; i++ ) {
+				fd[i] = -1;
+				slot[i] = -1;
+			}
+		}
+
+		~PerfCounters() {
+			Close();
+		}
+
+		PerfCounters( const PerfCounters & ) = delete;
+		PerfCounters & operator=( const PerfCounters & ) = delete;
+
+		/// <summary>Gets a bit mask which designates the counters that are open.</summary>
+		unsigned Mask() const {
+			return mask;
+		}
+
+		bool IsOpen() const {
+			return mask != 0;
+		}
+
+		/**
+		 *	<summary>
+		 *	Opens and starts as many of the counters as possible for the calling
+		 *	thread. Returns false, and sets error to the reason, if none can be 
+		 *	opened.
+		 *	</summary>
+		 */
+		bool Open( std::string & error ) {
+			Close();
+
+#if PERF_COUNTERS_AVAILABLE
+			int firstErrno = 0;
+			int leader = -1;
+
+			for ( int i = 0; i < Count; i++ ) {
+				perf_event_attr attr;
+				memset( &attr, 0, sizeof( attr ) );
+				attr.size = sizeof( attr );
+				attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				attr.disabled = leader < 0 ? 1 : 0;
+				SetEvent( attr, (Counter) i );
+
+				int f = (int) syscall( __NR_perf_event_open, &attr, 0, -1, leader, 0 );
+
+				if ( f < 0 ) {
+					if ( !firstErrno ) firstErrno = errno;
+					continue;
+				}
+
+				if ( leader < 0 ) leader = f;
+
+				fd[i] = f;
+				slot[i] = members++;
+				mask |= 1u << i;
+			}
+
+			if ( leader < 0 ) {
+				error = Describe( firstErrno );
+				return false;
+			}
+
+			ioctl( leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+			ioctl( leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+			return true;
+#else
+			error = "hardware counters need the Linux perf_event_open system call";
+			return false;
+#endif
+		}
+
+		/**
+		 *	<summary>
+		 *	Gets the estimated number of events of the designated counter between 
+		 *	two samples. When the counters are multiplexed, the raw delta is 
+		 *	scaled by the ratio of the time enabled to the time running over the 
+		 *	same interval; scaling each sample by its own cumulative ratio would 
+		 *	let the second fall below the first.
+		 *	</summary>
+		 */
+		static uint64_t Delta( const Sample & start, const Sample & end, int counter ) {
+			if ( end.values[counter] <= start.values[counter] ) return 0;
+
+			uint64_t value = end.values[counter] - start.values[counter];
+			uint64_t enabled = end.enabled - start.enabled;
+			uint64_t running = end.running - start.running;
+
+			if ( running == 0 || running >= enabled ) return value;
+
+			return (uint64_t) ( value * ( (double) enabled / running ) );
+		}
+
+		/// <summary>Reads the current (cumulative) raw counts. Returns false if the group is not open.</summary>
+		bool Read( Sample & sample ) const {
+			sample.mask = 0;
+
+#if PERF_COUNTERS_AVAILABLE
+			if ( !mask ) return false;
+
+			// Layout of a group read: nr, time_enabled, time_running, value[nr].
+			uint64_t buffer[3 + Count];
+			ssize_t bytes = read( Leader(), buffer, sizeof( buffer ) );
+
+			if ( bytes < (ssize_t) ( 3 * sizeof( uint64_t ) ) ) return false;
+
+			sample.enabled = buffer[1];
+			sample.running = buffer[2];
+
+			for ( int i = 0; i < Count; i++ ) {
+				if ( slot[i] >= 0 && (uint64_t) slot[i] < buffer[0] ) {
+					sample.values[i] = buffer[3 + slot[i]];
+					sample.mask |= 1u << i;
+				}
+			}
+
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		void Close() {
+#if PERF_COUNTERS_AVAILABLE
+			// Members first, so the leader outlives its group.
+			for ( int i = Count - 1; i >= 0; i-- ) {
+				if ( fd[i] >= 0 ) close( fd[i] );
+			}
+#endif
+			for ( int i = 0; i < Count; i++ ) {
+				fd[i] = -1;
+				slot[i] = -1;
+			}
+
+			members = 0;
+			mask = 0;
+		}
+
+	private:
+		int fd[Count];
+		int slot[Count];
+		int members = 0;
+		unsigned mask = 0;
+
+		int Leader() const {
+			for ( int i = 0; i < Count; i++ ) {
+				if ( slot[i] == 0 ) return fd[i];
+			}
+
+			return -1;
+		}
+
+#if PERF_COUNTERS_AVAILABLE
+		static void SetEvent( perf_event_attr & attr, Counter counter ) {
+			switch ( counter ) {
+			case Cycles:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_CPU_CYCLES;
+				break;
+			case Instructions:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+				break;
+			case L1dReadMisses:
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = PERF_COUNT_HW_CACHE_L1D
+					| ( PERF_COUNT_HW_CACHE_OP_READ << 8 )
+					| ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+				break;
+			case LlcMisses:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_CACHE_MISSES;
+				break;
+			default:
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+				break;
+			}
+		}
+
+		static std::string Describe( int error ) {
+			std::string reason = strerror( error );
+
+			switch ( error ) {
+			case EACCES:
+			case EPERM:
+				return reason + "; lower /proc/sys/kernel/perf_event_paranoid to 2 or less";
+			case ENOENT:
+			case ENODEV:
+			case EOPNOTSUPP:
+				return reason + "; the processor or hypervisor does not expose hardware counters";
+			case ENOSYS:
+				return reason + "; the kernel was built without perf events";
+			default:
+				return reason;
+			}
+		}
+#endif
+	};
+}
@@ -0,0 +1,695 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18),
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published
+// by the Free Software Foundation; either version 3, or (at your
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "PerfCounters.hpp"
+
+using namespace std;
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define PROFILER_RDTSC 1
+#endif
+
+// Profiling is compiled in unless DO_PROFILE is defined as 0. When compiled
+// in, it costs one predictable branch per scope until enabled by --profile.
+#if !defined(DO_PROFILE)
+#define DO_PROFILE 1
+#endif
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	A hierarchical, thread-aware profiler. Each thread accumulates a tree
+	 *	of timed regions of its own, so timing a scope takes no locks. Regions
+	 *	which a worker thread enters at the top level are attached to the 
+	 *	region that the main thread (the one which called Enable) was in at 
+	 *	the time, so the work of a parallel loop appears under the region 
+	 *	which contains the loop. The trees are merged by path when the report
+	 *	is written.
+	 *
+	 *	Optionally, each thread also reads a group of hardware performance
+	 *	counters as it enters and leaves a region, and the report gives the
+	 *	event counts of each region in total and per thread. 
+	 *	</summary>
+	 */
+	class Profiler {
+	public:
+		// Durations are binned in a histogram with four bins per power of 2,
+		// which gives percentiles to within about 12%.
+		static const int Buckets = 256;
+
+		struct Node {
+			const char * name;
+			Node * parent;
+
+			// For regions entered at the top level of a worker thread, the 
+			// region of the main thread that was active at the time.
+			const Node * anchor;
+
+			vector<Node *> children;
+			uint64_t calls = 0;
+			uint64_t ticks = 0;
+			uint64_t minTicks = UINT64_MAX;
+			uint64_t maxTicks = 0;
+			uint64_t histogram[Buckets] = {};
+			uint64_t counters[PerfCounters::Count] = {};
+
+			Node( const char * name, Node * parent, const Node * anchor ) : name( name ), parent( parent ), anchor( anchor ) {}
+		};
+
+		struct Thread {
+			Node root{ "", 0, 0 };
+			Node * current = &root;
+			vector<unique_ptr<Node>> nodes;
+			bool isMain = false;
+			PerfCounters perf;
+		};
+
+	private:
+		// Static data of a header-only class.
+		template<typename T = void>
+		struct Data {
+			static bool enabled;
+			static bool counting;
+			static thread_local Thread * thread;
+			static std::atomic<const Node *> mainCurrent;
+			static std::mutex lock;
+			static vector<unique_ptr<Thread>> threads;
+			static uint64_t startTicks;
+			static std::chrono::steady_clock::time_point startTime;
+		};
+
+	public:
+		static bool IsEnabled() {
+#if DO_PROFILE
+			return Data<>::enabled;
+#else
+			return false;
+#endif
+		}
+
+		static bool IsCounting() {
+#if DO_PROFILE
+			return Data<>::counting;
+#else
+			return false;
+#endif
+		}
+
+		/**
+		 *	<summary>
+		 *	Starts profiling. The calling thread becomes the main thread. If 
+		 *	counters is true, regions also record hardware event counts, provided
+		 *	that the counters can be opened for the main thread; if they cannot,
+		 *	the reason is reported and profiling continues with times only.
+		 *	</summary>
+		 */
+		static void Enable( bool counters = false ) {
+#if DO_PROFILE
+			Thread * thread = GetThread();
+			thread->isMain = true;
+
+			if ( counters ) {
+				string error;
+
+				if ( thread->perf.Open( error ) ) {
+					Data<>::counting = true;
+				}
+				else {
+					cerr << "Hardware performance counters are unavailable (" << error << "); the profile will contain times only.\n";
+				}
+			}
+
+			Data<>::startTicks = Ticks();
+			Data<>::startTime = std::chrono::steady_clock::now();
+			Data<>::enabled = true;
+#else
+			cerr << "Profiling was disabled when this program was compiled (DO_PROFILE=0).\n";
+#endif
+		}
+
+		/// <summary>Gets a timestamp in processor-specific ticks.</summary>
+		static uint64_t Ticks() {
+#if PROFILER_RDTSC
+			return __rdtsc();
+#else
+			return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+#endif
+		}
+
+		/// <summary>Enters the named child of the current region of this thread, and returns it.</summary>
+		static Node * Enter( const char * name ) {
+			Thread * thread = GetThread();
+			Node * parent = thread->current;
+			const Node * anchor = parent == &thread->root && !thread->isMain
+				? Anchor( name )
+				: 0;
+			Node * node = 0;
+
+			// Call sites are identified by the address of their name.
+			for ( auto child : parent->children ) {
+				if ( child->name == name && child->anchor == anchor ) {
+					node = child;
+					break;
+				}
+			}
+
+			if ( !node ) {
+				node = new Node( name, parent, anchor );
+				thread->nodes.emplace_back( node );
+				parent->children.push_back( node );
+			}
+
+			thread->current = node;
+
+			if ( thread->isMain ) Data<>::mainCurrent.store( node, std::memory_order_release );
+
+			return node;
+		}
+
+		/// <summary>Records a call of duration ticks to node, which must be the current region of this thread, and leaves it.</summary>
+		static void Exit( Node * node, uint64_t ticks ) {
+			Thread * thread = Data<>::thread;
+
+			node->calls++;
+			node->ticks += ticks;
+			if ( ticks < node->minTicks ) node->minTicks = ticks;
+			if ( ticks > node->maxTicks ) node->maxTicks = ticks;
+			node->histogram[Bucket( ticks )]++;
+
+			thread->current = node->parent;
+
+			if ( thread->isMain ) {
+				Data<>::mainCurrent.store( node->parent == &thread->root ? 0 : node->parent, std::memory_order_release );
+			}
+		}
+
+		/// <summary>Reads the hardware counters of this thread, if counting, at the start of a region.</summary>
+		static void StartCounters( PerfCounters::Sample & start ) {
+			start.mask = 0;
+			if ( Data<>::counting ) Data<>::thread->perf.Read( start );
+		}
+
+		/// <summary>Adds the events since start to node, which must be the current region of this thread.</summary>
+		static void StopCounters( Node * node, const PerfCounters::Sample & start ) {
+			if ( !start.mask ) return;
+
+			PerfCounters::Sample end;
+
+			if ( !Data<>::thread->perf.Read( end ) ) return;
+
+			for ( int i = 0; i < PerfCounters::Count; i++ ) {
+				if ( start.mask & end.mask & ( 1u << i ) ) {
+					node->counters[i] += PerfCounters::Delta( start, end, i );
+				}
+			}
+		}
+
+		/**
+		 *	<summary>
+		 *	Writes the merged profile of all threads as JSON. Call this when no
+		 *	other thread is inside a region.
+		 *	</summary>
+		 */
+		static void WriteReport( ostream & out, const string & program ) {
+			double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - Data<>::startTime ).count();
+			uint64_t ticks = Ticks() - Data<>::startTicks;
+			double secondsPerTick = ticks > 0 && elapsed > 0 ? elapsed / ticks : 1e-9;
+
+			Summary root;
+			std::lock_guard<std::mutex> guard( Data<>::lock );
+			unsigned counters = 0;
+
+			for ( size_t t = 0; t < Data<>::threads.size(); t++ ) {
+				auto & thread = Data<>::threads[t];
+				counters |= thread->perf.Mask();
+
+				for ( auto child : thread->root.children ) {
+					Summary * parent = child->anchor ? Find( root, child->anchor ) : &root;
+					parent->Merge( child, t );
+				}
+			}
+
+			out << "{\n"
+				<< "  \"program\": \"" << Escape( program ) << "\",\n"
+				<< "  \"threads\": " << Data<>::threads.size() << ",\n"
+				<< "  \"elapsed_s\": " << elapsed << ",\n"
+				<< "  \"counters\": [";
+
+			for ( int i = 0, n = 0; i < PerfCounters::Count; i++ ) {
+				if ( counters & ( 1u << i ) ) out << ( n++ ? ", " : "" ) << "\"" << PerfCounters::Name( i ) << "\"";
+			}
+
+			out << "],\n"
+				<< "  \"regions\": ";
+			root.WriteChildren( out, secondsPerTick, counters, "  " );
+			out << "\n}\n";
+		}
+
+	private:
+		/// <summary>The share of one thread in a region of the merged profile.</summary>
+		struct ThreadSummary {
+			uint64_t calls = 0;
+			uint64_t ticks = 0;
+			uint64_t counters[PerfCounters::Count] = {};
+		};
+
+		/// <summary>A region of the merged profile.</summary>
+		struct Summary {
+			string name;
+			uint64_t calls = 0;
+			uint64_t ticks = 0;
+			uint64_t minTicks = UINT64_MAX;
+			uint64_t maxTicks = 0;
+			vector<uint64_t> histogram = vector<uint64_t>( Buckets );
+			uint64_t counters[PerfCounters::Count] = {};
+			map<size_t, ThreadSummary> threads;
+			map<string, unique_ptr<Summary>> children;
+
+			Summary * Child( const string & name ) {
+				auto & child = children[name];
+
+				if ( !child ) {
+					child.reset( new Summary() );
+					child->name = name;
+				}
+
+				return child.get();
+			}
+
+			void Merge( const Node * node, size_t thread ) {
+				Summary * summary = Child( node->name );
+				summary->calls += node->calls;
+				summary->ticks += node->ticks;
+				summary->minTicks = std::min( summary->minTicks, node->minTicks );
+				summary->maxTicks = std::max( summary->maxTicks, node->maxTicks );
+
+				for ( int i = 0; i < Buckets; i++ ) {
+					summary->histogram[i] += node->histogram[i];
+				}
+
+				ThreadSummary & share = summary->threads[thread];
+				share.calls += node->calls;
+				share.ticks += node->ticks;
+
+				for ( int i = 0; i < PerfCounters::Count; i++ ) {
+					summary->counters[i] += node->counters[i];
+					share.counters[i] += node->counters[i];
+				}
+
+				for ( auto child : node->children ) {
+					summary->Merge( child, thread );
+				}
+			}
+
+			/// <summary>Gets the approximate duration, in ticks, below which fraction p of calls fall.</summary>
+			double Percentile( double p ) const {
+				uint64_t target = std::max<uint64_t>( 1, (uint64_t) ceil( p * calls ) ), count = 0;
+
+				for ( int i = 0; i < Buckets; i++ ) {
+					count += histogram[i];
+
+					if ( count >= target ) {
+						double value = ( BucketFloor( i ) + BucketFloor( i + 1 ) ) / 2.0;
+						return std::max<double>( minTicks, std::min<double>( maxTicks, value ) );
+					}
+				}
+
+				return (double) maxTicks;
+			}
+
+			/// <summary>Writes the event counts designated by mask as a JSON object, with instructions per cycle if available.</summary>
+			static void WriteCounters( ostream & out, const uint64_t * counters, unsigned mask ) {
+				out << "{ ";
+
+				for ( int i = 0, n = 0; i < PerfCounters::Count; i++ ) {
+					if ( mask & ( 1u << i ) ) out << ( n++ ? ", " : "" ) << "\"" << PerfCounters::Name( i ) << "\": " << counters[i];
+				}
+
+				unsigned ipc = ( 1u << PerfCounters::Cycles ) | ( 1u << PerfCounters::Instructions );
+
+				if ( ( mask & ipc ) == ipc && counters[PerfCounters::Cycles] > 0 ) {
+					out << ", \"ipc\": " << (double) counters[PerfCounters::Instructions] / counters[PerfCounters::Cycles];
+				}
+
+				out << " }";
+			}
+
+			void Write( ostream & out, double secondsPerTick, unsigned counterMask, const string & indent ) const {
+				double ns = secondsPerTick * 1e9;
+
+				out << "{\n"
+					<< indent << "  \"name\": \"" << Escape( name ) << "\",\n"
+					<< indent << "  \"calls\": " << calls << ",\n"
+					<< indent << "  \"threads\": " << threads.size() << ",\n"
+					<< indent << "  \"total_s\": " << ( ticks * secondsPerTick ) << ",\n"
+					<< indent << "  \"mean_ns\": " << ( calls ? ticks * ns / calls : 0 ) << ",\n"
+					<< indent << "  \"min_ns\": " << ( calls ? minTicks * ns : 0 ) << ",\n"
+					<< indent << "  \"p50_ns\": " << ( Percentile( 0.5 ) * ns ) << ",\n"
+					<< indent << "  \"p90_ns\": " << ( Percentile( 0.9 ) * ns ) << ",\n"
+					<< indent << "  \"p99_ns\": " << ( Percentile( 0.99 ) * ns ) << ",\n"
+					<< indent << "  \"max_ns\": " << ( maxTicks * ns ) << ",\n";
+
+				if ( counterMask ) {
+					out << indent << "  \"counters\": ";
+					WriteCounters( out, counters, counterMask );
+					out << ",\n" << indent << "  \"per_thread\": [\n";
+
+					size_t n = 0;
+
+					for ( auto & share : threads ) {
+						out << indent << "    { \"thread\": " << share.first
+							<< ", \"calls\": " << share.second.calls
+							<< ", \"total_s\": " << ( share.second.ticks * secondsPerTick )
+							<< ", \"counters\": ";
+						WriteCounters( out, share.second.counters, counterMask );
+						out << " }" << ( ++n < threads.size() ? ",\n" : "\n" );
+					}
+
+					out << indent << "  ],\n";
+				}
+
+				out << indent << "  \"children\": ";
+				WriteChildren( out, secondsPerTick, counterMask, indent + "  " );
+				out << "\n" << indent << "}";
+			}
+
+			/// <summary>Writes the children as a JSON array, longest total time first.</summary>
+			void WriteChildren( ostream & out, double secondsPerTick, unsigned counterMask, const string & indent ) const {
+				vector<const Summary *> sorted;
+
+				for ( auto & child : children ) {
+					sorted.push_back( child.second.get() );
+				}
+
+				std::stable_sort( sorted.begin(), sorted.end(), []( const Summary * x, const Summary * y ) {
+					return x->ticks > y->ticks;
+				} );
+
+				if ( sorted.empty() ) {
+					out << "[]";
+					return;
+				}
+
+				out << "[\n";
+
+				for ( size_t i = 0; i < sorted.size(); i++ ) {
+					out << indent << "  ";
+					sorted[i]->Write( out, secondsPerTick, counterMask, indent + "  " );
+					out << ( i + 1 < sorted.size() ? ",\n" : "\n" );
+				}
+
+				out << indent << "]";
+			}
+		};
+
+		static Thread * GetThread() {
+			Thread *& thread = Data<>::thread;
+
+			if ( !thread ) {
+				thread = new Thread();
+
+				// Counters for worker threads are best effort: a thread which 
+				// cannot open them contributes times only.
+				if ( Data<>::counting ) {
+					string error;
+					thread->perf.Open( error );
+				}
+
+				std::lock_guard<std::mutex> guard( Data<>::lock );
+				Data<>::threads.emplace_back( thread );
+			}
+
+			return thread;
+		}
+
+		/**
+		 *	<summary>
+		 *	Gets the region of the main thread under which a top-level region of a
+		 *	worker thread belongs. This is the current region of the main thread, 
+		 *	unless the main thread is itself inside the same call site (as it will
+		 *	be in a parallel loop), in which case it is the parent of that region.
+		 *	</summary>
+		 */
+		static const Node * Anchor( const char * name ) {
+			const Node * anchor = Data<>::mainCurrent.load( std::memory_order_acquire );
+
+			for ( const Node * node = anchor; node && node->parent; node = node->parent ) {
+				if ( node->name == name ) {
+					anchor = node->parent->parent ? node->parent : 0;
+				}
+			}
+
+			return anchor;
+		}
+
+		/// <summary>Gets the bin of a duration: exact below 4, then four per power of 2.</summary>
+		static int Bucket( uint64_t ticks ) {
+			if ( ticks < 4 ) return (int) ticks;
+
+#if defined(_MSC_VER)
+			unsigned long b;
+			_BitScanReverse64( &b, ticks );
+#else
+			int b = 63 - __builtin_clzll( ticks );
+#endif
+			return 4 * ( (int) b - 1 ) + (int) ( ( ticks >> ( b - 2 ) ) & 3 );
+		}
+
+		/// <summary>Gets the least duration that falls in the designated bin.</summary>
+		static double BucketFloor( int i ) {
+			if ( i < 4 ) return i;
+			return ldexp( 4 + i % 4, i / 4 - 1 );
+		}
+
+		/// <summary>Gets the summary of the (main thread) region node, creating it and its ancestors if needed.</summary>
+		static Summary * Find( Summary & root, const Node * node ) {
+			vector<const char *> path;
+
+			for ( ; node && node->parent; node = node->parent ) {
+				path.push_back( node->name );
+			}
+
+			Summary * summary = &root;
+
+			for ( auto name = path.rbegin(); name != path.rend(); name++ ) {
+				summary = summary->Child( *name );
+			}
+
+			return summary;
+		}
+
+		static string Escape( const string & s ) {
+			string result;
+
+			for ( char c : s ) {
+				if ( c == '"' || c == '\\' ) result += '\\';
+				result += c;
+			}
+
+			return result;
+		}
+	};
+
+	template<typename T> bool Profiler::Data<T>::enabled = false;
+	template<typename T> bool Profiler::Data<T>::counting = false;
+	template<typename T> thread_local Profiler::Thread * Profiler::Data<T>::thread = 0;
+	template<typename T> std::atomic<const Profiler::Node *> Profiler::Data<T>::mainCurrent{ 0 };
+	template<typename T> std::mutex Profiler::Data<T>::lock;
+	template<typename T> vector<unique_ptr<Profiler::Thread>> Profiler::Data<T>::threads;
+	template<typename T> uint64_t Profiler::Data<T>::startTicks = 0;
+	template<typename T> std::chrono::steady_clock::time_point Profiler::Data<T>::startTime;
+
+	/**
+	 *	<summary>
+	 *	Times the enclosing block as a region of the profile, if profiling is
+	 *	enabled. Use PROFILE_SCOPE rather than declaring these directly.
+	 *	</summary>
+	 */
+	class ProfileScope {
+		Profiler::Node * node = 0;
+		uint64_t start = 0;
+		PerfCounters::Sample counters;
+
+	public:
+		explicit ProfileScope( const char * name ) {
+			if ( Profiler::IsEnabled() ) {
+				node = Profiler::Enter( name );
+				Profiler::StartCounters( counters );
+				start = Profiler::Ticks();
+			}
+		}
+
+		~ProfileScope() {
+			if ( node ) {
+				uint64_t ticks = Profiler::Ticks() - start;
+				Profiler::StopCounters( node, counters );
+				Profiler::Exit( node, ticks );
+			}
+		}
+
+		ProfileScope( const ProfileScope & ) = delete;
+		ProfileScope & operator=( const ProfileScope & ) = delete;
+	};
+
+	/**
+	 *	<summary>
+	 *	A stopwatch which accumulates the time between calls to Start and Stop,
+	 *	and also records each interval as a region of the profile if profiling
+	 *	is enabled. Intervals must nest properly with the other regions of the
+	 *	thread. A running stopwatch is stopped when it is destroyed.
+	 *	</summary>
+	 */
+	class ProfileRegion {
+		const char * name;
+		Profiler::Node * node = 0;
+		uint64_t startTicks = 0;
+		PerfCounters::Sample counters;
+		std::chrono::steady_clock::time_point startTime;
+		double elapsed = 0;
+		bool running = false;
+
+	public:
+		explicit ProfileRegion( const char * name ) : name( name ) {}
+
+		~ProfileRegion() {
+			if ( running ) Stop();
+		}
+
+		ProfileRegion( const ProfileRegion & ) = delete;
+		ProfileRegion & operator=( const ProfileRegion & ) = delete;
+
+		void Start() {
+			running = true;
+			startTime = std::chrono::steady_clock::now();
+
+			if ( Profiler::IsEnabled() ) {
+				node = Profiler::Enter( name );
+				Profiler::StartCounters( counters );
+				startTicks = Profiler::Ticks();
+			}
+		}
+
+		void Stop() {
+			if ( !running ) return;
+
+			if ( node ) {
+				uint64_t ticks = Profiler::Ticks() - startTicks;
+				Profiler::StopCounters( node, counters );
+				Profiler::Exit( node, ticks );
+				node = 0;
+			}
+
+			elapsed += std::chrono::duration<double>( std::chrono::steady_clock::now() - startTime ).count();
+			running = false;
+		}
+
+		/// <summary>Gets the total time, in seconds, of the completed intervals.</summary>
+		double Elapsed() const {
+			return elapsed;
+		}
+	};
+
+	/**
+	 *	<summary>
+	 *	Enables the profiler if the program was run with --profile fileName, 
+	 *	and writes the report to that file when the session ends. With 
+	 *	--perfCounters true as well, the report includes hardware event counts.
+	 *	</summary>
+	 *	<typeparam name="ArgList">Args, or a class with the same Get and ProgName methods.</typeparam>
+	 */
+	class ProfileSession {
+		string fileName;
+		string program;
+
+	public:
+		template<typename ArgList>
+		explicit ProfileSession( ArgList & args ) {
+			bool counters = false;
+
+			if ( args.IsDefined( "perfCounters" ) ) {
+				args.Get( "perfCounters", counters );
+			}
+
+			if ( args.Get( "profile", fileName ) && fileName.size() > 0 ) {
+				program = args.ProgName();
+				Profiler::Enable( counters );
+			}
+			else if ( counters ) {
+				cerr << args.ProgName() << ": --perfCounters has no effect without --profile.\n";
+			}
+		}
+
+		~ProfileSession() {
+			if ( fileName.empty() || !Profiler::IsEnabled() ) return;
+
+			ofstream out( fileName );
+
+			if ( !out ) {
+				cerr << program << ": unable to write profile to '" << fileName << "'.\n";
+				return;
+			}
+
+			Profiler::WriteReport( out, program );
+		}
+	};
+}
+
+#define PROFILE_CONCAT_( x, y ) x ## y
+#define PROFILE_CONCAT( x, y ) PROFILE_CONCAT_( x, y )
+
+#if DO_PROFILE
+/// Times the rest of the enclosing block as a region with the designated (string literal) name.
+#define PROFILE_SCOPE( name ) QutBio::ProfileScope PROFILE_CONCAT( profileScope_, __LINE__ )( name )
+#else
+#define PROFILE_SCOPE( name )
+#endif
@@ -36,12 +36,14 @@
 #include "Alphabet.hpp"
 #include "SimilarityMatrix.hpp"
 #include "FastaSequence.hpp"
-#include "FreeList.hpp"
+#include "KmerDiagonalSweep.hpp"
 #include "Util.hpp"
 
+#include <algorithm>
 #include <string>
 #include <ctime>
 #include <cfloat>
+#include <vector>
 
 namespace QutBio {
 
@@ -61,9 +63,230 @@ namespace QutBio {
 
 		virtual ~SequenceDistanceFunction() {}
 
-		virtual double ComputeDistance(
+		virtual Distance ComputeDistance(
 			EncodedFastaSequence * querySeq,
 			EncodedFastaSequence * subjectSeq
 			) = 0;
 	};
+
+	/**
+	 *	<summary>
+	 *	Fragment distance with integer arithmetic throughout. Each sequence is
+	 *	divided into fragments of fragmentLength consecutive kmers; the distance 
+	 *	between two fragments is the least distance between their kmers; and the 
+	 *	sequence distance is the Hausdorff average of the matrix of fragment 
+	 *	distances: the larger of the mean row minimum and the mean column minimum, 
+	 *	rounded to the nearest integer.
+	 *	<para>
+	 *		ComputeDistance streams the all-pairs kmer distance matrix one row at a
+	 *		time from a KmerDiagonalSweep without storing it, folding column minima 
+	 *		into the sweep and accumulating row minima as rows arrive.
+	 *	</para>
+	 *	</summary>
+	 */
+	class FragmentHausdorffDistanceFunction : public SequenceDistanceFunction {
+	public:
+		using InstructionSet = KmerDiagonalSweep::InstructionSet;
+
+	protected:
+		uint fragmentLength;
+		KmerDiagonalSweep sweep;
+
+	public:
+		/**
+		 *	<summary>
+		 *	Initialises the distance function.
+		 *	</summary>
+		 *	<param name="matrix">The similarity matrix which defines 1-mer distances.</param>
+		 *	<param name="kmerLength">The kmer length.</param>
+		 *	<param name="fragmentLength">The number of kmers in each fragment.</param>
+		 *	<param name="allowed">The widest instruction set to use. The kernel is 
+		 *	restricted further to what the processor supports.</param>
+		 */
+		FragmentHausdorffDistanceFunction(
+			SimilarityMatrix * matrix,
+			uint kmerLength,
+			uint fragmentLength = 1,
+			InstructionSet allowed = InstructionSet::Avx512Bw
+			) :
+			SequenceDistanceFunction(matrix, kmerLength),
+			fragmentLength(fragmentLength),
+			sweep(*matrix, kmerLength, allowed) {
+			if ( fragmentLength < 1 ) {
+				throw Exception("FragmentHausdorffDistanceFunction: fragmentLength must be at least 1.", FileAndLine);
+			}
+		}
+
+		virtual ~FragmentHausdorffDistanceFunction() {}
+
+		static InstructionSet Detect() {
+			return KmerDiagonalSweep::Detect();
+		}
+
+		static const char * Name(InstructionSet instructionSet) {
+			return KmerDiagonalSweep::Name(instructionSet);
+		}
+
+		InstructionSet GetInstructionSet() const {
+			return sweep.GetInstructionSet();
+		}
+
+		Distance ComputeDistance(
+			EncodedFastaSequence * querySeq,
+			EncodedFastaSequence * subjectSeq
+			) override {
+			const uint K = kmerLength;
+			const uint Mq = (uint)querySeq->KmerCount(K);
+			const uint Ms = (uint)subjectSeq->KmerCount(K);
+
+			if ( Mq == 0 || Ms == 0 ) {
+				return numeric_limits<Distance>::max();
+			}
+
+			const uint Fq = (Mq + fragmentLength - 1) / fragmentLength;
+			const uint Fs = (Ms + fragmentLength - 1) / fragmentLength;
+			const char * q = querySeq->Sequence().c_str();
+			const char * s = subjectSeq->Sequence().c_str();
+
+			// columnLeast holds the minimum of each column of kmer distances, over all
+			// rows when fragmentLength is 1, and otherwise over the rows of the current 
+			// fragment, which are reduced to fragment columns when the fragment ends.
+			const Distance maxDistance = numeric_limits<Distance>::max();
+			vector<Distance> columnLeast(Ms, maxDistance);
+			vector<Distance> fragmentColumnLeast(Fs, maxDistance);
+			uint64_t rowSum = 0;
+
+			sweep.Rows(q, Mq, s, Ms, columnLeast.data(), [&](uint i, const Distance * row, Distance least) {
+				if ( fragmentLength == 1 ) {
+					rowSum += least;
+				}
+				else if ( (i + 1) % fragmentLength == 0 || i + 1 == Mq ) {
+					Distance rowLeast = maxDistance;
+
+					for ( uint b = 0; b < Fs; b++ ) {
+						uint jMax = std::min(Ms, (b + 1) * fragmentLength);
+						Distance blockLeast = maxDistance;
+
+						for ( uint j = b * fragmentLength; j < jMax; j++ ) {
+							blockLeast = std::min(blockLeast, columnLeast[j]);
+						}
+
+						rowLeast = std::min(rowLeast, blockLeast);
+						fragmentColumnLeast[b] = std::min(fragmentColumnLeast[b], blockLeast);
+					}
+
+					std::fill(columnLeast.begin(), columnLeast.end(), maxDistance);
+					rowSum += rowLeast;
+				}
+			});
+
+			uint64_t colSum = 0;
+
+			for ( auto d : fragmentLength == 1 ? columnLeast : fragmentColumnLeast ) {
+				colSum += d;
+			}
+
+			uint64_t rowMean = (rowSum + Fq / 2) / Fq;
+			uint64_t colMean = (colSum + Fs / 2) / Fs;
+			return (Distance)std::max(rowMean, colMean);
+		}
+
+		/**
+		 *	<summary>
+		 *	Reference implementation: materialises the fragment distance matrix, 
+		 *	computing every kmer distance from scratch with saturating adds.
+		 *	</summary>
+		 */
+		Distance ComputeDistanceDirect(
+			EncodedFastaSequence * querySeq,
+			EncodedFastaSequence * subjectSeq
+			) {
+			const uint Mq = (uint)querySeq->KmerCount(kmerLength);
+			const uint Ms = (uint)subjectSeq->KmerCount(kmerLength);
+
+			if ( Mq == 0 || Ms == 0 ) {
+				return numeric_limits<Distance>::max();
+			}
+
+			const uint Fq = (Mq + fragmentLength - 1) / fragmentLength;
+			const uint Fs = (Ms + fragmentLength - 1) / fragmentLength;
+			const char * q = querySeq->Sequence().c_str();
+			const char * s = subjectSeq->Sequence().c_str();
+
+			vector<Distance> kmerDistance(Ms);
+			vector<Distance> fragmentDistance(Fq * Fs, numeric_limits<Distance>::max());
+
+			for ( uint i = 0; i < Mq; i++ ) {
+				GetKmerDistances(q + i, s, Ms, kmerDistance.data());
+				Distance * row = &fragmentDistance[(i / fragmentLength) * Fs];
+
+				for ( uint b = 0; b < Fs; b++ ) {
+					uint jMax = std::min(Ms, (b + 1) * fragmentLength);
+					Distance least = row[b];
+
+					for ( uint j = b * fragmentLength; j < jMax; j++ ) {
+						least = std::min(least, kmerDistance[j]);
+					}
+
+					row[b] = least;
+				}
+			}
+
+			return HausdorffAverage(fragmentDistance.data(), Fq, Fs);
+		}
+
+		/**
+		 *	<summary>
+		 *	Gets the distance from the kmer at x to each of the first n kmers of s.
+		 *	Position t of the kmer contributes the same table row to every lane, so
+		 *	the loop over subject kmers is a gather followed by a saturating add.
+		 *	</summary>
+		 */
+		void GetKmerDistances(const char * x, const char * s, uint n, Distance * distances) const {
+			std::fill(distances, distances + n, 0);
+
+			for ( uint t = 0; t < kmerLength; t++ ) {
+				const uint8_t * row = sweep.OneMerDistances(x[t]);
+				const char * st = s + t;
+
+				for ( uint j = 0; j < n; j++ ) {
+					distances[j] = SaturatingAdd(distances[j], row[(uint8_t)st[j] & 127]);
+				}
+			}
+		}
+
+		/**
+		 *	<summary>
+		 *	Gets the larger of the mean row minimum and the mean column minimum of
+		 *	a rows x cols matrix, rounded to nearest. Sums are 64 bit, so there is 
+		 *	no overflow for any matrix that fits in memory.
+		 *	</summary>
+		 */
+		static Distance HausdorffAverage(const Distance * d, uint rows, uint cols) {
+			vector<Distance> colMin(d, d + cols);
+			uint64_t rowSum = 0;
+
+			for ( uint a = 0; a < rows; a++ ) {
+				const Distance * row = d + (size_t)a * cols;
+				Distance least = numeric_limits<Distance>::max();
+
+				for ( uint b = 0; b < cols; b++ ) {
+					least = std::min(least, row[b]);
+					colMin[b] = std::min(colMin[b], row[b]);
+				}
+
+				rowSum += least;
+			}
+
+			uint64_t colSum = 0;
+
+			for ( uint b = 0; b < cols; b++ ) {
+				colSum += colMin[b];
+			}
+
+			uint64_t rowMean = (rowSum + rows / 2) / rows;
+			uint64_t colMean = (colSum + cols / 2) / cols;
+			return (Distance)std::max(rowMean, colMean);
+		}
+	};
 }
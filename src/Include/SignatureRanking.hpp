@@ -0,0 +1,125 @@
+// ------------------------------------------------------------------
+// Copyright (C) 2018 Lawrence Buckingham.
+//
+// This file is part of the supplementary material which accompanies
+// the paper:
+//	Lawrence Buckingham, Shlomo Geva, and James M. Hogan. 2018.
+//	Protein database search using compressed k-mer vocabularies.
+//	In 23rd Australasian Document Computing Symposium (ADCS '18),
+//	December 11--12, 2018, Dunedin, New Zealand
+//	https://doi.org/10.1145/3291992.3291997
+//
+// This file is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published
+// by the Free Software Foundation; either version 3, or (at your
+// option) any later version.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; see the file "license.txt".  If not, see
+// <http://www.gnu.org/licenses/>.
+// ------------------------------------------------------------------
+
+#pragma once
+
+// Trick Visual studio.
+#if __cplusplus < 201103L
+#undef __cplusplus
+#define __cplusplus 201103L
+#endif
+
+#include <vector>
+
+#include "BitSet.hpp"
+#include "kNearestNeighbours.hpp"
+
+namespace QutBio {
+
+	/**
+	 *	<summary>
+	 *	Similarity ranking of sparse signatures, each of which is the ascending 
+	 *	list of codebook entries present in a sequence.
+	 *	</summary>
+	 */
+	struct SignatureRanking {
+
+		/**
+		 *	<summary>
+		 *	Gets the Jaccard similarity of two signatures, |a & b| / |a | b|, by
+		 *	merging the ascending lists.
+		 *	</summary>
+		 */
+		static double Jaccard( const vector<uint> & a, const vector<uint> & b ) {
+			uint m = a.size();
+			uint n = b.size();
+			uint i = 0, j = 0, intersect = 0, union_ = 0;
+
+			while ( i < m && j < n ) {
+				uint x = a[i], y = b[j];
+
+				union_++;
+
+				if ( x < y ) {
+					i++;
+				}
+				else if ( y < x ) {
+					j++;
+				}
+				else {
+					intersect++;
+					i++;
+					j++;
+				}
+			}
+
+			union_ += m + n - i - j;
+
+			return (double) intersect / union_;
+		}
+
+		/**
+		 *	<summary>
+		 *	Accumulates in rankings the database signatures nearest to query, by 
+		 *	Jaccard distance, visiting only those which share at least one entry 
+		 *	with it. dbIndex[c] lists the database signatures containing entry c,
+		 *	and processed (one bit per database signature) is cleared first.
+		 *	Returns the number of distinct database signatures scored.
+		 *	</summary>
+		 *	<param name="signature">A function which maps a database offset to its signature.</param>
+		 */
+		template<typename SignatureFunction>
+		static size_t RankMerge(
+			const vector<uint> & query,
+			const vector<vector<uint>> & dbIndex,
+			SignatureFunction signature,
+			BitSet & processed,
+			KnnVector<size_t, double> & rankings
+		) {
+			size_t scored = 0;
+
+			rankings.clear();
+			processed.Clear();
+
+			for ( uint c : query ) {
+				for ( uint d : dbIndex[c] ) {
+					if ( !processed.Contains( d ) ) {
+						processed.Insert( d );
+						double distance = 1.0 - Jaccard( query, signature( d ) );
+						scored++;
+
+						if ( rankings.canPush( distance ) ) {
+							rankings.push( d, distance );
+						}
+					}
+				}
+			}
+
+			rankings.sort();
+			return scored;
+		}
+	};
+}
@@ -36,12 +36,15 @@
 #include <climits>
 #include <fstream>
 #include <cstdint>
+#include <set>
 
 #include "Assert.hpp"
 #include "Delegates.hpp"
 #include "DistanceType.hpp"
+#include "Exception.hpp"
 #include "Histogram.hpp"
 #include "IntegerDistribution.hpp"
+#include "String.hpp"
 #include "Types.hpp"
 
 namespace QutBio {
@@ -60,29 +63,51 @@ namespace QutBio {
 	typedef Distance * pDistance;
 	typedef pDistance * ppDistance;
 
+	/// <summary>Adds two distances, clamping the sum to the largest Distance 
+	///		rather than wrapping. Written branch-free so that loops over it map 
+	///		onto saturating 16 bit vector adds.
+	/// </summary>
+	inline Distance SaturatingAdd(Distance x, Distance y) {
+#if USE_DOUBLE_DIST
+		return x + y;
+#else
+		uint32_t sum = (uint32_t)x + y;
+		return (Distance)(sum > MAX_DIST ? MAX_DIST : sum);
+#endif
+	}
+
 	typedef class SimilarityMatrix *pSimilarityMatrix;
 
 	struct SimilarityMatrix {
 		int8_t dict[128][128];
+
+		// The scores as they were set, before Parse replaces the unset entries 
+		// (which, since BAD_DIST is 0, include those scored 0) with the worst score.
+		int8_t raw[128][128];
 		bool isDefined[128];
 		string symbols;
 		int8_t maxValue = numeric_limits<int8_t>::min();
 		int8_t minValue = numeric_limits<int8_t>::max();
 		bool isCaseSensitive = false;
 		bool isCustom = false;
+		bool isReduced = false;
+
+		// In a reduced matrix, the symbol which stands for the group containing each
+		// character. Otherwise, each character stands for itself.
+		char representative[128];
 
 		void SetSimilarity(unsigned char s, unsigned char t, int8_t value) {
 			assert_true(s < 128 && t < 128);
 
 			if (isCaseSensitive) {
-				dict[s][t] = value;
+				dict[s][t] = raw[s][t] = value;
 				isDefined[s] = true;
 			}
 			else {
-				dict[tolower(s)][tolower(t)] = value;
-				dict[toupper(s)][tolower(t)] = value;
-				dict[tolower(s)][toupper(t)] = value;
-				dict[toupper(s)][toupper(t)] = value;
+				dict[tolower(s)][tolower(t)] = raw[tolower(s)][tolower(t)] = value;
+				dict[toupper(s)][tolower(t)] = raw[toupper(s)][tolower(t)] = value;
+				dict[tolower(s)][toupper(t)] = raw[tolower(s)][toupper(t)] = value;
+				dict[toupper(s)][toupper(t)] = raw[toupper(s)][toupper(t)] = value;
 				isDefined[tolower(s)] = true;
 				isDefined[toupper(s)] = true;
 			}
@@ -153,9 +178,11 @@ namespace QutBio {
 		SimilarityMatrix() {
 			for (int i = 0; i < 128; i++) {
 				isDefined[i] = false;
+				representative[i] = (char)i;
 
 				for (int j = 0; j < 128; j++) {
 					dict[i][j] = BAD_DIST;
+					raw[i][j] = 0;
 				}
 			}
 		}
@@ -168,6 +195,11 @@ namespace QutBio {
 			return dict[s][t];
 		}
 
+		/// <summary>Gets the score of a pair as it appears in the matrix, without the adjustment made by Parse.</summary>
+		int8_t RawSimilarity(unsigned char s, unsigned char t) const {
+			return raw[s][t];
+		}
+
 		int8_t MaxValue(void) const {
 			return maxValue;
 		}
@@ -243,6 +275,134 @@ namespace QutBio {
 			return true;
 		}
 
+		/// <summary>Returns true iff this matrix was produced by Reduce.</summary>
+		bool IsReduced() const {
+			return isReduced;
+		}
+
+		/// <summary>Gets the symbol which stands for a character: the representative of 
+		///		its group in a reduced matrix, otherwise the character itself.</summary>
+		char Representative(unsigned char ch) const {
+			return representative[ch & 127];
+		}
+
+		/**
+		 *	<summary>
+		 *		Gets the residue groups of a reduced amino acid alphabet, either by name or
+		 *		as a comma-separated list of groups.
+		 *		<para>murphy10: Murphy, Wallqvist and Levy (2000), 10 groups.</para>
+		 *		<para>seb14: SE-B(14), Peterson et al. (2009), 14 groups.</para>
+		 *		<para>Anything else is split on commas, e.g. "LVIM,C,A,G,ST,P,FYW,EDNQ,KR,H".</para>
+		 *		Ambiguity codes which fall within a single group are placed in it.
+		 *	</summary>
+		 */
+		static vector<string> ReducedAlphabetGroups(const string & spec) {
+			string name = String::ToLowerCase(spec);
+
+			if (name == "murphy10") {
+				return vector<string>{ "lvim", "c", "a", "g", "st", "p", "fyw", "ednqbz", "kr", "h" };
+			}
+
+			if (name == "seb14") {
+				return vector<string>{ "a", "c", "d", "eqz", "fy", "g", "h", "iv", "kr", "lm", "n", "p", "st", "w" };
+			}
+
+			return String::Split(spec, ',');
+		}
+
+		/**
+		 *	<summary>
+		 *		Creates a similarity matrix over a reduced alphabet, in which each group of 
+		 *		residues is represented by its first member. The similarity between two groups 
+		 *		is the mean similarity, rounded to the nearest integer, over all pairs of their 
+		 *		members. Every member retains its own row and column, holding the group scores,
+		 *		so sequences may be scored with or without first mapping residues to their 
+		 *		representatives. Symbols of the source which are not mentioned in any group 
+		 *		become singleton groups.
+		 *	</summary>
+		 *	<param name="source">The full matrix, e.g. one of the BLOSUM matrices.</param>
+		 *	<param name="groups">The residue groups; see ReducedAlphabetGroups.</param>
+		 */
+		static SimilarityMatrix * Reduce(const SimilarityMatrix & source, const vector<string> & groups) {
+			vector<string> allGroups;
+			set<char> seen;
+
+			for (auto & group : groups) {
+				string members;
+
+				for (char ch : String::Trim(group)) {
+					char c = source.isCaseSensitive ? ch : (char)tolower(ch);
+
+					if (source.symbols.find(c) == string::npos) {
+						throw Exception(string("Reduced alphabet symbol '") + ch + "' is not defined in the similarity matrix.", FileAndLine);
+					}
+
+					if (!seen.insert(c).second) {
+						throw Exception(string("Reduced alphabet symbol '") + ch + "' appears in more than one group.", FileAndLine);
+					}
+
+					members += c;
+				}
+
+				if (members.size() > 0) {
+					allGroups.push_back(members);
+				}
+			}
+
+			for (char c : source.symbols) {
+				if (seen.insert(c).second) {
+					allGroups.push_back(string(1, c));
+				}
+			}
+
+			SimilarityMatrix * matrix = new SimilarityMatrix();
+			matrix->isCaseSensitive = source.isCaseSensitive;
+			matrix->isCustom = source.isCustom;
+			matrix->isReduced = true;
+
+			for (auto & a : allGroups) {
+				matrix->symbols += a[0];
+
+				for (char x : a) {
+					if (source.isCaseSensitive) {
+						matrix->representative[(uint8_t)x] = a[0];
+					}
+					else {
+						matrix->representative[tolower(x)] = (char)tolower(a[0]);
+						matrix->representative[toupper(x)] = (char)toupper(a[0]);
+					}
+				}
+
+				for (auto & b : allGroups) {
+					double sum = 0;
+
+					for (char x : a) {
+						for (char y : b) {
+							sum += source.dict[(uint8_t)x][(uint8_t)y];
+						}
+					}
+
+					int8_t score = (int8_t)round(sum / (a.size() * b.size()));
+
+					for (char x : a) {
+						for (char y : b) {
+							matrix->SetSimilarity(x, y, score);
+						}
+					}
+				}
+			}
+
+			for (int i = 0; i < 128; i++) {
+				for (int j = 0; j < 128; j++) {
+					if (!matrix->isDefined[i] || !matrix->isDefined[j]) {
+						matrix->dict[i][j] = matrix->minValue;
+					}
+				}
+			}
+
+			return matrix;
+		}
+
 		static SimilarityMatrix * Blosum100() {
 #pragma region Data
 			static const string data =
@@ -705,6 +865,17 @@ namespace QutBio {
 				}
 			}
 		}
+
+		/// <summary>Fills an 8 bit table of 1-mer distances, maxValue - b(x,y). 
+		///		This always fits, because the scores are themselves 8 bit.
+		/// </summary>
+		void PopulateDistanceTable( uint8_t lookup[128][128] ) const {
+			for ( int i = 0; i < 128; i++ ) {
+				for ( int j = 0; j < 128; j++ ) {
+					lookup[i][j] = (uint8_t)( maxValue - dict[i][j] );
+				}
+			}
+		}
 	};
 
 	typedef SimilarityMatrix * pSimilarityMatrix;
@@ -34,7 +34,7 @@
 #include <Args.hpp>
 #include <Domain.hpp>
 #include <FastaSequence.hpp>
-#include <OmpTimer.h>
+#include <Profiler.hpp>
 #include <Exception.hpp>
 #include <HBRandom.hpp>
 
@@ -45,6 +45,7 @@ using namespace QutBio;
 struct SplitFastaHomologs {
 	static void Run( int argc, char** argv ) {
 		Args args( argc, argv );
+		ProfileSession profile( args );
 		Params parms( args );
 		UniformIntRandom<size_t> rand( parms.seed, 1, parms.parts );
 
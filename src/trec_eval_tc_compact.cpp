@@ -32,6 +32,11 @@
 //	Not intended to be compatible with trec_eval; however, the
 //	interpolated precision/recall curves generated are numerically 
 //	equal to hose calculated by Tim's program.
+//
+//	Both inputs are memory mapped and split at line boundaries. The
+//	pieces are tokenised in place and the rankings evaluated in 
+//	parallel, while topics are numbered and results printed in file 
+//	order, so the summary does not depend on the number of threads.
 
 // Trick Visual studio.
 #if __cplusplus < 201103L
@@ -46,14 +51,27 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <limits>
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <omp.h>
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
 
+#include "Args.hpp"
 #include "Array.hpp"
+#include "MappedFile.hpp"
+#include "MemoryAccount.hpp"
+#include "Profiler.hpp"
 
 using namespace std;
 using std::vector;
@@ -77,9 +95,101 @@ namespace QutBio {
 			}
 		};
 
+		/// <summary>A token which points into a mapped input file.</summary>
+		struct Token {
+			const char * chars;
+			size_t length;
+
+			friend bool operator==( const Token & lhs, const Token & rhs ) {
+				return lhs.length == rhs.length && memcmp( lhs.chars, rhs.chars, lhs.length ) == 0;
+			}
+
+			friend bool operator!=( const Token & lhs, const Token & rhs ) {
+				return !( lhs == rhs );
+			}
+
+			/// <summary>FNV-1a.</summary>
+			struct Hash {
+				size_t operator()( const Token & t ) const {
+					uint64_t h = 14695981039346656037ULL;
+
+					for ( size_t i = 0; i < t.length; i++ ) {
+						h = ( h ^ (uint8_t) t.chars[i] ) * 1099511628211ULL;
+					}
+
+					return (size_t) h;
+				}
+			};
+		};
+
+		typedef unordered_map<Token, size_t, Token::Hash> TokenIndex;
+		typedef unordered_set<Token, Token::Hash> TokenSet;
+
+		static const size_t NoTopic = numeric_limits<size_t>::max();
+
+		/// <summary>A topic and its homologs, which are docs[first..first+count).</summary>
+		struct HomologRecord {
+			Token topic;
+			size_t first, count;
+		};
+
+		struct HomologChunk {
+			vector<HomologRecord> records;
+			vector<Token> docs;
+		};
+
+		/// <summary>The evaluation of one line of the rankings file.</summary>
+		struct RankingRecord {
+			Token topic;
+			size_t topicId;
+			size_t numReturned;
+			size_t numRelevantReturned;
+			double averagePrecision;
+		};
+
+		struct RankingChunk {
+			vector<RankingRecord> records;
+
+			// The interpolated precision of record i is grids[i*points..(i+1)*points),
+			// and its precision at the cutoffs is precisionAt[i*cutoffs..(i+1)*cutoffs).
+			vector<double> grids;
+			vector<double> precisionAt;
+			vector<char> unexpectedDelimiters;
+		};
+
+		/// <summary>The homologs of each topic, which are loaded once and shared by all runs.</summary>
+		struct Homologs {
+			MappedFile * file = 0;
+			TokenIndex topicIds;
+			vector<Token> topicNames;
+			vector<TokenSet> qrels;
+			vector<size_t> relevantDocumentCount;
+			size_t overallRelevant = 0;
+
+			~Homologs() {
+				delete file;
+			}
+		};
+
+		/// <summary>The overall evaluation of one rankings file.</summary>
+		struct RunSummary {
+			size_t topicCount = 0;
+			size_t overallReturned = 0;
+			size_t overallRelevantReturned = 0;
+			double meanAveragePrecision = 0;
+			vector<double> averageIprec;
+			vector<double> precisionAt;
+		};
+
 		static int main( int argc, char **argv_ ) {
+			if ( argc >= 2 && strncmp( argv_[1], "--", 2 ) == 0 ) {
+				return MultiRun( argc, argv_ );
+			}
+
 			if ( argc < 5 ) {
 				fprintf( stderr, "Usage: %s homologsFile rankingFile summaryFile ignoreMissing=true|false [interpolated_precision_points=11]\n", argv_[0] );
+				fprintf( stderr, "   or: %s --homologs homologsFile --rankings rankingFile|directory... --summary summaryFile ...\n", argv_[0] );
+				fprintf( stderr, "       (for details, run: %s --help)\n", argv_[0] );
 				exit( 1 );
 			}
 
@@ -102,256 +212,665 @@ namespace QutBio {
 
 			fprintf( stderr, "Reading homologs\n" );
 
-			FILE *fp;
-			fp = fopen( qrelsFile, "r" );
+			Homologs homologs;
+			LoadHomologs( qrelsFile, homologs );
 
-			if ( !fp ) {
-				fprintf( stderr, "homologs file %s does not exist.\n", qrelsFile );
+			fprintf( stderr, "topicCount: %u\n", (unsigned) homologs.topicNames.size() );
+
+			fprintf( stderr, "Reading rankings...\n" );
+			MappedFile * rankings = Open( rankingFile, "Rankings file %s does not exist.\n" );
+
+			FILE *summaryStream = fopen( summaryFile, "w" "b" );
+
+			if ( !summaryStream ) {
+				fprintf( stderr, "Unable to open summary file '%s'\n", summaryFile );
 				exit( 1 );
 			}
 
-			size_t overallRelevant = 0;
+			PrintSummaryHeadings( summaryStream, interpolationPoints );
 
-			unordered_map<string, size_t> topicIds;
-			vector<string> topicNames;
+			RunSummary summary = EvaluateRun( *rankings, homologs, ignoreMissing, interpolationPoints, vector<size_t>(), summaryStream );
+			delete rankings;
 
-			unordered_map<string, size_t> docIds;
-			vector<string> docNames;
+			// Emit results for total.
+			fprintf( summaryStream, "%s\t%zu\t%zu\t%zu\t%0.4f",
+				"Overall", homologs.overallRelevant, summary.overallRelevantReturned, summary.overallReturned, summary.meanAveragePrecision );
 
-			vector<unordered_set<size_t>> qrels;
-			vector<size_t> relevantDocumentCount;
+			for ( size_t j = 0; j < interpolationPoints; j++ ) {
+				fprintf( summaryStream, "\t%.4f", summary.averageIprec[j] );
+			}
 
-			//size_t n = 0;
+			fprintf( summaryStream, "\n" );
 
-			for ( ;; ) {
-				char topic_[256];
-				char delimiter;
+			fclose( summaryStream );
 
-				int items = fscanf( fp, "%256s%c", topic_, &delimiter );
+			fprintf( stderr, "Finished.\n" );
+			return 0;
+		}
 
-				if ( items < 2 ) {
-					// fprintf(stderr, "%d items read. Finishing.\n", items);
-					break;
+		/**
+		 *	Evaluates any number of rankings files against one homologs file, which
+		 *	is loaded once. Runs are evaluated in parallel when there are at least as
+		 *	many as threads; otherwise each run is parsed in parallel. Emits one row
+		 *	per run, in the order the runs were named.
+		 */
+		static int MultiRun( int argc, char **argv_ ) {
+			Args args( argc, argv_ );
+			ProfileSession profile( args );
+			MemorySession memory( args );
+
+			if ( args.IsDefined( "help" ) ) {
+				vector<string> text{
+					"trec_eval_tc_compact --homologs homologsFile --rankings rankingFile|directory... --summary summaryFile",
+					"--help          Gets this text.",
+					"--homologs      Required. A homologs file: one line per topic, listing the topic then its homologs.",
+					"--rankings      Required. One or more compact rankings files or directories. Every file in a",
+					"                directory is a run; directories are read in file name order.",
+					"--summary       Required. A file which will be overwritten with one row per run: the overall",
+					"                counts, mean average precision, mean precision at each cutoff, and the mean",
+					"                interpolated precision at each recall point.",
+					"--ignoreMissing Optional; Boolean, default = false. If true, topics with no rankings are left",
+					"                out of the means; otherwise they count as zero.",
+					"--points        Optional; default = 11. The number of interpolated precision points.",
+					"--cutoffs       Optional; default = 5 10 20 100. The ranks k at which to report P@k.",
+					"--profile       Optional. A file to which a JSON profile of the run is written.",
+					"--perfCounters  Optional; default = false. If true, the profile includes hardware event counts",
+					"                (cycles, instructions, cache and branch misses) for each region and thread.",
+					"--memoryReport  Optional; default = false. If true, the peak resident memory is reported at the end.",
+					"--memoryBudget  Optional. A size such as 512M or 64G. The memory needed for the homologs and the",
+					"                largest runs is estimated before anything is loaded, and if it does not fit the",
+					"                program stops.",
+				};
+
+				for ( auto & s : text ) {
+					cerr << s << "\n";
 				}
 
-				string topic( topic_ );
-				size_t topicId = GetTopicId( topic, topicIds, topicNames, qrels, relevantDocumentCount );
+				return 0;
+			}
+
+			string homologsFile, summaryFile;
+			vector<string> rankingPaths;
+			bool ignoreMissing = false;
+			int interpolationPoints = 11;
+			vector<int> cutoffs_{ 5, 10, 20, 100 };
+			bool ok = true;
 
-				//if ( n++ /* % 1000 == 0 */ ) {
-				//	( cerr << "\r" << n << ": Current topic: " << topic << "                    " ).flush();
-				//}
+			if ( !args.Get( "homologs", homologsFile ) ) {
+				cerr << args.ProgName() << ": error - required argument '--homologs' not supplied.\n";
+				ok = false;
+			}
 
-				while ( delimiter == ' ' ) {
-					char doc_[256];
+			if ( !args.Get( "rankings", rankingPaths ) || rankingPaths.empty() ) {
+				cerr << args.ProgName() << ": error - required argument '--rankings' not supplied.\n";
+				ok = false;
+			}
 
-					items = fscanf( fp, "%256s%c", doc_, &delimiter );
+			if ( !args.Get( "summary", summaryFile ) ) {
+				cerr << args.ProgName() << ": error - required argument '--summary' not supplied.\n";
+				ok = false;
+			}
 
-					if ( items < 2 ) break;
+			if ( args.IsDefined( "ignoreMissing" ) && !args.Get( "ignoreMissing", ignoreMissing ) ) {
+				cerr << args.ProgName() << ": error - invalid boolean data for argument '--ignoreMissing'.\n";
+				ok = false;
+			}
 
-					string doc( doc_ );
-					size_t docId;
+			if ( args.IsDefined( "points" ) && ( !args.Get( "points", interpolationPoints ) || interpolationPoints < 2 ) ) {
+				cerr << args.ProgName() << ": error - '--points' must be an integer greater than 1.\n";
+				ok = false;
+			}
 
-					auto docPos = docIds.find( doc );
+			if ( args.IsDefined( "cutoffs" ) && !args.Get( "cutoffs", cutoffs_ ) ) {
+				cerr << args.ProgName() << ": error - invalid data for argument '--cutoffs'.\n";
+				ok = false;
+			}
 
-					if ( docPos == docIds.end() ) {
-						docId = docNames.size();
-						docIds.emplace( doc, docId );
-						docNames.push_back( doc );
-					}
-					else {
-						docId = docPos->second;
-					}
+			for ( int k : cutoffs_ ) {
+				if ( k < 1 ) {
+					cerr << args.ProgName() << ": error - cutoffs must be positive.\n";
+					ok = false;
+				}
+			}
 
-					qrels[topicId].insert( docId );
-					relevantDocumentCount[topicId]++;
-					overallRelevant++;
+			if ( !ok ) {
+				cerr << "For help, run: " << args.ProgName() << " --help\n";
+				return 1;
+			}
+
+			vector<size_t> cutoffs( cutoffs_.begin(), cutoffs_.end() );
+			vector<string> runs;
+
+			for ( auto & path : rankingPaths ) {
+				if ( !ListRuns( path, runs ) ) {
+					cerr << args.ProgName() << ": error - unable to read '" << path << "'.\n";
+					return 1;
 				}
 			}
 
-			fclose( fp );
-			fprintf( stderr, "topicCount: %u\n", (unsigned) topicNames.size() );
+			const bool parallelRuns = runs.size() >= (size_t) omp_get_max_threads();
 
-			fprintf( stderr, "Reading rankings...\n" );
-			FILE * rankingStream = fopen( rankingFile, "r" );
+			if ( MemoryAccount::Budget() > 0 ) {
+				size_t concurrentRuns = parallelRuns ? (size_t) omp_get_max_threads() : 1;
 
-			if ( !rankingStream ) {
-				fprintf( stderr, "Rankings file %s does not exist.\n", rankingFile );
-				exit( 1 );
+				try {
+					MemoryAccount::Require( "Evaluating " + to_string( runs.size() ) + " runs",
+						EstimateBytes( homologsFile, runs, concurrentRuns, interpolationPoints, cutoffs.size() ) );
+				}
+				catch ( Exception & ex ) {
+					cerr << args.ProgName() << ": error - " << ex.what() << "\n";
+					return 1;
+				}
 			}
 
-			FILE *summaryStream = fopen( summaryFile, "w" "b" );
+			fprintf( stderr, "Reading homologs\n" );
+
+			Homologs homologs;
+			LoadHomologs( homologsFile.c_str(), homologs );
+
+			fprintf( stderr, "topicCount: %u\n", (unsigned) homologs.topicNames.size() );
+			fprintf( stderr, "Evaluating %zu runs...\n", runs.size() );
+
+			vector<RunSummary> summaries( runs.size() );
+			vector<char> failed( runs.size(), 0 );
+
+#pragma omp parallel for schedule(dynamic, 1) if(parallelRuns)
+			for ( int64_t r = 0; r < (int64_t) runs.size(); r++ ) {
+				try {
+					MappedFile rankings( runs[r] );
+					summaries[r] = EvaluateRun( rankings, homologs, ignoreMissing, interpolationPoints, cutoffs, 0 );
+				}
+				catch ( Exception & ) {
+					failed[r] = 1;
+				}
+			}
+
+			for ( size_t r = 0; r < runs.size(); r++ ) {
+				if ( failed[r] ) {
+					fprintf( stderr, "Rankings file %s does not exist.\n", runs[r].c_str() );
+					return 1;
+				}
+			}
+
+			FILE *summaryStream = fopen( summaryFile.c_str(), "w" "b" );
 
 			if ( !summaryStream ) {
-				fprintf( stderr, "Unable to open summary file '%s'\n", summaryFile );
-				exit( 1 );
+				fprintf( stderr, "Unable to open summary file '%s'\n", summaryFile.c_str() );
+				return 1;
 			}
 
-			PrintSummaryHeadings( summaryStream, interpolationPoints );
+			fprintf( summaryStream, "Run\tTopics\tRelevant\tRelevant Returned\tTotal Returned\tMAP" );
 
-			vector<double> averageIprec( interpolationPoints, 0.0 );
-			size_t topicRetCount = 0;
-			double meanAveragePrecision = 0.0;
+			for ( size_t k : cutoffs ) {
+				fprintf( summaryStream, "\tP@%zu", k );
+			}
 
-			unordered_map<size_t, bool> retrievedResultsFor;
-			size_t overallReturned = 0;
-			size_t overallRelevantReturned = 0;
-			string prevTopic = "";
+			for ( int j = 0; j < interpolationPoints; j++ ) {
+				fprintf( summaryStream, "\t%.2f", 1.0 * j / ( interpolationPoints - 1 ) );
+			}
 
-			//n = 0;
+			fprintf( summaryStream, "\n" );
 
-			while ( !feof( rankingStream ) ) {
-				char topic_[257];
-				double score;
-				char delimiter;
+			for ( size_t r = 0; r < runs.size(); r++ ) {
+				auto & summary = summaries[r];
 
-				int itemsParsed = fscanf( rankingStream, " %256s", topic_ );
+				fprintf( summaryStream, "%s\t%zu\t%zu\t%zu\t%zu\t%0.4f",
+					runs[r].c_str(), summary.topicCount, homologs.overallRelevant, summary.overallRelevantReturned, summary.overallReturned, summary.meanAveragePrecision );
 
-				if ( itemsParsed == 0 ) break;
+				for ( double p : summary.precisionAt ) {
+					fprintf( summaryStream, "\t%.4f", p );
+				}
 
-				string topic( topic_ );
-				size_t topicId = GetTopicId( topic, topicIds, topicNames, qrels, relevantDocumentCount );
+				for ( double p : summary.averageIprec ) {
+					fprintf( summaryStream, "\t%.4f", p );
+				}
 
-				retrievedResultsFor[topicId] = true;
+				fprintf( summaryStream, "\n" );
+			}
 
-				//if ( n++ /* % 1000 == 0 */ ) {
-				//	( cerr << "\r" << n << ": Current rankings: " << topic_ << "                    " ).flush();
-				//}
+			fclose( summaryStream );
 
-				vector<Ranking> rankings;
-				rankings.reserve( 10000 );
+			fprintf( stderr, "Finished.\n" );
+			return 0;
+		}
 
-				size_t numReturned = 0;
-				size_t numRelevantReturned = 0;
+		/// <summary>Appends path to runs if it is a file, or the files it contains (sorted by name) if it is a directory.</summary>
+		static bool ListRuns( const string & path, vector<string> & runs ) {
+			vector<string> files;
 
-				while ( !feof( rankingStream ) ) {
-					char doc_[257];
+#if defined(_WIN32) && !defined(__CYGWIN__)
+			DWORD attributes = GetFileAttributesA( path.c_str() );
 
-					itemsParsed = fscanf( rankingStream, " %256s %lf%c", doc_, &score, &delimiter );
+			if ( attributes == INVALID_FILE_ATTRIBUTES ) return false;
 
-					if ( itemsParsed < 3 ) break;
+			if ( !( attributes & FILE_ATTRIBUTE_DIRECTORY ) ) {
+				runs.push_back( path );
+				return true;
+			}
 
-					// cerr << "topic(" << topic_ << ") doc(" << doc_ << ") score(" << score << ") delimiter(" << int(delimiter) << ")\n";
+			WIN32_FIND_DATAA entry;
+			HANDLE dir = FindFirstFileA( ( path + "\\*" ).c_str(), &entry );
 
+			if ( dir == INVALID_HANDLE_VALUE ) return false;
 
-					string doc( doc_ );
-					size_t docId;
+			do {
+				if ( !( entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) ) {
+					files.push_back( path + "/" + entry.cFileName );
+				}
+			} while ( FindNextFileA( dir, &entry ) );
 
-					auto docPos = docIds.find( doc );
+			FindClose( dir );
+#else
+			struct stat status;
 
-					if ( docPos == docIds.end() ) {
-						docId = docNames.size();
-						docNames.push_back( doc );
-						docIds.emplace( doc, docId );
-					}
-					else {
-						docId = docPos->second;
+			if ( stat( path.c_str(), &status ) != 0 ) return false;
+
+			if ( !S_ISDIR( status.st_mode ) ) {
+				runs.push_back( path );
+				return true;
+			}
+
+			DIR * dir = opendir( path.c_str() );
+
+			if ( !dir ) return false;
+
+			while ( dirent * entry = readdir( dir ) ) {
+				string file = path + "/" + entry->d_name;
+
+				if ( stat( file.c_str(), &status ) == 0 && S_ISREG( status.st_mode ) ) {
+					files.push_back( file );
+				}
+			}
+
+			closedir( dir );
+#endif
+
+			sort( files.begin(), files.end() );
+			runs.insert( runs.end(), files.begin(), files.end() );
+			return true;
+		}
+
+		/**
+		 *	Estimates the bytes needed to evaluate the runs, from a count of the 
+		 *	tokens in the homologs file and of the lines in the largest run, which
+		 *	is assumed to be typical of the runs evaluated at the same time. Each 
+		 *	homolog is held once in its chunk and once in the set of its topic.
+		 */
+		static size_t EstimateBytes( const string & homologsFile, const vector<string> & runs, size_t concurrentRuns, size_t interpolationPoints, size_t cutoffCount ) {
+			const size_t block = MemoryAccount::BlockOverhead;
+			size_t bytes = 0;
+
+			try {
+				MappedFile file( homologsFile );
+				const char * end = file.Data() + file.Size();
+				size_t lines = std::count( file.Data(), end, '\n' ) + 1;
+				size_t tokens = std::count( file.Data(), end, ' ' ) + lines;
+
+				bytes += file.Size()
+					+ tokens * ( 2 * sizeof( Token ) + 3 * sizeof( void * ) + block )
+					+ lines * ( sizeof( HomologRecord ) + 2 * sizeof( Token ) + sizeof( TokenSet ) + 4 * sizeof( void * ) + block );
+
+				string largest;
+				size_t largestSize = 0;
+
+				for ( auto & run : runs ) {
+					size_t size = MappedFile( run ).Size();
+
+					if ( size >= largestSize ) {
+						largest = run;
+						largestSize = size;
 					}
+				}
 
-					bool relevant = qrels[topicId].find( docId ) != qrels[topicId].end();
+				if ( largest.size() > 0 ) {
+					MappedFile run( largest );
+					size_t runLines = std::count( run.Data(), run.Data() + run.Size(), '\n' ) + 1;
+					size_t runBytes = run.Size()
+						+ runLines * ( sizeof( RankingRecord ) + ( interpolationPoints + cutoffCount ) * sizeof( double ) + sizeof( char ) );
 
-					rankings.emplace_back( -score, relevant );
-					retrievedResultsFor[topicId] = true;
+					bytes += std::min( concurrentRuns, runs.size() ) * runBytes;
+				}
+			}
+			catch ( Exception & ) {
+				// Missing files are reported when they are loaded.
+			}
+
+			return bytes;
+		}
+
+		/**
+		 *	Loads a homologs file. The pieces are tokenised in parallel, the topics 
+		 *	are numbered in file order, then the homolog set of each topic is built 
+		 *	in parallel.
+		 */
+		static void LoadHomologs( const char * fileName, Homologs & homologs ) {
+			PROFILE_SCOPE( "loadHomologs" );
+
+			homologs.file = Open( fileName, "homologs file %s does not exist.\n" );
+
+			auto & file = *homologs.file;
+			vector<size_t> bounds = file.LineBoundaries( ChunkCount( file ) );
+			vector<HomologChunk> chunks( bounds.size() - 1 );
+
+#pragma omp parallel for schedule(dynamic, 1)
+			for ( int c = 0; c < (int) chunks.size(); c++ ) {
+				ParseHomologs( file.Data() + bounds[c], file.Data() + bounds[c + 1], chunks[c] );
+			}
 
-					// Update returned document count for individual query and total.
-					numReturned++;
-					overallReturned++;
+			vector<vector<pair<const HomologChunk *, const HomologRecord *>>> topicRecords;
 
-					if ( relevant ) {
-						// Update relevant document count for individual query and total.
-						numRelevantReturned++;
-						overallRelevantReturned++;
+			for ( auto & chunk : chunks ) {
+				for ( auto & record : chunk.records ) {
+					size_t topicId = GetTopicId( record.topic, homologs.topicIds, homologs.topicNames );
+
+					if ( topicRecords.size() <= topicId ) {
+						topicRecords.resize( topicId + 1 );
+						homologs.relevantDocumentCount.resize( topicId + 1 );
 					}
 
-					if ( delimiter != ' ' ) {
-						if ( delimiter != '\n' && delimiter != '\r' ) {
-							( cerr << "\nUnexpected delimiter: ASCII(" << int( delimiter ) << ")\n" ).flush();
-						}
-						break;
+					topicRecords[topicId].emplace_back( &chunk, &record );
+					homologs.relevantDocumentCount[topicId] += record.count;
+					homologs.overallRelevant += record.count;
+				}
+			}
+
+			homologs.qrels.resize( homologs.topicNames.size() );
+
+#pragma omp parallel for schedule(dynamic, 64)
+			for ( int64_t topicId = 0; topicId < (int64_t) topicRecords.size(); topicId++ ) {
+				auto & set = homologs.qrels[topicId];
+				set.reserve( homologs.relevantDocumentCount[topicId] );
+
+				for ( auto & p : topicRecords[topicId] ) {
+					auto & docs = p.first->docs;
+					auto record = p.second;
+
+					for ( size_t i = 0; i < record->count; i++ ) {
+						set.insert( docs[record->first + i] );
 					}
 				}
+			}
+		}
 
-				if ( topic != prevTopic ) {
-					double averagePrecision;
-					vector<double> interpolatedGrid( interpolationPoints, 0.0 );
+		/**
+		 *	Evaluates one rankings file. Each line is evaluated in parallel against 
+		 *	the (read-only) homologs; results are then accumulated, and printed to 
+		 *	perTopic if it is not null, in file order, so they do not depend on the 
+		 *	number of threads. As before, a line whose topic is the same as that of
+		 *	the line before counts towards the totals but is not reported.
+		 */
+		static RunSummary EvaluateRun(
+			const MappedFile & file,
+			const Homologs & homologs,
+			bool ignoreMissing,
+			int interpolationPoints,
+			const vector<size_t> & cutoffs,
+			FILE * perTopic
+		) {
+			PROFILE_SCOPE( "evaluateRun" );
 
-					ProcessTopic(
-						rankings,
-						relevantDocumentCount[topicId],
-						averagePrecision,
-						averageIprec,
-						interpolatedGrid
-					);
+			vector<size_t> bounds = file.LineBoundaries( ChunkCount( file ) );
+			vector<RankingChunk> chunks( bounds.size() - 1 );
 
-					PrintTopic(
-						topicNames[topicId].c_str(),
-						relevantDocumentCount[topicId],
-						numReturned,
-						numRelevantReturned,
-						averagePrecision,
-						interpolatedGrid,
-						summaryStream
-					);
+#pragma omp parallel for schedule(dynamic, 1)
+			for ( int c = 0; c < (int) chunks.size(); c++ ) {
+				EvaluateRankings( file.Data() + bounds[c], file.Data() + bounds[c + 1], homologs, interpolationPoints, cutoffs, chunks[c] );
+			}
 
-					meanAveragePrecision += averagePrecision;
-					topicRetCount++;
+			RunSummary summary;
+			summary.averageIprec.assign( interpolationPoints, 0.0 );
+			summary.precisionAt.assign( cutoffs.size(), 0.0 );
+
+			const size_t knownTopics = homologs.topicNames.size();
+			vector<bool> retrievedResultsFor( knownTopics );
+			Token prevTopic{ "", 0 };
+
+			for ( auto & chunk : chunks ) {
+				for ( char delimiter : chunk.unexpectedDelimiters ) {
+					( cerr << "\nUnexpected delimiter: ASCII(" << int( delimiter ) << ")\n" ).flush();
 				}
 
-				prevTopic = topic;
+				for ( size_t i = 0; i < chunk.records.size(); i++ ) {
+					auto & record = chunk.records[i];
+					size_t relevantDocumentCount = 0;
+
+					if ( record.topicId != NoTopic ) {
+						retrievedResultsFor[record.topicId] = true;
+						relevantDocumentCount = homologs.relevantDocumentCount[record.topicId];
+					}
+
+					summary.overallReturned += record.numReturned;
+					summary.overallRelevantReturned += record.numRelevantReturned;
+
+					if ( record.topic != prevTopic ) {
+						vector<double> interpolatedGrid(
+							chunk.grids.begin() + i * interpolationPoints,
+							chunk.grids.begin() + ( i + 1 ) * interpolationPoints
+						);
+
+						for ( int j = 0; j < interpolationPoints; j++ ) {
+							summary.averageIprec[j] += interpolatedGrid[j];
+						}
+
+						for ( size_t k = 0; k < cutoffs.size(); k++ ) {
+							summary.precisionAt[k] += chunk.precisionAt[i * cutoffs.size() + k];
+						}
+
+						if ( perTopic ) {
+							PrintTopic(
+								record.topic,
+								relevantDocumentCount,
+								record.numReturned,
+								record.numRelevantReturned,
+								record.averagePrecision,
+								interpolatedGrid,
+								perTopic
+							);
+						}
+
+						summary.meanAveragePrecision += record.averagePrecision;
+						summary.topicCount++;
+					}
+
+					prevTopic = record.topic;
+				}
 			}
 
 			// Emit results for topics where no records returned (if we are not ignoring them).
 			if ( !ignoreMissing ) {
-				//(cerr << "\nProcessing missing topics\n").flush();
-
-				for ( size_t topicId = 0; topicId < (int) topicNames.size(); topicId++ ) {
+				for ( size_t topicId = 0; topicId < knownTopics; topicId++ ) {
 					if ( !retrievedResultsFor[topicId] ) {
-						//( cerr << "\rMissing topic: " << topicNames[topicId] << "                    " ).flush();
-
 						vector<double> emptyGrid( interpolationPoints, 0.0 );
 
-						PrintTopic(
-							topicNames[topicId].c_str(),
-							relevantDocumentCount[topicId],
-							0,
-							0,
-							0,
-							emptyGrid,
-							summaryStream
-						);
+						if ( perTopic ) {
+							PrintTopic(
+								homologs.topicNames[topicId],
+								homologs.relevantDocumentCount[topicId],
+								0,
+								0,
+								0,
+								emptyGrid,
+								perTopic
+							);
+						}
 
-						topicRetCount++;
+						summary.topicCount++;
 					}
 				}
 			}
 
-			meanAveragePrecision /= topicRetCount;
+			summary.meanAveragePrecision /= summary.topicCount;
 
-			for ( size_t j = 0; j < interpolationPoints; j++ ) {
-				averageIprec[j] /= topicRetCount;
+			for ( auto & p : summary.averageIprec ) {
+				p /= summary.topicCount;
 			}
 
-			// Emit results for total.
-			fprintf( summaryStream, "%s\t%zu\t%zu\t%zu\t%0.4f",
-				"Overall", overallRelevant, overallRelevantReturned, overallReturned, meanAveragePrecision );
+			for ( auto & p : summary.precisionAt ) {
+				p /= summary.topicCount;
+			}
 
-			for ( size_t j = 0; j < interpolationPoints; j++ ) {
-				fprintf( summaryStream, "\t%.4f", averageIprec[j] );
+			return summary;
+		}
+
+		static MappedFile * Open( const char * fileName, const char * missingFormat ) {
+			try {
+				return new MappedFile( fileName );
+			}
+			catch ( Exception & ) {
+				fprintf( stderr, missingFormat, fileName );
+				exit( 1 );
 			}
+		}
 
-			fprintf( summaryStream, "\n" );
+		/// <summary>Gets the number of pieces to split a file into: a few per thread, of at least 1MB.</summary>
+		static size_t ChunkCount( const MappedFile & file ) {
+			size_t byThreads = 4 * (size_t) omp_get_max_threads();
+			size_t bySize = file.Size() / ( 1 << 20 ) + 1;
+			return std::min( byThreads, bySize );
+		}
 
-			fclose( summaryStream );
+		static bool IsSpace( char c ) {
+			return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+		}
 
-			fprintf( stderr, "Finished.\n" );
-			return 0;
+		/// <summary>Skips white space, then reads a token. Returns false at the end of the line.</summary>
+		static bool NextToken( const char *& p, const char * end, Token & token ) {
+			while ( p < end && IsSpace( *p ) ) p++;
+
+			if ( p >= end ) return false;
+
+			token.chars = p;
+
+			while ( p < end && !IsSpace( *p ) ) p++;
+
+			token.length = p - token.chars;
+			return true;
+		}
+
+		static const char * LineEnd( const char * p, const char * end ) {
+			const char * newline = (const char *) memchr( p, '\n', end - p );
+			return newline ? newline : end;
+		}
+
+		/**
+		 *	Parses lines of the form "topic doc doc ...". As in trec_eval, the list
+		 *	of docs continues only while each token is followed by a space.
+		 */
+		static void ParseHomologs( const char * p, const char * end, HomologChunk & chunk ) {
+			while ( p < end ) {
+				const char * lineEnd = LineEnd( p, end );
+				Token token;
+
+				while ( NextToken( p, lineEnd, token ) ) {
+					HomologRecord record{ token, chunk.docs.size(), 0 };
+
+					while ( p < lineEnd && *p == ' ' && NextToken( p, lineEnd, token ) ) {
+						chunk.docs.push_back( token );
+						record.count++;
+					}
+
+					chunk.records.push_back( record );
+				}
+
+				p = lineEnd + 1;
+			}
+		}
+
+		/**
+		 *	Parses and evaluates lines of the form "topic doc score doc score ...".
+		 *	The list of (doc, score) pairs continues while each score is followed
+		 *	by a space.
+		 */
+		static void EvaluateRankings(
+			const char * p,
+			const char * end,
+			const Homologs & homologs,
+			size_t interpolationPoints,
+			const vector<size_t> & cutoffs,
+			RankingChunk & chunk
+		) {
+			static const TokenSet noHomologs;
+			vector<Ranking> rankings;
+			vector<double> averageIprec( interpolationPoints );
+			vector<double> interpolatedGrid( interpolationPoints );
+
+			while ( p < end ) {
+				const char * lineEnd = LineEnd( p, end );
+				Token topic;
+
+				while ( NextToken( p, lineEnd, topic ) ) {
+					auto topicPos = homologs.topicIds.find( topic );
+					size_t topicId = topicPos == homologs.topicIds.end() ? NoTopic : topicPos->second;
+					const TokenSet & relevantDocs = topicId == NoTopic ? noHomologs : homologs.qrels[topicId];
+
+					RankingRecord record{ topic, topicId, 0, 0, 0.0 };
+					rankings.clear();
+
+					Token doc, scoreText;
+
+					while ( NextToken( p, lineEnd, doc ) && NextToken( p, lineEnd, scoreText ) ) {
+						// The token is not null terminated, so convert a copy.
+						char buffer[64];
+						size_t length = std::min( scoreText.length, sizeof( buffer ) - 1 );
+						memcpy( buffer, scoreText.chars, length );
+						buffer[length] = 0;
+
+						char * parsed;
+						double score = strtod( buffer, &parsed );
+
+						if ( parsed == buffer ) break;
+
+						bool relevant = relevantDocs.find( doc ) != relevantDocs.end();
+
+						rankings.emplace_back( -score, relevant );
+						record.numReturned++;
+
+						if ( relevant ) record.numRelevantReturned++;
+
+						// The character after the score; the end of the line acts as a newline.
+						const char * next = scoreText.chars + ( parsed - buffer );
+						char delimiter = next < lineEnd ? *next : '\n';
+
+						if ( delimiter != ' ' ) {
+							if ( delimiter != '\n' && delimiter != '\r' ) {
+								chunk.unexpectedDelimiters.push_back( delimiter );
+							}
+
+							break;
+						}
+					}
+
+					ProcessTopic(
+						rankings,
+						topicId == NoTopic ? 0 : homologs.relevantDocumentCount[topicId],
+						record.averagePrecision,
+						averageIprec,
+						interpolatedGrid
+					);
+
+					chunk.records.push_back( record );
+					chunk.grids.insert( chunk.grids.end(), interpolatedGrid.begin(), interpolatedGrid.end() );
+
+					// The rankings are now in rank order.
+					for ( size_t k : cutoffs ) {
+						size_t n = std::min( k, rankings.size() ), relevant = 0;
+
+						for ( size_t r = 0; r < n; r++ ) {
+							relevant += rankings[r].isRelevant;
+						}
+
+						chunk.precisionAt.push_back( double( relevant ) / k );
+					}
+				}
+
+				p = lineEnd + 1;
+			}
 		}
 
 		static size_t GetTopicId(
-			const string & topic,
-			unordered_map<string, size_t> & topicIds,
-			vector<string> & topicNames,
-			vector<unordered_set<size_t>> & qrels,
-			vector<size_t> & relevantDocumentCount
+			const Token & topic,
+			TokenIndex & topicIds,
+			vector<Token> & topicNames
 		) {
 			auto topicPos = topicIds.find( topic );
 			size_t topicId;
@@ -360,8 +879,6 @@ namespace QutBio {
 				topicId = topicNames.size();
 				topicNames.push_back( topic );
 				topicIds.emplace( topic, topicId );
-				relevantDocumentCount.push_back( 0 );
-				qrels.resize( qrels.size() + 1 );
 			}
 			else {
 				topicId = topicPos->second;
@@ -371,7 +888,7 @@ namespace QutBio {
 		}
 
 		static void PrintTopic(
-			const char * topicName,
+			const Token & topicName,
 			size_t relevantDocumentCount,
 			size_t returnedDocumentCount,
 			size_t returnedRelevantDocumentCount,
@@ -379,8 +896,8 @@ namespace QutBio {
 			const vector<double> & interpolatedGrid,
 			FILE * f
 		) {
-			fprintf( f, "%s\t%zu\t%zu\t%zu\t%0.4f",
-				topicName, relevantDocumentCount, returnedRelevantDocumentCount, returnedDocumentCount, averagePrecision );
+			fprintf( f, "%.*s\t%zu\t%zu\t%zu\t%0.4f",
+				(int) topicName.length, topicName.chars, relevantDocumentCount, returnedRelevantDocumentCount, returnedDocumentCount, averagePrecision );
 
 			size_t interpolationPoints = interpolatedGrid.size();
 